@@ -126,6 +126,7 @@ static void print_info_error(char *callFunct, return_status retStatus) {
 		return;
 	}
 	android_only(__android_log_print(ANDROID_LOG_DEBUG, callFunct, "error;%.*s\n", (int)error_message_length, error_message);)
+	molch_free(error_message);
 }
 
 JNIEXPORT jstring JNICALL Java_de_hz1984not_crypto_Molch_getMolchVersion(JNIEnv * env, jobject jObj) {
@@ -304,6 +305,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_getvCardInfoAvatar(J
 	for (i = 0; i < retLength; i++) {
 		bytes[i] = newVcard[i];
 	}
+	//allocated by 1984notlib with malloc, not by molch
 	free(newVcard);
 
 // move from the temp structure to the java structure
@@ -389,6 +391,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_getvCardPubKey(JNIEn
 	for (i = 0; i < retLength; i++) {
 		bytes[i] = newPubKey[i];
 	}
+	//allocated by 1984notlib with malloc, not by molch
 	free(newPubKey);
 
 // move from the temp structure to the java structure
@@ -433,6 +436,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_getvCardpreKeys(JNIE
 	for (i = 0; i < retLength; i++) {
 		bytes[i] = newPreKey[i];
 	}
+	//allocated by 1984notlib with malloc, not by molch
 	free(newPreKey);
 
 // move from the temp structure to the java structure
@@ -516,6 +520,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateUserFromN
 				(*env)->ReleaseByteArrayElements(env, prekey_list, (jbyte *) arg2, 0);
 			}
 		}
+		molch_free(public_prekeys);
 	}
 
 	android_only(__android_log_print(ANDROID_LOG_DEBUG, ": ", "next %d", (int) complete_json_export_length);)
@@ -535,7 +540,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateUserFromN
 		}
 		(*env)->SetByteArrayRegion(env, data, 0, complete_json_export_length, bytes);
 
-		free(complete_json_export);
+		molch_free(complete_json_export);
 	}
 
 	android_only(__android_log_print(ANDROID_LOG_DEBUG, ": ", "%d", (int) retVal);)
@@ -665,7 +670,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchUserListFromNat
 	for (i = 0; i < sizeByteUrl; i++) {
 		bytes[i] = retptr[i];
 	}
-	free(retptr);
+	molch_free(retptr);
 
 	(*env)->SetByteArrayRegion(env, data, 0, sizeByteUrl, bytes);
 
@@ -755,7 +760,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateSendConve
 	unsigned char *alice_send_packet = NULL;
 	size_t packet_length = 0;
 	//size_t prekey_list_length = (size_t) jlength_prekey_list_length;
-	unsigned char * json_export = NULL; //optional, can be NULL, exports the entire library state as json, free with sodium_free, check if NULL before use!
+	unsigned char * json_export = NULL; //optional, can be NULL, exports the entire library state as json, free with molch_free, check if NULL before use!
 	size_t json_export_length = 0;
 	return_status retStatus;
 	int retVal = 0;
@@ -798,10 +803,10 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateSendConve
 	}
 // move from the temp structure to the java structure
 	(*env)->SetByteArrayRegion(env, data, 0, packet_length, bytes);
-	free(alice_send_packet);
+	molch_free(alice_send_packet);
 
 	if (json_export != NULL) {
-		free(json_export);
+		molch_free(json_export);
 	}
 
 	return data;
@@ -861,7 +866,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateReceiveCo
 	size_t alice_message_length = 0;
 	size_t pre_keys_length = (size_t) jpre_keys_length;
 	unsigned char *my_public_prekeys = NULL;  //arg4
-	unsigned char * json_export = NULL; //optional, can be NULL, exports the entire library state as json, free with sodium_free, check if NULL before use!
+	unsigned char * json_export = NULL; //optional, can be NULL, exports the entire library state as json, free with molch_free, check if NULL before use!
 	size_t json_export_length = 0;
 	return_status retStatus;
 	//retStatus = molch_create_receive_conversation(arg1, &alice_receive_packet, &alice_message_length, arg2, arg3, &my_public_prekeys, &pre_keys_length, arg5, arg6, &json_export, &json_export_length);
@@ -879,7 +884,7 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateReceiveCo
 				for (i = 0; i < pre_keys_length; i++) {
 					arg4[i] = my_public_prekeys[i];
 				}
-				free(my_public_prekeys);
+				molch_free(my_public_prekeys);
 			}
 			else {
 				android_only(__android_log_print(ANDROID_LOG_DEBUG, "Java_de_hz1984not_crypto_Molch_molchCreateReceiveConversationFromNativeCode: preKeyListdifferent;", "error: %d\n", retStatus.status);)
@@ -917,11 +922,11 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchCreateReceiveCo
 		bytes[i] = alice_receive_packet[i];
 	}
 	(*env)->SetByteArrayRegion(env, data, 0, alice_message_length, bytes);
-	free(alice_receive_packet);
+	molch_free(alice_receive_packet);
 
 	if (json_export != NULL)
 	{
-		free(json_export);
+		molch_free(json_export);
 	}
 
 	return data;
@@ -987,11 +992,11 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchEncryptMessageF
 	}
 // move from the temp structure to the java structure
 	(*env)->SetByteArrayRegion(env, data, 0, packet_length, bytes);
-	free(packet);
+	molch_free(packet);
 
 	if (conversation_json_export != NULL)
 	{
-		free(conversation_json_export);
+		molch_free(conversation_json_export);
 	}
 
 	return data;
@@ -1047,11 +1052,11 @@ JNIEXPORT jbyteArray JNICALL Java_de_hz1984not_crypto_Molch_molchDecryptMessageF
 		bytes[i] = packet[i];
 	}
 	(*env)->SetByteArrayRegion(env, data, 0, packet_length, bytes);
-	free(packet);
+	molch_free(packet);
 
 	if (conversation_json_export != NULL)
 	{
-		free(conversation_json_export);
+		molch_free(conversation_json_export);
 	}
 
 	return data;
@@ -73,12 +73,13 @@ static auto jbyteArray_from(JNIEnv& environment, const Container& container) noe
 }
 
 template <typename Pointer, typename = std::enable_if_t<std::is_pointer<Pointer>::value>>
+//! For outputs of molch, which come from the allocator set with molch_set_allocator.
 struct AutoFreePointer {
 	Pointer pointer = nullptr;
 
 	~AutoFreePointer() noexcept {
 		if (this->pointer != nullptr) {
-			free(this->pointer);
+			molch_free(this->pointer);
 		}
 	}
 };
@@ -473,7 +474,7 @@ extern "C" {
 		for (size_t index = 0; index < sizeByteUrl; index++) {
 			bytes[index] = (jbyte)retptr[index];
 		}
-		free(retptr);
+		molch_free(retptr);
 
 		env->SetByteArrayRegion(data, 0, (jsize)sizeByteUrl, bytes);
 
@@ -562,10 +563,10 @@ extern "C" {
 		}
 		// move from the temp structure to the java structure
 		env->SetByteArrayRegion(data, 0, (jsize)packet_length, bytes);
-		free(alice_send_packet);
+		molch_free(alice_send_packet);
 
 		if (json_export != nullptr) {
-			free(json_export);
+			molch_free(json_export);
 		}
 
 		return data;
@@ -614,7 +615,7 @@ extern "C" {
 					for (size_t index = 0; index < pre_keys_length; index++) {
 						arg4[index] = my_public_prekeys[index];
 					}
-					free(my_public_prekeys);
+					molch_free(my_public_prekeys);
 				}
 				else {
 					android_only(__android_log_print(ANDROID_LOG_DEBUG, "Java_de_hz1984not_crypto_Molch_molchCreateReceiveConversationFromNativeCode: preKeyListdifferent;", "error: %d\n", retStatus.status);)
@@ -643,11 +644,11 @@ extern "C" {
 			bytes[index] = (jbyte)alice_receive_packet[index];
 		}
 		env->SetByteArrayRegion(data, 0, (jsize)alice_message_length, bytes);
-		free(alice_receive_packet);
+		molch_free(alice_receive_packet);
 
 		if (json_export != nullptr)
 		{
-			free(json_export);
+			molch_free(json_export);
 		}
 
 		return data;
@@ -700,11 +701,11 @@ extern "C" {
 		}
 		// move from the temp structure to the java structure
 		env->SetByteArrayRegion(data, 0, (jsize)packet_length, bytes);
-		free(packet);
+		molch_free(packet);
 
 		if (conversation_json_export != nullptr)
 		{
-			free(conversation_json_export);
+			molch_free(conversation_json_export);
 		}
 
 		return data;
@@ -745,11 +746,11 @@ extern "C" {
 			bytes[index] = (jbyte)packet[index];
 		}
 		env->SetByteArrayRegion(data, 0, (jsize)packet_length, bytes);
-		free(packet);
+		molch_free(packet);
 
 		if (conversation_json_export != nullptr)
 		{
-			free(conversation_json_export);
+			molch_free(conversation_json_export);
 		}
 
 		return data;
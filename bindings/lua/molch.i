@@ -43,7 +43,20 @@ typedef unsigned int uint32_t;
 %array_class(unsigned char, ucstring_array);
 %inline %{
 	static unsigned char **create_ucstring_pointer(void) {
-		return malloc(sizeof(unsigned char*));
+		unsigned char **pointer = malloc(sizeof(unsigned char*));
+		if (pointer != NULL) {
+			*pointer = NULL;
+		}
+		return pointer;
+	}
+
+	/* frees the output molch has put into the pointer (with molch_free) and the pointer itself */
+	static void free_ucstring_pointer(unsigned char ** pointer) {
+		if (pointer == NULL) {
+			return;
+		}
+		molch_free(*pointer);
+		free(pointer);
 	}
 
 	static unsigned char *dereference_ucstring_pointer(unsigned char ** pointer) {
@@ -91,11 +104,14 @@ typedef enum status_type {
 	PROTOBUF_UNPACK_ERROR,
 	PROTOBUF_MISSING_ERROR,
 	UNSUPPORTED_PROTOCOL_VERSION,
-	EXCEPTION
+	EXCEPTION,
+	EXPECTATION_FAILED,
+	DUPLICATE_MESSAGE
 } status_type;
 
 extern void free(void *);
 extern void sodium_free(void *);
+extern void molch_free(void *pointer);
 
 extern return_status molch_create_user(
 		unsigned char *const public_master_key,
@@ -58,21 +58,22 @@ function convert_to_c_string(data)
 	return new_string, #data
 end
 
-function copy_callee_allocated_string(pointer, length, free)
+function copy_callee_allocated_string(pointer, length)
 	length = (type(length) == 'userdata') and length:value() or length
-	free = free or molch_interface.free
 
-	local free_pointer = true
+	local pointer_pointer = nil
 	if swig_type(pointer) == "unsigned char **" then
+		pointer_pointer = pointer
 		pointer = molch_interface.dereference_ucstring_pointer(pointer)
-		free_pointer = false
 	end
 
 	local new_string = molch_interface.ucstring_array(length)
 	molch_interface.ucstring_copy(new_string, pointer, length)
-	free(pointer)
-	if free_pointer then
-		molch_interface.free(pointer_pointer)
+	-- outputs of molch have to be freed with molch_free, they come from the allocator set with molch_set_allocator
+	if pointer_pointer then
+		molch_interface.free_ucstring_pointer(pointer_pointer)
+	else
+		molch_interface.molch_free(pointer)
 	end
 
 	return new_string
@@ -184,8 +185,8 @@ function molch.user.new(random_spice --[[optional]])
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
 		molch_interface.molch_destroy_return_status(status)
-		molch_interface.free(temp_prekey_list)
-		molch_interface.free(temp_backup)
+		molch_interface.free_ucstring_pointer(temp_prekey_list)
+		molch_interface.free_ucstring_pointer(temp_backup)
 		error(molch.print_errors(status))
 	end
 
@@ -324,6 +325,7 @@ function molch.user:list_conversations()
 		error(molch.print_errors(status))
 	end
 	if count:value() == 0 then
+		molch_interface.free_ucstring_pointer(raw_list)
 		return {}
 	end
 	raw_list = copy_callee_allocated_string(raw_list, raw_list_length:value())
@@ -444,8 +446,8 @@ function molch.user:start_send_conversation(message, prekey_list, receiver_id)
 		raw_backup_length)
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
-		molch_interface.free(raw_packet)
-		molch_interface.free(raw_backup)
+		molch_interface.free_ucstring_pointer(raw_packet)
+		molch_interface.free_ucstring_pointer(raw_backup)
 		error(molch.print_errors(status))
 	end
 
@@ -499,9 +501,9 @@ function molch.user:start_receive_conversation(packet, sender_id)
 		raw_backup_length)
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
-		molch_interface.free(raw_message)
-		molch_interface.free(raw_prekey_list)
-		molch_interface.free(raw_backup)
+		molch_interface.free_ucstring_pointer(raw_message)
+		molch_interface.free_ucstring_pointer(raw_prekey_list)
+		molch_interface.free_ucstring_pointer(raw_backup)
 		error(molch.print_errors(status))
 	end
 
@@ -510,12 +512,17 @@ function molch.user:start_receive_conversation(packet, sender_id)
 	raw_prekey_list = copy_callee_allocated_string(raw_prekey_list, raw_prekey_list_length)
 	raw_backup = copy_callee_allocated_string(raw_backup, raw_backup_length)
 
-	self.backup = molch.backup.new(raw_backup, raw_backup_length)
-	users.attributes.backup = self.backup:copy()
-
 	local message = convert_to_lua_string(raw_message, raw_message_length)
 	local prekey_list = convert_to_lua_string(raw_prekey_list, raw_prekey_list_length)
 
+	-- a prekey message that has been received before doesn't change anything
+	if self.conversations[conversation_id] and (#prekey_list == 0) then
+		return self.conversations[conversation_id], message
+	end
+
+	self.backup = molch.backup.new(raw_backup, raw_backup_length)
+	users.attributes.backup = self.backup:copy()
+
 	conversation.backup = molch.backup.new()
 	conversation.id = conversation_id
 	self.prekey_list = prekey_list
@@ -537,7 +544,7 @@ function molch.user:get_prekey_list()
 		#self.id)
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
-		molch_interface.free(temp_prekey_list)
+		molch_interface.free_ucstring_pointer(temp_prekey_list)
 		error(molch.print_errors(status))
 	end
 
@@ -567,8 +574,8 @@ function molch.conversation:encrypt_message(message)
 		raw_backup_length)
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
-		molch_interface.free(raw_packet)
-		molch_interface.free(raw_backup)
+		molch_interface.free_ucstring_pointer(raw_packet)
+		molch_interface.free_ucstring_pointer(raw_backup)
 		error(molch.print_errors(status))
 	end
 
@@ -603,8 +610,8 @@ function molch.conversation:decrypt_message(packet)
 		raw_backup_length)
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
-		molch_interface.free(raw_message)
-		molch_interface.free(raw_backup)
+		molch_interface.free_ucstring_pointer(raw_message)
+		molch_interface.free_ucstring_pointer(raw_backup)
 		error(molch.print_errors(status))
 	end
 
@@ -638,8 +645,8 @@ function molch.conversation:destroy()
 		raw_backup_length)
 	local status_type = molch_interface.get_status(status)
 	if status_type ~= molch_interface.SUCCESS then
-		molch_interface.free(raw_message)
-		molch_interface.free(raw_backup)
+		molch_interface.free_ucstring_pointer(raw_message)
+		molch_interface.free_ucstring_pointer(raw_backup)
 		error(molch.print_errors(status))
 	end
 
@@ -64,18 +64,45 @@ MOLCH_PUBLIC(return_status) molch_create_user(
 		//outputs
 		unsigned char *const public_master_key, //PUBLIC_MASTER_KEY_SIZE
 		const size_t public_master_key_length,
-		unsigned char **const prekey_list, //needs to be freed
+		unsigned char **const prekey_list, //free with molch_free after use
 		size_t *const prekey_list_length,
 		unsigned char * backup_key, //BACKUP_KEY_SIZE
 		const size_t backup_key_length,
 		//optional output (can be NULL)
-		unsigned char **const backup, //exports the entire library state, free after use, check if NULL before use!
+		unsigned char **const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
 		size_t *const backup_length,
 		//optional input (can be NULL)
 		const unsigned char *const random_data,
 		const size_t random_data_length
 	) __attribute__((warn_unused_result));
 
+/*
+ * Create many users at once, like calling molch_create_user count times.
+ *
+ * The users are generated in parallel. Only one new backup key is generated,
+ * and if requested, only one backup is created at the end.
+ *
+ * created_users contains one entry per user: the public master key
+ * (PUBLIC_MASTER_KEY_SIZE) followed by the signed prekey list of the user
+ * (prekey_list_length). The random data is mixed into the keys of every user.
+ */
+MOLCH_PUBLIC(return_status) molch_create_users(
+		//outputs
+		unsigned char ** const created_users, //count * (PUBLIC_MASTER_KEY_SIZE + prekey_list_length), free with molch_free after use
+		size_t * const created_users_length,
+		size_t * const prekey_list_length,
+		unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length,
+		//inputs
+		const size_t count,
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
+		size_t * const backup_length,
+		//optional input (can be NULL)
+		const unsigned char * const random_data,
+		const size_t random_data_length
+	) __attribute__((warn_unused_result));
+
 /*
  * Destroy a user.
  */
@@ -83,7 +110,7 @@ MOLCH_PUBLIC(return_status) molch_destroy_user(
 		const unsigned char *const public_master_key,
 		const size_t public_master_key_length,
 		//optional output (can be NULL)
-		unsigned char **const backup, //exports the entire library state, free after use, check if NULL before use
+		unsigned char **const backup, //exports the entire library state, free with molch_free after use, check if NULL before use
 		size_t *const backup_length
 );
 
@@ -96,7 +123,7 @@ MOLCH_PUBLIC(size_t) molch_user_count(void);
  * List all of the users (list of the public keys),
  * NULL if there are no users.
  *
- * This list is heap allocated, so don't forget to free it.
+ * This list is heap allocated, so don't forget to free it with molch_free.
  */
 MOLCH_PUBLIC(return_status) molch_list_users(
 		unsigned char **const user_list,
@@ -104,7 +131,11 @@ MOLCH_PUBLIC(return_status) molch_list_users(
 		size_t *count);
 
 /*
- * Delete all users.
+ * Delete all users from memory.
+ *
+ * An open state store is closed without writing to it, so the users can be
+ * restored by opening it again. Use molch_destroy_user to remove a user from
+ * the state store.
  */
 MOLCH_PUBLIC(void) molch_destroy_all_users(void);
 
@@ -131,7 +162,7 @@ MOLCH_PUBLIC(return_status) molch_start_send_conversation(
 		//outputs
 		unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
 		const size_t conversation_id_length,
-		unsigned char ** const packet, //free after use
+		unsigned char ** const packet, //free with molch_free after use
 		size_t *packet_length,
 		//inputs
 		const unsigned char * const sender_public_master_key, //signing key of the sender (user)
@@ -143,7 +174,82 @@ MOLCH_PUBLIC(return_status) molch_start_send_conversation(
 		const unsigned char * const message,
 		const size_t message_length,
 		//optional output (can be NULL)
-		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		unsigned char ** const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
+		size_t * const backup_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Prepare a new conversation (sending) before the first message is known.
+ *
+ * This does everything molch_start_send_conversation does except encrypting
+ * the message, so that sending the first message with molch_send_prepared_conversation
+ * only needs symmetric encryption.
+ *
+ * Prepared conversations are only kept in memory and aren't part of backups.
+ * They are forgotten if their first message isn't sent within an hour.
+ */
+MOLCH_PUBLIC(return_status) molch_prepare_send_conversation(
+		//outputs
+		unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
+		const size_t conversation_id_length,
+		//inputs
+		const unsigned char * const sender_public_master_key, //signing key of the sender (user)
+		const size_t sender_public_master_key_length,
+		const unsigned char * const receiver_public_master_key, //signing key of the receiver
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const prekey_list, //prekey list of the receiver
+		const size_t prekey_list_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Send the first message of a conversation prepared with molch_prepare_send_conversation
+ * and start it like molch_start_send_conversation would.
+ *
+ * After this the conversation is used with its id like any other conversation.
+ */
+MOLCH_PUBLIC(return_status) molch_send_prepared_conversation(
+		//outputs
+		unsigned char ** const packet, //free with molch_free after use
+		size_t * const packet_length,
+		//inputs
+		const unsigned char * const conversation_id, //from molch_prepare_send_conversation
+		const size_t conversation_id_length,
+		const unsigned char * const message,
+		const size_t message_length,
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
+		size_t * const backup_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Start new conversations with many receivers at once. (sending)
+ *
+ * This works like calling molch_start_send_conversation for every receiver,
+ * but the master keys of the sender are only unlocked once, the key agreements
+ * run in parallel and only one backup is created at the end.
+ *
+ * Conversations that fail don't stop the others. Their status is put into
+ * conversation_statuses, their conversation id is zeroed and their packet is NULL.
+ */
+MOLCH_PUBLIC(return_status) molch_start_send_conversations(
+		//outputs
+		unsigned char * const conversation_ids, //count * CONVERSATION_ID_SIZE long
+		const size_t conversation_ids_length,
+		unsigned char ** const packets, //count long, free every packet with molch_free after use
+		size_t * const packet_lengths, //count long
+		status_type * const conversation_statuses, //count long
+		//inputs
+		const unsigned char * const sender_public_master_key, //signing key of the sender (user)
+		const size_t sender_public_master_key_length,
+		const unsigned char * const receiver_public_master_keys, //count * PUBLIC_MASTER_KEY_SIZE long
+		const size_t receiver_public_master_keys_length,
+		const unsigned char * const * const prekey_lists, //count long, prekey lists of the receivers
+		const size_t * const prekey_list_lengths,
+		const unsigned char * const * const messages, //count long
+		const size_t * const message_lengths,
+		const size_t count,
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
 		size_t * const backup_length
 		) __attribute__((warn_unused_result));
 
@@ -155,14 +261,20 @@ MOLCH_PUBLIC(return_status) molch_start_send_conversation(
  * This function is called after receiving a prekey message.
  *
  * The conversation can be identified by it's ID
+ *
+ * If the same prekey message is received again (e.g. because the transport
+ * delivered it twice), the conversation that was created the first time is
+ * returned together with its message, no new conversation is created. Nothing
+ * changes in that case, so the prekey list and the backup are NULL with a
+ * length of 0.
  */
 MOLCH_PUBLIC(return_status) molch_start_receive_conversation(
 		//outputs
 		unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
 		const size_t conversation_id_length,
-		unsigned char ** const prekey_list, //free after use
+		unsigned char ** const prekey_list, //free with molch_free after use
 		size_t * const prekey_list_length,
-		unsigned char ** const message, //free after use
+		unsigned char ** const message, //free with molch_free after use
 		size_t * const message_length,
 		//inputs
 		const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
@@ -172,16 +284,55 @@ MOLCH_PUBLIC(return_status) molch_start_receive_conversation(
 		const unsigned char * const packet, //received prekey packet
 		const size_t packet_length,
 		//optional output (can be NULL)
-		unsigned char ** const backup, //exports the entire library state, free after use, check if NULL before use!
+		unsigned char ** const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
+		size_t * const backup_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Start new conversations for many prekey messages to the same receiver. (receiving)
+ *
+ * This works like calling molch_start_receive_conversation for every packet,
+ * but only one new set of prekeys is generated and signed at the end, so
+ * the prekey list only has to be uploaded once.
+ *
+ * Packets that fail don't stop the others. Their status is put into
+ * packet_statuses, their conversation id is zeroed and their message is NULL.
+ * The other conversations are created normally.
+ *
+ * Packets that have been received before or that appear more than once in
+ * the batch all get the conversation that was created for the first of them.
+ * If every packet has been received before, the prekey list and the backup
+ * are NULL with a length of 0.
+ */
+MOLCH_PUBLIC(return_status) molch_start_receive_conversations(
+		//outputs
+		unsigned char * const conversation_ids, //packet_count * CONVERSATION_ID_SIZE long
+		const size_t conversation_ids_length,
+		unsigned char ** const messages, //packet_count long, free every message with molch_free after use
+		size_t * const message_lengths, //packet_count long
+		status_type * const packet_statuses, //packet_count long
+		unsigned char ** const prekey_list, //free with molch_free after use
+		size_t * const prekey_list_length,
+		//inputs
+		const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
+		const size_t receiver_public_master_key_length,
+		const unsigned char * const * const packets, //received prekey packets
+		const size_t * const packet_lengths,
+		const size_t packet_count,
+		//optional output (can be NULL)
+		unsigned char ** const backup, //exports the entire library state, free with molch_free after use, check if NULL before use!
 		size_t * const backup_length
 		) __attribute__((warn_unused_result));
 
 /*
  * Encrypt a message and create a packet that can be sent to the receiver.
+ *
+ * The conversation backup is a full backup of the conversation unless delta
+ * backups have been enabled, see molch_set_conversation_backups.
  */
 MOLCH_PUBLIC(return_status) molch_encrypt_message(
 		//output
-		unsigned char ** const packet, //free after use
+		unsigned char ** const packet, //free with molch_free after use
 		size_t *packet_length,
 		//inputs
 		const unsigned char * const conversation_id,
@@ -189,16 +340,56 @@ MOLCH_PUBLIC(return_status) molch_encrypt_message(
 		const unsigned char * const message,
 		const size_t message_length,
 		//optional output (can be NULL)
-		unsigned char ** const conversation_backup, //exports the conversationn, free after use, check if NULL before use!
+		unsigned char ** const conversation_backup, //exports the conversationn, free with molch_free after use, check if NULL before use!
 		size_t * const conversation_backup_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Get the size of the packet that molch_encrypt_message creates for a message.
+ *
+ * \param message_length Length of the message that will be encrypted.
+ * \return The exact length of the packet.
+ */
+MOLCH_PUBLIC(size_t) molch_get_packet_size(const size_t message_length) __attribute__((warn_unused_result));
+
+/*
+ * Encrypt a message into a buffer provided by the caller.
+ *
+ * Other than molch_encrypt_message, this doesn't allocate any memory.
+ *
+ * \param packet Buffer to write the packet to, needs to be at least molch_get_packet_size(message_length) long.
+ * \param packet_capacity Length of the packet buffer.
+ * \param packet_length Length of the packet that was written to the buffer.
+ * \param conversation_id Id of the conversation to send the message in.
+ * \param conversation_id_length Length of the conversation id.
+ * \param message The message to encrypt.
+ * \param message_length Length of the message.
+ */
+MOLCH_PUBLIC(return_status) molch_encrypt_message_to_buffer(
+		//output
+		unsigned char * const packet,
+		const size_t packet_capacity,
+		size_t * const packet_length,
+		//inputs
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const message,
+		const size_t message_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Decrypt a message.
+ *
+ * The conversation backup is a full backup of the conversation unless delta
+ * backups have been enabled, see molch_set_conversation_backups.
+ *
+ * A packet that has recently been decrypted in the same conversation (e.g.
+ * a retransmission) fails with DUPLICATE_MESSAGE without changing the
+ * conversation. Such packets can simply be dropped.
  */
 MOLCH_PUBLIC(return_status) molch_decrypt_message(
 		//outputs
-		unsigned char ** const message, //free after use
+		unsigned char ** const message, //free with molch_free after use
 		size_t *message_length,
 		uint32_t * const receive_message_number,
 		uint32_t * const previous_receive_message_number,
@@ -208,10 +399,40 @@ MOLCH_PUBLIC(return_status) molch_decrypt_message(
 		const unsigned char * const packet, //received packet
 		const size_t packet_length,
 		//optional output (can be NULL)
-		unsigned char ** const conversation_backup, //exports the conversation, free after use, check if NULL before use!
+		unsigned char ** const conversation_backup, //exports the conversation, free with molch_free after use, check if NULL before use!
 		size_t * const conversation_backup_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Decrypt a message into a buffer provided by the caller.
+ *
+ * Other than molch_decrypt_message, this doesn't allocate any memory.
+ *
+ * \param message Buffer to write the message to. The buffer is also used for removing the padding,
+ *   a buffer of packet_length is always sufficient.
+ * \param message_capacity Length of the message buffer.
+ * \param message_length Length of the message that was written to the buffer.
+ * \param receive_message_number Number of the message in the current receive chain.
+ * \param previous_receive_message_number Length of the previous receive chain.
+ * \param conversation_id Id of the conversation the message was received in.
+ * \param conversation_id_length Length of the conversation id.
+ * \param packet The received packet.
+ * \param packet_length Length of the packet.
+ */
+MOLCH_PUBLIC(return_status) molch_decrypt_message_to_buffer(
+		//outputs
+		unsigned char * const message,
+		const size_t message_capacity,
+		size_t * const message_length,
+		uint32_t * const receive_message_number,
+		uint32_t * const previous_receive_message_number,
+		//inputs
+		const unsigned char * const conversation_id,
+		const size_t conversation_id_length,
+		const unsigned char * const packet,
+		const size_t packet_length
+		) __attribute__((warn_unused_result));
+
 /*
  * End a conversation.
  *
@@ -248,7 +469,7 @@ MOLCH_PUBLIC(return_status) molch_list_conversations(
 /*
  * Print a return status into a nice looking error message.
  *
- * Don't forget to free the output after use.
+ * Don't forget to free the output with molch_free after use.
  */
 MOLCH_PUBLIC(char*) molch_print_status(size_t * const output_length, return_status status) __attribute__((warn_unused_result));
 
@@ -277,17 +498,55 @@ MOLCH_PUBLIC(return_status) molch_conversation_export(
 		const unsigned char * const conversation_id,
 		const size_t conversation_id_length) __attribute__((warn_unused_result));
 
+/*
+ * Serialize many conversations into one backup that is encrypted at once.
+ *
+ * \param conversation_ids Concatenated conversation ids, like the output of molch_list_conversations.
+ *
+ * Don't forget to free the output after use.
+ */
+MOLCH_PUBLIC(return_status) molch_conversations_export(
+		//output
+		unsigned char ** const backup,
+		size_t * const backup_length,
+		//input
+		const unsigned char * const conversation_ids, //multiple of CONVERSATION_ID_SIZE
+		const size_t conversation_ids_length) __attribute__((warn_unused_result));
+
 /*
  * Serialise molch's internal state. The output is encrypted with the backup key.
  *
+ * Every user and every conversation is encrypted as a separate segment.
+ * Segments of users and conversations that haven't changed since the last
+ * backup are reused until the backup key changes.
+ *
  * Don't forget to free the output after use.
  */
 MOLCH_PUBLIC(return_status) molch_export(
-		unsigned char ** const backup, //output, free after use
+		unsigned char ** const backup, //output, free with molch_free after use
 		size_t *backup_length) __attribute__((warn_unused_result));
 
 /*
  * Import a conversation from a backup (overwrites the current one if it exists).
+ *
+ * With delta backups enabled (see molch_set_conversation_backups), the backups
+ * created by molch_encrypt_message and molch_decrypt_message are deltas to the
+ * last full backup they created. To restore a conversation:
+ *
+ * 1. Import the last full backup molch_encrypt_message or molch_decrypt_message
+ *    created for it.
+ * 2. Import every delta that has been created after it, in the order they
+ *    have been created. A missing or repeated delta fails with INCORRECT_DATA.
+ *
+ * Where the chain of deltas stands is kept in the state store (see
+ * molch_open_store), so the remaining deltas can still be imported after a
+ * restart. The next backup molch_encrypt_message or molch_decrypt_message
+ * creates after the backup key changed, after delta backups have been switched
+ * on or off, after an import or after the conversation has been loaded from
+ * the state store is a full backup again. molch_conversation_export and
+ * molch_conversations_export don't change the chain of deltas.
+ *
+ * Backups from molch_conversations_export are imported as a whole.
  */
 MOLCH_PUBLIC(return_status) molch_conversation_import(
 		//output
@@ -300,11 +559,33 @@ MOLCH_PUBLIC(return_status) molch_conversation_import(
 		const size_t backup_key_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Import multiple conversation backups in order, like calling
+ * molch_conversation_import for each of them, but the backup key
+ * is only rotated once, after all of them have been imported.
+ *
+ * All backups have to be encrypted with the same backup key. If one of
+ * them fails to import, the ones before it stay imported and the backup
+ * key isn't rotated.
+ */
+MOLCH_PUBLIC(return_status) molch_conversations_import(
+		//output
+		unsigned char * new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+		const size_t new_backup_key_length,
+		//inputs
+		const unsigned char * const * const backups,
+		const size_t * const backup_lengths,
+		const size_t backup_count,
+		const unsigned char * backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Import molch's internal state from a backup (overwrites the current state)
  * and generates a new backup key.
  *
- * The backup key is needed to decrypt the backup.
+ * The backup key is needed to decrypt the backup. Both segmented backups and
+ * the older unsegmented full backups can be imported.
  */
 MOLCH_PUBLIC(return_status) molch_import(
 		//output
@@ -317,17 +598,177 @@ MOLCH_PUBLIC(return_status) molch_import(
 		const size_t backup_key_length
 		) __attribute__((warn_unused_result));
 
+/*
+ * Import molch's internal state from a backup like molch_import, but keep the
+ * conversations encrypted until they are used for the first time.
+ *
+ * Only the users are imported right away, conversations are authenticated and
+ * kept in their encrypted form. This makes the import faster and saves memory
+ * for conversations that are idle. Conversations of full backups and of
+ * segmented backups created before lazy imports existed are imported right away.
+ */
+MOLCH_PUBLIC(return_status) molch_import_lazy(
+		//output
+		unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+		const size_t new_backup_key_length,
+		//inputs
+		const unsigned char * const backup,
+		const size_t backup_length,
+		const unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Serialize a single user with its master keys, prekeys and conversations.
+ * The output is encrypted with the backup key.
+ *
+ * Together with molch_import_user, this moves a user to another instance
+ * of molch without exporting the other users. Destroy the user with
+ * molch_destroy_user after it has been imported at its new place.
+ *
+ * Don't forget to free the output after use.
+ */
+MOLCH_PUBLIC(return_status) molch_export_user(
+		//output
+		unsigned char ** const backup, //free with molch_free after use
+		size_t * const backup_length,
+		//input
+		const unsigned char * const public_master_key,
+		const size_t public_master_key_length) __attribute__((warn_unused_result));
+
+/*
+ * Import a user from molch_export_user and generate a new backup key.
+ *
+ * Replaces the user if it already exists, all other users stay untouched.
+ */
+MOLCH_PUBLIC(return_status) molch_import_user(
+		//output
+		unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+		const size_t new_backup_key_length,
+		//inputs
+		const unsigned char * const backup,
+		const size_t backup_length,
+		const unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length
+		) __attribute__((warn_unused_result));
+
+/*
+ * Function that writes the next part of a backup stream, gets the stream data
+ * that was passed to molch_export_stream. Returns 0 if all of the data has been written.
+ */
+typedef int (*molch_write_function)(void *stream_data, const unsigned char *data, size_t length);
+/*
+ * Function that reads exactly length bytes of a backup stream into data, gets the
+ * stream data that was passed to molch_import_stream. Returns 0 on success.
+ */
+typedef int (*molch_read_function)(void *stream_data, unsigned char *data, size_t length);
+
+/*
+ * Serialise molch's internal state like molch_export, but write it through a callback
+ * instead of returning one big buffer (e.g. directly to a file descriptor).
+ *
+ * Every user and every conversation is encrypted as a separate chunk, so only one
+ * of them needs to be held in memory at a time. The chunks are authenticated
+ * together, a stream that has been truncated or reordered can't be imported.
+ *
+ * \param write Called with the parts of the stream in order.
+ * \param stream_data Passed to write, can be NULL.
+ */
+MOLCH_PUBLIC(return_status) molch_export_stream(
+		molch_write_function write,
+		void * const stream_data) __attribute__((warn_unused_result));
+
+/*
+ * Import molch's internal state from a stream written by molch_export_stream
+ * (overwrites the current state) and generate a new backup key.
+ *
+ * The current state is only replaced once the entire stream has been read and verified.
+ *
+ * \param read Called to read the parts of the stream in order.
+ * \param stream_data Passed to read, can be NULL.
+ */
+MOLCH_PUBLIC(return_status) molch_import_stream(
+		//output
+		unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+		const size_t new_backup_key_length,
+		//inputs
+		molch_read_function read,
+		void * const stream_data,
+		const unsigned char * const backup_key, //BACKUP_KEY_SIZE
+		const size_t backup_key_length
+		) __attribute__((warn_unused_result));
+
 /*
  * Get a signed list of prekeys for a given user.
  */
 MOLCH_PUBLIC(return_status) molch_get_prekey_list(
 		//output
-		unsigned char ** const prekey_list,  //free after use
+		unsigned char ** const prekey_list,  //free with molch_free after use
 		size_t * const prekey_list_length,
 		//input
 		unsigned char * const public_master_key,
 		const size_t public_master_key_length) __attribute__((warn_unused_result));
 
+/*
+ * Get a signed list of prekeys for a given user like molch_get_prekey_list, and
+ * a delta from a prekey list that was published before.
+ *
+ * Only the prekeys that changed since the base list are part of the delta.
+ * Senders that have the base list can turn the delta into the new prekey list
+ * with molch_apply_prekey_list_delta. The new prekey list is the base for the
+ * next delta.
+ */
+MOLCH_PUBLIC(return_status) molch_get_prekey_list_delta(
+		//output
+		unsigned char ** const prekey_list_delta,  //free with molch_free after use
+		size_t * const prekey_list_delta_length,
+		unsigned char ** const prekey_list,  //free with molch_free after use
+		size_t * const prekey_list_length,
+		//input
+		const unsigned char * const public_master_key,
+		const size_t public_master_key_length,
+		const unsigned char * const base_prekey_list, //prekey list of the same user
+		const size_t base_prekey_list_length) __attribute__((warn_unused_result));
+
+/*
+ * Rebuild the prekey list of a receiver from a prekey list delta and
+ * the prekey list it is based on.
+ *
+ * The new prekey list is verified with the signing key of the receiver
+ * and can be used with molch_start_send_conversation.
+ */
+MOLCH_PUBLIC(return_status) molch_apply_prekey_list_delta(
+		//output
+		unsigned char ** const prekey_list,  //free with molch_free after use
+		size_t * const prekey_list_length,
+		//input
+		const unsigned char * const public_master_key, //signing key of the receiver
+		const size_t public_master_key_length,
+		const unsigned char * const base_prekey_list,
+		const size_t base_prekey_list_length,
+		const unsigned char * const prekey_list_delta,
+		const size_t prekey_list_delta_length) __attribute__((warn_unused_result));
+
+/*
+ * Change the number of prekeys a user keeps (PREKEY_AMOUNT by default) and get
+ * a new signed list of prekeys.
+ *
+ * Receivers that get many new conversations can use a bigger pool, so that a
+ * prekey isn't used by more than one sender before it is rotated. When the pool
+ * shrinks, the dropped prekeys are deprecated and can still be used by senders
+ * that have an older prekey list.
+ *
+ * \param amount Number of prekeys, between 1 and 65536.
+ */
+MOLCH_PUBLIC(return_status) molch_set_prekey_amount(
+		//output
+		unsigned char ** const prekey_list,  //free with molch_free after use
+		size_t * const prekey_list_length,
+		//input
+		unsigned char * const public_master_key,
+		const size_t public_master_key_length,
+		const size_t amount) __attribute__((warn_unused_result));
+
 /*
  * Generate and return a new key for encrypting the exported library state.
  */
@@ -335,6 +776,159 @@ MOLCH_PUBLIC(return_status) molch_update_backup_key(
 		unsigned char * const new_key, //output, BACKUP_KEY_SIZE
 		const size_t new_key_length) __attribute__((warn_unused_result));
 
+/*
+ * Function that allocates memory for molch, gets the allocator data that was passed to
+ * molch_set_allocator and the number of bytes. Returns NULL on failure.
+ */
+typedef void *(*molch_allocate_function)(void *allocator_data, size_t size);
+/*
+ * Function that frees memory that was allocated by the matching molch_allocate_function.
+ */
+typedef void (*molch_free_function)(void *allocator_data, void *pointer);
+
+/*
+ * Set the allocator for all buffers that molch hands out to the caller
+ * (packets, messages, backups, prekey lists, printed return status ...).
+ * This allows those buffers to be allocated directly in memory that the caller
+ * manages, e.g. an arena per request.
+ *
+ * The default is malloc and free. Only replace the allocator while there are no
+ * buffers from the previous allocator left, they can't be freed with molch_free anymore.
+ * This isn't thread safe.
+ *
+ * \param allocate Allocation function, pass NULL together with deallocate to go back to the default.
+ * \param deallocate Function that frees memory returned by allocate.
+ * \param allocator_data Passed to allocate and deallocate, can be NULL.
+ */
+MOLCH_PUBLIC(return_status) molch_set_allocator(
+		molch_allocate_function allocate,
+		molch_free_function deallocate,
+		void *allocator_data) __attribute__((warn_unused_result));
+
+/*
+ * Free a buffer that has been handed out by molch, using the allocator set with molch_set_allocator.
+ *
+ * \param pointer The buffer to free, can be NULL.
+ */
+MOLCH_PUBLIC(void) molch_free(void *pointer);
+
+/*
+ * How the pages containing private keys (master keys and the backup key) are protected.
+ *
+ * STRICT: The pages are only readable while they are in use, every access
+ *   costs two mprotect syscalls. This is the default.
+ * BATCHED: Like STRICT, but between molch_begin_batch and molch_end_batch the keys
+ *   are only unlocked once and locked again when the batch ends.
+ * LOCKED_ONLY: The pages stay mlocked and excluded from core dumps, but once unlocked
+ *   they stay accessible, so no mprotect syscalls happen after the first access.
+ */
+typedef enum class molch_memory_protection { STRICT, BATCHED, LOCKED_ONLY } molch_memory_protection;
+
+/*
+ * Set the memory protection policy for private keys.
+ *
+ * Switching to a stricter policy locks all keys again. This isn't thread safe.
+ */
+MOLCH_PUBLIC(void) molch_set_memory_protection(const molch_memory_protection protection);
+
+MOLCH_PUBLIC(molch_memory_protection) molch_get_memory_protection(void);
+
+/*
+ * What the conversation backups of molch_encrypt_message and molch_decrypt_message contain.
+ *
+ * FULL_BACKUPS: The whole conversation. This is the default.
+ * DELTA_BACKUPS: Only the changes since the previous backup, see molch_conversation_import.
+ */
+typedef enum class molch_conversation_backups { FULL_BACKUPS, DELTA_BACKUPS } molch_conversation_backups;
+
+/*
+ * Set what the conversation backups of molch_encrypt_message and molch_decrypt_message contain.
+ *
+ * After switching, the next backup of every conversation is a full backup. This isn't thread safe.
+ */
+MOLCH_PUBLIC(void) molch_set_conversation_backups(const molch_conversation_backups backups);
+
+/*
+ * Keep the library state in a file from now on.
+ *
+ * The file is an append only log of users and conversations that are
+ * encrypted individually with the store key. After every call that changes
+ * the state, only the users and conversations that have changed are appended
+ * and the file is synced to disk. Within molch_begin_batch and molch_end_batch,
+ * syncing is deferred until the batch ends. The file is compacted once most of
+ * it is outdated. A record that has only been written partially because of a
+ * crash is discarded when the file is opened again. A wrong key fails with
+ * DECRYPT_ERROR, as does a corrupted record, without changing the file.
+ *
+ * If the file already contains users, they replace the current state, otherwise
+ * the current state is written to it. Only one process can open a file at a time.
+ * This isn't thread safe.
+ *
+ * \param path Path of the file, it is created if it doesn't exist.
+ * \param store_key Key to encrypt the records with, BACKUP_KEY_SIZE. Keep it, it is needed to open the file again.
+ */
+MOLCH_PUBLIC(return_status) molch_open_store(
+		const char * const path,
+		const unsigned char * const store_key,
+		const size_t store_key_length) __attribute__((warn_unused_result));
+
+/*
+ * Stop writing changes to the state store and close it.
+ *
+ * Changes that haven't been synced yet are synced first. If that fails, the
+ * store is closed anyway and the error is returned, the last changes might
+ * not be in the file then.
+ */
+MOLCH_PUBLIC(return_status) molch_close_store(void) __attribute__((warn_unused_result));
+
+/*
+ * Limit the number of conversations per user that are kept decrypted in memory.
+ *
+ * The limit applies to every user on its own, not to all users together: with
+ * n users, up to n times the limit conversations can be decrypted at once.
+ *
+ * When the limit is exceeded, the user's least recently used conversation is
+ * encrypted with a key that only exists in memory and decrypted again transparently
+ * the next time it is used. This doesn't change its backups, if delta backups are
+ * enabled, the chain of deltas continues after it has been decrypted again.
+ * Conversations that exceed a new limit are evicted immediately. This isn't thread safe.
+ *
+ * \param resident_conversations Maximum number of decrypted conversations per user, 0 means no limit (the default).
+ */
+MOLCH_PUBLIC(return_status) molch_set_conversation_budget(const size_t resident_conversations) __attribute__((warn_unused_result));
+
+/*
+ * Counters of the conversation residency since the program started.
+ *
+ * hits: A conversation was used while it was decrypted.
+ * misses: A conversation had to be decrypted before it could be used.
+ * evictions: A conversation has been encrypted to stay under the budget.
+ */
+typedef struct molch_residency_statistics {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} molch_residency_statistics;
+
+MOLCH_PUBLIC(molch_residency_statistics) molch_get_residency_statistics(void);
+
+/*
+ * Start a batch of operations, e.g. all messages that are sent or received in one go.
+ *
+ * With the BATCHED memory protection policy, private keys that are used during
+ * the batch stay unlocked until molch_end_batch is called.
+ */
+MOLCH_PUBLIC(void) molch_begin_batch(void);
+
+/*
+ * End a batch of operations and lock all private keys that were unlocked during it.
+ *
+ * If a state store is open, the changes of the batch are synced to disk. A failure
+ * to do so is returned, the keys are locked either way and syncing is tried again
+ * with the next change.
+ */
+MOLCH_PUBLIC(return_status) molch_end_batch(void) __attribute__((warn_unused_result));
+
 #ifdef __cplusplus
 }
 #endif
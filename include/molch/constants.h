@@ -34,7 +34,7 @@
 #endif
 
 #define CONVERSATION_ID_SIZE CONSTANT(32U) //length of a conversation id in bytes
-#define PREKEY_AMOUNT CONSTANT(100U) //number of prekeys that are used
+#define PREKEY_AMOUNT CONSTANT(100U) //default number of prekeys per user, see molch_set_prekey_amount
 
 #define DIFFIE_HELLMAN_SIZE CONSTANT(crypto_generichash_BYTES)
 
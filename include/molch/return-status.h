@@ -62,7 +62,8 @@ typedef enum class status_type { //TODO add more error types
 	PROTOBUF_MISSING_ERROR,
 	UNSUPPORTED_PROTOCOL_VERSION,
 	EXCEPTION,
-	EXPECTATION_FAILED
+	EXPECTATION_FAILED,
+	DUPLICATE_MESSAGE //the packet has already been received
 } status_type;
 
 typedef struct return_status {
@@ -0,0 +1,35 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "backup-hash.hpp"
+#include "sodium-wrappers.hpp"
+
+namespace Molch {
+	result<BackupHash> hash_encrypted_backup(const span<const std::byte> nonce, const span<const std::byte> ciphertext) {
+		BackupHash hash{};
+		OUTCOME_TRY(hasher, CryptoGenerichash::construct({nullptr, static_cast<size_t>(0)}, hash.size()));
+		OUTCOME_TRY(hasher.update(nonce));
+		OUTCOME_TRY(hasher.update(ciphertext));
+		OUTCOME_TRY(hasher.final(hash));
+
+		return hash;
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_BACKUP_HASH_H
+#define LIB_BACKUP_HASH_H
+
+#include <array>
+#include <sodium.h>
+
+#include "gsl.hpp"
+#include "result.hpp"
+
+namespace Molch {
+	constexpr size_t backup_hash_size{crypto_generichash_BYTES};
+	using BackupHash = std::array<std::byte,backup_hash_size>;
+
+	/*
+	 * Hash the nonce and the ciphertext of an encrypted backup or backup segment,
+	 * this is used to reference one backup from within another one.
+	 */
+	result<BackupHash> hash_encrypted_backup(const span<const std::byte> nonce, const span<const std::byte> ciphertext);
+}
+
+#endif /* LIB_BACKUP_HASH_H */
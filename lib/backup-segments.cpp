@@ -0,0 +1,417 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "backup-segments.hpp"
+#include "parallel.hpp"
+#include "gsl.hpp"
+
+namespace Molch {
+	static result<BackupSegment> encrypt_segment(
+			Arena& arena,
+			const ProtobufCMessage& message,
+			const StateVersion& version,
+			const BackupKey& backup_key) {
+		//pack the message
+		const auto packed_size{protobuf_c_message_get_packed_size(&message)};
+		auto packed_content{arena.allocate<std::byte>(packed_size)};
+		span<std::byte> packed_message{packed_content, packed_size};
+		protobuf_c_message_pack(&message, byte_to_uchar(packed_message.data()));
+
+		BackupSegment segment;
+		segment.version = version.value();
+
+		//generate the nonce
+		segment.nonce = Buffer{BACKUP_NONCE_SIZE, BACKUP_NONCE_SIZE};
+		randombytes_buf(segment.nonce);
+
+		//encrypt the segment
+		segment.encrypted_segment = Buffer{packed_size + crypto_secretbox_MACBYTES, packed_size + crypto_secretbox_MACBYTES};
+		OUTCOME_TRY(crypto_secretbox_easy(segment.encrypted_segment, packed_message, segment.nonce, backup_key));
+
+		OUTCOME_TRY(hash, hash_encrypted_backup(segment.nonce, segment.encrypted_segment));
+		segment.hash = hash;
+
+		return segment;
+	}
+
+	using SegmentExporter = std::function<result<const ProtobufCMessage*>(Arena&)>;
+
+	//segment that has to be encrypted again, encrypted_segment is filled in by encrypt
+	struct PendingSegment {
+		BackupSegment *segment;
+		StateVersion version;
+		SegmentExporter export_protobuf;
+
+		result<void> encrypt(const BackupKey& backup_key) const {
+			Arena arena;
+			OUTCOME_TRY(message, this->export_protobuf(arena));
+			OUTCOME_TRY(encrypted_segment, encrypt_segment(arena, *message, this->version, backup_key));
+			*this->segment = std::move(encrypted_segment);
+
+			return outcome::success();
+		}
+	};
+
+	/*
+	 * Move the segment of an unchanged state from the old cache to the new
+	 * one. If it has changed or isn't cached yet, reserve a place for it in
+	 * the new cache and remember to encrypt it again.
+	 */
+	template <typename Id>
+	static BackupSegment& get_segment(
+			std::map<Id,BackupSegment>& old_segments,
+			std::map<Id,BackupSegment>& new_segments,
+			std::vector<PendingSegment>& pending_segments,
+			const Id& id,
+			const StateVersion& version,
+			SegmentExporter&& export_protobuf) {
+		auto cached_segment{old_segments.find(id)};
+		if ((cached_segment != std::end(old_segments)) && (cached_segment->second.version == version.value())) {
+			auto inserted{new_segments.insert(old_segments.extract(cached_segment))};
+			return inserted.position->second;
+		}
+
+		//map nodes don't move, so the segment can be filled in later
+		auto inserted{new_segments.insert_or_assign(id, BackupSegment())};
+		auto& segment{inserted.first->second};
+		pending_segments.push_back({&segment, version, std::move(export_protobuf)});
+		return segment;
+	}
+
+	result<MallocBuffer> BackupSegmentCache::exportBackup(const UserStore& users, const BackupKey& backup_key) {
+		//everything that isn't part of this backup anymore is dropped from the cache
+		std::map<PublicSigningKey,BackupSegment> new_user_segments;
+		std::map<ConversationId,BackupSegment> new_conversation_segments;
+
+		//collect the segments in order and find the ones that have changed
+		struct ManifestEntry {
+			BackupSegment *segment;
+			Molch__Protobuf__BackupManifest__Segment__SegmentType type;
+			span<const std::byte> id; //only for conversations
+		};
+		std::vector<ManifestEntry> segments;
+		std::vector<PendingSegment> pending_segments;
+		for (const auto& user : users) {
+			auto& user_segment{get_segment(
+					this->user_segments,
+					new_user_segments,
+					pending_segments,
+					user.id(),
+					user.prekeys.version(),
+					[&user](Arena& arena) -> result<const ProtobufCMessage*> {
+						OUTCOME_TRY(exported_user, user.exportProtobufWithoutConversations(arena));
+						return &exported_user->base;
+					})};
+			segments.push_back({&user_segment, MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__USER, {nullptr, static_cast<size_t>(0)}});
+
+			for (const auto& conversation : user.conversations) {
+				auto& conversation_segment{get_segment(
+						this->conversation_segments,
+						new_conversation_segments,
+						pending_segments,
+						conversation.id(),
+						conversation.version(),
+						[&conversation](Arena& arena) -> result<const ProtobufCMessage*> {
+							OUTCOME_TRY(exported_conversation, conversation.exportProtobuf(arena));
+							return &exported_conversation->base;
+						})};
+				segments.push_back({&conversation_segment, MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__CONVERSATION, conversation.id()});
+			}
+
+			//dormant conversations never change, so they only need to be encrypted again if the backup key has changed
+			for (const auto& conversation : user.conversations.dormant()) {
+				auto& conversation_segment{get_segment(
+						this->conversation_segments,
+						new_conversation_segments,
+						pending_segments,
+						conversation.id(),
+						conversation.version(),
+						[&conversation](Arena& arena) -> result<const ProtobufCMessage*> {
+							OUTCOME_TRY(exported_conversation, conversation.exportProtobuf(arena));
+							return &exported_conversation->base;
+						})};
+				segments.push_back({&conversation_segment, MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__CONVERSATION, conversation.id()});
+			}
+		}
+
+		//every changed segment is exported and encrypted independently
+		OUTCOME_TRY(parallel_for(pending_segments.size(), [&pending_segments, &backup_key](const size_t index) {
+			return pending_segments[index].encrypt(backup_key);
+		}));
+
+		Arena arena;
+		std::vector<ProtobufCBackupManifestSegment*> manifest_segments;
+		std::vector<ProtobufCEncryptedSegment*> encrypted_segments;
+		manifest_segments.reserve(segments.size());
+		encrypted_segments.reserve(segments.size());
+		for (const auto& [segment, type, id] : segments) {
+			auto manifest_segment{arena.allocate<ProtobufCBackupManifestSegment>(1)};
+			molch__protobuf__backup_manifest__segment__init(manifest_segment);
+			protobuf_optional_export(manifest_segment, type, type);
+			manifest_segment->has_hash = true;
+			manifest_segment->hash.data = byte_to_uchar(segment->hash.data());
+			manifest_segment->hash.len = segment->hash.size();
+			if (!id.empty()) {
+				manifest_segment->has_id = true;
+				manifest_segment->id.data = const_cast<uint8_t*>(byte_to_uchar(id.data())); //NOLINT
+				manifest_segment->id.len = id.size();
+			}
+			manifest_segments.push_back(manifest_segment);
+
+			auto encrypted_segment{arena.allocate<ProtobufCEncryptedSegment>(1)};
+			molch__protobuf__encrypted_segment__init(encrypted_segment);
+			encrypted_segment->has_nonce = true;
+			encrypted_segment->nonce.data = byte_to_uchar(segment->nonce.data());
+			encrypted_segment->nonce.len = segment->nonce.size();
+			encrypted_segment->has_encrypted_segment = true;
+			encrypted_segment->encrypted_segment.data = byte_to_uchar(segment->encrypted_segment.data());
+			encrypted_segment->encrypted_segment.len = segment->encrypted_segment.size();
+			encrypted_segments.push_back(encrypted_segment);
+		}
+
+		//pack the manifest
+		protobuf_arena_create(arena, ProtobufCBackupManifest, backup_manifest);
+		backup_manifest->segments = manifest_segments.data();
+		backup_manifest->n_segments = manifest_segments.size();
+		const auto manifest_size{molch__protobuf__backup_manifest__get_packed_size(backup_manifest)};
+		auto manifest_content{arena.allocate<std::byte>(manifest_size)};
+		span<std::byte> manifest{manifest_content, manifest_size};
+		molch__protobuf__backup_manifest__pack(backup_manifest, byte_to_uchar(manifest.data()));
+
+		//encrypt the manifest with a fresh nonce
+		Buffer manifest_nonce{BACKUP_NONCE_SIZE, BACKUP_NONCE_SIZE};
+		randombytes_buf(manifest_nonce);
+		Buffer encrypted_manifest{manifest_size + crypto_secretbox_MACBYTES, manifest_size + crypto_secretbox_MACBYTES};
+		OUTCOME_TRY(crypto_secretbox_easy(encrypted_manifest, manifest, manifest_nonce, backup_key));
+
+		//fill in the encrypted backup struct
+		ProtobufCEncryptedBackup encrypted_backup_struct;
+		molch__protobuf__encrypted_backup__init(&encrypted_backup_struct);
+		//metadata
+		encrypted_backup_struct.backup_version = 0;
+		encrypted_backup_struct.has_backup_type = true;
+		encrypted_backup_struct.backup_type = MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__SEGMENTED_BACKUP;
+		//nonce
+		encrypted_backup_struct.has_encrypted_backup_nonce = true;
+		encrypted_backup_struct.encrypted_backup_nonce.data = byte_to_uchar(manifest_nonce.data());
+		encrypted_backup_struct.encrypted_backup_nonce.len = manifest_nonce.size();
+		//encrypted manifest
+		encrypted_backup_struct.has_encrypted_backup = true;
+		encrypted_backup_struct.encrypted_backup.data = byte_to_uchar(encrypted_manifest.data());
+		encrypted_backup_struct.encrypted_backup.len = encrypted_manifest.size();
+		//segments
+		encrypted_backup_struct.segments = encrypted_segments.data();
+		encrypted_backup_struct.n_segments = encrypted_segments.size();
+
+		//now pack the entire backup
+		const auto encrypted_backup_size{molch__protobuf__encrypted_backup__get_packed_size(&encrypted_backup_struct)};
+		MallocBuffer malloced_encrypted_backup{encrypted_backup_size, 0};
+		OUTCOME_TRY(malloced_encrypted_backup.setSize(molch__protobuf__encrypted_backup__pack(&encrypted_backup_struct, byte_to_uchar(malloced_encrypted_backup.data()))));
+		if (malloced_encrypted_backup.size() != encrypted_backup_size) {
+			return Error(status_type::PROTOBUF_PACK_ERROR, "Failed to pack segmented backup.");
+		}
+
+		this->user_segments = std::move(new_user_segments);
+		this->conversation_segments = std::move(new_conversation_segments);
+
+		return malloced_encrypted_backup;
+	}
+
+	void BackupSegmentCache::clear() noexcept {
+		this->user_segments.clear();
+		this->conversation_segments.clear();
+	}
+
+	size_t BackupSegmentCache::size() const noexcept {
+		return this->user_segments.size() + this->conversation_segments.size();
+	}
+
+	struct VerifiedSegment {
+		span<const std::byte> nonce;
+		span<const std::byte> ciphertext;
+	};
+
+	//check that the segment is the one listed in the manifest, which authenticates it
+	static result<VerifiedSegment> verify_segment(
+			const ProtobufCBackupManifestSegment& manifest_segment,
+			const ProtobufCEncryptedSegment* const encrypted_segment) {
+		if ((encrypted_segment == nullptr)
+				|| !encrypted_segment->has_nonce || (encrypted_segment->nonce.len != BACKUP_NONCE_SIZE)
+				|| !encrypted_segment->has_encrypted_segment || (encrypted_segment->encrypted_segment.len < crypto_secretbox_MACBYTES)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "Invalid encrypted backup segment.");
+		}
+		if (!manifest_segment.has_hash || (manifest_segment.hash.len != backup_hash_size)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup manifest is missing a segment hash.");
+		}
+
+		const span<const std::byte> nonce{uchar_to_byte(encrypted_segment->nonce.data), encrypted_segment->nonce.len};
+		const span<const std::byte> ciphertext{uchar_to_byte(encrypted_segment->encrypted_segment.data), encrypted_segment->encrypted_segment.len};
+
+		OUTCOME_TRY(hash, hash_encrypted_backup(nonce, ciphertext));
+		OUTCOME_TRY(hashes_match, sodium_memcmp(hash, {uchar_to_byte(manifest_segment.hash.data), manifest_segment.hash.len}));
+		if (!hashes_match) {
+			return Error(status_type::INCORRECT_DATA, "Backup segment doesn't match the manifest.");
+		}
+
+		return VerifiedSegment{nonce, ciphertext};
+	}
+
+	static result<span<std::byte>> decrypt_segment(
+			Arena& arena,
+			const ProtobufCBackupManifestSegment& manifest_segment,
+			const ProtobufCEncryptedSegment* const encrypted_segment,
+			const span<const std::byte> backup_key) {
+		OUTCOME_TRY(verified_segment, verify_segment(manifest_segment, encrypted_segment));
+		const auto& ciphertext{verified_segment.ciphertext};
+
+		auto decrypted_segment_content{arena.allocate<std::byte>(ciphertext.size() - crypto_secretbox_MACBYTES)};
+		span<std::byte> decrypted_segment{decrypted_segment_content, ciphertext.size() - crypto_secretbox_MACBYTES};
+		OUTCOME_TRY(crypto_secretbox_open_easy(decrypted_segment, ciphertext, verified_segment.nonce, backup_key));
+
+		return decrypted_segment;
+	}
+
+	result<UserStore> import_segmented_backup(
+			const ProtobufCEncryptedBackup& encrypted_backup,
+			const span<const std::byte> backup_key,
+			const ConversationImport conversation_import) {
+		if (!encrypted_backup.has_backup_type || (encrypted_backup.backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__SEGMENTED_BACKUP)) {
+			return Error(status_type::INCORRECT_DATA, "Backup is not a segmented backup.");
+		}
+		if (!encrypted_backup.has_encrypted_backup || (encrypted_backup.encrypted_backup.len < crypto_secretbox_MACBYTES)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted manifest.");
+		}
+		if (!encrypted_backup.has_encrypted_backup_nonce || (encrypted_backup.encrypted_backup_nonce.len != BACKUP_NONCE_SIZE)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the nonce.");
+		}
+
+		//decrypt the manifest
+		Arena arena;
+		auto decrypted_manifest_content{arena.allocate<std::byte>(encrypted_backup.encrypted_backup.len - crypto_secretbox_MACBYTES)};
+		span<std::byte> decrypted_manifest{decrypted_manifest_content, encrypted_backup.encrypted_backup.len - crypto_secretbox_MACBYTES};
+		OUTCOME_TRY(crypto_secretbox_open_easy(
+				decrypted_manifest,
+				{uchar_to_byte(encrypted_backup.encrypted_backup.data), encrypted_backup.encrypted_backup.len},
+				{uchar_to_byte(encrypted_backup.encrypted_backup_nonce.data), encrypted_backup.encrypted_backup_nonce.len},
+				backup_key));
+
+		auto arena_protoc_allocator{arena.getProtobufCAllocator()};
+		auto manifest{molch__protobuf__backup_manifest__unpack(&arena_protoc_allocator, decrypted_manifest.size(), byte_to_uchar(decrypted_manifest.data()))};
+		if (manifest == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack the backup manifest.");
+		}
+		if (manifest->n_segments != encrypted_backup.n_segments) {
+			return Error(status_type::INCORRECT_DATA, "The backup manifest doesn't match the number of segments.");
+		}
+
+		//check the structure before doing any of the expensive work, every conversation belongs to the last user before it
+		for (size_t index{0}; index < manifest->n_segments; index++) {
+			const auto manifest_segment{manifest->segments[index]};
+			if ((manifest_segment == nullptr) || !manifest_segment->has_type) {
+				return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup manifest is missing a segment type.");
+			}
+			if ((manifest_segment->type != MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__USER)
+					&& (manifest_segment->type != MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__CONVERSATION)) {
+				return Error(status_type::INCORRECT_DATA, "Invalid segment type.");
+			}
+			if ((index == 0) && (manifest_segment->type != MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__USER)) {
+				return Error(status_type::INCORRECT_DATA, "Conversation segment without a user.");
+			}
+		}
+
+		//conversations that are imported lazily keep a copy of the backup key to decrypt them later
+		std::shared_ptr<const BackupKey> shared_backup_key;
+		if (conversation_import == ConversationImport::LAZY) {
+			OUTCOME_TRY(copied_backup_key, share_backup_key(backup_key));
+			shared_backup_key = std::move(copied_backup_key);
+		}
+
+		//decrypt and import every segment independently, each with its own arena
+		std::vector<std::optional<User>> users(manifest->n_segments);
+		std::vector<std::optional<Conversation>> conversations(manifest->n_segments);
+		std::vector<std::optional<DormantConversation>> dormant_conversations(manifest->n_segments);
+		OUTCOME_TRY(parallel_for(manifest->n_segments, [&](const size_t index) -> result<void> {
+			const auto& manifest_segment{*manifest->segments[index]};
+			//older backups don't list the conversation ids, those conversations are imported right away
+			if ((conversation_import == ConversationImport::LAZY)
+					&& (manifest_segment.type == MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__CONVERSATION)
+					&& manifest_segment.has_id) {
+				OUTCOME_TRY(id, ConversationId::fromSpan({manifest_segment.id}));
+				OUTCOME_TRY(verified_segment, verify_segment(manifest_segment, encrypted_backup.segments[index]));
+				OUTCOME_TRY(dormant_conversation, DormantConversation::create(id, verified_segment.nonce, verified_segment.ciphertext, shared_backup_key));
+				dormant_conversations[index].emplace(std::move(dormant_conversation));
+				return outcome::success();
+			}
+
+			Arena segment_arena;
+			auto segment_protoc_allocator{segment_arena.getProtobufCAllocator()};
+			OUTCOME_TRY(decrypted_segment, decrypt_segment(segment_arena, manifest_segment, encrypted_backup.segments[index], backup_key));
+			if (manifest_segment.type == MOLCH__PROTOBUF__BACKUP_MANIFEST__SEGMENT__SEGMENT_TYPE__USER) {
+				auto user{molch__protobuf__user__unpack(&segment_protoc_allocator, decrypted_segment.size(), byte_to_uchar(decrypted_segment.data()))};
+				if (user == nullptr) {
+					return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack a user segment.");
+				}
+				if (user->n_conversations != 0) {
+					return Error(status_type::INCORRECT_DATA, "User segment contains conversations.");
+				}
+				OUTCOME_TRY(imported_user, User::import(*user));
+				users[index].emplace(std::move(imported_user));
+			} else {
+				auto conversation{molch__protobuf__conversation__unpack(&segment_protoc_allocator, decrypted_segment.size(), byte_to_uchar(decrypted_segment.data()))};
+				if (conversation == nullptr) {
+					return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack a conversation segment.");
+				}
+				OUTCOME_TRY(imported_conversation, Conversation::import(*conversation));
+				conversations[index].emplace(std::move(imported_conversation));
+			}
+
+			return outcome::success();
+		}));
+
+		//assemble the user store in order
+		UserStore store;
+		std::optional<User> current_user;
+		for (size_t index{0}; index < manifest->n_segments; index++) {
+			if (users[index].has_value()) {
+				if (current_user.has_value()) {
+					store.add(std::move(*current_user));
+				}
+				current_user.emplace(std::move(*users[index]));
+			} else if (dormant_conversations[index].has_value()) {
+				current_user->conversations.addDormant(std::move(*dormant_conversations[index]));
+			} else {
+				OUTCOME_TRY(current_user->conversations.add(std::move(*conversations[index])));
+			}
+		}
+		if (current_user.has_value()) {
+			store.add(std::move(*current_user));
+		}
+
+		return store;
+	}
+}
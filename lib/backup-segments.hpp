@@ -0,0 +1,95 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_BACKUP_SEGMENTS_H
+#define LIB_BACKUP_SEGMENTS_H
+
+#include <map>
+
+#include "molch/constants.h"
+#include "backup-hash.hpp"
+#include "buffer.hpp"
+#include "key.hpp"
+#include "protobuf.hpp"
+#include "protobuf-arena.hpp"
+#include "user-store.hpp"
+
+/*
+ * Segmented backups encrypt every user (without its conversations) and every
+ * conversation separately. An encrypted manifest lists the segments in order
+ * together with a hash of each encrypted segment, so segments can't be
+ * swapped, dropped or replayed from an older backup without noticing.
+ */
+
+namespace Molch {
+	struct BackupSegment {
+		uint64_t version{0}; //version of the state that was encrypted
+		Buffer nonce;
+		Buffer encrypted_segment;
+		BackupHash hash{};
+	};
+
+	/*
+	 * Creates segmented backups and keeps the encrypted segments around, so
+	 * that users and conversations that haven't changed since the last
+	 * backup don't need to be exported and encrypted again.
+	 */
+	class BackupSegmentCache {
+	private:
+		std::map<PublicSigningKey,BackupSegment> user_segments;
+		std::map<ConversationId,BackupSegment> conversation_segments;
+
+	public:
+		/*
+		 * Export all users as a packed EncryptedBackup of type SEGMENTED_BACKUP.
+		 *
+		 * All segments need to be encrypted with the same key, so the
+		 * cache has to be cleared whenever the backup key changes.
+		 */
+		result<MallocBuffer> exportBackup(const UserStore& users, const BackupKey& backup_key);
+
+		//! Forget all cached segments.
+		void clear() noexcept;
+
+		//! Number of cached segments.
+		size_t size() const noexcept;
+	};
+
+	enum class ConversationImport {
+		EAGER, //import every conversation right away
+		LAZY, //keep the conversations encrypted until they are used
+	};
+
+	/*! Decrypt and import a segmented backup.
+	 * The segments are decrypted and imported in parallel.
+	 * \param encrypted_backup The unpacked EncryptedBackup of type SEGMENTED_BACKUP.
+	 * \param backup_key The key that the segments and the manifest have been encrypted with.
+	 * \param conversation_import With LAZY, conversations are only authenticated and added as dormant conversations.
+	 *
+	 * \return The imported users with their conversations.
+	 */
+	result<UserStore> import_segmented_backup(
+			const ProtobufCEncryptedBackup& encrypted_backup,
+			const span<const std::byte> backup_key,
+			const ConversationImport conversation_import);
+}
+
+#endif /* LIB_BACKUP_SEGMENTS_H */
@@ -0,0 +1,225 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <optional>
+
+#include "backup-stream.hpp"
+#include "endianness.hpp"
+#include "gsl.hpp"
+#include "protobuf-arena.hpp"
+
+namespace Molch {
+	constexpr unsigned char backup_stream_version{0};
+	constexpr size_t backup_stream_preamble_size{1 + crypto_secretstream_xchacha20poly1305_HEADERBYTES};
+	constexpr size_t backup_stream_length_size{sizeof(uint32_t)};
+
+	enum class StreamRecordType : unsigned char {
+		USER = 0,
+		CONVERSATION = 1,
+		END = 2,
+	};
+
+	//grow a buffer that is reused for all chunks if necessary
+	static result<void> reserve(Buffer& buffer, const size_t size) {
+		if (buffer.capacity() < size) {
+			buffer = Buffer{size, 0};
+		}
+
+		return buffer.setSize(size);
+	}
+
+	static result<void> write_all(molch_write_function write, void *stream_data, const span<const std::byte> data) {
+		if (write(stream_data, byte_to_uchar(data.data()), data.size()) != 0) {
+			return Error(status_type::EXPORT_ERROR, "Failed to write to the backup stream.");
+		}
+
+		return outcome::success();
+	}
+
+	static result<void> read_all(molch_read_function read, void *stream_data, const span<std::byte> data) {
+		if (read(stream_data, byte_to_uchar(data.data()), data.size()) != 0) {
+			return Error(status_type::IMPORT_ERROR, "Failed to read from the backup stream.");
+		}
+
+		return outcome::success();
+	}
+
+	namespace {
+		class BackupStreamWriter {
+		private:
+			CryptoSecretstreamPush stream;
+			molch_write_function write;
+			void *stream_data;
+			Buffer plaintext;
+			Buffer ciphertext;
+
+		public:
+			BackupStreamWriter(CryptoSecretstreamPush&& stream, molch_write_function write, void *stream_data) :
+				stream{std::move(stream)},
+				write{write},
+				stream_data{stream_data} {}
+
+			result<void> writeRecord(const StreamRecordType type, const ProtobufCMessage *message, const unsigned char tag) {
+				//type byte followed by the packed message
+				const auto message_size{(message == nullptr) ? 0 : protobuf_c_message_get_packed_size(message)};
+				if ((message_size + 1 + crypto_secretstream_xchacha20poly1305_ABYTES) > backup_stream_maximum_chunk_size) {
+					return Error(status_type::EXPORT_ERROR, "State is too large for a single chunk of the backup stream.");
+				}
+				OUTCOME_TRY(reserve(this->plaintext, message_size + 1));
+				this->plaintext[0] = static_cast<std::byte>(type);
+				if (message != nullptr) {
+					protobuf_c_message_pack(message, byte_to_uchar(this->plaintext.data() + 1));
+				}
+
+				OUTCOME_TRY(reserve(this->ciphertext, this->plaintext.size() + crypto_secretstream_xchacha20poly1305_ABYTES));
+				OUTCOME_TRY(this->stream.push(this->ciphertext, this->plaintext, tag));
+
+				std::array<std::byte,backup_stream_length_size> length;
+				OUTCOME_TRY(to_big_endian(gsl::narrow<uint32_t>(this->ciphertext.size()), length));
+				OUTCOME_TRY(write_all(this->write, this->stream_data, length));
+				return write_all(this->write, this->stream_data, this->ciphertext);
+			}
+		};
+	}
+
+	result<void> export_backup_stream(
+			const UserStore& users,
+			const BackupKey& backup_key,
+			molch_write_function write,
+			void *stream_data) {
+		std::array<std::byte,backup_stream_preamble_size> preamble;
+		preamble[0] = static_cast<std::byte>(backup_stream_version);
+		const span<std::byte> header{preamble.data() + 1, preamble.size() - 1};
+		OUTCOME_TRY(stream, CryptoSecretstreamPush::construct(header, backup_key));
+		OUTCOME_TRY(write_all(write, stream_data, preamble));
+
+		BackupStreamWriter writer{std::move(stream), write, stream_data};
+		for (const auto& user : users) {
+			{
+				Arena arena;
+				OUTCOME_TRY(user_struct, user.exportProtobufWithoutConversations(arena));
+				OUTCOME_TRY(writer.writeRecord(StreamRecordType::USER, &user_struct->base, crypto_secretstream_xchacha20poly1305_TAG_MESSAGE));
+			}
+
+			for (const auto& conversation : user.conversations) {
+				Arena arena;
+				OUTCOME_TRY(conversation_struct, conversation.exportProtobuf(arena));
+				OUTCOME_TRY(writer.writeRecord(StreamRecordType::CONVERSATION, &conversation_struct->base, crypto_secretstream_xchacha20poly1305_TAG_MESSAGE));
+			}
+			for (const auto& conversation : user.conversations.dormant()) {
+				Arena arena;
+				OUTCOME_TRY(conversation_struct, conversation.exportProtobuf(arena));
+				OUTCOME_TRY(writer.writeRecord(StreamRecordType::CONVERSATION, &conversation_struct->base, crypto_secretstream_xchacha20poly1305_TAG_MESSAGE));
+			}
+		}
+
+		return writer.writeRecord(StreamRecordType::END, nullptr, crypto_secretstream_xchacha20poly1305_TAG_FINAL);
+	}
+
+	result<UserStore> import_backup_stream(
+			const span<const std::byte> backup_key,
+			molch_read_function read,
+			void *stream_data) {
+		if (backup_key.size() != BACKUP_KEY_SIZE) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "Backup key has an incorrect size.");
+		}
+
+		std::array<std::byte,backup_stream_preamble_size> preamble;
+		OUTCOME_TRY(read_all(read, stream_data, preamble));
+		if (preamble[0] != static_cast<std::byte>(backup_stream_version)) {
+			return Error(status_type::INCORRECT_DATA, "Incompatible backup stream.");
+		}
+		const span<const std::byte> header{preamble.data() + 1, preamble.size() - 1};
+		OUTCOME_TRY(stream, CryptoSecretstreamPull::construct(header, backup_key));
+
+		UserStore store;
+		//conversations are added to the user until the next user starts
+		std::optional<User> current_user;
+		Buffer ciphertext;
+		Buffer plaintext;
+		while (true) {
+			std::array<std::byte,backup_stream_length_size> length_bytes;
+			OUTCOME_TRY(read_all(read, stream_data, length_bytes));
+			uint32_t length{0};
+			OUTCOME_TRY(from_big_endian(length, length_bytes));
+			if ((length < (1 + crypto_secretstream_xchacha20poly1305_ABYTES)) || (length > backup_stream_maximum_chunk_size)) {
+				return Error(status_type::INCORRECT_DATA, "Backup stream chunk has an invalid length.");
+			}
+
+			OUTCOME_TRY(reserve(ciphertext, length));
+			OUTCOME_TRY(read_all(read, stream_data, ciphertext));
+			OUTCOME_TRY(reserve(plaintext, ciphertext.size() - crypto_secretstream_xchacha20poly1305_ABYTES));
+			OUTCOME_TRY(tag, stream.pull(plaintext, ciphertext));
+
+			const auto record_type{static_cast<StreamRecordType>(plaintext[0])};
+			const span<const std::byte> record{plaintext.data() + 1, plaintext.size() - 1};
+			Arena arena;
+			auto arena_protoc_allocator{arena.getProtobufCAllocator()};
+			switch (record_type) {
+				case StreamRecordType::USER: {
+					auto user_struct{molch__protobuf__user__unpack(&arena_protoc_allocator, record.size(), byte_to_uchar(record.data()))};
+					if (user_struct == nullptr) {
+						return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack user from the backup stream.");
+					}
+
+					if (current_user.has_value()) {
+						store.add(std::move(*current_user));
+					}
+					OUTCOME_TRY(user, User::import(*user_struct));
+					current_user.emplace(std::move(user));
+					break;
+				}
+
+				case StreamRecordType::CONVERSATION: {
+					if (!current_user.has_value()) {
+						return Error(status_type::INCORRECT_DATA, "Conversation without a user in the backup stream.");
+					}
+
+					auto conversation_struct{molch__protobuf__conversation__unpack(&arena_protoc_allocator, record.size(), byte_to_uchar(record.data()))};
+					if (conversation_struct == nullptr) {
+						return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack conversation from the backup stream.");
+					}
+
+					OUTCOME_TRY(conversation, Conversation::import(*conversation_struct));
+					OUTCOME_TRY(current_user->conversations.add(std::move(conversation)));
+					break;
+				}
+
+				case StreamRecordType::END:
+					if ((tag != crypto_secretstream_xchacha20poly1305_TAG_FINAL) || !record.empty()) {
+						return Error(status_type::INCORRECT_DATA, "Invalid end of the backup stream.");
+					}
+
+					if (current_user.has_value()) {
+						store.add(std::move(*current_user));
+					}
+					return store;
+
+				default:
+					return Error(status_type::INCORRECT_DATA, "Invalid record in the backup stream.");
+			}
+
+			if (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL) {
+				return Error(status_type::INCORRECT_DATA, "Backup stream ended without an end marker.");
+			}
+		}
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_BACKUP_STREAM_H
+#define LIB_BACKUP_STREAM_H
+
+#include "molch.h"
+#include "molch/constants.h"
+#include "key.hpp"
+#include "user-store.hpp"
+
+/*
+ * A backup stream starts with a version byte and a secretstream header,
+ * followed by length prefixed chunks that are encrypted with
+ * crypto_secretstream_xchacha20poly1305. Every chunk contains one user
+ * (without its conversations) or one conversation of the preceding user.
+ * The last chunk is an empty end marker with the final tag, so a truncated
+ * stream is detected.
+ */
+
+namespace Molch {
+	//! Upper bound for the size of a single chunk, protects against huge allocations from corrupted streams.
+	constexpr size_t backup_stream_maximum_chunk_size{16 * 1024 * 1024};
+
+	/*! Write all users and their conversations to a backup stream.
+	 * \param users The users to export.
+	 * \param backup_key The key to encrypt the stream with.
+	 * \param write Called with every part of the stream in order.
+	 * \param stream_data Passed to write.
+	 */
+	result<void> export_backup_stream(
+			const UserStore& users,
+			const BackupKey& backup_key,
+			molch_write_function write,
+			void *stream_data);
+
+	/*! Read a backup stream into a new user store.
+	 * \param backup_key The key the stream has been encrypted with.
+	 * \param read Called to read every part of the stream in order.
+	 * \param stream_data Passed to read.
+	 */
+	result<UserStore> import_backup_stream(
+			const span<const std::byte> backup_key,
+			molch_read_function read,
+			void *stream_data);
+}
+
+#endif /* LIB_BACKUP_STREAM_H */
@@ -0,0 +1,105 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_BOUNDED_CACHE_HPP
+#define LIB_BOUNDED_CACHE_HPP
+
+#include <cstddef>
+#include <map>
+#include <utility>
+
+#include "ring-buffer.hpp"
+
+namespace Molch {
+	/*!
+	 * Map with a maximum number of entries. When it is full, the entry
+	 * that was added first is forgotten to make room for a new one.
+	 */
+	template <typename Key, typename Value, size_t maximum_size>
+	class BoundedCache {
+	private:
+		std::map<Key,Value> entries;
+		RingBuffer<Key> insertion_order;
+
+	public:
+		//! Returns nullptr if there is no entry for the key.
+		const Value* find(const Key& key) const {
+			const auto found{this->entries.find(key)};
+			if (found == std::cend(this->entries)) {
+				return nullptr;
+			}
+
+			return &found->second;
+		}
+
+		//! Doesn't replace an existing entry for the same key.
+		void add(const Key& key, Value&& value) {
+			if (!this->entries.emplace(key, std::move(value)).second) {
+				return;
+			}
+
+			this->insertion_order.push_back(key);
+			if (this->insertion_order.size() > maximum_size) {
+				this->entries.erase(this->insertion_order.front());
+				this->insertion_order.pop_front();
+			}
+		}
+
+		void remove(const Key& key) {
+			if (this->entries.erase(key) == 0) {
+				return;
+			}
+
+			for (size_t index{0}; index < this->insertion_order.size(); index++) {
+				if (!(this->insertion_order[index] < key) and !(key < this->insertion_order[index])) {
+					this->insertion_order.erase(index);
+					return;
+				}
+			}
+		}
+
+		//! Remove every entry the predicate returns true for, it is called with the key and the value.
+		template <typename Predicate>
+		void removeIf(Predicate&& predicate) {
+			size_t index{0};
+			while (index < this->insertion_order.size()) {
+				const auto entry{this->entries.find(this->insertion_order[index])};
+				if (predicate(entry->first, entry->second)) {
+					this->entries.erase(entry);
+					this->insertion_order.erase(index);
+				} else {
+					index++;
+				}
+			}
+		}
+
+		void clear() noexcept {
+			this->entries.clear();
+			this->insertion_order.clear();
+		}
+
+		size_t size() const noexcept {
+			return this->entries.size();
+		}
+	};
+}
+
+#endif /* LIB_BOUNDED_CACHE_HPP */
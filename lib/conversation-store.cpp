@@ -19,34 +19,103 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <algorithm>
+#include <atomic>
 #include <iterator>
 
 #include "conversation-store.hpp"
 #include "destroyers.hpp"
 #include "gsl.hpp"
+#include "sodium-wrappers.hpp"
 
 namespace Molch {
+	static std::atomic<size_t> budget{0};
+	static std::atomic<uint64_t> hits{0};
+	static std::atomic<uint64_t> misses{0};
+	static std::atomic<uint64_t> evictions{0};
+	//evicted conversations are encrypted with a key that never leaves the process
+	static std::shared_ptr<const BackupKey> global_paging_key;
+
+	void set_conversation_budget(const size_t resident_conversations) noexcept {
+		budget = resident_conversations;
+	}
+
+	size_t conversation_budget() noexcept {
+		return budget;
+	}
+
+	molch_residency_statistics residency_statistics() noexcept {
+		return {hits, misses, evictions};
+	}
+
+	static result<std::shared_ptr<const BackupKey>> paging_key() {
+		if (global_paging_key == nullptr) {
+			BackupKey key;
+			randombytes_buf(key);
+			OUTCOME_TRY(shared_key, share_backup_key(key));
+			global_paging_key = std::move(shared_key);
+		}
+
+		return global_paging_key;
+	}
+
 	size_t ConversationStore::size() const {
-		return this->conversations.size();
-	}
-
-	void ConversationStore::add(Conversation&& conversation) {
-		const auto& id{conversation.id()};
-		//search if a conversation with this id already exists
-		auto existing_conversation{std::find_if(std::cbegin(this->conversations), std::cend(this->conversations),
-				[&id](const Conversation& conversation) {
-					return conversation.id() == id;
-				})};
-		//if none exists, just add the conversation
-		if (existing_conversation == std::cend(this->conversations)) {
-			this->conversations.push_back(std::move(conversation));
-			return;
+		return this->conversations.size() + this->dormant_conversations.size();
+	}
+
+	std::list<Conversation>::const_iterator ConversationStore::begin() const noexcept {
+		return std::cbegin(this->conversations);
+	}
+
+	std::list<Conversation>::const_iterator ConversationStore::end() const noexcept {
+		return std::cend(this->conversations);
+	}
+
+	const std::list<DormantConversation>& ConversationStore::dormant() const noexcept {
+		return this->dormant_conversations;
+	}
+
+	const std::set<ConversationId>& ConversationStore::changes() const noexcept {
+		return this->changed;
+	}
+
+	void ConversationStore::clearChanges() noexcept {
+		this->changed.clear();
+	}
+
+	void ConversationStore::removeDormant(const ConversationId& id) {
+		const auto dormant_conversation{this->dormant_index.find(id)};
+		if (dormant_conversation != std::end(this->dormant_index)) {
+			this->dormant_conversations.erase(dormant_conversation->second);
+			this->dormant_index.erase(dormant_conversation);
+		}
+	}
+
+	result<void> ConversationStore::add(Conversation&& conversation) {
+		const auto id{conversation.id()};
+		this->removeDormant(id);
+		this->changed.insert(id);
+
+		//replace an existing conversation with this id, it has just been used
+		const auto existing_conversation{this->index.find(id)};
+		if (existing_conversation != std::end(this->index)) {
+			*existing_conversation->second = std::move(conversation);
+			this->conversations.splice(std::end(this->conversations), this->conversations, existing_conversation->second);
+			return outcome::success();
 		}
 
-		//otherwise replace the exiting one
-		auto existing_index{gsl::narrow_cast<size_t>(existing_conversation - std::cbegin(this->conversations))};
-		this->conversations[existing_index] = std::move(conversation);
+		OUTCOME_TRY(this->makeRoom());
+		this->conversations.push_back(std::move(conversation));
+		this->index.emplace(id, std::prev(std::end(this->conversations)));
+
+		return outcome::success();
+	}
+
+	void ConversationStore::addDormant(DormantConversation&& conversation) {
+		const auto id{conversation.id()};
+		this->remove(id);
+		this->changed.insert(id);
+		this->dormant_conversations.push_back(std::move(conversation));
+		this->dormant_index.emplace(id, std::prev(std::end(this->dormant_conversations)));
 	}
 
 	void ConversationStore::remove(const Conversation * const node) {
@@ -54,12 +123,11 @@ namespace Molch {
 			return;
 		}
 
-		auto found_node{std::find_if(std::cbegin(this->conversations), std::cend(this->conversations),
-				[&node](const Conversation& conversation) {
-					return &conversation == node;
-				})};
-		if (found_node != std::cend(this->conversations)) {
-			this->conversations.erase(found_node);
+		const auto found_node{this->index.find(node->id())};
+		if ((found_node != std::end(this->index)) and (&(*found_node->second) == node)) {
+			this->changed.insert(found_node->first);
+			this->conversations.erase(found_node->second);
+			this->index.erase(found_node);
 		}
 	}
 
@@ -69,13 +137,13 @@ namespace Molch {
 	 * The conversation is identified by it's id.
 	 */
 	void ConversationStore::remove(const ConversationId& id) {
-		auto found_node{std::find_if(std::cbegin(this->conversations), std::cend(this->conversations),
-				[&id](const Conversation& conversation) {
-					return conversation.id() == id;
-				})};
+		this->removeDormant(id);
+		this->changed.insert(id);
 
-		if (found_node != std::cend(this->conversations)) {
-			this->conversations.erase(found_node);
+		const auto found_node{this->index.find(id)};
+		if (found_node != std::end(this->index)) {
+			this->conversations.erase(found_node->second);
+			this->index.erase(found_node);
 		}
 	}
 
@@ -84,24 +152,145 @@ namespace Molch {
 	 *
 	 * Returns nullptr if no conversation was found.
 	 */
-	Conversation* ConversationStore::find(const ConversationId& id) {
-		auto node{std::find_if(std::begin(this->conversations), std::end(this->conversations),
-				[&id](const Conversation& conversation) {
-					return conversation.id() == id;
-				})};
+	result<Conversation*> ConversationStore::find(const ConversationId& id) {
+		const auto node{this->index.find(id)};
+		if (node != std::end(this->index)) {
+			hits++;
+			//the caller is free to change it
+			this->changed.insert(id);
+			this->conversations.splice(std::end(this->conversations), this->conversations, node->second);
+			return &(*node->second);
+		}
 
-		if (node == std::end(this->conversations)) {
+		const auto dormant_conversation{this->dormant_index.find(id)};
+		if (dormant_conversation == std::end(this->dormant_index)) {
 			return nullptr;
 		}
 
-		return &(*node);
+		OUTCOME_TRY(this->makeRoom());
+		OUTCOME_TRY(hydrated_conversation, dormant_conversation->second->hydrate());
+		this->dormant_conversations.erase(dormant_conversation->second);
+		this->dormant_index.erase(dormant_conversation);
+		misses++;
+
+		this->conversations.push_back(std::move(hydrated_conversation));
+		const auto hydrated_node{std::prev(std::end(this->conversations))};
+		this->index.emplace(id, hydrated_node);
+		this->changed.insert(id);
+
+		return &(*hydrated_node);
+	}
+
+	bool ConversationStore::contains(const ConversationId& id) const {
+		return (this->index.count(id) != 0) or (this->dormant_index.count(id) != 0);
+	}
+
+	result<ProtobufCConversation*> ConversationStore::exportProtobuf(const ConversationId& id, Arena& arena) const {
+		const auto node{this->index.find(id)};
+		if (node != std::cend(this->index)) {
+			return node->second->exportProtobuf(arena);
+		}
+
+		const auto dormant_conversation{this->dormant_index.find(id)};
+		if (dormant_conversation != std::cend(this->dormant_index)) {
+			return dormant_conversation->second->exportProtobuf(arena);
+		}
+
+		return nullptr;
+	}
+
+	result<ProtobufCConversation*> ConversationStore::exportProtobufWithCheckpoint(const ConversationId& id, Arena& arena) const {
+		const auto node{this->index.find(id)};
+		if (node != std::cend(this->index)) {
+			return node->second->exportProtobufWithCheckpoint(arena);
+		}
+
+		const auto dormant_conversation{this->dormant_index.find(id)};
+		if (dormant_conversation != std::cend(this->dormant_index)) {
+			return dormant_conversation->second->exportProtobufWithCheckpoint(arena);
+		}
+
+		return nullptr;
+	}
+
+	const StateVersion* ConversationStore::version(const ConversationId& id) const {
+		const auto node{this->index.find(id)};
+		if (node != std::cend(this->index)) {
+			return &node->second->version();
+		}
+
+		const auto dormant_conversation{this->dormant_index.find(id)};
+		if (dormant_conversation != std::cend(this->dormant_index)) {
+			return &dormant_conversation->second->version();
+		}
+
+		return nullptr;
+	}
+
+	result<void> ConversationStore::setBackupCheckpoint(const ConversationId& id, const BackupHash& base_hash, const uint64_t backup_key_generation) {
+		const auto node{this->index.find(id)};
+		if (node != std::end(this->index)) {
+			node->second->setBackupCheckpoint(base_hash, backup_key_generation);
+			return outcome::success();
+		}
+
+		const auto dormant_conversation{this->dormant_index.find(id)};
+		if (dormant_conversation == std::end(this->dormant_index)) {
+			return Error(status_type::NOT_FOUND, "Failed to find the conversation to set the backup checkpoint for.");
+		}
+
+		return dormant_conversation->second->setBackupCheckpoint(base_hash, backup_key_generation);
+	}
+
+	result<void> ConversationStore::evict(const size_t resident_conversations) {
+		while (this->conversations.size() > resident_conversations) {
+			const auto least_recently_used{std::begin(this->conversations)};
+			const auto id{least_recently_used->id()};
+
+			OUTCOME_TRY(key, paging_key());
+			OUTCOME_TRY(dormant_conversation, DormantConversation::evict(std::move(*least_recently_used), std::move(key)));
+			this->dormant_conversations.push_back(std::move(dormant_conversation));
+			this->dormant_index.emplace(id, std::prev(std::end(this->dormant_conversations)));
+			this->conversations.erase(least_recently_used);
+			this->index.erase(id);
+			evictions++;
+		}
+
+		return outcome::success();
+	}
+
+	result<void> ConversationStore::makeRoom() {
+		const size_t resident_conversations{budget};
+		if (resident_conversations == 0) {
+			return outcome::success();
+		}
+
+		return this->evict(resident_conversations - 1);
+	}
+
+	result<void> ConversationStore::enforceBudget() {
+		const size_t resident_conversations{budget};
+		if (resident_conversations == 0) {
+			return outcome::success();
+		}
+
+		return this->evict(resident_conversations);
 	}
 
 	/*
 	 * Remove all entries from a conversation store.
 	 */
 	void ConversationStore::clear() {
+		for (const auto& [id, conversation] : this->index) {
+			this->changed.insert(id);
+		}
+		for (const auto& [id, conversation] : this->dormant_index) {
+			this->changed.insert(id);
+		}
 		this->conversations.clear();
+		this->index.clear();
+		this->dormant_conversations.clear();
+		this->dormant_index.clear();
 	}
 
 	/*
@@ -110,11 +299,11 @@ namespace Molch {
 	 * Returns nullptr if empty.
 	 */
 	result<Buffer> ConversationStore::list() const {
-		if (this->conversations.empty()) {
+		if (this->size() == 0) {
 			return Buffer();
 		}
 
-		Buffer list{this->conversations.size() * CONVERSATION_ID_SIZE, 0};
+		Buffer list{this->size() * CONVERSATION_ID_SIZE, 0};
 
 		size_t index{0};
 		for (const auto& conversation : this->conversations) {
@@ -125,25 +314,38 @@ namespace Molch {
 				conversation.id().size()));
 			index++;
 		}
+		for (const auto& conversation : this->dormant_conversations) {
+			OUTCOME_TRY(list.copyFromRaw(
+				CONVERSATION_ID_SIZE * index,
+				conversation.id().data(),
+				0,
+				conversation.id().size()));
+			index++;
+		}
 
 		return list;
 	}
 
 	result<span<ProtobufCConversation*>> ConversationStore::exportProtobuf(Arena& arena) const {
-		if (this->conversations.empty()) {
+		if (this->size() == 0) {
 			return {nullptr, static_cast<size_t>(0)};
 		}
 
 		//export the conversations
-		auto conversations{arena.allocate<ProtobufCConversation*>(this->conversations.size())};
+		auto conversations{arena.allocate<ProtobufCConversation*>(this->size())};
 		size_t index{0};
 		for (const auto& conversation : this->conversations) {
 			OUTCOME_TRY(exported_conversation, conversation.exportProtobuf(arena));
 			conversations[index] = exported_conversation;
 			index++;
 		}
+		for (const auto& conversation : this->dormant_conversations) {
+			OUTCOME_TRY(exported_conversation, conversation.exportProtobuf(arena));
+			conversations[index] = exported_conversation;
+			index++;
+		}
 
-		return {conversations, this->conversations.size()};
+		return {conversations, this->size()};
 	}
 
 	result<ConversationStore> ConversationStore::import(const span<ProtobufCConversation*> conversations) {
@@ -155,7 +357,10 @@ namespace Molch {
 			}
 
 			OUTCOME_TRY(imported_conversation, Conversation::import(*conversation));
-			store.conversations.emplace_back(std::move(imported_conversation));
+			const auto id{imported_conversation.id()};
+			store.remove(id);
+			store.conversations.push_back(std::move(imported_conversation));
+			store.index.emplace(id, std::prev(std::end(store.conversations)));
 		}
 
 		return store;
@@ -167,6 +372,7 @@ namespace Molch {
 			conversation.print(stream) << ",\n";
 		}
 		stream << "]\n";
+		stream << "Dormant conversations: " << this->dormant_conversations.size() << '\n';
 
 		return stream;
 	}
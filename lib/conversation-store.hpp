@@ -22,14 +22,36 @@
 #ifndef LIB_CONVERSATION_STORE_H
 #define LIB_CONVERSATION_STORE_H
 
+#include <list>
+#include <map>
 #include <ostream>
+#include <set>
+#include "molch.h"
 #include "conversation.hpp"
+#include "dormant-conversation.hpp"
 #include "protobuf-arena.hpp"
 
 namespace Molch {
 	class ConversationStore {
 	private:
-		std::vector<Conversation> conversations;
+		//the least recently used conversation comes first, list nodes keep pointers to conversations valid
+		std::list<Conversation> conversations;
+		std::map<ConversationId,std::list<Conversation>::iterator> index;
+		//imported lazily, these are turned into conversations when they are found
+		std::list<DormantConversation> dormant_conversations;
+		std::map<ConversationId,std::list<DormantConversation>::iterator> dormant_index;
+		//conversations that have been handed out, added or removed since clearChanges
+		std::set<ConversationId> changed;
+
+		void removeDormant(const ConversationId& id);
+
+		/*
+		 * Encrypt the least recently used conversations until
+		 * at most the given number of conversations is resident.
+		 */
+		result<void> evict(const size_t resident_conversations);
+		//make room for one more conversation
+		result<void> makeRoom();
 
 	public:
 
@@ -50,7 +72,13 @@ namespace Molch {
 		 * Add a conversation to the conversation store or replaces
 		 * it if one with the same ID already exists.
 		 */
-		void add(Conversation&& conversation);
+		result<void> add(Conversation&& conversation);
+
+		/*
+		 * Add a conversation that is only imported once it is found,
+		 * replaces an existing one with the same ID.
+		 */
+		void addDormant(DormantConversation&& conversation);
 
 		/*
 		 * Remove a conversation from the conversation_store.
@@ -66,16 +94,51 @@ namespace Molch {
 
 		/*
 		 * Find a conversation for a given conversation ID.
+		 * A dormant conversation is imported at this point, which can evict
+		 * the least recently used conversation if the budget is exhausted.
+		 * Only pointers to the evicted conversation become invalid.
 		 *
 		 * Returns nullptr if no conversation was found.
 		 */
-		Conversation* find(const ConversationId& id);
+		result<Conversation*> find(const ConversationId& id);
+
+		//! If there is a conversation with this id, dormant ones aren't hydrated.
+		bool contains(const ConversationId& id) const;
+
+		/*! Export one conversation, a dormant one is exported without making it resident.
+		 * \return nullptr if no conversation was found.
+		 */
+		result<ProtobufCConversation*> exportProtobuf(const ConversationId& id, Arena& arena) const;
+		result<ProtobufCConversation*> exportProtobufWithCheckpoint(const ConversationId& id, Arena& arena) const;
+
+		//! State version of a conversation, dormant ones stay dormant. nullptr if no conversation was found.
+		const StateVersion* version(const ConversationId& id) const;
+
+		/*
+		 * Ids of the conversations that might have changed since the last
+		 * call of clearChanges. These are the ones that have been found,
+		 * added or removed, so a removed conversation's id is in there as well.
+		 */
+		const std::set<ConversationId>& changes() const noexcept;
+		void clearChanges() noexcept;
+
+		/*
+		 * Start a new chain of delta backups for a conversation after a full
+		 * backup of it has been exported, dormant conversations stay dormant.
+		 */
+		result<void> setBackupCheckpoint(const ConversationId& id, const BackupHash& base_hash, const uint64_t backup_key_generation);
 
 		/*
 		 * Remove all entries from a conversation store.
 		 */
 		void clear();
 
+		/*
+		 * Evict the least recently used conversations until the
+		 * conversation budget is met.
+		 */
+		result<void> enforceBudget();
+
 		/*
 		 * Create a list of conversations (one buffer filled with the conversation ids.
 		 *
@@ -87,6 +150,22 @@ namespace Molch {
 		result<span<ProtobufCConversation*>> exportProtobuf(Arena& arena) const;
 
 		std::ostream& print(std::ostream& stream) const;
+
+		//! Iterate over the conversations that aren't dormant.
+		std::list<Conversation>::const_iterator begin() const noexcept;
+		std::list<Conversation>::const_iterator end() const noexcept;
+
+		//! The dormant conversations, the one that has been evicted first comes first.
+		const std::list<DormantConversation>& dormant() const noexcept;
 	};
+
+	/*!
+	 * Maximum number of conversations per ConversationStore that are kept
+	 * decrypted in memory, 0 means no limit.
+	 */
+	void set_conversation_budget(const size_t resident_conversations) noexcept;
+	size_t conversation_budget() noexcept;
+
+	molch_residency_statistics residency_statistics() noexcept;
 }
 #endif
@@ -20,7 +20,9 @@
  */
 
 #include <exception>
+#include <algorithm>
 #include <iterator>
+#include <array>
 
 #include "molch/constants.h"
 #include "conversation.hpp"
@@ -35,6 +37,9 @@ namespace Molch {
 	Conversation& Conversation::move(Conversation&& conversation) noexcept {
 		this->id_storage = conversation.id_storage;
 		this->ratchet = std::move(conversation.ratchet);
+		this->state_version = conversation.state_version;
+		this->backup_checkpoint = std::move(conversation.backup_checkpoint);
+		this->received_packets = conversation.received_packets;
 
 		return *this;
 	}
@@ -74,13 +79,12 @@ namespace Molch {
 		return conversation;
 	}
 
-	result<SendConversation> Conversation::createSendConversation(
-			const span<const std::byte> message, //message we want to send to the receiver
-			const PublicKey& sender_public_identity, //who is sending this message?
+	result<PreparedSendConversation> Conversation::prepareSendConversation(
+			const PublicKey& sender_public_identity,
 			const PrivateKey& sender_private_identity,
 			const PublicKey& receiver_public_identity,
-			const span<const std::byte> receiver_prekey_list) { //PREKEY_AMOUNT * PUBLIC_KEY_SIZE
-		FulfillOrFail(receiver_prekey_list.size() == (PREKEY_AMOUNT * PUBLIC_KEY_SIZE));
+			const span<const std::byte> receiver_prekey_list) { //multiple of PUBLIC_KEY_SIZE
+		FulfillOrFail(!receiver_prekey_list.empty() && ((receiver_prekey_list.size() % PUBLIC_KEY_SIZE) == 0));
 
 		//create an ephemeral keypair
 		PublicKey sender_public_ephemeral;
@@ -88,7 +92,7 @@ namespace Molch {
 		OUTCOME_TRY(crypto_box_keypair(sender_public_ephemeral, sender_private_ephemeral));
 
 		//choose a prekey
-		auto prekey_number{randombytes_uniform(PREKEY_AMOUNT)};
+		auto prekey_number{randombytes_uniform(gsl::narrow<uint32_t>(receiver_prekey_list.size() / PUBLIC_KEY_SIZE))};
 		OUTCOME_TRY(receiver_public_prekey, PublicKey::fromSpan({&receiver_prekey_list[gsl::narrow_cast<ptrdiff_t>(prekey_number * PUBLIC_KEY_SIZE)], PUBLIC_KEY_SIZE}));
 
 		//initialize the conversation
@@ -100,14 +104,28 @@ namespace Molch {
 				sender_public_ephemeral,
 				receiver_public_prekey));
 
-		auto prekey_metadata{std::make_optional<PrekeyMetadata>()};
-		auto& prekey_metadata_content{prekey_metadata.value()};
-		prekey_metadata_content.identity = sender_public_identity;
-		prekey_metadata_content.ephemeral = sender_public_ephemeral;
-		prekey_metadata_content.prekey = receiver_public_prekey;
-		OUTCOME_TRY(packet, conversation.send(message, prekey_metadata));
+		PrekeyMetadata prekey_metadata;
+		prekey_metadata.identity = sender_public_identity;
+		prekey_metadata.ephemeral = sender_public_ephemeral;
+		prekey_metadata.prekey = receiver_public_prekey;
+
+		return PreparedSendConversation(prekey_metadata, std::move(conversation));
+	}
+
+	result<SendConversation> Conversation::createSendConversation(
+			const span<const std::byte> message, //message we want to send to the receiver
+			const PublicKey& sender_public_identity, //who is sending this message?
+			const PrivateKey& sender_private_identity,
+			const PublicKey& receiver_public_identity,
+			const span<const std::byte> receiver_prekey_list) { //multiple of PUBLIC_KEY_SIZE
+		OUTCOME_TRY(prepared, prepareSendConversation(
+				sender_public_identity,
+				sender_private_identity,
+				receiver_public_identity,
+				receiver_prekey_list));
+		OUTCOME_TRY(packet, prepared.conversation.send(message, prepared.prekey_metadata));
 
-		return SendConversation(std::move(packet), std::move(conversation));
+		return SendConversation(std::move(packet), std::move(prepared.conversation));
 	}
 
 	result<ReceiveConversation> Conversation::createReceiveConversation(
@@ -142,57 +160,98 @@ namespace Molch {
 		return ReceiveConversation(std::move(received_message.message), std::move(conversation));
 	}
 
+	size_t Conversation::packetSize(const size_t message_size, const molch_message_type packet_type) noexcept {
+		return packet_size(packet_type, header_size, message_size);
+	}
+
 	result<Buffer> Conversation::send(const span<const std::byte> message, const std::optional<PrekeyMetadata>& prekey_metadata) {
-		OUTCOME_TRY(send_data, this->ratchet.getSendData());
-		OUTCOME_TRY(header, header_construct(
-				send_data.ephemeral,
-				send_data.message_number,
-				send_data.previous_message_number));
+		const auto packet_type{prekey_metadata.has_value() ? molch_message_type::PREKEY_MESSAGE : molch_message_type::NORMAL_MESSAGE};
+		const auto size{packetSize(message.size(), packet_type)};
+		Buffer packet{size, size};
+		OUTCOME_TRY(encrypted_packet, this->send(packet, message, prekey_metadata));
+		OUTCOME_TRY(packet.setSize(encrypted_packet.size()));
 
+		return packet;
+	}
+
+	result<span<std::byte>> Conversation::send(const span<std::byte> packet, const span<const std::byte> message, const std::optional<PrekeyMetadata>& prekey_metadata) {
 		auto packet_type{molch_message_type::NORMAL_MESSAGE};
 		//check if this is a prekey message
 		if (prekey_metadata.has_value()) {
 			packet_type = molch_message_type::PREKEY_MESSAGE;
 		}
 
-		OUTCOME_TRY(encrypted_packet, packet_encrypt(
+		//check before advancing the ratchet
+		if (packet.size() < packetSize(message.size(), packet_type)) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The buffer is too small for the packet.");
+		}
+
+		this->state_version.bump();
+
+		OUTCOME_TRY(send_data, this->ratchet.getSendData());
+		std::array<std::byte,header_size> header{};
+		OUTCOME_TRY(header_construct(
+				header,
+				send_data.ephemeral,
+				send_data.message_number,
+				send_data.previous_message_number));
+
+		return packet_encrypt(
+				packet,
 				packet_type,
 				header,
 				send_data.header_key,
 				message,
 				send_data.message_key,
-				prekey_metadata));
-
-		return std::move(encrypted_packet);
+				prekey_metadata);
 	}
 
-	result<ReceivedMessage> Conversation::trySkippedHeaderAndMessageKeys(const span<const std::byte> packet) {
+	result<ReceivedMessageSpan> Conversation::trySkippedHeaderAndMessageKeys(const span<std::byte> message, const PacketView& packet) {
+		std::array<std::byte,header_size> header_buffer{};
 		for (size_t index{0}; index < this->ratchet.skipped_header_and_message_keys.keys().size(); index++) {
 			auto& node = this->ratchet.skipped_header_and_message_keys.keys()[index];
-			auto decrypted_packet_result = packet_decrypt(
-					packet,
-					node.headerKey(),
-					node.messageKey());
-			if (decrypted_packet_result.has_value()) {
-				ReceivedMessage message;
-				auto& decrypted_packet{decrypted_packet_result.value()};
-				message.message = std::move(decrypted_packet.message);
+			const auto header_result{packet_decrypt_header(header_buffer, packet, node.headerKey())};
+			if (not header_result.has_value()) {
+				continue;
+			}
+			const auto message_result{packet_decrypt_message(message, packet, node.messageKey())};
+			if (message_result.has_value()) {
 				this->ratchet.skipped_header_and_message_keys.remove(index);
 
-				PublicKey their_signed_public_ephemeral;
-				OUTCOME_TRY(extracted_header, header_extract(decrypted_packet.header));
-				message.message_number = extracted_header.message_number;
-				message.previous_message_number = extracted_header.previous_message_number;
+				OUTCOME_TRY(extracted_header, header_extract(header_result.value()));
+				ReceivedMessageSpan received_message;
+				received_message.message = message_result.value();
+				received_message.message_number = extracted_header.message_number;
+				received_message.previous_message_number = extracted_header.previous_message_number;
 
-				return message;
+				return received_message;
 			}
 		}
 
 		return Error(status_type::DECRYPT_ERROR, "No keys found for the packet.");
 	}
 
-	result<ReceivedMessage> Conversation::internal_receive(const span<const std::byte> packet) {
-		const auto received_message_result = trySkippedHeaderAndMessageKeys(packet);
+	bool ReceivedPackets::contains(const PacketView& packet) const noexcept {
+		const auto stored{std::min(this->count, this->packets.size())};
+		for (size_t index{0}; index < stored; index++) {
+			const auto& nonces{this->packets[index]};
+			if ((nonces.header == packet.header_nonce) and (nonces.message == packet.message_nonce)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void ReceivedPackets::add(const PacketView& packet) noexcept {
+		auto& nonces{this->packets[this->count % this->packets.size()]};
+		nonces.header = packet.header_nonce;
+		nonces.message = packet.message_nonce;
+		this->count++;
+	}
+
+	result<ReceivedMessageSpan> Conversation::internal_receive(const span<std::byte> message, const PacketView& packet_view) {
+		const auto received_message_result = trySkippedHeaderAndMessageKeys(message, packet_view);
 		if (received_message_result.has_value()) {
 			return received_message_result.value();
 		}
@@ -200,15 +259,16 @@ namespace Molch {
 		const auto receive_header_keys{this->ratchet.getReceiveHeaderKeys()};
 
 		//try to decrypt the packet header with the current receive header key
-		Buffer header;
-		auto header_result = packet_decrypt_header(packet, receive_header_keys.current);
+		std::array<std::byte,header_size> header_buffer{};
+		span<std::byte> header;
+		auto header_result = packet_decrypt_header(header_buffer, packet_view, receive_header_keys.current);
 		if (header_result.has_value()) {
-			header = std::move(header_result.value());
+			header = header_result.value();
 			OUTCOME_TRY(this->ratchet.setHeaderDecryptability(Ratchet::HeaderDecryptability::CURRENT_DECRYPTABLE));
 		} else {
-			auto header_result = packet_decrypt_header(packet, receive_header_keys.next);
+			auto header_result = packet_decrypt_header(header_buffer, packet_view, receive_header_keys.next);
 			if (header_result.has_value()) {
-				header = std::move(header_result.value());
+				header = header_result.value();
 				OUTCOME_TRY(this->ratchet.setHeaderDecryptability(Ratchet::HeaderDecryptability::NEXT_DECRYPTABLE));
 			} else {
 				OUTCOME_TRY(this->ratchet.setHeaderDecryptability(Ratchet::HeaderDecryptability::UNDECRYPTABLE));
@@ -227,12 +287,12 @@ namespace Molch {
 			extracted_header.message_number,
 			extracted_header.previous_message_number));
 
-		OUTCOME_TRY(message, packet_decrypt_message(packet, message_key));
+		OUTCOME_TRY(decrypted_message, packet_decrypt_message(message, packet_view, message_key));
 
 		OUTCOME_TRY(this->ratchet.setLastMessageAuthenticity(true));
 
-		ReceivedMessage received_message;
-		received_message.message = std::move(message);
+		ReceivedMessageSpan received_message;
+		received_message.message = decrypted_message;
 		received_message.message_number = extracted_header.message_number;
 		received_message.previous_message_number = extracted_header.previous_message_number;
 
@@ -240,9 +300,40 @@ namespace Molch {
 	}
 
 	result<ReceivedMessage> Conversation::receive(const span<const std::byte> packet) {
-		auto received_message_result = internal_receive(packet);
+		Buffer message{packet.size(), packet.size()};
+		OUTCOME_TRY(received_message_span, this->receive(message, packet));
+		OUTCOME_TRY(message.setSize(received_message_span.message.size()));
+
+		ReceivedMessage received_message;
+		received_message.message = std::move(message);
+		received_message.message_number = received_message_span.message_number;
+		received_message.previous_message_number = received_message_span.previous_message_number;
+
+		return received_message;
+	}
+
+	result<ReceivedMessageSpan> Conversation::receive(const span<std::byte> message, const span<const std::byte> packet) {
+		const auto packet_view_result{packet_parse(packet)};
+
+		//retransmissions are dropped before doing any crypto
+		if (packet_view_result.has_value() and this->received_packets.contains(packet_view_result.value())) {
+			return Error(status_type::DUPLICATE_MESSAGE, "The packet has already been received.");
+		}
+
+		//even a failed receive changes the ratchet state
+		this->state_version.bump();
+
+		if (not packet_view_result.has_value()) {
+			OUTCOME_TRY(this->ratchet.setHeaderDecryptability(Ratchet::HeaderDecryptability::UNDECRYPTABLE));
+			OUTCOME_TRY(this->ratchet.setLastMessageAuthenticity(false));
+			return Error(status_type::DECRYPT_ERROR, "Failed to decrypt the message.");
+		}
+
+		auto received_message_result = internal_receive(message, packet_view_result.value());
 		if (not received_message_result.has_value()) {
 			OUTCOME_TRY(this->ratchet.setLastMessageAuthenticity(false));
+		} else {
+			this->received_packets.add(packet_view_result.value());
 		}
 
 		return received_message_result;
@@ -272,10 +363,162 @@ namespace Molch {
 		return conversation;
 	}
 
+	result<ProtobufCConversation*> Conversation::exportProtobufWithCheckpoint(Arena& arena) const {
+		OUTCOME_TRY(exported_conversation, this->exportProtobuf(arena));
+		OUTCOME_TRY(export_backup_checkpoint(arena, *exported_conversation, this->backup_checkpoint.get()));
+
+		return exported_conversation;
+	}
+
+	result<Conversation> Conversation::importWithCheckpoint(const ProtobufCConversation& conversation_protobuf) {
+		OUTCOME_TRY(conversation, import(conversation_protobuf));
+		if (conversation_protobuf.backup_checkpoint == nullptr) {
+			return std::move(conversation);
+		}
+
+		const auto& checkpoint_protobuf{*conversation_protobuf.backup_checkpoint};
+		auto checkpoint{std::make_unique<ConversationCheckpoint>()};
+		if (checkpoint_protobuf.base_hash.len != checkpoint->base_hash.size()) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The base hash of the backup checkpoint has an incorrect size.");
+		}
+		OUTCOME_TRY(copyFromTo({checkpoint_protobuf.base_hash}, checkpoint->base_hash));
+		checkpoint->sequence_number = checkpoint_protobuf.sequence_number;
+		//the backup key generation starts at 1, so no deltas are exported from this checkpoint
+		checkpoint->backup_key_generation = 0;
+		conversation.backup_checkpoint = std::move(checkpoint);
+
+		return std::move(conversation);
+	}
+
+	size_t Conversation::maximumSnapshotSize() const noexcept {
+		return CONVERSATION_ID_SIZE + this->ratchet.maximumSnapshotSize();
+	}
+
+	result<size_t> Conversation::exportSnapshot(const span<std::byte> snapshot) const {
+		SnapshotWriter writer{snapshot};
+		OUTCOME_TRY(writer.write(this->id_storage));
+		OUTCOME_TRY(this->ratchet.exportSnapshot(writer));
+
+		return writer.size();
+	}
+
+	result<Conversation> Conversation::importSnapshot(const span<const std::byte> snapshot) {
+		SnapshotReader reader{snapshot};
+		Conversation conversation(uninitialized);
+		OUTCOME_TRY(reader.read(conversation.id_storage));
+
+		OUTCOME_TRY(ratchet, Ratchet::importSnapshot(reader));
+		conversation.ratchet = std::move(ratchet);
+		if (!reader.done()) {
+			return Error(status_type::INCORRECT_DATA, "Trailing data after the conversation snapshot.");
+		}
+
+		return conversation;
+	}
+
 	const ConversationId& Conversation::id() const {
 		return this->id_storage;
 	}
 
+	const StateVersion& Conversation::version() const noexcept {
+		return this->state_version;
+	}
+
+	void Conversation::setBackupCheckpoint(const BackupHash& base_hash, const uint64_t backup_key_generation) {
+		if (this->backup_checkpoint == nullptr) {
+			this->backup_checkpoint = std::make_unique<ConversationCheckpoint>();
+		}
+
+		this->ratchet.updateCheckpoint(this->backup_checkpoint->ratchet);
+		this->backup_checkpoint->base_hash = base_hash;
+		this->backup_checkpoint->sequence_number = 0;
+		this->backup_checkpoint->backup_key_generation = backup_key_generation;
+	}
+
+	bool Conversation::hasBackupCheckpoint(const uint64_t backup_key_generation) const noexcept {
+		return (this->backup_checkpoint != nullptr) && (this->backup_checkpoint->backup_key_generation == backup_key_generation);
+	}
+
+	result<ProtobufCConversationDelta*> Conversation::exportDeltaProtobuf(Arena& arena) const {
+		if (this->backup_checkpoint == nullptr) {
+			return Error(status_type::INCORRECT_DATA, "No full backup of the conversation to create a delta for.");
+		}
+		const auto& checkpoint{*this->backup_checkpoint};
+
+		OUTCOME_TRY(conversation_delta, this->ratchet.exportDeltaProtobuf(arena, checkpoint.ratchet));
+		protobuf_optional_export(conversation_delta, sequence_number, checkpoint.sequence_number + 1);
+		const auto& base_hash{checkpoint.base_hash};
+		outcome_protobuf_optional_bytes_arena_export(arena, conversation_delta, base_hash, base_hash.size());
+
+		//export the conversation id
+		const auto& id{this->id_storage};
+		outcome_protobuf_bytes_arena_export(arena, conversation_delta->changes, id, CONVERSATION_ID_SIZE);
+
+		return conversation_delta;
+	}
+
+	void Conversation::advanceBackupCheckpoint() {
+		if (this->backup_checkpoint == nullptr) {
+			return;
+		}
+
+		this->ratchet.updateCheckpoint(this->backup_checkpoint->ratchet);
+		this->backup_checkpoint->sequence_number++;
+	}
+
+	std::unique_ptr<ConversationCheckpoint> Conversation::releaseBackupCheckpoint() noexcept {
+		return std::move(this->backup_checkpoint);
+	}
+
+	void Conversation::restoreBackupCheckpoint(std::unique_ptr<ConversationCheckpoint>&& checkpoint) noexcept {
+		this->backup_checkpoint = std::move(checkpoint);
+	}
+
+	result<void> export_backup_checkpoint(Arena& arena, ProtobufCConversation& conversation, const ConversationCheckpoint* checkpoint) {
+		if (checkpoint == nullptr) {
+			return outcome::success();
+		}
+
+		protobuf_arena_create(arena, ProtobufCConversationCheckpoint, conversation_checkpoint);
+		const auto& base_hash{checkpoint->base_hash};
+		outcome_protobuf_bytes_arena_export(arena, conversation_checkpoint, base_hash, base_hash.size());
+		conversation_checkpoint->sequence_number = checkpoint->sequence_number;
+		conversation.backup_checkpoint = conversation_checkpoint;
+
+		return outcome::success();
+	}
+
+	result<void> Conversation::applyDelta(const ProtobufCConversationDelta& delta) {
+		if (this->backup_checkpoint == nullptr) {
+			return Error(status_type::INCORRECT_DATA, "The full conversation backup the delta is based on hasn't been imported.");
+		}
+		const auto& checkpoint{*this->backup_checkpoint};
+
+		if ((delta.changes == nullptr) || !delta.has_sequence_number || !delta.has_base_hash) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "Incomplete conversation delta.");
+		}
+		OUTCOME_TRY(id, ConversationId::fromSpan({delta.changes->id}));
+		if (id != this->id_storage) {
+			return Error(status_type::INCORRECT_DATA, "The delta belongs to a different conversation.");
+		}
+		if (delta.base_hash.len != checkpoint.base_hash.size()) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The base hash of the delta has an incorrect size.");
+		}
+		OUTCOME_TRY(same_base, sodium_memcmp(checkpoint.base_hash, {uchar_to_byte(delta.base_hash.data), delta.base_hash.len}));
+		if (!same_base) {
+			return Error(status_type::INCORRECT_DATA, "The delta isn't based on the last imported conversation backup.");
+		}
+		if (delta.sequence_number != (checkpoint.sequence_number + 1)) {
+			return Error(status_type::INCORRECT_DATA, "Deltas have to be imported in sequence.");
+		}
+
+		OUTCOME_TRY(this->ratchet.applyDelta(delta));
+		this->state_version.bump();
+		this->advanceBackupCheckpoint();
+
+		return outcome::success();
+	}
+
 	std::ostream& Conversation::print(std::ostream& stream) const {
 		stream << "Conversation-ID:\n";
 		std::cout << this->id_storage << "\n";
@@ -287,6 +530,10 @@ namespace Molch {
 		packet{std::move(packet)},
 		conversation{std::move(conversation)}{}
 
+	PreparedSendConversation::PreparedSendConversation(const PrekeyMetadata& prekey_metadata, Conversation&& conversation) noexcept :
+		prekey_metadata{prekey_metadata},
+		conversation{std::move(conversation)} {}
+
 	ReceiveConversation::ReceiveConversation(Molch::Buffer &&message, Molch::Conversation &&conversation) noexcept :
 		message{std::move(message)},
 		conversation{std::move(conversation)} {}
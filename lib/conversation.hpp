@@ -22,12 +22,15 @@
 #ifndef LIB_CONVERSATION_H
 #define LIB_CONVERSATION_H
 
+#include <array>
 #include <ostream>
 
 #include "molch/constants.h"
+#include "backup-hash.hpp"
 #include "ratchet.hpp"
 #include "packet.hpp"
 #include "prekey-store.hpp"
+#include "state-version.hpp"
 
 namespace Molch {
 	struct ReceivedMessage {
@@ -36,18 +39,65 @@ namespace Molch {
 		Buffer message;
 	};
 
+	//! Like ReceivedMessage, but the message lives in a buffer provided by the caller.
+	struct ReceivedMessageSpan {
+		uint32_t message_number;
+		uint32_t previous_message_number;
+		span<std::byte> message;
+	};
+
 	struct SendConversation;
+	struct PreparedSendConversation;
 	struct ReceiveConversation;
 
+	/*
+	 * Where the chain of delta backups of a conversation currently stands.
+	 */
+	struct ConversationCheckpoint {
+		RatchetCheckpoint ratchet;
+		BackupHash base_hash{}; //hash of the full conversation backup the deltas are applied to
+		uint64_t sequence_number{0}; //of the last delta, 0 right after the full conversation backup
+		uint64_t backup_key_generation{0}; //deltas are only exported as long as the backup key stays the same
+	};
+
+	/*! Export where the chain of delta backups stands into a conversation for the state store.
+	 * Only the position in the chain is stored, that is enough to import the
+	 * following deltas. Exporting deltas starts with a full backup again.
+	 */
+	result<void> export_backup_checkpoint(Arena& arena, ProtobufCConversation& conversation, const ConversationCheckpoint* checkpoint);
+
+	/*
+	 * Nonces of the last few packets a conversation has received. Packets are
+	 * encrypted with random nonces, so a packet with the same nonces is a
+	 * retransmission of one that has already been decrypted.
+	 */
+	class ReceivedPackets {
+	private:
+		struct Nonces {
+			std::array<std::byte,HEADER_NONCE_SIZE> header;
+			std::array<std::byte,MESSAGE_NONCE_SIZE> message;
+		};
+
+		std::array<Nonces,32> packets{};
+		size_t count{0}; //number of packets ever added, the oldest one is overwritten
+
+	public:
+		bool contains(const PacketView& packet) const noexcept;
+		void add(const PacketView& packet) noexcept;
+	};
+
 	class Conversation {
 	private:
 		Conversation& move(Conversation&& conversation) noexcept;
 
-		result<ReceivedMessage> internal_receive(const span<const std::byte> packet);
-		result<ReceivedMessage> trySkippedHeaderAndMessageKeys(const span<const std::byte> packet);
+		result<ReceivedMessageSpan> internal_receive(const span<std::byte> message, const PacketView& packet);
+		result<ReceivedMessageSpan> trySkippedHeaderAndMessageKeys(const span<std::byte> message, const PacketView& packet);
 
 		ConversationId id_storage; //unique id of a conversation, generated randomly
 		Ratchet ratchet;
+		StateVersion state_version;
+		std::unique_ptr<ConversationCheckpoint> backup_checkpoint;
+		ReceivedPackets received_packets; //not part of backups, only a shortcut for retransmissions
 
 		Conversation(uninitialized_t uninitialized) noexcept;
 
@@ -63,12 +113,23 @@ namespace Molch {
 				const PublicKey& our_public_ephemeral,
 				const PublicKey& their_public_ephemeral);
 
+		/*
+		 * Do the key agreement of a new conversation where we are the sender,
+		 * without sending anything yet. The first message has to be sent with
+		 * the returned prekey metadata.
+		 */
+		static result<PreparedSendConversation> prepareSendConversation(
+				const PublicKey& sender_public_identity,
+				const PrivateKey& sender_private_identity,
+				const PublicKey& receiver_public_identity,
+				const span<const std::byte> receiver_prekey_list); //multiple of PUBLIC_KEY_SIZE
+
 		static result<SendConversation> createSendConversation(
 				const span<const std::byte> message, //message we want to send to the receiver
 				const PublicKey& sender_public_identity, //who is sending this message?
 				const PrivateKey& sender_private_identity,
 				const PublicKey& receiver_public_identity,
-				const span<const std::byte> receiver_prekey_list); //PREKEY_AMOUNT * PUBLIC_KEY_SIZE
+				const span<const std::byte> receiver_prekey_list); //multiple of PUBLIC_KEY_SIZE
 
 		/*
 		 * Start a new conversation where we are the receiver.
@@ -89,6 +150,18 @@ namespace Molch {
 		 */
 		static result<Conversation> import(const ProtobufCConversation& conversation_protobuf);
 
+		/*! Import a conversation from the state store, including its backup checkpoint.
+		 * The checkpoint can only be used to import deltas, not to export them.
+		 */
+		static result<Conversation> importWithCheckpoint(const ProtobufCConversation& conversation_protobuf);
+
+		/*! Import a conversation from a fixed layout snapshot.
+		 * \param snapshot A snapshot written by exportSnapshot.
+		 *
+		 * \return The imported conversation
+		 */
+		static result<Conversation> importSnapshot(const span<const std::byte> snapshot);
+
 		Conversation(Conversation&& conversation) noexcept;
 		Conversation(const Conversation& conversation) = delete;
 
@@ -97,6 +170,9 @@ namespace Molch {
 
 		const ConversationId& id() const;
 
+		//! Changes whenever sending or receiving changes the state of the conversation.
+		const StateVersion& version() const noexcept;
+
 		/*
 		 * Send a message using an existing conversation.
 		 *
@@ -106,18 +182,100 @@ namespace Molch {
 		 */
 		result<Buffer> send(const span<const std::byte> message, const std::optional<PrekeyMetadata>& prekey_metadata);
 
+		/*
+		 * Send a message using an existing conversation into a buffer provided
+		 * by the caller. This doesn't allocate any memory.
+		 *
+		 * \param packet The output buffer, needs to be at least packetSize() long.
+		 * \param message The message to send.
+		 * \param prekey_metadata Prekey metadata in case of prekey messages
+		 * \return The part of the output buffer that contains the packet.
+		 */
+		result<span<std::byte>> send(const span<std::byte> packet, const span<const std::byte> message, const std::optional<PrekeyMetadata>& prekey_metadata);
+
+		/*
+		 * Size of the packet that send() creates for a message.
+		 *
+		 * \param message_size The length of the message to send.
+		 * \param packet_type The type of packet (prekey or normal message).
+		 * \return The exact size of the packet.
+		 */
+		static size_t packetSize(const size_t message_size, const molch_message_type packet_type) noexcept;
+
 		/*
 		 * Receive and decrypt a message using an existing conversation.
 		 *
+		 * A packet that is one of the last 32 packets received in this conversation
+		 * fails with DUPLICATE_MESSAGE without decrypting anything or changing the state.
+		 *
 		 * \return The message that has been decrypted.
 		 */
 		result<ReceivedMessage> receive(const span<const std::byte> packet);
 
+		/*
+		 * Receive and decrypt a message using an existing conversation into a
+		 * buffer provided by the caller. This doesn't allocate any memory.
+		 *
+		 * \param message The output buffer, a buffer as long as the packet is always sufficient.
+		 * \param packet The packet to decrypt.
+		 * \return The message that has been decrypted, pointing into the output buffer.
+		 */
+		result<ReceivedMessageSpan> receive(const span<std::byte> message, const span<const std::byte> packet);
+
 		/*! Export a conversation to a Protobuf-C struct.
 		 * \return exported_conversation The exported conversation protobuf-c struct.
 		 */
 		result<ProtobufCConversation*> exportProtobuf(Arena& arena) const;
 
+		/*! Export a conversation together with its backup checkpoint.
+		 * This is only for the state store, backups never contain the checkpoint.
+		 */
+		result<ProtobufCConversation*> exportProtobufWithCheckpoint(Arena& arena) const;
+
+		//! Upper bound of the size of a snapshot of this conversation.
+		size_t maximumSnapshotSize() const noexcept;
+
+		/*! Export a conversation to a fixed layout snapshot, the id followed by the ratchet.
+		 * \param snapshot Buffer of at least maximumSnapshotSize() bytes.
+		 * \return The number of bytes written.
+		 */
+		result<size_t> exportSnapshot(const span<std::byte> snapshot) const;
+
+		/*
+		 * Start a new chain of delta backups after a full backup of this
+		 * conversation has been exported or imported.
+		 *
+		 * \param base_hash Hash of the encrypted full conversation backup.
+		 * \param backup_key_generation Changes every time the backup key changes.
+		 */
+		void setBackupCheckpoint(const BackupHash& base_hash, const uint64_t backup_key_generation);
+
+		/*
+		 * Check if there is a checkpoint to export deltas from that has
+		 * been created with the current backup key.
+		 */
+		bool hasBackupCheckpoint(const uint64_t backup_key_generation) const noexcept;
+
+		/*! Export what has changed since the last backup of this conversation.
+		 * Call advanceBackupCheckpoint() once the delta has been exported successfully.
+		 * \return The next delta in the chain.
+		 */
+		result<ProtobufCConversationDelta*> exportDeltaProtobuf(Arena& arena) const;
+
+		void advanceBackupCheckpoint();
+
+		/*
+		 * Hand the checkpoint over to keep it while the conversation is
+		 * evicted and give it back once the conversation is hydrated again.
+		 */
+		std::unique_ptr<ConversationCheckpoint> releaseBackupCheckpoint() noexcept;
+		void restoreBackupCheckpoint(std::unique_ptr<ConversationCheckpoint>&& checkpoint) noexcept;
+
+		/*! Apply a delta on top of the current state.
+		 * \param delta The next delta after the last full conversation backup or delta that has been imported.
+		 */
+		result<void> applyDelta(const ProtobufCConversationDelta& delta);
+
 		std::ostream& print(std::ostream& stream) const;
 	};
 
@@ -128,6 +286,13 @@ namespace Molch {
 		SendConversation(Buffer&& packet, Conversation&& conversation) noexcept;
 	};
 
+	struct PreparedSendConversation {
+		PrekeyMetadata prekey_metadata;
+		Conversation conversation;
+
+		PreparedSendConversation(const PrekeyMetadata& prekey_metadata, Conversation&& conversation) noexcept;
+	};
+
 	struct ReceiveConversation {
 		Buffer message;
 		Conversation conversation;
@@ -24,11 +24,13 @@
 #ifndef LIB_DESTROYERS_H
 #define LIB_DESTROYERS_H
 
+#include "malloc.hpp"
+
 namespace Molch {
 	template <typename T>
 	inline void free_and_null_if_valid(T*& pointer) {
 		if (pointer != nullptr) {
-			free(pointer);
+			output_free(pointer);
 			pointer = nullptr;
 		}
 	}
@@ -0,0 +1,159 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "dormant-conversation.hpp"
+#include "gsl.hpp"
+#include "sodium-wrappers.hpp"
+
+namespace Molch {
+	result<DormantConversation> DormantConversation::create(
+			const ConversationId& id,
+			const span<const std::byte> nonce,
+			const span<const std::byte> encrypted_conversation,
+			std::shared_ptr<const BackupKey> backup_key) {
+		if ((nonce.size() != BACKUP_NONCE_SIZE) || (encrypted_conversation.size() < crypto_secretbox_MACBYTES) || (backup_key == nullptr)) {
+			return Error(status_type::INVALID_VALUE, "Invalid input to DormantConversation::create.");
+		}
+
+		DormantConversation conversation;
+		conversation.id_storage = id;
+		conversation.nonce = Buffer{nonce.size(), 0};
+		OUTCOME_TRY(conversation.nonce.cloneFromRaw(nonce));
+		conversation.encrypted_conversation = Buffer{encrypted_conversation.size(), 0};
+		OUTCOME_TRY(conversation.encrypted_conversation.cloneFromRaw(encrypted_conversation));
+		conversation.backup_key = std::move(backup_key);
+
+		return conversation;
+	}
+
+	result<DormantConversation> DormantConversation::evict(Conversation&& conversation, std::shared_ptr<const BackupKey> paging_key) {
+		if (paging_key == nullptr) {
+			return Error(status_type::INVALID_VALUE, "Invalid input to DormantConversation::evict.");
+		}
+
+		Arena arena;
+		const auto maximum_size{conversation.maximumSnapshotSize()};
+		auto conversation_buffer_content{arena.allocate<std::byte>(maximum_size)};
+		OUTCOME_TRY(conversation_size, conversation.exportSnapshot({conversation_buffer_content, maximum_size}));
+		span<std::byte> conversation_buffer{conversation_buffer_content, conversation_size};
+
+		DormantConversation dormant_conversation;
+		dormant_conversation.id_storage = conversation.id();
+		dormant_conversation.encoding = Encoding::SNAPSHOT;
+		//the content doesn't change, so neither backups nor the state store need to write it again
+		dormant_conversation.state_version = conversation.version();
+		dormant_conversation.nonce = Buffer{BACKUP_NONCE_SIZE, BACKUP_NONCE_SIZE};
+		randombytes_buf(dormant_conversation.nonce);
+		dormant_conversation.encrypted_conversation = Buffer{conversation_size + crypto_secretbox_MACBYTES, conversation_size + crypto_secretbox_MACBYTES};
+		const auto status{crypto_secretbox_easy(dormant_conversation.encrypted_conversation, conversation_buffer, dormant_conversation.nonce, *paging_key)};
+		sodium_memzero(conversation_buffer);
+		OUTCOME_TRY(status);
+		dormant_conversation.backup_key = std::move(paging_key);
+		dormant_conversation.backup_checkpoint = conversation.releaseBackupCheckpoint();
+
+		return dormant_conversation;
+	}
+
+	const ConversationId& DormantConversation::id() const noexcept {
+		return this->id_storage;
+	}
+
+	const StateVersion& DormantConversation::version() const noexcept {
+		return this->state_version;
+	}
+
+	result<span<std::byte>> DormantConversation::decrypt(Arena& arena) const {
+		const auto decrypted_size{this->encrypted_conversation.size() - crypto_secretbox_MACBYTES};
+		auto decrypted_content{arena.allocate<std::byte>(decrypted_size)};
+		span<std::byte> decrypted_conversation{decrypted_content, decrypted_size};
+		OUTCOME_TRY(crypto_secretbox_open_easy(decrypted_conversation, this->encrypted_conversation, this->nonce, *this->backup_key));
+
+		return decrypted_conversation;
+	}
+
+	result<ProtobufCConversation*> DormantConversation::exportProtobuf(Arena& arena) const {
+		if (this->encoding == Encoding::SNAPSHOT) {
+			OUTCOME_TRY(conversation, this->import());
+			return conversation.exportProtobuf(arena);
+		}
+
+		OUTCOME_TRY(decrypted_conversation, this->decrypt(arena));
+		auto arena_protoc_allocator{arena.getProtobufCAllocator()};
+		auto conversation{molch__protobuf__conversation__unpack(&arena_protoc_allocator, decrypted_conversation.size(), byte_to_uchar(decrypted_conversation.data()))};
+		if (conversation == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack dormant conversation.");
+		}
+
+		return conversation;
+	}
+
+	result<ProtobufCConversation*> DormantConversation::exportProtobufWithCheckpoint(Arena& arena) const {
+		OUTCOME_TRY(conversation, this->exportProtobuf(arena));
+		OUTCOME_TRY(export_backup_checkpoint(arena, *conversation, this->backup_checkpoint.get()));
+
+		return conversation;
+	}
+
+	result<Conversation> DormantConversation::import() const {
+		Arena arena;
+		auto imported_conversation{[&]() -> result<Conversation> {
+			if (this->encoding == Encoding::PROTOBUF) {
+				OUTCOME_TRY(conversation_struct, this->exportProtobuf(arena));
+				return Conversation::import(*conversation_struct);
+			}
+
+			OUTCOME_TRY(snapshot, this->decrypt(arena));
+			auto conversation{Conversation::importSnapshot(snapshot)};
+			sodium_memzero(snapshot);
+			return conversation;
+		}()};
+		OUTCOME_TRY(conversation, std::move(imported_conversation));
+		if (conversation.id() != this->id_storage) {
+			return Error(status_type::INCORRECT_DATA, "Dormant conversation has a different id than listed in the backup.");
+		}
+
+		return std::move(conversation);
+	}
+
+	result<void> DormantConversation::setBackupCheckpoint(const BackupHash& base_hash, const uint64_t backup_key_generation) {
+		//the checkpoint is a copy of the ratchet, so it needs the decrypted conversation once
+		OUTCOME_TRY(conversation, this->import());
+		conversation.setBackupCheckpoint(base_hash, backup_key_generation);
+		this->backup_checkpoint = conversation.releaseBackupCheckpoint();
+
+		return outcome::success();
+	}
+
+	result<Conversation> DormantConversation::hydrate() {
+		OUTCOME_TRY(conversation, this->import());
+		conversation.restoreBackupCheckpoint(std::move(this->backup_checkpoint));
+
+		return std::move(conversation);
+	}
+
+	result<std::shared_ptr<const BackupKey>> share_backup_key(const span<const std::byte> backup_key) {
+		OUTCOME_TRY(key, BackupKey::fromSpan(backup_key));
+		std::shared_ptr<BackupKey> shared_key(sodium_malloc<BackupKey>(1), SodiumDeleter<BackupKey>());
+		new (shared_key.get()) BackupKey(key);
+
+		return std::shared_ptr<const BackupKey>(std::move(shared_key));
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_DORMANT_CONVERSATION_H
+#define LIB_DORMANT_CONVERSATION_H
+
+#include <memory>
+
+#include "buffer.hpp"
+#include "conversation.hpp"
+#include "key.hpp"
+#include "protobuf.hpp"
+#include "protobuf-arena.hpp"
+#include "state-version.hpp"
+
+namespace Molch {
+	/*
+	 * A conversation that has been imported lazily from a segmented backup
+	 * or that has been evicted from its ConversationStore. It stays encrypted
+	 * until it is used the next time, so idle conversations don't need a RatchetStorage.
+	 */
+	class DormantConversation {
+	private:
+		//backup segments are Protobuf-C, evicted conversations are snapshots (see snapshot.hpp)
+		enum class Encoding : bool {
+			PROTOBUF,
+			SNAPSHOT
+		};
+
+		ConversationId id_storage;
+		Encoding encoding{Encoding::PROTOBUF};
+		Buffer nonce;
+		Buffer encrypted_conversation;
+		std::shared_ptr<const BackupKey> backup_key;
+		StateVersion state_version;
+		//taken from an evicted conversation, so deltas can continue where they left off
+		std::unique_ptr<ConversationCheckpoint> backup_checkpoint;
+
+		DormantConversation() = default;
+
+		result<span<std::byte>> decrypt(Arena& arena) const;
+		result<Conversation> import() const;
+
+	public:
+		/*! Keep an encrypted conversation segment around.
+		 * \param id The id of the conversation, taken from the backup manifest.
+		 * \param nonce The nonce of the segment.
+		 * \param encrypted_conversation The encrypted conversation segment, has to be authenticated already.
+		 * \param backup_key The key the segment has been encrypted with.
+		 */
+		static result<DormantConversation> create(
+				const ConversationId& id,
+				const span<const std::byte> nonce,
+				const span<const std::byte> encrypted_conversation,
+				std::shared_ptr<const BackupKey> backup_key);
+
+		/*! Encrypt a conversation that isn't resident anymore.
+		 * \param conversation The conversation to encrypt, its backup checkpoint is taken over on success.
+		 * \param paging_key Key that only lives in memory, used instead of a backup key.
+		 */
+		static result<DormantConversation> evict(Conversation&& conversation, std::shared_ptr<const BackupKey> paging_key);
+
+		const ConversationId& id() const noexcept;
+		const StateVersion& version() const noexcept;
+
+		//! Decrypt and unpack the conversation without importing it.
+		result<ProtobufCConversation*> exportProtobuf(Arena& arena) const;
+		//! Like exportProtobuf, but with the backup checkpoint for the state store.
+		result<ProtobufCConversation*> exportProtobufWithCheckpoint(Arena& arena) const;
+
+		/*
+		 * Start a new chain of delta backups after a full backup of this
+		 * conversation has been exported, without hydrating it.
+		 */
+		result<void> setBackupCheckpoint(const BackupHash& base_hash, const uint64_t backup_key_generation);
+
+		/*! Decrypt and import the conversation.
+		 * The backup checkpoint is handed over to the conversation, so the
+		 * dormant conversation has to be discarded afterwards.
+		 */
+		result<Conversation> hydrate();
+	};
+
+	//! Copy a backup key into sodium_malloced memory that can be shared by dormant conversations.
+	result<std::shared_ptr<const BackupKey>> share_backup_key(const span<const std::byte> backup_key);
+}
+
+#endif /* LIB_DORMANT_CONVERSATION_H */
@@ -20,6 +20,7 @@
  */
 
 #include <algorithm>
+#include <vector>
 
 #include "molch/constants.h"
 #include "header-and-message-keystore.hpp"
@@ -27,6 +28,10 @@
 
 namespace Molch {
 	constexpr auto expiration_time{1_months};
+	//header key index of keys without a header key in a snapshot
+	constexpr uint16_t snapshot_no_header_key{0xFFFF};
+	//header key index, message key and expiration date
+	constexpr size_t snapshot_key_size{sizeof(uint16_t) + MESSAGE_KEY_SIZE + sizeof(int64_t)};
 
 	HeaderAndMessageKey::HeaderAndMessageKey([[maybe_unused]] uninitialized_t uninitialized) noexcept {}
 
@@ -138,21 +143,23 @@ namespace Molch {
 		return stream;
 	}
 
-	static bool compareHeaderAndMessageKeyExpirationDates(const HeaderAndMessageKey& a, const HeaderAndMessageKey& b) {
-		return a.expirationDate() < b.expirationDate();
-	}
-
 	void HeaderAndMessageKeyStore::add(const HeaderAndMessageKeyStore& keystore) {
-		decltype(this->key_storage) merged;
-		merged.resize(this->key_storage.size() + keystore.key_storage.size(), HeaderAndMessageKey(uninitialized));
+		//common shortpath, nothing was skipped
+		if (keystore.key_storage.empty()) {
+			return;
+		}
+
+		if (&keystore == this) {
+			const auto copy{keystore};
+			this->add(copy);
+			return;
+		}
 
-		std::merge(
-				std::cbegin(this->key_storage), std::cend(this->key_storage),
-				std::cbegin(keystore.key_storage), std::cend(keystore.key_storage),
-				std::begin(merged),
-				compareHeaderAndMessageKeyExpirationDates);
+		//both stores are sorted, so this is appending in the common case
+		for (const auto& key : keystore.key_storage) {
+			this->add(key);
+		}
 
-		this->key_storage = std::move(merged);
 		this->removeOutdatedAndTrimSize();
 	}
 
@@ -168,59 +175,63 @@ namespace Molch {
 		}
 
 		if (this->key_storage.size() == header_and_message_store_maximum_keys) {
+			if (key.expirationDate() < this->key_storage.front().expirationDate()) {
+				//older than everything that is kept anyway
+				return;
+			}
+
 			//remove the oldest key
-			this->key_storage.erase(std::begin(this->key_storage));
+			this->key_storage.pop_front();
 		}
 
+		this->state_version.bump();
+
 		//common shortpath
 		if (this->key_storage.empty() || (this->key_storage.back().expirationDate() <= key.expirationDate())) {
 			this->key_storage.push_back(key);
-		} else {
-			//find the position to insert at
-			auto bound{std::upper_bound(
-					std::cbegin(this->key_storage),
-					std::cend(this->key_storage),
-					key,
-					compareHeaderAndMessageKeyExpirationDates)};
-
-			this->key_storage.insert(bound, key);
+			return;
+		}
+
+		//find the position to insert at
+		size_t index{this->key_storage.size()};
+		while ((index > 0) && (key.expirationDate() < this->key_storage[index - 1].expirationDate())) {
+			index--;
 		}
+		this->key_storage.insert(index, key);
 	}
 
 	void HeaderAndMessageKeyStore::remove(size_t index) {
-		this->key_storage.erase(std::begin(this->key_storage) + gsl::narrow<ptrdiff_t>(index));
+		this->key_storage.erase(index);
+		this->state_version.bump();
 	}
 
 	void HeaderAndMessageKeyStore::clear() {
+		if (this->key_storage.empty()) {
+			return;
+		}
+
 		this->key_storage.clear();
+		this->state_version.bump();
 	}
 
 	void HeaderAndMessageKeyStore::removeOutdatedAndTrimSize() {
-		//find the first non-outdated element
-		auto outdated{now() - header_and_message_store_maximum_age};
-		auto first_not_outdated{std::cbegin(this->key_storage)};
-		for (; (first_not_outdated != std::cend(this->key_storage))
-				&& ((first_not_outdated->expirationDate() <= outdated));
-				++first_not_outdated) {}
-
-		//if there are too many keys, get rid of them as well
-		auto keys_left{gsl::narrow<size_t>(std::cend(this->key_storage) - first_not_outdated)};
-		if (keys_left > header_and_message_store_maximum_keys) {
-			first_not_outdated += gsl::narrow_cast<ptrdiff_t>(keys_left - header_and_message_store_maximum_keys);
-		}
-
-		if (first_not_outdated == std::cbegin(this->key_storage)) {
-			//nothing outdated
-			return;
+		const auto outdated{now() - header_and_message_store_maximum_age};
+		while (!this->key_storage.empty()
+				&& ((this->key_storage.front().expirationDate() <= outdated)
+					|| (this->key_storage.size() > header_and_message_store_maximum_keys))) {
+			this->key_storage.pop_front();
+			this->state_version.bump();
 		}
-
-		this->key_storage.erase(std::cbegin(this->key_storage), first_not_outdated);
 	}
 
-	const std::vector<HeaderAndMessageKey,SodiumAllocator<HeaderAndMessageKey>>& HeaderAndMessageKeyStore::keys() const noexcept {
+	const HeaderAndMessageKeyStore::KeyStorage& HeaderAndMessageKeyStore::keys() const noexcept {
 		return this->key_storage;
 	}
 
+	const StateVersion& HeaderAndMessageKeyStore::version() const noexcept {
+		return this->state_version;
+	}
+
 	result<span<ProtobufCKeyBundle*>> HeaderAndMessageKeyStore::exportProtobuf(Arena& arena) const {
 		if (this->key_storage.empty()) {
 			return {nullptr, static_cast<size_t>(0)};
@@ -246,7 +257,89 @@ namespace Molch {
 			}
 
 			OUTCOME_TRY(imported_keypair, HeaderAndMessageKey::import(*key_bundle));
-			store.key_storage.emplace_back(imported_keypair);
+			store.key_storage.push_back(imported_keypair);
+		}
+
+		return store;
+	}
+
+	size_t HeaderAndMessageKeyStore::maximumSnapshotSize() const noexcept {
+		//worst case is a distinct header key for every key
+		return (2 * sizeof(uint16_t)) + (this->key_storage.size() * (HEADER_KEY_SIZE + snapshot_key_size));
+	}
+
+	result<void> HeaderAndMessageKeyStore::exportSnapshot(SnapshotWriter& writer) const {
+		//all keys skipped in one chain share their header key
+		std::vector<const EmptyableHeaderKey*> header_keys;
+		std::vector<uint16_t> header_key_indices;
+		header_key_indices.reserve(this->key_storage.size());
+		for (const auto& key : this->key_storage) {
+			if (key.headerKey().empty) {
+				header_key_indices.push_back(snapshot_no_header_key);
+				continue;
+			}
+
+			//keys are sorted by expiration date, so the same chain is usually the most recent one
+			const auto found{std::find_if(
+					std::crbegin(header_keys),
+					std::crend(header_keys),
+					[&key](const EmptyableHeaderKey *header_key) {
+						return *header_key == key.headerKey();
+					})};
+			if (found == std::crend(header_keys)) {
+				header_keys.push_back(&key.headerKey());
+				header_key_indices.push_back(gsl::narrow<uint16_t>(header_keys.size() - 1));
+			} else {
+				header_key_indices.push_back(gsl::narrow<uint16_t>(std::crend(header_keys) - found - 1));
+			}
+		}
+
+		OUTCOME_TRY(writer.writeInteger(gsl::narrow<uint16_t>(header_keys.size())));
+		for (const auto header_key : header_keys) {
+			OUTCOME_TRY(writer.write(*header_key));
+		}
+
+		OUTCOME_TRY(writer.writeInteger(gsl::narrow<uint16_t>(this->key_storage.size())));
+		size_t index{0};
+		for (const auto& key : this->key_storage) {
+			OUTCOME_TRY(writer.writeInteger(header_key_indices[index]));
+			OUTCOME_TRY(writer.write(key.messageKey()));
+			OUTCOME_TRY(writer.writeInteger(gsl::narrow<int64_t>(key.expirationDate().count())));
+			index++;
+		}
+
+		return outcome::success();
+	}
+
+	result<HeaderAndMessageKeyStore> HeaderAndMessageKeyStore::importSnapshot(SnapshotReader& reader) {
+		OUTCOME_TRY(header_key_count, reader.readInteger<uint16_t>());
+		std::vector<EmptyableHeaderKey> header_keys(header_key_count);
+		for (auto& header_key : header_keys) {
+			OUTCOME_TRY(reader.read(header_key));
+			header_key.empty = false;
+		}
+
+		OUTCOME_TRY(key_count, reader.readInteger<uint16_t>());
+		if (key_count > header_and_message_store_maximum_keys) {
+			return Error(status_type::INCORRECT_DATA, "Snapshot contains too many keys.");
+		}
+
+		HeaderAndMessageKeyStore store;
+		for (size_t index{0}; index < key_count; index++) {
+			OUTCOME_TRY(header_key_index, reader.readInteger<uint16_t>());
+			MessageKey message_key;
+			OUTCOME_TRY(reader.read(message_key));
+			OUTCOME_TRY(expiration_date, reader.readInteger<int64_t>());
+
+			if (header_key_index == snapshot_no_header_key) {
+				store.key_storage.push_back({EmptyableHeaderKey(), message_key, seconds{expiration_date}});
+				continue;
+			}
+
+			if (header_key_index >= header_keys.size()) {
+				return Error(status_type::INCORRECT_DATA, "Snapshot references a nonexistent header key.");
+			}
+			store.key_storage.push_back({header_keys[header_key_index], message_key, seconds{expiration_date}});
 		}
 
 		return store;
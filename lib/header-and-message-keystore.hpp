@@ -23,16 +23,18 @@
 #define LIB_HEADER_AND_MESSAGE_KEY_STORE_H
 
 #include <sodium.h>
-#include <vector>
 #include <ostream>
 
 #include "molch/constants.h"
 #include "buffer.hpp"
 #include "return-status.hpp"
+#include "snapshot.hpp"
 #include "sodium-wrappers.hpp"
 #include "protobuf.hpp"
 #include "key.hpp"
 #include "time.hpp"
+#include "ring-buffer.hpp"
+#include "state-version.hpp"
 
 namespace Molch {
 	class HeaderAndMessageKey {
@@ -74,9 +76,14 @@ namespace Molch {
 
 	//header of the key store
 	class HeaderAndMessageKeyStore {
+	public:
+		using KeyStorage = RingBuffer<HeaderAndMessageKey,SodiumAllocator<HeaderAndMessageKey>>;
+
 	private:
-		//Vector of Header and message keys, sorted in ascending order by expiration date
-		std::vector<HeaderAndMessageKey,SodiumAllocator<HeaderAndMessageKey>> key_storage;
+		//Ring of header and message keys, sorted in ascending order by expiration date,
+		//so the oldest key can be evicted and new keys appended in O(1)
+		KeyStorage key_storage;
+		StateVersion state_version;
 
 	public:
 		HeaderAndMessageKeyStore() = default;
@@ -94,10 +101,23 @@ namespace Molch {
 
 		void removeOutdatedAndTrimSize();
 
-		const std::vector<HeaderAndMessageKey,SodiumAllocator<HeaderAndMessageKey>>& keys() const noexcept;
+		const KeyStorage& keys() const noexcept;
+
+		//! Changes whenever keys are added or removed.
+		const StateVersion& version() const noexcept;
 
 		//! Export a header_and_message_keystore as Protobuf-C struct.
 		result<span<ProtobufCKeyBundle*>> exportProtobuf(Arena& arena) const;
+
+		//! Upper bound of the size of a snapshot of the keystore.
+		size_t maximumSnapshotSize() const noexcept;
+		//! Append the keys to a fixed layout snapshot, see snapshot.hpp.
+		/*
+		 * Every distinct header key is only written once and referenced by index.
+		 */
+		result<void> exportSnapshot(SnapshotWriter& writer) const;
+		//! Import a keystore written by exportSnapshot.
+		static result<HeaderAndMessageKeyStore> importSnapshot(SnapshotReader& reader);
 	};
 
 	std::ostream& operator<<(std::ostream& stream, const HeaderAndMessageKeyStore& keystore);
@@ -29,6 +29,21 @@ namespace Molch {
 			const PublicKey& our_public_ephemeral, //PUBLIC_KEY_SIZE
 			const uint32_t message_number,
 			const uint32_t previous_message_number) {
+		Buffer header{header_size, header_size};
+		OUTCOME_TRY(header_construct(header, our_public_ephemeral, message_number, previous_message_number));
+
+		return header;
+	}
+
+	result<void> header_construct(
+			//output
+			const span<std::byte> header,
+			//inputs
+			const PublicKey& our_public_ephemeral, //PUBLIC_KEY_SIZE
+			const uint32_t message_number,
+			const uint32_t previous_message_number) {
+		FulfillOrFail(header.size() == header_size);
+
 		ProtobufCHeader header_struct;
 		molch__protobuf__header__init(&header_struct);
 
@@ -45,23 +60,24 @@ namespace Molch {
 		header_struct.public_ephemeral_key = protobuf_our_public_ephemeral;
 		header_struct.has_public_ephemeral_key = true;
 
-		//allocate the header buffer
-		auto header_length{molch__protobuf__header__get_packed_size(&header_struct)};
-		Buffer header{header_length, header_length};
+		if (molch__protobuf__header__get_packed_size(&header_struct) != header_size) {
+			return Error(status_type::PROTOBUF_PACK_ERROR, "Header has an unexpected packed length.");
+		}
 
 		//pack it
 		auto packed_length{molch__protobuf__header__pack(&header_struct, byte_to_uchar(header.data()))};
-		if (packed_length != header_length) {
+		if (packed_length != header_size) {
 			return Error(status_type::PROTOBUF_PACK_ERROR, "Packed header has incorrect length.");
 		}
 
-		return header;
+		return outcome::success();
 	}
 
 	result<ExtractedHeader> header_extract(const span<const std::byte> header) {
-		//unpack the message
-		auto header_struct{std::unique_ptr<ProtobufCHeader,HeaderDeleter>(molch__protobuf__header__unpack(&protobuf_c_allocator, header.size(), byte_to_uchar(header.data())))};
-		if (!header_struct) {
+		//unpack the message, the struct lives in the allocator, so it doesn't need to be freed
+		FixedProtobufCAllocator<256> allocator;
+		const auto header_struct{molch__protobuf__header__unpack(allocator.get(), header.size(), byte_to_uchar(header.data()))};
+		if (header_struct == nullptr) {
 			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
 		}
 
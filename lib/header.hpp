@@ -32,6 +32,7 @@
 
 #include <memory>
 
+#include "molch/constants.h"
 #include "buffer.hpp"
 #include "return-status.hpp"
 #include "key.hpp"
@@ -39,6 +40,12 @@
 #include "result.hpp"
 
 namespace Molch {
+	/*!
+	 * Size of a packed Axolotl-Header. All of its fields have a fixed length:
+	 * the public ephemeral (tag, length, key) and two fixed32 message numbers (tag, value).
+	 */
+	constexpr size_t header_size{(2 + PUBLIC_KEY_SIZE) + (1 + sizeof(uint32_t)) + (1 + sizeof(uint32_t))};
+
 	/*!
 	 * Constructs an Axolotl-Header into a buffer.
 	 *
@@ -57,6 +64,24 @@ namespace Molch {
 			const uint32_t message_number,
 			const uint32_t previous_message_number);
 
+	/*!
+	 * Constructs an Axolotl-Header into an existing buffer.
+	 *
+	 * \param header
+	 *   The output, length has to be header_size.
+	 * \param our_public_ephemeral
+	 *   The public ephemeral key of the sender (ours). Length has to be PUBLIC_KEY_SIZE.
+	 * \param message_number
+	 *   The number of the message in the current message chain.
+	 * \param previous_message_number
+	 *   The number of messages in the previous message chain.
+	 */
+	result<void> header_construct(
+			const span<std::byte> header,
+			const PublicKey& our_public_ephemeral, //PUBLIC_KEY_SIZE
+			const uint32_t message_number,
+			const uint32_t previous_message_number);
+
 
 	struct ExtractedHeader {
 		PublicKey their_public_ephemeral;
@@ -0,0 +1,56 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdlib>
+
+#include "malloc.hpp"
+
+namespace Molch {
+	static void *default_allocate(void *allocator_data, size_t size) {
+		(void)allocator_data;
+		return malloc(size); //NOLINT
+	}
+
+	static void default_deallocate(void *allocator_data, void *pointer) {
+		(void)allocator_data;
+		free(pointer); //NOLINT
+	}
+
+	OutputAllocator output_allocator{
+		&default_allocate,
+		&default_deallocate,
+		nullptr
+	};
+
+	void reset_output_allocator() noexcept {
+		output_allocator.allocate = &default_allocate;
+		output_allocator.deallocate = &default_deallocate;
+		output_allocator.allocator_data = nullptr;
+	}
+
+	void output_free(void *pointer) noexcept {
+		if (pointer == nullptr) {
+			return;
+		}
+
+		output_allocator.deallocate(output_allocator.allocator_data, pointer);
+	}
+}
@@ -23,16 +23,46 @@
 #define LIB_MALLOC_HPP
 
 #include <memory>
+#include <limits>
+#include <cstring>
 
 namespace Molch {
+	/*!
+	 * Allocator for all the memory that is handed out to the user of the library.
+	 * Defaults to malloc and free, can be replaced with molch_set_allocator.
+	 */
+	struct OutputAllocator {
+		void *(*allocate)(void *allocator_data, size_t size);
+		void (*deallocate)(void *allocator_data, void *pointer);
+		void *allocator_data;
+	};
+
+	extern OutputAllocator output_allocator;
+
+	/*!
+	 * Reset the output allocator to malloc and free.
+	 */
+	void reset_output_allocator() noexcept;
+
+	/*!
+	 * Free memory that was allocated by throwing_malloc.
+	 */
+	void output_free(void *pointer) noexcept;
+
 	template <typename T>
 	T *throwing_malloc(size_t elements) {
-		auto pointer = reinterpret_cast<T*>(calloc(elements, sizeof(T)));
+		if (elements > (std::numeric_limits<size_t>::max() / sizeof(T))) {
+			throw std::bad_alloc();
+		}
+
+		const auto size{elements * sizeof(T)};
+		auto pointer = output_allocator.allocate(output_allocator.allocator_data, size);
 		if (pointer == nullptr) {
 			throw std::bad_alloc();
 		}
+		std::memset(pointer, 0, size);
 
-		return pointer;
+		return static_cast<T*>(pointer);
 	}
 
 	template <typename T>
@@ -51,7 +81,7 @@ namespace Molch {
 
 		void deallocate(T* pointer, size_t elements) noexcept {
 			(void)elements;
-			free(pointer);
+			output_free(pointer);
 		}
 	};
 	template <typename T, typename U>
@@ -67,9 +97,7 @@ namespace Molch {
 	class MallocDeleter {
 	public:
 		void operator()(T* object) {
-			if (object != nullptr) {
-				free(object);
-			}
+			output_free(object);
 		}
 	};
 }
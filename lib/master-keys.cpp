@@ -33,6 +33,7 @@ namespace Molch {
 	MasterKeys& MasterKeys::move(MasterKeys&& master_keys) noexcept {
 		//move the private keys
 		this->private_keys = std::move(master_keys.private_keys);
+		this->private_keys_access = master_keys.private_keys_access;
 		this->private_identity_key = master_keys.private_identity_key;
 		this->private_signing_key = master_keys.private_signing_key;
 
@@ -202,16 +203,22 @@ namespace Molch {
 
 	void MasterKeys::lock() const noexcept {
 		if (this->private_keys) {
-			sodium_mprotect_noaccess(this->private_keys.get());
+			protect_noaccess(this->private_keys.get(), this->private_keys_access);
+		}
+	}
+
+	void MasterKeys::forceLock() const noexcept {
+		if (this->private_keys) {
+			force_noaccess(this->private_keys.get(), this->private_keys_access);
 		}
 	}
 
 	void MasterKeys::unlock() const noexcept {
-		sodium_mprotect_readonly(this->private_keys.get());
+		protect_readonly(this->private_keys.get(), this->private_keys_access);
 	}
 
 	void MasterKeys::unlock_readwrite() const noexcept {
-		sodium_mprotect_readwrite(this->private_keys.get());
+		protect_readwrite(this->private_keys.get(), this->private_keys_access);
 	}
 
 	std::ostream& MasterKeys::print(std::ostream& stream) const {
@@ -32,6 +32,7 @@
 #include "sodium-wrappers.hpp"
 #include "protobuf.hpp"
 #include "key.hpp"
+#include "memory-protection.hpp"
 #include "gsl.hpp"
 
 namespace Molch {
@@ -44,6 +45,7 @@ namespace Molch {
 	class MasterKeys {
 	private:
 		mutable std::unique_ptr<PrivateMasterKeyStorage,SodiumDeleter<PrivateMasterKeyStorage>> private_keys;
+		mutable PageAccess private_keys_access{PageAccess::READ_WRITE};
 		//Ed25519 key for signing
 		PublicSigningKey public_signing_key;
 		PrivateSigningKey *private_signing_key{nullptr};
@@ -132,6 +134,9 @@ namespace Molch {
 			~Unlocker() noexcept;
 		};
 
+		/*! Lock the private keys even if the memory protection policy keeps them unlocked. */
+		void forceLock() const noexcept;
+
 		std::ostream& print(std::ostream& stream) const;
 	};
 }
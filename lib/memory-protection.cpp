@@ -0,0 +1,100 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "memory-protection.hpp"
+#include "sodium-wrappers.hpp"
+
+namespace Molch {
+	static molch_memory_protection protection{molch_memory_protection::STRICT};
+	static bool batch_active{false};
+
+	molch_memory_protection memory_protection() noexcept {
+		return protection;
+	}
+
+	void set_memory_protection(const molch_memory_protection new_protection) noexcept {
+		protection = new_protection;
+	}
+
+	void begin_protection_batch() noexcept {
+		batch_active = true;
+	}
+
+	void end_protection_batch() noexcept {
+		batch_active = false;
+	}
+
+	bool in_protection_batch() noexcept {
+		return batch_active;
+	}
+
+	static bool keep_unlocked() noexcept {
+		switch (protection) {
+			case molch_memory_protection::STRICT:
+				return false;
+
+			case molch_memory_protection::BATCHED:
+				return batch_active;
+
+			case molch_memory_protection::LOCKED_ONLY:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	void protect_noaccess(void *pointer, PageAccess& access) noexcept {
+		if (keep_unlocked()) {
+			return;
+		}
+
+		force_noaccess(pointer, access);
+	}
+
+	void protect_readonly(void *pointer, PageAccess& access) noexcept {
+		//in strict mode every access does the mprotect, same as without a policy
+		if ((protection != molch_memory_protection::STRICT) and (access != PageAccess::NO_ACCESS)) {
+			return;
+		}
+
+		sodium_mprotect_readonly(pointer);
+		access = PageAccess::READ_ONLY;
+	}
+
+	void protect_readwrite(void *pointer, PageAccess& access) noexcept {
+		if ((protection != molch_memory_protection::STRICT) and (access == PageAccess::READ_WRITE)) {
+			return;
+		}
+
+		sodium_mprotect_readwrite(pointer);
+		access = PageAccess::READ_WRITE;
+	}
+
+	void force_noaccess(void *pointer, PageAccess& access) noexcept {
+		if ((protection != molch_memory_protection::STRICT) and (access == PageAccess::NO_ACCESS)) {
+			return;
+		}
+
+		sodium_mprotect_noaccess(pointer);
+		access = PageAccess::NO_ACCESS;
+	}
+}
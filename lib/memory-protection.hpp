@@ -0,0 +1,65 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+//! \file Policy for changing the page protection of private keys with mprotect.
+
+#ifndef LIB_MEMORY_PROTECTION_HPP
+#define LIB_MEMORY_PROTECTION_HPP
+
+#include "molch.h"
+
+namespace Molch {
+	/*!
+	 * Current access to memory that has been allocated with sodium_malloc.
+	 */
+	enum class PageAccess {
+		NO_ACCESS,
+		READ_ONLY,
+		READ_WRITE
+	};
+
+	molch_memory_protection memory_protection() noexcept;
+	void set_memory_protection(const molch_memory_protection protection) noexcept;
+
+	/*!
+	 * A batch defers locking memory until it is ended, in BATCHED mode this
+	 * means only one mprotect per key and batch instead of one per access.
+	 */
+	void begin_protection_batch() noexcept;
+	void end_protection_batch() noexcept;
+	bool in_protection_batch() noexcept;
+
+	/*!
+	 * Change the access to the pages behind pointer, but only call mprotect if
+	 * the memory protection policy requires it. access is updated accordingly.
+	 */
+	void protect_noaccess(void *pointer, PageAccess& access) noexcept;
+	void protect_readonly(void *pointer, PageAccess& access) noexcept;
+	void protect_readwrite(void *pointer, PageAccess& access) noexcept;
+
+	/*!
+	 * Lock the pages regardless of the policy, used when a batch ends
+	 * or the policy gets stricter.
+	 */
+	void force_noaccess(void *pointer, PageAccess& access) noexcept;
+}
+
+#endif /* LIB_MEMORY_PROTECTION_HPP */
@@ -24,8 +24,10 @@
  */
 
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <iterator>
+#include <optional>
 
 #include "molch.h"
 #include "molch/constants.h"
@@ -33,12 +35,20 @@
 #include "packet.hpp"
 #include "buffer.hpp"
 #include "user-store.hpp"
+#include "backup-hash.hpp"
+#include "backup-segments.hpp"
+#include "backup-stream.hpp"
+#include "state-store.hpp"
 #include "endianness.hpp"
 #include "destroyers.hpp"
 #include "malloc.hpp"
+#include "memory-protection.hpp"
 #include "protobuf.hpp"
 #include "protobuf-arena.hpp"
 #include "key.hpp"
+#include "snapshot.hpp"
+#include "parallel.hpp"
+#include "bounded-cache.hpp"
 #include "gsl.hpp"
 
 using namespace Molch;
@@ -46,6 +56,89 @@ using namespace Molch;
 //global user store
 static UserStore users;
 static std::unique_ptr<BackupKey,SodiumDeleter<BackupKey>> global_backup_key;
+static PageAccess global_backup_key_access{PageAccess::READ_WRITE};
+//encrypted segments of the last full backup, reused for unchanged users and conversations
+static BackupSegmentCache backup_segment_cache;
+//changes with every new backup key and with molch_set_conversation_backups,
+//delta backups are only chained as long as it stays the same
+//it is at least 1 once there is a backup key, checkpoints loaded from the state store have 0
+static uint64_t backup_key_generation{0};
+//what molch_encrypt_message and molch_decrypt_message back up
+static molch_conversation_backups conversation_backups{molch_conversation_backups::FULL_BACKUPS};
+//file that all changes are written to, if one has been opened
+static std::optional<StateStore> state_store;
+
+/*
+ * Send conversations whose key agreement has been done in advance. They only
+ * live in memory until their first message is sent and are forgotten if that
+ * doesn't happen in time.
+ */
+constexpr auto prepared_conversation_lifetime{hours{1}};
+
+struct PreparedConversation {
+	PublicSigningKey owner;
+	PreparedSendConversation prepared;
+	seconds expiration_date;
+};
+
+static std::map<ConversationId,PreparedConversation> prepared_conversations;
+
+//! Drop the key agreements a user has prepared, so they don't outlive the user.
+static void forget_prepared_conversations(const PublicSigningKey& owner) {
+	for (auto prepared{std::begin(prepared_conversations)}; prepared != std::end(prepared_conversations);) {
+		if (prepared->second.owner == owner) {
+			prepared = prepared_conversations.erase(prepared);
+		} else {
+			++prepared;
+		}
+	}
+}
+
+using PacketHash = std::array<std::byte,crypto_generichash_BYTES>;
+
+/*
+ * Prekey packets that have already been received, identified by the receiver
+ * and a hash of the packet. When a transport delivers a packet again, the
+ * conversation that was created the first time is returned instead of a new one.
+ */
+struct ReceivedPrekeyPacket {
+	ConversationId conversation_id;
+	Buffer message;
+};
+
+static BoundedCache<std::pair<PublicSigningKey,PacketHash>,ReceivedPrekeyPacket,1024> received_prekey_packets;
+//bigger messages aren't kept, a packet with one of them is received again like a new one
+constexpr size_t received_prekey_packet_maximum_message_size{4096};
+
+static result<void> remember_received_prekey_packet(
+		const PublicSigningKey& receiver,
+		const PacketHash& hash,
+		const ConversationId& conversation_id,
+		const span<const std::byte> message) {
+	if (message.size() > received_prekey_packet_maximum_message_size) {
+		return outcome::success();
+	}
+
+	ReceivedPrekeyPacket received_packet{conversation_id, Buffer{message.size(), 0}};
+	OUTCOME_TRY(received_packet.message.cloneFromRaw(message));
+	received_prekey_packets.add({receiver, hash}, std::move(received_packet));
+
+	return outcome::success();
+}
+
+//! Drop the plaintexts a user has received, so they don't outlive the user.
+static void forget_received_prekey_packets(const PublicSigningKey& receiver) {
+	received_prekey_packets.removeIf([&receiver](const auto& key, [[maybe_unused]] const ReceivedPrekeyPacket& received) {
+		return key.first == receiver;
+	});
+}
+
+//! Drop the plaintext of the packet that started a conversation once it has ended.
+static void forget_received_prekey_packets(const ConversationId& conversation_id) {
+	received_prekey_packets.removeIf([&conversation_id]([[maybe_unused]] const auto& key, const ReceivedPrekeyPacket& received) {
+		return received.conversation_id == conversation_id;
+	});
+}
 
 class GlobalBackupKeyUnlocker {
 public:
@@ -53,7 +146,7 @@ public:
 		if (global_backup_key == nullptr) {
 			std::terminate();
 		}
-		Molch::sodium_mprotect_readonly(global_backup_key.get());
+		protect_readonly(global_backup_key.get(), global_backup_key_access);
 	}
 
 	GlobalBackupKeyUnlocker(const GlobalBackupKeyUnlocker&) = default;
@@ -62,7 +155,7 @@ public:
 	GlobalBackupKeyUnlocker& operator=(GlobalBackupKeyUnlocker&&) = default;
 
 	~GlobalBackupKeyUnlocker() noexcept {
-		Molch::sodium_mprotect_noaccess(global_backup_key.get());
+		protect_noaccess(global_backup_key.get(), global_backup_key_access);
 	}
 };
 
@@ -72,7 +165,7 @@ public:
 		if (!global_backup_key) {
 			std::terminate();
 		}
-		Molch::sodium_mprotect_readwrite(global_backup_key.get());
+		protect_readwrite(global_backup_key.get(), global_backup_key_access);
 	}
 
 	GlobalBackupKeyWriteUnlocker(const GlobalBackupKeyWriteUnlocker&) = default;
@@ -81,48 +174,98 @@ public:
 	GlobalBackupKeyWriteUnlocker& operator=(GlobalBackupKeyWriteUnlocker&&) = default;
 
 	~GlobalBackupKeyWriteUnlocker() noexcept {
-		Molch::sodium_mprotect_noaccess(global_backup_key.get());
+		protect_noaccess(global_backup_key.get(), global_backup_key_access);
 	}
 };
 
-constexpr auto PREKEYS_SIZE = PREKEY_AMOUNT * PUBLIC_KEY_SIZE;
-constexpr auto PREKEY_LIST_EXPIRATION_DATE_OFFSET = PUBLIC_KEY_SIZE + PREKEYS_SIZE;
-
 /*
- * Create a prekey list.
+ * Lock all private keys that the memory protection policy might have left unlocked.
  */
-static result<MallocBuffer> create_prekey_list(const PublicSigningKey& public_signing_key) {
-	//get the user
-	auto user{users.find(public_signing_key)};
-	if (user == nullptr) {
-		return Error(status_type::NOT_FOUND, "Couldn't find the user to create a prekey list from.");
+static void lock_all_private_keys() noexcept {
+	users.lockMasterKeys();
+	if (global_backup_key != nullptr) {
+		force_noaccess(global_backup_key.get(), global_backup_key_access);
 	}
+}
 
+/*
+ * Layout of a prekey list before it is signed:
+ * public identity key, number of prekeys (4 bytes), prekeys, expiration date (8 bytes)
+ *
+ * Lists of older versions don't contain the number and always have PREKEY_AMOUNT prekeys,
+ * their length can't be confused with the current layout.
+ */
+constexpr auto PREKEY_LIST_AMOUNT_OFFSET = PUBLIC_KEY_SIZE;
+constexpr auto PREKEY_LIST_PREKEYS_OFFSET = PREKEY_LIST_AMOUNT_OFFSET + sizeof(uint32_t);
+constexpr auto LEGACY_PREKEY_LIST_SIZE = PUBLIC_KEY_SIZE + (PREKEY_AMOUNT * PUBLIC_KEY_SIZE) + sizeof(int64_t);
+
+/*
+ * Signed prekey lists are reused until the prekeys change, but at least
+ * this often the expiration date is moved forward with a new signature.
+ */
+constexpr auto prekey_list_resign_time{1_days};
+
+/*
+ * Rotate the prekeys of a user and sign a new prekey list if the last one is out of date.
+ * Only touches the given user, so different users can be handled in parallel.
+ */
+static result<const Buffer*> update_signed_prekey_list(User& user) {
 	//rotate the prekeys
-	OUTCOME_TRY(user->prekeys.rotate());
+	OUTCOME_TRY(user.prekeys.rotate());
+
+	//reuse the last signed prekey list if the prekeys haven't changed since
+	const auto& cached{user.signed_prekey_list};
+	if (cached.has_value()
+			&& (cached->prekeys_version == user.prekeys.version().value())
+			&& ((cached->signing_time + prekey_list_resign_time) > now())) {
+		return &cached->list;
+	}
 
 	//copy the public identity to the prekey list
-	MallocBuffer unsigned_prekey_list{
-			PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE + sizeof(uint64_t),
-			PUBLIC_KEY_SIZE + PREKEY_AMOUNT * PUBLIC_KEY_SIZE + sizeof(uint64_t)};
-	OUTCOME_TRY(unsigned_prekey_list.copyFromRaw(0, user->masterKeys().getIdentityKey().data(), 0, PUBLIC_KEY_SIZE));
+	const auto prekeys_size{user.prekeys.size() * PUBLIC_KEY_SIZE};
+	const auto expiration_date_offset{PREKEY_LIST_PREKEYS_OFFSET + prekeys_size};
+	Buffer unsigned_prekey_list{
+			expiration_date_offset + sizeof(int64_t),
+			expiration_date_offset + sizeof(int64_t)};
+	OUTCOME_TRY(unsigned_prekey_list.copyFromRaw(0, user.masterKeys().getIdentityKey().data(), 0, PUBLIC_KEY_SIZE));
+
+	//add the number of prekeys
+	auto big_endian_amount = span<std::byte>(unsigned_prekey_list).subspan(PREKEY_LIST_AMOUNT_OFFSET, sizeof(uint32_t));
+	OUTCOME_TRY(to_big_endian(gsl::narrow<uint32_t>(user.prekeys.size()), big_endian_amount));
 
 	//get the prekeys
-	OUTCOME_TRY(prekey_list_buffer, user->prekeys.list());
-	auto prekey_subspan = span<std::byte>(unsigned_prekey_list).subspan(PUBLIC_KEY_SIZE, PREKEYS_SIZE);
+	OUTCOME_TRY(prekey_list_buffer, user.prekeys.list());
+	auto prekey_subspan = span<std::byte>(unsigned_prekey_list).subspan(PREKEY_LIST_PREKEYS_OFFSET, prekeys_size);
 	OUTCOME_TRY(copyFromTo(prekey_list_buffer, prekey_subspan));
 
 	//add the expiration date
 	int64_t expiration_date{now().count() + seconds{3_months}.count()};
-	auto big_endian_expiration_date = span<std::byte>(unsigned_prekey_list).subspan(PREKEY_LIST_EXPIRATION_DATE_OFFSET, sizeof(int64_t));
+	auto big_endian_expiration_date = span<std::byte>(unsigned_prekey_list).subspan(expiration_date_offset, sizeof(int64_t));
 	OUTCOME_TRY(to_big_endian(expiration_date, big_endian_expiration_date));
 
 	//sign the prekey list with the current identity key
-	MallocBuffer prekey_list{
-			unsigned_prekey_list.size() + SIGNATURE_SIZE,
-			unsigned_prekey_list.size() + SIGNATURE_SIZE};
-	OUTCOME_TRY(signed_data, user->masterKeys().sign(unsigned_prekey_list));
-	OUTCOME_TRY(copyFromTo(signed_data, prekey_list));
+	OUTCOME_TRY(signed_data, user.masterKeys().sign(unsigned_prekey_list));
+	user.signed_prekey_list.emplace(User::SignedPrekeyList{
+			user.prekeys.version().value(),
+			now(),
+			std::move(signed_data)});
+
+	return &user.signed_prekey_list->list;
+}
+
+/*
+ * Create a prekey list.
+ */
+static result<MallocBuffer> create_prekey_list(const PublicSigningKey& public_signing_key) {
+	//get the user
+	auto user{users.find(public_signing_key)};
+	if (user == nullptr) {
+		return Error(status_type::NOT_FOUND, "Couldn't find the user to create a prekey list from.");
+	}
+
+	OUTCOME_TRY(signed_prekey_list, update_signed_prekey_list(*user));
+	MallocBuffer prekey_list{signed_prekey_list->size(), 0};
+	OUTCOME_TRY(prekey_list.cloneFrom(*signed_prekey_list));
 
 	return prekey_list;
 }
@@ -134,77 +277,44 @@ static result<MallocBuffer> create_prekey_list(const PublicSigningKey& public_si
 		if (global_backup_key == nullptr) {
 			global_backup_key = std::unique_ptr<BackupKey,SodiumDeleter<BackupKey>>(sodium_malloc<BackupKey>(1));
 			new (global_backup_key.get()) BackupKey();
+			global_backup_key_access = PageAccess::READ_WRITE;
 		}
 
 		//make the content of the backup key writable
 		GlobalBackupKeyWriteUnlocker unlocker;
 
+		//the cached segments are encrypted with the old key
+		backup_segment_cache.clear();
+		backup_key_generation++;
+
 		randombytes_buf(*global_backup_key);
 		return *global_backup_key;
 	}
 
-	static result<MallocBuffer> export_all() {
-		GlobalBackupKeyUnlocker unlocker;
-		if (global_backup_key == nullptr) {
-			return Error(status_type::INCORRECT_DATA, "No backup key found.");
+	/*
+	 * Append the changed users and conversations to the state store.
+	 * Within a batch, the fsync is deferred until the batch ends.
+	 */
+	static result<void> persist_state() {
+		if (!state_store.has_value()) {
+			return outcome::success();
 		}
 
-		Arena arena;
-		auto backup_struct{arena.allocate<ProtobufCBackup>(1)};
-		molch__protobuf__backup__init(backup_struct);
-
-		//export the conversation
-		outcome_protobuf_array_arena_export(arena, backup_struct, users, users);
-
-		//pack the struct
-		auto backup_struct_size{molch__protobuf__backup__get_packed_size(backup_struct)};
-		auto users_buffer_content{arena.allocate<std::byte>(backup_struct_size)};
-		span<std::byte> users_buffer{users_buffer_content, backup_struct_size};
-		molch__protobuf__backup__pack(backup_struct, byte_to_uchar(users_buffer.data()));
-
-		//generate the nonce
-		Buffer backup_nonce(BACKUP_NONCE_SIZE, BACKUP_NONCE_SIZE);
-		randombytes_buf(backup_nonce);
-
-		//allocate the output
-		Buffer backup_buffer{backup_struct_size + crypto_secretbox_MACBYTES, backup_struct_size + crypto_secretbox_MACBYTES};
-
-		//encrypt the backup
-		auto status{crypto_secretbox_easy(
-				byte_to_uchar(backup_buffer.data()),
-				byte_to_uchar(users_buffer.data()),
-				users_buffer.size(),
-				byte_to_uchar(backup_nonce.data()),
-				byte_to_uchar(global_backup_key->data()))};
-		if (status != 0) {
-			return Error(status_type::ENCRYPT_ERROR, "Failed to enrypt conversation state.");
+		OUTCOME_TRY(state_store->persist(users));
+		if (in_protection_batch()) {
+			return outcome::success();
 		}
 
-		//fill in the encrypted backup struct
-		ProtobufCEncryptedBackup encrypted_backup_struct;
-		molch__protobuf__encrypted_backup__init(&encrypted_backup_struct);
-		//metadata
-		encrypted_backup_struct.backup_version = 0;
-		encrypted_backup_struct.has_backup_type = true;
-		encrypted_backup_struct.backup_type = MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__FULL_BACKUP;
-		//nonce
-		encrypted_backup_struct.has_encrypted_backup_nonce = true;
-		encrypted_backup_struct.encrypted_backup_nonce.data = byte_to_uchar(backup_nonce.data());
-		encrypted_backup_struct.encrypted_backup_nonce.len = backup_nonce.size();
-		//encrypted backup
-		encrypted_backup_struct.has_encrypted_backup = true;
-		encrypted_backup_struct.encrypted_backup.data = byte_to_uchar(backup_buffer.data());
-		encrypted_backup_struct.encrypted_backup.len = backup_buffer.size();
+		return state_store->sync();
+	}
 
-		//now pack the entire backup
-		const auto encrypted_backup_size{molch__protobuf__encrypted_backup__get_packed_size(&encrypted_backup_struct)};
-		MallocBuffer malloced_encrypted_backup{encrypted_backup_size, 0};
-		OUTCOME_TRY(malloced_encrypted_backup.setSize(molch__protobuf__encrypted_backup__pack(&encrypted_backup_struct, byte_to_uchar(malloced_encrypted_backup.data()))));
-		if (malloced_encrypted_backup.size() != encrypted_backup_size) {
-			return Error(status_type::PROTOBUF_PACK_ERROR, "Failed to pack encrypted conversation.");
+	static result<MallocBuffer> export_all() {
+		GlobalBackupKeyUnlocker unlocker;
+		if (global_backup_key == nullptr) {
+			return Error(status_type::INCORRECT_DATA, "No backup key found.");
 		}
 
-		return malloced_encrypted_backup;
+		return backup_segment_cache.exportBackup(users, *global_backup_key);
 	}
 
 
@@ -236,6 +346,7 @@ static result<MallocBuffer> create_prekey_list(const PublicSigningKey& public_si
 
 		OUTCOME_TRY(prekey_list, create_prekey_list(user_result.user_id));
 		user_result.prekey_list = std::move(prekey_list);
+		OUTCOME_TRY(persist_state());
 
 		if (create_backup == CreateBackup::YES) {
 			OUTCOME_TRY(backup, export_all());
@@ -302,9 +413,123 @@ MOLCH_PUBLIC(return_status) molch_create_user(
 	return success_status;
 }
 
+	struct CreateUsersResult {
+		MallocBuffer users;
+		size_t prekey_list_length{0};
+		BackupKey backup_key;
+		std::optional<MallocBuffer> backup;
+	};
+
+	/*
+	 * Create many users at once. The users and their prekey lists are generated in
+	 * parallel, the backup key is only updated and the state only persisted once.
+	 */
+	static result<CreateUsersResult> create_users(const size_t count, const CreateBackup create_backup, const std::optional<span<const std::byte>> random_spice) {
+		OUTCOME_TRY(Molch::sodium_init());
+
+		CreateUsersResult users_result;
+
+		//create a new backup key
+		OUTCOME_TRY(updated_backup_key, update_backup_key());
+		users_result.backup_key = updated_backup_key;
+
+		//create the users, every user is independent of the others
+		std::vector<std::optional<User>> created_users(count);
+		OUTCOME_TRY(parallel_for(count, [&created_users, &random_spice](const size_t index) -> result<void> {
+			OUTCOME_TRY(user, Molch::User::create(random_spice));
+			OUTCOME_TRY(update_signed_prekey_list(user));
+			created_users[index].emplace(std::move(user));
+			return outcome::success();
+		}));
+
+		//every entry is the public master key followed by the prekey list
+		users_result.prekey_list_length = created_users.front()->signed_prekey_list->list.size();
+		const auto entry_length{PUBLIC_MASTER_KEY_SIZE + users_result.prekey_list_length};
+		users_result.users = MallocBuffer{count * entry_length, count * entry_length};
+		std::vector<User> new_users;
+		new_users.reserve(count);
+		auto entry{std::begin(users_result.users)};
+		for (auto& created_user : created_users) {
+			const auto& prekey_list{created_user->signed_prekey_list->list};
+			entry = std::copy(std::cbegin(created_user->id()), std::cend(created_user->id()), entry);
+			entry = std::copy(std::cbegin(prekey_list), std::cend(prekey_list), entry);
+			new_users.push_back(std::move(*created_user));
+		}
+		users.addCreated(std::move(new_users));
+		OUTCOME_TRY(persist_state());
+
+		if (create_backup == CreateBackup::YES) {
+			OUTCOME_TRY(backup, export_all());
+			users_result.backup = std::move(backup);
+		}
+
+		return users_result;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_create_users(
+			//outputs
+			unsigned char ** const created_users, //free with molch_free after use
+			size_t * const created_users_length,
+			size_t * const prekey_list_length,
+			unsigned char * const backup_key, //BACKUP_KEY_SIZE
+			const size_t backup_key_length,
+			//inputs
+			const size_t count,
+			//optional output (can be nullptr)
+			unsigned char ** const backup, //exports the entire library state, free after use, check if nullptr before use!
+			size_t * const backup_length,
+			//optional input (can be nullptr)
+			const unsigned char * const random_data,
+			const size_t random_data_length) {
+		if ((created_users == nullptr) or (created_users_length == nullptr) or (prekey_list_length == nullptr)
+				or (backup_key == nullptr) or (backup_key_length != BACKUP_KEY_SIZE)
+				or (count == 0)
+				or ((backup != nullptr) and (backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_create_users"};
+		}
+
+		try {
+			const auto create_backup{[&](){
+				if (backup == nullptr) {
+					return CreateBackup::NO;
+				}
+
+				return CreateBackup::YES;
+			}()};
+			const auto random_spice{[&]() -> std::optional<span<const std::byte>> {
+				if (random_data == nullptr) {
+					return std::nullopt;
+				}
+
+				return {{uchar_to_byte(random_data), random_data_length}};
+			}()};
+			auto created_users_result = create_users(count, create_backup, random_spice);
+			if (created_users_result.has_error()) {
+				return created_users_result.error().toReturnStatus();
+			}
+			auto& created{created_users_result.value()};
+			if (create_backup == CreateBackup::YES) {
+				auto& backup_buffer{created.backup.value()};
+				*backup_length = backup_buffer.size();
+				*backup = byte_to_uchar(backup_buffer.release());
+			}
+			*prekey_list_length = created.prekey_list_length;
+			*created_users_length = created.users.size();
+			*created_users = byte_to_uchar(created.users.release());
+			std::copy(std::cbegin(created.backup_key), std::cend(created.backup_key), uchar_to_byte(backup_key));
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
 	static result<std::optional<MallocBuffer>> destroy_user(const span<const std::byte> user_id, CreateBackup create_backup) {
 		OUTCOME_TRY(id, PublicSigningKey::fromSpan(user_id));
 		users.remove(id);
+		forget_prepared_conversations(id);
+		forget_received_prekey_packets(id);
+		OUTCOME_TRY(persist_state());
 		if (create_backup == CreateBackup::YES) {
 			OUTCOME_TRY(backup, export_all());
 			return std::move(backup);
@@ -355,6 +580,11 @@ MOLCH_PUBLIC(size_t) molch_user_count() {
 
 MOLCH_PUBLIC(void) molch_destroy_all_users() {
 	users.clear();
+	prepared_conversations.clear();
+	received_prekey_packets.clear();
+	backup_segment_cache.clear();
+	//the users stay in the state store, removing them from it has to be done with molch_destroy_user
+	state_store.reset();
 }
 
 	struct ListedUsers {
@@ -406,38 +636,163 @@ MOLCH_PUBLIC(molch_message_type) molch_get_message_type(
 	return unverified_metadata.packet_type;
 }
 
+struct VerifiedPrekeyList {
+	PublicKey identity;
+	span<const std::byte> prekeys; //points into the signed prekey list
+	int64_t expiration_date{0};
+};
+
 /*
- * Verify prekey list and extract the public identity
- * and choose a prekey.
+ * Extract the public identity, the prekeys and the expiration date
+ * of a signed prekey list without verifying the signature.
+ */
+static result<VerifiedPrekeyList> parse_prekey_list(const span<const std::byte> prekey_list) {
+	if (prekey_list.size() < (SIGNATURE_SIZE + PUBLIC_KEY_SIZE + sizeof(int64_t))) {
+		return Error(status_type::INCORRECT_BUFFER_SIZE, "Prekey list is too short.");
+	}
+	const auto unsigned_prekey_list{prekey_list.subspan(SIGNATURE_SIZE, prekey_list.size() - SIGNATURE_SIZE)};
+
+	//find the prekeys
+	size_t prekeys_offset{PUBLIC_KEY_SIZE};
+	size_t prekeys_size{PREKEY_AMOUNT * PUBLIC_KEY_SIZE};
+	if (unsigned_prekey_list.size() != LEGACY_PREKEY_LIST_SIZE) {
+		if (unsigned_prekey_list.size() < (PREKEY_LIST_PREKEYS_OFFSET + sizeof(int64_t))) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "Prekey list is too short.");
+		}
+
+		uint32_t amount{0};
+		OUTCOME_TRY(from_big_endian(amount, unsigned_prekey_list.subspan(PREKEY_LIST_AMOUNT_OFFSET, sizeof(uint32_t))));
+		prekeys_offset = PREKEY_LIST_PREKEYS_OFFSET;
+		prekeys_size = amount * PUBLIC_KEY_SIZE;
+		if ((amount == 0) || (unsigned_prekey_list.size() != (prekeys_offset + prekeys_size + sizeof(int64_t)))) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "Prekey list has an invalid number of prekeys.");
+		}
+	}
+
+	//get the expiration date
+	VerifiedPrekeyList verified;
+	const auto big_endian_expiration_date = unsigned_prekey_list.subspan(prekeys_offset + prekeys_size, sizeof(int64_t));
+	OUTCOME_TRY(from_big_endian(verified.expiration_date, big_endian_expiration_date));
+
+	//copy the public identity key
+	OUTCOME_TRY(copyFromTo(unsigned_prekey_list, {verified.identity.data(), PUBLIC_KEY_SIZE}, PUBLIC_KEY_SIZE));
+	verified.prekeys = unsigned_prekey_list.subspan(prekeys_offset, prekeys_size);
+
+	return verified;
+}
+
+/*
+ * Verify the signature of a prekey list and extract the public identity,
+ * the prekeys and the expiration date.
  */
-static result<PublicKey> verify_prekey_list(
+static result<VerifiedPrekeyList> open_prekey_list(
 		const span<const std::byte> prekey_list,
 		const PublicSigningKey& public_signing_key) {
-	//verify the signature
-	Buffer verified_prekey_list{prekey_list.size() - SIGNATURE_SIZE, prekey_list.size() - SIGNATURE_SIZE};
-	OUTCOME_TRY(crypto_sign_open(
-			verified_prekey_list,
-			prekey_list,
+	if (prekey_list.size() < (SIGNATURE_SIZE + PUBLIC_KEY_SIZE + sizeof(int64_t))) {
+		return Error(status_type::INCORRECT_BUFFER_SIZE, "Prekey list is too short.");
+	}
+
+	//verify the signature in place
+	OUTCOME_TRY(crypto_sign_verify_detached(
+			prekey_list.subspan(0, SIGNATURE_SIZE),
+			prekey_list.subspan(SIGNATURE_SIZE, prekey_list.size() - SIGNATURE_SIZE),
 			public_signing_key));
 
-	//get the expiration date
-	int64_t expiration_date{0};
-	constexpr auto prekeys_size = PREKEY_AMOUNT * PUBLIC_KEY_SIZE;
-	constexpr auto expiration_date_offset = PUBLIC_KEY_SIZE + prekeys_size;
-	const auto big_endian_expiration_date = span<std::byte>(verified_prekey_list).subspan(expiration_date_offset, sizeof(int64_t));
-	OUTCOME_TRY(from_big_endian(expiration_date, big_endian_expiration_date));
+	return parse_prekey_list(prekey_list);
+}
+
+using PrekeyListHash = std::array<std::byte,crypto_generichash_BYTES>;
+
+static result<PrekeyListHash> hash_prekey_list(const span<const std::byte> prekey_list) {
+	PrekeyListHash hash;
+	OUTCOME_TRY(crypto_generichash(hash, prekey_list, {nullptr, static_cast<size_t>(0)}));
+
+	return hash;
+}
+
+/*
+ * Prekey lists whose signature has already been verified, identified by the
+ * signing key and a hash of the signed list, with their expiration date.
+ * Starting more conversations with the same prekey list only needs the hash
+ * instead of another signature check.
+ */
+class VerifiedPrekeyListCache {
+private:
+	BoundedCache<std::pair<PublicSigningKey,PrekeyListHash>,int64_t,1024> expiration_dates;
+
+public:
+	bool contains(const PublicSigningKey& public_signing_key, const PrekeyListHash& hash) const {
+		const auto expiration_date{this->expiration_dates.find({public_signing_key, hash})};
+		return (expiration_date != nullptr) && (*expiration_date >= now().count());
+	}
+
+	void add(const PublicSigningKey& public_signing_key, const PrekeyListHash& hash, int64_t expiration_date) {
+		this->expiration_dates.add({public_signing_key, hash}, std::move(expiration_date));
+	}
+};
+
+static VerifiedPrekeyListCache verified_prekey_lists;
+
+static result<PacketHash> hash_packet(const span<const std::byte> packet) {
+	PacketHash hash;
+	OUTCOME_TRY(crypto_generichash(hash, packet, {nullptr, static_cast<size_t>(0)}));
+
+	return hash;
+}
+
+/*
+ * Find a prekey packet that the user has already received, as long as
+ * the conversation that was created for it still exists.
+ */
+static const ReceivedPrekeyPacket* find_received_prekey_packet(User& user, const PacketHash& hash) {
+	const auto received{received_prekey_packets.find({user.id(), hash})};
+	if (received == nullptr) {
+		return nullptr;
+	}
+
+	if (not user.conversations.contains(received->conversation_id)) {
+		received_prekey_packets.remove({user.id(), hash});
+		return nullptr;
+	}
+
+	return received;
+}
+
+/*
+ * Check a prekey list without touching the cache of verified prekey lists,
+ * the signature is only verified if it hasn't been before.
+ */
+static result<VerifiedPrekeyList> check_prekey_list(
+		const span<const std::byte> prekey_list,
+		const PublicSigningKey& public_signing_key,
+		const bool already_verified) {
+	OUTCOME_TRY(verified, already_verified ? parse_prekey_list(prekey_list) : open_prekey_list(prekey_list, public_signing_key));
 
 	//make sure the prekey list isn't too old
 	int64_t current_time{now().count()};
-	if (expiration_date < current_time) {
+	if (verified.expiration_date < current_time) {
 		return Error(status_type::OUTDATED, "Prekey list has expired (older than 3 months).");
 	}
 
-	//copy the public identity key
-	PublicKey public_identity_key;
-	OUTCOME_TRY(copyFromTo(verified_prekey_list, {public_identity_key.data(), PUBLIC_KEY_SIZE}, PUBLIC_KEY_SIZE));
+	return verified;
+}
+
+/*
+ * Verify prekey list and extract the public identity
+ * and the prekeys.
+ */
+static result<VerifiedPrekeyList> verify_prekey_list(
+		const span<const std::byte> prekey_list,
+		const PublicSigningKey& public_signing_key) {
+	OUTCOME_TRY(hash, hash_prekey_list(prekey_list));
+	const auto already_verified{verified_prekey_lists.contains(public_signing_key, hash)};
+	OUTCOME_TRY(verified, check_prekey_list(prekey_list, public_signing_key, already_verified));
 
-	return public_identity_key;
+	if (!already_verified) {
+		verified_prekey_lists.add(public_signing_key, hash, verified.expiration_date);
+	}
+
+	return verified;
 }
 
 	struct SendConversationResult {
@@ -461,23 +816,23 @@ static result<PublicKey> verify_prekey_list(
 
 		//get the receivers public ephemeral and identity
 		OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(receiver_id));
-		OUTCOME_TRY(receiver_public_identity, verify_prekey_list(prekey_list, receiver_public_master_key));
+		OUTCOME_TRY(verified_prekey_list, verify_prekey_list(prekey_list, receiver_public_master_key));
 
 		MasterKeys::Unlocker unlocker{user->masterKeys()};
 
 		//create the conversation and encrypt the message
-		const auto prekeys{prekey_list.subspan(PUBLIC_KEY_SIZE + SIGNATURE_SIZE, prekey_list.size() - PUBLIC_KEY_SIZE - SIGNATURE_SIZE - sizeof(int64_t))};
 		OUTCOME_TRY(private_identity_key, user->masterKeys().getPrivateIdentityKey());
 		OUTCOME_TRY(send_conversation, Molch::Conversation::createSendConversation(
 				message,
 				user->masterKeys().getIdentityKey(),
 				*private_identity_key,
-				receiver_public_identity,
-				prekeys));
+				verified_prekey_list.identity,
+				verified_prekey_list.prekeys));
 
 		SendConversationResult conversation_result;
 		conversation_result.conversation_id = send_conversation.conversation.id();
-		user->conversations.add(std::move(send_conversation.conversation));
+		OUTCOME_TRY(user->conversations.add(std::move(send_conversation.conversation)));
+		OUTCOME_TRY(persist_state());
 
 		conversation_result.packet = send_conversation.packet;
 
@@ -493,7 +848,7 @@ static result<PublicKey> verify_prekey_list(
 			//outputs
 			unsigned char *const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
 			const size_t conversation_id_length,
-			unsigned char **const packet, //free after use
+			unsigned char **const packet, //free with molch_free after use
 			size_t *packet_length,
 			//inputs
 			const unsigned char *const sender_public_master_key, //signing key of the sender (user)
@@ -538,9 +893,9 @@ static result<PublicKey> verify_prekey_list(
 			auto& conversation{conversation_result.value()};
 			std::copy(std::cbegin(conversation.conversation_id), std::cend(conversation.conversation_id), uchar_to_byte(conversation_id));
 			if (create_backup == CreateBackup::YES) {
-				auto& created_backup{conversation.backup.value()};
-				*backup_length = created_backup.size();
-				*backup = byte_to_uchar(created_backup.release());
+				auto& created_backup{conversation.backup};
+				*backup_length = created_backup.has_value() ? created_backup->size() : 0;
+				*backup = created_backup.has_value() ? byte_to_uchar(created_backup->release()) : nullptr;
 			}
 			*packet_length = conversation.packet.size();
 			*packet = byte_to_uchar(conversation.packet.release());
@@ -551,118 +906,81 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	struct ReceiveConversationResult {
-		ConversationId conversation_id;
-		MallocBuffer prekey_list;
-		MallocBuffer message;
-		std::optional<MallocBuffer> backup;
-	};
+	static void forget_expired_prepared_conversations() {
+		const auto current_time{now()};
+		for (auto prepared{std::begin(prepared_conversations)}; prepared != std::end(prepared_conversations);) {
+			if (prepared->second.expiration_date < current_time) {
+				prepared = prepared_conversations.erase(prepared);
+			} else {
+				++prepared;
+			}
+		}
+	}
 
-	static result<ReceiveConversationResult> start_receive_conversation(
-			const span<const std::byte> receiver_id,
+	static result<ConversationId> prepare_send_conversation(
 			const span<const std::byte> sender_id,
-			const span<const std::byte> packet,
-			CreateBackup create_backup) {
-		(void)sender_id;
-		//get the user that matches the public signing key of the receiver
-		OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(receiver_id));
-		auto user{users.find(receiver_public_master_key)};
+			const span<const std::byte> receiver_id,
+			const span<const std::byte> prekey_list) {
+		forget_expired_prepared_conversations();
+
+		//get the user that matches the public signing key of the sender
+		OUTCOME_TRY(sender_public_master_key, PublicSigningKey::fromSpan(sender_id));
+		auto user{users.find(sender_public_master_key)};
 		if (user == nullptr) {
-			return Error(status_type::NOT_FOUND, "User not found in the user store.");
+			return Error(status_type::NOT_FOUND, "User not found.");
 		}
 
-		//unlock the master keys
-		MasterKeys::Unlocker unlocker(user->masterKeys());
+		//get the receivers public ephemeral and identity
+		OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(receiver_id));
+		OUTCOME_TRY(verified_prekey_list, verify_prekey_list(prekey_list, receiver_public_master_key));
 
-		//create the conversation
+		MasterKeys::Unlocker unlocker{user->masterKeys()};
+
+		//do the key agreement, but don't send anything yet
 		OUTCOME_TRY(private_identity_key, user->masterKeys().getPrivateIdentityKey());
-		OUTCOME_TRY(receive_conversation, Molch::Conversation::createReceiveConversation(
-				packet,
+		OUTCOME_TRY(prepared, Molch::Conversation::prepareSendConversation(
 				user->masterKeys().getIdentityKey(),
 				*private_identity_key,
-				user->prekeys));
+				verified_prekey_list.identity,
+				verified_prekey_list.prekeys));
 
-		//copy the conversation id
-		ReceiveConversationResult conversation_result;
-		conversation_result.conversation_id = receive_conversation.conversation.id();
+		const auto conversation_id{prepared.conversation.id()};
+		prepared_conversations.emplace(conversation_id, PreparedConversation{
+				sender_public_master_key,
+				std::move(prepared),
+				now() + prepared_conversation_lifetime});
 
-		//create the prekey list
-		OUTCOME_TRY(prekey_list, create_prekey_list(receiver_public_master_key));
-		conversation_result.prekey_list = std::move(prekey_list);
-
-		//add the conversation to the conversation store
-		user->conversations.add(std::move(receive_conversation.conversation));
-
-		//copy the message
-		conversation_result.message = receive_conversation.message;
-
-		if (create_backup == CreateBackup::YES) {
-			OUTCOME_TRY(backup, export_all());
-			conversation_result.backup = std::move(backup);
-		}
-
-		return conversation_result;
+		return conversation_id;
 	}
 
-	MOLCH_PUBLIC(return_status) molch_start_receive_conversation(
+	MOLCH_PUBLIC(return_status) molch_prepare_send_conversation(
 			//outputs
 			unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
 			const size_t conversation_id_length,
-			unsigned char ** const prekey_list, //free after use
-			size_t * const prekey_list_length,
-			unsigned char ** const message, //free after use
-			size_t * const message_length,
 			//inputs
-			const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
-			const size_t receiver_public_master_key_length,
-			const unsigned char * const sender_public_master_key, //signing key of the sender
+			const unsigned char * const sender_public_master_key, //signing key of the sender (user)
 			const size_t sender_public_master_key_length,
-			const unsigned char * const packet, //received prekey packet
-			const size_t packet_length,
-			//optional output (can be nullptr)
-			unsigned char ** const backup, //exports the entire library state, free after use, check if nullptr before use!
-			size_t * const backup_length
-			) {
+			const unsigned char * const receiver_public_master_key, //signing key of the receiver
+			const size_t receiver_public_master_key_length,
+			const unsigned char * const prekey_list, //prekey list of the receiver
+			const size_t prekey_list_length) {
 		if ((conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
-				or (prekey_list == nullptr) or (prekey_list_length == nullptr)
-				or (message == nullptr) or (message_length == nullptr)
-				or (receiver_public_master_key == nullptr) or (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
 				or (sender_public_master_key == nullptr) or (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
-				or (packet == nullptr)
-				or ((backup != nullptr) and (backup_length == nullptr))) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_start_receive_conversation"};
+				or (receiver_public_master_key == nullptr) or (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				or (prekey_list == nullptr)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_prepare_send_conversation"};
 		}
 
 		try {
-			const auto create_backup{[&](){
-				if (backup == nullptr) {
-					return CreateBackup::NO;
-				}
-
-				return CreateBackup::YES;
-			}()};
-			auto conversation_result = start_receive_conversation(
-					{uchar_to_byte(receiver_public_master_key), receiver_public_master_key_length},
+			auto prepared_result = prepare_send_conversation(
 					{uchar_to_byte(sender_public_master_key), sender_public_master_key_length},
-					{uchar_to_byte(packet), packet_length},
-					create_backup);
-			if (conversation_result.has_error()) {
-				return conversation_result.error().toReturnStatus();
-			}
-			auto& conversation{conversation_result.value()};
-			std::copy(std::cbegin(conversation.conversation_id), std::cend(conversation.conversation_id), uchar_to_byte(conversation_id));
-
-			*prekey_list_length = conversation.prekey_list.size();
-			*prekey_list = byte_to_uchar(conversation.prekey_list.release());
-
-			*message_length = conversation.message.size();
-			*message = byte_to_uchar(conversation.message.release());
-
-			if (create_backup == CreateBackup::YES) {
-				auto& created_backup{conversation.backup.value()};
-				*backup_length = created_backup.size();
-				*backup = byte_to_uchar(created_backup.release());
+					{uchar_to_byte(receiver_public_master_key), receiver_public_master_key_length},
+					{uchar_to_byte(prekey_list), prekey_list_length});
+			if (prepared_result.has_error()) {
+				return prepared_result.error().toReturnStatus();
 			}
+			const auto& prepared_conversation_id{prepared_result.value()};
+			std::copy(std::cbegin(prepared_conversation_id), std::cend(prepared_conversation_id), uchar_to_byte(conversation_id));
 		} catch (const std::exception& exception) {
 			return {status_type::EXCEPTION, exception.what()};
 		}
@@ -670,151 +988,87 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	static result<MallocBuffer> export_conversation(const span<const std::byte> conversation_id) {
-		ProtobufCEncryptedBackup encrypted_backup_struct;
-		molch__protobuf__encrypted_backup__init(&encrypted_backup_struct);
-
-		if ((global_backup_key == nullptr) || (global_backup_key->size() != BACKUP_KEY_SIZE)) {
-			return Error(status_type::INCORRECT_DATA, "No backup key found.");
-		}
-
-		//find the conversation
-		Molch::User *user{nullptr};
-		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
-		auto conversation{users.findConversation(user, conversation_id_key)};
-		if (conversation == nullptr) {
-			return Error(status_type::NOT_FOUND, "Failed to find the conversation.");
-		}
-
-		//export the conversation
-		Arena arena;
-		OUTCOME_TRY(conversation_struct, conversation->exportProtobuf(arena));
-
-		//pack the struct
-		auto conversation_size{molch__protobuf__conversation__get_packed_size(conversation_struct)};
-		auto conversation_buffer_content{arena.allocate<std::byte>(conversation_size)};
-		span<std::byte> conversation_buffer{conversation_buffer_content, conversation_size};
-		molch__protobuf__conversation__pack(conversation_struct, byte_to_uchar(conversation_buffer.data()));
-
-		//generate the nonce
-		Buffer backup_nonce(BACKUP_NONCE_SIZE, BACKUP_NONCE_SIZE);
-		randombytes_buf(backup_nonce);
-
-		//allocate the output
-		Buffer backup_buffer{conversation_size + crypto_secretbox_MACBYTES, conversation_size + crypto_secretbox_MACBYTES};
-
-		//encrypt the backup
-		GlobalBackupKeyUnlocker unlocker;
-		auto status{crypto_secretbox_easy(
-				byte_to_uchar(backup_buffer.data()),
-				byte_to_uchar(conversation_buffer.data()),
-				conversation_buffer.size(),
-				byte_to_uchar(backup_nonce.data()),
-				byte_to_uchar(global_backup_key->data()))};
-		if (status != 0) {
-			OUTCOME_TRY(backup_buffer.setSize(0));
-			return Error(status_type::ENCRYPT_ERROR, "Failed to enrypt conversation state.");
-		}
-
-		//fill in the encrypted backup struct
-		//metadata
-		encrypted_backup_struct.backup_version = 0;
-		encrypted_backup_struct.has_backup_type = true;
-		encrypted_backup_struct.backup_type = MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP;
-		//nonce
-		encrypted_backup_struct.has_encrypted_backup_nonce = true;
-		encrypted_backup_struct.encrypted_backup_nonce.data = byte_to_uchar(backup_nonce.data());
-		encrypted_backup_struct.encrypted_backup_nonce.len = backup_nonce.size();
-		//encrypted backup
-		encrypted_backup_struct.has_encrypted_backup = true;
-		encrypted_backup_struct.encrypted_backup.data = byte_to_uchar(backup_buffer.data());
-		encrypted_backup_struct.encrypted_backup.len = backup_buffer.size();
-
-		//now pack the entire backup
-		const auto encrypted_backup_size{molch__protobuf__encrypted_backup__get_packed_size(&encrypted_backup_struct)};
-		MallocBuffer malloced_encrypted_backup{encrypted_backup_size, 0};
-		OUTCOME_TRY(malloced_encrypted_backup.setSize(molch__protobuf__encrypted_backup__pack(&encrypted_backup_struct, byte_to_uchar(malloced_encrypted_backup.data()))));
-		if (malloced_encrypted_backup.size() != encrypted_backup_size) {
-			return Error(status_type::PROTOBUF_PACK_ERROR, "Failed to pack encrypted conversation.");
-		}
-
-		return malloced_encrypted_backup;
-	}
-
-	struct EncryptResult {
-		MallocBuffer packet;
-		std::optional<MallocBuffer> conversation_backup;
-	};
-
-	static result<EncryptResult> encrypt_message(
+	static result<SendConversationResult> send_prepared_conversation(
 			const span<const std::byte> conversation_id,
 			const span<const std::byte> message,
 			const CreateBackup create_backup) {
-		//find the conversation
-		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
-		Molch::User *user;
-		auto conversation{users.findConversation(user, conversation_id_key)};
-		if (conversation == nullptr) {
-			return Error(status_type::NOT_FOUND, "Failed to find a conversation for the given ID.");
+		forget_expired_prepared_conversations();
+
+		OUTCOME_TRY(id, ConversationId::fromSpan(conversation_id));
+		const auto prepared_entry{prepared_conversations.find(id)};
+		if (prepared_entry == std::end(prepared_conversations)) {
+			return Error(status_type::NOT_FOUND, "No prepared conversation with this id, it may have expired.");
+		}
+		auto& prepared{prepared_entry->second};
+		auto user{users.find(prepared.owner)};
+		if (user == nullptr) {
+			prepared_conversations.erase(prepared_entry);
+			return Error(status_type::NOT_FOUND, "User not found.");
 		}
 
-		OUTCOME_TRY(packet, conversation->send(message, std::nullopt));
+		//only the message has to be encrypted, the key agreement is already done
+		auto& conversation{prepared.prepared.conversation};
+		OUTCOME_TRY(packet, conversation.send(message, prepared.prepared.prekey_metadata));
 
-		EncryptResult encrypt_result;
-		encrypt_result.packet = packet;
+		//the prepared conversation is only used up once sending succeeded
+		SendConversationResult conversation_result;
+		conversation_result.conversation_id = conversation.id();
+		OUTCOME_TRY(user->conversations.add(std::move(conversation)));
+		prepared_conversations.erase(prepared_entry);
+		OUTCOME_TRY(persist_state());
+
+		conversation_result.packet = packet;
 
 		if (create_backup == CreateBackup::YES) {
-			OUTCOME_TRY(conversation_backup, export_conversation(conversation_id));
-			encrypt_result.conversation_backup = std::move(conversation_backup);
+			OUTCOME_TRY(backup, export_all());
+			conversation_result.backup = std::move(backup);
 		}
 
-		return encrypt_result;
+		return conversation_result;
 	}
 
-	MOLCH_PUBLIC(return_status) molch_encrypt_message(
-			//output
-			unsigned char ** const packet, //free after use
-			size_t *packet_length,
+	MOLCH_PUBLIC(return_status) molch_send_prepared_conversation(
+			//outputs
+			unsigned char ** const packet, //free with molch_free after use
+			size_t * const packet_length,
 			//inputs
-			const unsigned char * const conversation_id,
+			const unsigned char * const conversation_id, //from molch_prepare_send_conversation
 			const size_t conversation_id_length,
 			const unsigned char * const message,
 			const size_t message_length,
 			//optional output (can be nullptr)
-			unsigned char ** const conversation_backup, //exports the conversation, free after use, check if nullptr before use!
-			size_t * const conversation_backup_length
-			) {
+			unsigned char ** const backup, //exports the entire library state, free after use, check if nullptr before use!
+			size_t * const backup_length) {
 		if ((packet == nullptr) or (packet_length == nullptr)
 				or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
 				or (message == nullptr)
-				or ((conversation_backup != nullptr) and (conversation_backup_length == nullptr))) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_encrypt_message"};
+				or ((backup != nullptr) and (backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_send_prepared_conversation"};
 		}
 
 		try {
 			const auto create_backup{[&](){
-				if (conversation_backup == nullptr) {
+				if (backup == nullptr) {
 					return CreateBackup::NO;
 				}
 
 				return CreateBackup::YES;
 			}()};
-			auto encrypted_message_result = encrypt_message(
+			auto conversation_result = send_prepared_conversation(
 					{uchar_to_byte(conversation_id), conversation_id_length},
 					{uchar_to_byte(message), message_length},
 					create_backup);
-			if (encrypted_message_result.has_error()) {
-				return encrypted_message_result.error().toReturnStatus();
+			if (conversation_result.has_error()) {
+				return conversation_result.error().toReturnStatus();
 			}
-			auto& encrypted_message{encrypted_message_result.value()};
-
-			*packet_length = encrypted_message.packet.size();
-			*packet = byte_to_uchar(encrypted_message.packet.release());
+			auto& conversation{conversation_result.value()};
+			*packet_length = conversation.packet.size();
+			*packet = byte_to_uchar(conversation.packet.release());
 
 			if (create_backup == CreateBackup::YES) {
-				auto& backup{encrypted_message.conversation_backup.value()};
-				*conversation_backup_length = backup.size();
-				*conversation_backup = byte_to_uchar(backup.release());
+				auto& created_backup{conversation.backup};
+				*backup_length = created_backup.has_value() ? created_backup->size() : 0;
+				*backup = created_backup.has_value() ? byte_to_uchar(created_backup->release()) : nullptr;
 			}
 		} catch (const std::exception& exception) {
 			return {status_type::EXCEPTION, exception.what()};
@@ -823,90 +1077,183 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	struct DecryptResult {
-		uint32_t message_number = 0;
-		uint32_t previous_message_number = 0;
-		MallocBuffer message;
-		std::optional<MallocBuffer> conversation_backup;
+	struct ConversationStart {
+		span<const std::byte> receiver_id;
+		span<const std::byte> prekey_list;
+		span<const std::byte> message;
 	};
 
-	static result<DecryptResult> decrypt_message(
-			const span<const std::byte> conversation_id,
-			const span<const std::byte> packet,
+	struct StartedConversation {
+		status_type status{status_type::SUCCESS};
+		ConversationId conversation_id;
+		MallocBuffer packet;
+	};
+
+	struct SendConversationsResult {
+		std::vector<StartedConversation> conversations;
+		std::optional<MallocBuffer> backup;
+	};
+
+	/*
+	 * Like start_send_conversation, but for many receivers. The master keys are only
+	 * unlocked once, the key agreements run in parallel and the state is only persisted once.
+	 * Conversations that fail don't affect the others, their status is reported instead.
+	 */
+	static result<SendConversationsResult> start_send_conversations(
+			const span<const std::byte> sender_id,
+			const span<const ConversationStart> starts,
 			const CreateBackup create_backup) {
-		//find the conversation
-		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
-		Molch::User* user;
-		auto conversation{users.findConversation(user, conversation_id_key)};
-		if (conversation == nullptr) {
-			return Error(status_type::NOT_FOUND, "Failed to find conversation with the given ID.");
+		//get the user that matches the public signing key of the sender
+		OUTCOME_TRY(sender_public_master_key, PublicSigningKey::fromSpan(sender_id));
+		auto user{users.find(sender_public_master_key)};
+		if (user == nullptr) {
+			return Error(status_type::NOT_FOUND, "User not found.");
 		}
 
-		OUTCOME_TRY(received_message, conversation->receive(packet));
+		//look up the prekey lists that have been verified before
+		std::vector<std::optional<PrekeyListHash>> prekey_list_hashes(starts.size());
+		std::vector<bool> already_verified(starts.size(), false);
+		for (size_t index{0}; index < starts.size(); index++) {
+			const auto& start{starts[index]};
+			auto receiver_public_master_key{PublicSigningKey::fromSpan(start.receiver_id)};
+			auto hash{hash_prekey_list(start.prekey_list)};
+			if (receiver_public_master_key.has_value() && hash.has_value()) {
+				already_verified[index] = verified_prekey_lists.contains(receiver_public_master_key.value(), hash.value());
+				prekey_list_hashes[index] = hash.value();
+			}
+		}
 
-		DecryptResult decrypt_result;
+		SendConversationsResult conversations_result;
+		conversations_result.conversations.resize(starts.size());
+		std::vector<std::optional<SendConversation>> send_conversations(starts.size());
+		std::vector<int64_t> expiration_dates(starts.size(), 0);
+		{
+			MasterKeys::Unlocker unlocker{user->masterKeys()};
+			OUTCOME_TRY(private_identity_key, user->masterKeys().getPrivateIdentityKey());
+
+			//create the conversations and encrypt the messages, they are independent of each other
+			OUTCOME_TRY(parallel_for(starts.size(), [&](const size_t index) -> result<void> {
+				const auto started{[&]() -> result<void> {
+					const auto& start{starts[index]};
+					OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(start.receiver_id));
+					OUTCOME_TRY(verified_prekey_list, check_prekey_list(start.prekey_list, receiver_public_master_key, already_verified[index]));
+					expiration_dates[index] = verified_prekey_list.expiration_date;
+					OUTCOME_TRY(send_conversation, Molch::Conversation::createSendConversation(
+							start.message,
+							user->masterKeys().getIdentityKey(),
+							*private_identity_key,
+							verified_prekey_list.identity,
+							verified_prekey_list.prekeys));
+					send_conversations[index].emplace(std::move(send_conversation));
+					return outcome::success();
+				}()};
+				if (started.has_error()) {
+					conversations_result.conversations[index].status = started.error().type;
+				}
 
-		decrypt_result.message = received_message.message;
-		decrypt_result.message_number = received_message.message_number;
-		decrypt_result.previous_message_number = received_message.previous_message_number;
+				return outcome::success();
+			}));
+		}
+
+		for (size_t index{0}; index < starts.size(); index++) {
+			auto& send_conversation{send_conversations[index]};
+			if (!send_conversation.has_value()) {
+				continue;
+			}
+
+			if (!already_verified[index]) {
+				OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(starts[index].receiver_id));
+				verified_prekey_lists.add(receiver_public_master_key, prekey_list_hashes[index].value(), expiration_dates[index]);
+			}
+
+			auto& started{conversations_result.conversations[index]};
+			started.conversation_id = send_conversation->conversation.id();
+			started.packet = send_conversation->packet;
+			OUTCOME_TRY(user->conversations.add(std::move(send_conversation->conversation)));
+		}
+		OUTCOME_TRY(persist_state());
 
 		if (create_backup == CreateBackup::YES) {
-			OUTCOME_TRY(created_backup, export_conversation(conversation_id));
-			decrypt_result.conversation_backup = std::move(created_backup);
+			OUTCOME_TRY(backup, export_all());
+			conversations_result.backup = std::move(backup);
 		}
 
-		return decrypt_result;
+		return conversations_result;
 	}
 
-	MOLCH_PUBLIC(return_status) molch_decrypt_message(
+	MOLCH_PUBLIC(return_status) molch_start_send_conversations(
 			//outputs
-			unsigned char ** const message, //free after use
-			size_t *message_length,
-			uint32_t * const receive_message_number,
-			uint32_t * const previous_receive_message_number,
+			unsigned char * const conversation_ids, //count * CONVERSATION_ID_SIZE long
+			const size_t conversation_ids_length,
+			unsigned char ** const packets, //count long, free every packet with molch_free after use
+			size_t * const packet_lengths, //count long
+			status_type * const conversation_statuses, //count long
 			//inputs
-			const unsigned char * const conversation_id,
-			const size_t conversation_id_length,
-			const unsigned char * const packet,
-			const size_t packet_length,
+			const unsigned char * const sender_public_master_key, //signing key of the sender (user)
+			const size_t sender_public_master_key_length,
+			const unsigned char * const receiver_public_master_keys, //count * PUBLIC_MASTER_KEY_SIZE long
+			const size_t receiver_public_master_keys_length,
+			const unsigned char * const * const prekey_lists, //count long
+			const size_t * const prekey_list_lengths,
+			const unsigned char * const * const messages, //count long
+			const size_t * const message_lengths,
+			const size_t count,
 			//optional output (can be nullptr)
-			unsigned char ** const conversation_backup, //exports the conversation, free after use, check if nullptr before use!
-			size_t * const conversation_backup_length) {
-		if ((message == nullptr) or (message_length == nullptr)
-				or (receive_message_number == nullptr) or (previous_receive_message_number == nullptr)
-				or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
-				or (packet == nullptr)
-				or ((conversation_backup != nullptr) and (conversation_backup_length == nullptr))) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_decrypt_message."};
+			unsigned char ** const backup, //exports the entire library state, free after use, check if nullptr before use!
+			size_t * const backup_length
+			) {
+		if ((count == 0)
+				or (conversation_ids == nullptr) or (conversation_ids_length != (count * CONVERSATION_ID_SIZE))
+				or (packets == nullptr) or (packet_lengths == nullptr) or (conversation_statuses == nullptr)
+				or (sender_public_master_key == nullptr) or (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				or (receiver_public_master_keys == nullptr) or (receiver_public_master_keys_length != (count * PUBLIC_MASTER_KEY_SIZE))
+				or (prekey_lists == nullptr) or (prekey_list_lengths == nullptr)
+				or (messages == nullptr) or (message_lengths == nullptr)
+				or ((backup != nullptr) and (backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_start_send_conversations"};
 		}
 
 		try {
+			std::vector<ConversationStart> starts;
+			starts.reserve(count);
+			for (size_t index{0}; index < count; index++) {
+				if ((prekey_lists[index] == nullptr) or (messages[index] == nullptr)) {
+					return {status_type::INVALID_VALUE, "Invalid input to molch_start_send_conversations"};
+				}
+				starts.push_back({
+						{uchar_to_byte(receiver_public_master_keys + (index * PUBLIC_MASTER_KEY_SIZE)), PUBLIC_MASTER_KEY_SIZE},
+						{uchar_to_byte(prekey_lists[index]), prekey_list_lengths[index]},
+						{uchar_to_byte(messages[index]), message_lengths[index]}});
+			}
+
 			const auto create_backup{[&](){
-				if (conversation_backup == nullptr) {
+				if (backup == nullptr) {
 					return CreateBackup::NO;
 				}
 
 				return CreateBackup::YES;
 			}()};
-			auto decrypted_message_result = decrypt_message(
-					{uchar_to_byte(conversation_id), conversation_id_length},
-					{uchar_to_byte(packet), packet_length},
+			auto conversations_result = start_send_conversations(
+					{uchar_to_byte(sender_public_master_key), sender_public_master_key_length},
+					starts,
 					create_backup);
-			if (decrypted_message_result.has_error()) {
-				return decrypted_message_result.error().toReturnStatus();
+			if (conversations_result.has_error()) {
+				return conversations_result.error().toReturnStatus();
+			}
+			auto& started{conversations_result.value()};
+
+			for (size_t index{0}; index < count; index++) {
+				auto& conversation{started.conversations[index]};
+				conversation_statuses[index] = conversation.status;
+				std::copy(std::cbegin(conversation.conversation_id), std::cend(conversation.conversation_id), uchar_to_byte(conversation_ids + (index * CONVERSATION_ID_SIZE)));
+				packet_lengths[index] = conversation.packet.size();
+				packets[index] = byte_to_uchar(conversation.packet.release());
 			}
-			auto& decrypted_message = decrypted_message_result.value();
-
-			*message_length = decrypted_message.message.size();
-			*message = byte_to_uchar(decrypted_message.message.release());
-
-			*receive_message_number = decrypted_message.message_number;
-			*previous_receive_message_number = decrypted_message.previous_message_number;
 
 			if (create_backup == CreateBackup::YES) {
-				auto& created_backup = decrypted_message.conversation_backup.value();
-				*conversation_backup_length = created_backup.size();
-				*conversation_backup = byte_to_uchar(created_backup.release());
+				auto& created_backup{started.backup.value()};
+				*backup_length = created_backup.size();
+				*backup = byte_to_uchar(created_backup.release());
 			}
 		} catch (const std::exception& exception) {
 			return {status_type::EXCEPTION, exception.what()};
@@ -915,37 +1262,101 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	static result<std::optional<MallocBuffer>> end_conversation(const span<const std::byte> conversation_id_span, CreateBackup create_backup) {
-		//find the conversation
-		OUTCOME_TRY(conversation_id, ConversationId::fromSpan(conversation_id_span));
-		Molch::User *user{nullptr};
-		auto conversation{users.findConversation(user, conversation_id)};
-		if (conversation == nullptr) {
-			return Error(status_type::NOT_FOUND, "Couldn't find conversation.");
+	struct ReceiveConversationResult {
+		ConversationId conversation_id;
+		MallocBuffer prekey_list;
+		MallocBuffer message;
+		std::optional<MallocBuffer> backup;
+	};
+
+	static result<ReceiveConversationResult> start_receive_conversation(
+			const span<const std::byte> receiver_id,
+			const span<const std::byte> sender_id,
+			const span<const std::byte> packet,
+			CreateBackup create_backup) {
+		(void)sender_id;
+		//get the user that matches the public signing key of the receiver
+		OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(receiver_id));
+		auto user{users.find(receiver_public_master_key)};
+		if (user == nullptr) {
+			return Error(status_type::NOT_FOUND, "User not found in the user store.");
 		}
 
-		user->conversations.remove(conversation_id);
+		//a packet that has been delivered again gets the conversation that was created the first time
+		OUTCOME_TRY(packet_hash, hash_packet(packet));
+		const auto already_received{find_received_prekey_packet(*user, packet_hash)};
+		if (already_received != nullptr) {
+			//nothing changes, so there is no new prekey list and no backup
+			ReceiveConversationResult conversation_result;
+			conversation_result.conversation_id = already_received->conversation_id;
+			conversation_result.message = already_received->message;
+			return conversation_result;
+		}
+
+		//unlock the master keys
+		MasterKeys::Unlocker unlocker(user->masterKeys());
+
+		//create the conversation
+		OUTCOME_TRY(private_identity_key, user->masterKeys().getPrivateIdentityKey());
+		OUTCOME_TRY(receive_conversation, Molch::Conversation::createReceiveConversation(
+				packet,
+				user->masterKeys().getIdentityKey(),
+				*private_identity_key,
+				user->prekeys));
+
+		//copy the conversation id
+		ReceiveConversationResult conversation_result;
+		conversation_result.conversation_id = receive_conversation.conversation.id();
+
+		//create the prekey list
+		OUTCOME_TRY(prekey_list, create_prekey_list(receiver_public_master_key));
+		conversation_result.prekey_list = std::move(prekey_list);
+
+		//add the conversation to the conversation store
+		OUTCOME_TRY(user->conversations.add(std::move(receive_conversation.conversation)));
+		OUTCOME_TRY(remember_received_prekey_packet(receiver_public_master_key, packet_hash, conversation_result.conversation_id, receive_conversation.message));
+		OUTCOME_TRY(persist_state());
+
+		//copy the message
+		conversation_result.message = receive_conversation.message;
 
 		if (create_backup == CreateBackup::YES) {
-			OUTCOME_TRY(created_backup, export_all());
-			return {std::move(created_backup)};
+			OUTCOME_TRY(backup, export_all());
+			conversation_result.backup = std::move(backup);
 		}
 
-		return std::nullopt;
+		return conversation_result;
 	}
 
-	MOLCH_PUBLIC(return_status) molch_end_conversation(
-			//input
-			const unsigned char * const conversation_id,
+	MOLCH_PUBLIC(return_status) molch_start_receive_conversation(
+			//outputs
+			unsigned char * const conversation_id, //CONVERSATION_ID_SIZE long (from conversation.h)
 			const size_t conversation_id_length,
+			unsigned char ** const prekey_list, //free with molch_free after use
+			size_t * const prekey_list_length,
+			unsigned char ** const message, //free with molch_free after use
+			size_t * const message_length,
+			//inputs
+			const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
+			const size_t receiver_public_master_key_length,
+			const unsigned char * const sender_public_master_key, //signing key of the sender
+			const size_t sender_public_master_key_length,
+			const unsigned char * const packet, //received prekey packet
+			const size_t packet_length,
 			//optional output (can be nullptr)
-			unsigned char ** const backup,
+			unsigned char ** const backup, //exports the entire library state, free after use, check if nullptr before use!
 			size_t * const backup_length
 			) {
 		if ((conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
+				or (prekey_list == nullptr) or (prekey_list_length == nullptr)
+				or (message == nullptr) or (message_length == nullptr)
+				or (receiver_public_master_key == nullptr) or (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				or (sender_public_master_key == nullptr) or (sender_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				or (packet == nullptr)
 				or ((backup != nullptr) and (backup_length == nullptr))) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_end_conversation"};
+			return {status_type::INVALID_VALUE, "Invalid input to molch_start_receive_conversation"};
 		}
+
 		try {
 			const auto create_backup{[&](){
 				if (backup == nullptr) {
@@ -954,15 +1365,27 @@ static result<PublicKey> verify_prekey_list(
 
 				return CreateBackup::YES;
 			}()};
-
-			auto backup_result = end_conversation({uchar_to_byte(conversation_id), conversation_id_length}, create_backup);
-			if (backup_result.has_error()) {
-				return backup_result.error().toReturnStatus();
+			auto conversation_result = start_receive_conversation(
+					{uchar_to_byte(receiver_public_master_key), receiver_public_master_key_length},
+					{uchar_to_byte(sender_public_master_key), sender_public_master_key_length},
+					{uchar_to_byte(packet), packet_length},
+					create_backup);
+			if (conversation_result.has_error()) {
+				return conversation_result.error().toReturnStatus();
 			}
+			auto& conversation{conversation_result.value()};
+			std::copy(std::cbegin(conversation.conversation_id), std::cend(conversation.conversation_id), uchar_to_byte(conversation_id));
+
+			*prekey_list_length = conversation.prekey_list.size();
+			*prekey_list = byte_to_uchar(conversation.prekey_list.release());
+
+			*message_length = conversation.message.size();
+			*message = byte_to_uchar(conversation.message.release());
+
 			if (create_backup == CreateBackup::YES) {
-				auto& created_backup{backup_result.value().value()};
-				*backup_length = created_backup.size();
-				*backup = byte_to_uchar(created_backup.release());
+				auto& created_backup{conversation.backup};
+				*backup_length = created_backup.has_value() ? created_backup->size() : 0;
+				*backup = created_backup.has_value() ? byte_to_uchar(created_backup->release()) : nullptr;
 			}
 		} catch (const std::exception& exception) {
 			return {status_type::EXCEPTION, exception.what()};
@@ -971,60 +1394,179 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	struct ConversationList {
-		MallocBuffer list;
-		size_t amount = 0;
+	struct ReceivedConversation {
+		status_type status{status_type::SUCCESS};
+		ConversationId conversation_id;
+		MallocBuffer message;
 	};
 
-	static result<ConversationList> list_conversations(const span<const std::byte> user_public_master_key_span) {
-		OUTCOME_TRY(user_public_master_key, PublicSigningKey::fromSpan(user_public_master_key_span));
-		auto user = users.find(user_public_master_key);
+	struct ReceiveConversationsResult {
+		std::vector<ReceivedConversation> conversations;
+		MallocBuffer prekey_list;
+		std::optional<MallocBuffer> backup;
+	};
+
+	/*
+	 * Like start_receive_conversation, but for many prekey packets of the same receiver.
+	 * The prekey list is only regenerated and the state only persisted once at the end.
+	 * Packets that fail don't affect the others, their status is reported instead.
+	 */
+	static result<ReceiveConversationsResult> start_receive_conversations(
+			const span<const std::byte> receiver_id,
+			const span<const span<const std::byte>> packets,
+			CreateBackup create_backup) {
+		//get the user that matches the public signing key of the receiver
+		OUTCOME_TRY(receiver_public_master_key, PublicSigningKey::fromSpan(receiver_id));
+		auto user{users.find(receiver_public_master_key)};
 		if (user == nullptr) {
-			return Error(status_type::NOT_FOUND, "No user found for the given public identity.");
+			return Error(status_type::NOT_FOUND, "User not found in the user store.");
 		}
 
-		ConversationList conversation_list;
-		OUTCOME_TRY(conversation_list_buffer, user->conversations.list());
-		if (conversation_list_buffer.empty()) {
-			conversation_list.amount = 0;
-			return conversation_list;
+		ReceiveConversationsResult conversations_result;
+		conversations_result.conversations.resize(packets.size());
+		std::vector<Conversation> created_conversations;
+		created_conversations.reserve(packets.size());
+		//first packet in this batch with a given hash, packets that were delivered more than once are only received once
+		std::map<PacketHash,size_t> first_packets;
+		{
+			//unlock the master keys
+			MasterKeys::Unlocker unlocker(user->masterKeys());
+			OUTCOME_TRY(private_identity_key, user->masterKeys().getPrivateIdentityKey());
+
+			//create the conversations
+			for (size_t index{0}; index < packets.size(); index++) {
+				auto& received{conversations_result.conversations[index]};
+				OUTCOME_TRY(packet_hash, hash_packet(packets[index]));
+				const auto already_received{find_received_prekey_packet(*user, packet_hash)};
+				if (already_received != nullptr) {
+					received.conversation_id = already_received->conversation_id;
+					received.message = already_received->message;
+					continue;
+				}
+				const auto first_packet{first_packets.find(packet_hash)};
+				if (first_packet != std::cend(first_packets)) {
+					const auto& first_received{conversations_result.conversations[first_packet->second]};
+					received.status = first_received.status;
+					received.conversation_id = first_received.conversation_id;
+					received.message = MallocBuffer{first_received.message};
+					continue;
+				}
+				first_packets.emplace(packet_hash, index);
+
+				auto receive_conversation{Molch::Conversation::createReceiveConversation(
+						packets[index],
+						user->masterKeys().getIdentityKey(),
+						*private_identity_key,
+						user->prekeys)};
+				if (receive_conversation.has_error()) {
+					received.status = receive_conversation.error().type;
+				} else {
+					received.conversation_id = receive_conversation.value().conversation.id();
+					received.message = receive_conversation.value().message;
+					created_conversations.push_back(std::move(receive_conversation.value().conversation));
+				}
+			}
 		}
 
-		if ((conversation_list_buffer.size() % CONVERSATION_ID_SIZE) != 0) {
-			return Error(status_type::INCORRECT_BUFFER_SIZE, "The conversation ID buffer has an incorrect length.");
+		//every packet has been received before, nothing changes
+		if (first_packets.empty()) {
+			return conversations_result;
 		}
-		conversation_list.amount = conversation_list_buffer.size() / CONVERSATION_ID_SIZE;
 
-		conversation_list.list = conversation_list_buffer;
-		return conversation_list;
+		//create the prekey list
+		OUTCOME_TRY(prekey_list, create_prekey_list(receiver_public_master_key));
+		conversations_result.prekey_list = std::move(prekey_list);
+
+		//add the conversations to the conversation store
+		for (auto& conversation : created_conversations) {
+			OUTCOME_TRY(user->conversations.add(std::move(conversation)));
+		}
+		for (const auto& [packet_hash, index] : first_packets) {
+			const auto& received{conversations_result.conversations[index]};
+			if (received.status == status_type::SUCCESS) {
+				OUTCOME_TRY(remember_received_prekey_packet(receiver_public_master_key, packet_hash, received.conversation_id, received.message));
+			}
+		}
+		OUTCOME_TRY(persist_state());
+
+		if (create_backup == CreateBackup::YES) {
+			OUTCOME_TRY(backup, export_all());
+			conversations_result.backup = std::move(backup);
+		}
+
+		return conversations_result;
 	}
 
-	MOLCH_PUBLIC(return_status) molch_list_conversations(
+	MOLCH_PUBLIC(return_status) molch_start_receive_conversations(
 			//outputs
-			unsigned char ** const conversation_list,
-			size_t * const conversation_list_length,
-			size_t * const number,
+			unsigned char * const conversation_ids, //packet_count * CONVERSATION_ID_SIZE long
+			const size_t conversation_ids_length,
+			unsigned char ** const messages, //packet_count long, free every message with molch_free after use
+			size_t * const message_lengths, //packet_count long
+			status_type * const packet_statuses, //packet_count long
+			unsigned char ** const prekey_list, //free with molch_free after use
+			size_t * const prekey_list_length,
 			//inputs
-			const unsigned char * const user_public_master_key,
-			const size_t user_public_master_key_length) {
-		if ((user_public_master_key == nullptr)
-				|| (user_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
-				|| (conversation_list == nullptr)
-				|| (conversation_list_length == nullptr)
-				|| (number == nullptr)) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_list_conversations."};
+			const unsigned char * const receiver_public_master_key, //signing key of the receiver (user)
+			const size_t receiver_public_master_key_length,
+			const unsigned char * const * const packets, //received prekey packets
+			const size_t * const packet_lengths,
+			const size_t packet_count,
+			//optional output (can be nullptr)
+			unsigned char ** const backup, //exports the entire library state, free after use, check if nullptr before use!
+			size_t * const backup_length
+			) {
+		if ((packets == nullptr) or (packet_lengths == nullptr) or (packet_count == 0)
+				or (conversation_ids == nullptr) or (conversation_ids_length != (packet_count * CONVERSATION_ID_SIZE))
+				or (messages == nullptr) or (message_lengths == nullptr) or (packet_statuses == nullptr)
+				or (prekey_list == nullptr) or (prekey_list_length == nullptr)
+				or (receiver_public_master_key == nullptr) or (receiver_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				or ((backup != nullptr) and (backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_start_receive_conversations"};
 		}
 
 		try {
-			auto conversation_list_result = list_conversations({uchar_to_byte(user_public_master_key), user_public_master_key_length});
-			if (conversation_list_result.has_error()) {
-				return conversation_list_result.error().toReturnStatus();
+			std::vector<span<const std::byte>> packet_spans;
+			packet_spans.reserve(packet_count);
+			for (size_t index{0}; index < packet_count; index++) {
+				if (packets[index] == nullptr) {
+					return {status_type::INVALID_VALUE, "Invalid input to molch_start_receive_conversations"};
+				}
+				packet_spans.emplace_back(uchar_to_byte(packets[index]), packet_lengths[index]);
 			}
-			auto& conversation_list_value = conversation_list_result.value();
 
-			*number = conversation_list_value.amount;
-			*conversation_list_length = conversation_list_value.list.size();
-			*conversation_list = byte_to_uchar(conversation_list_value.list.release());
+			const auto create_backup{[&](){
+				if (backup == nullptr) {
+					return CreateBackup::NO;
+				}
+
+				return CreateBackup::YES;
+			}()};
+			auto conversations_result = start_receive_conversations(
+					{uchar_to_byte(receiver_public_master_key), receiver_public_master_key_length},
+					packet_spans,
+					create_backup);
+			if (conversations_result.has_error()) {
+				return conversations_result.error().toReturnStatus();
+			}
+			auto& received{conversations_result.value()};
+
+			for (size_t index{0}; index < packet_count; index++) {
+				auto& conversation{received.conversations[index]};
+				packet_statuses[index] = conversation.status;
+				std::copy(std::cbegin(conversation.conversation_id), std::cend(conversation.conversation_id), uchar_to_byte(conversation_ids + (index * CONVERSATION_ID_SIZE)));
+				message_lengths[index] = conversation.message.size();
+				messages[index] = byte_to_uchar(conversation.message.release());
+			}
+
+			*prekey_list_length = received.prekey_list.size();
+			*prekey_list = byte_to_uchar(received.prekey_list.release());
+
+			if (create_backup == CreateBackup::YES) {
+				auto& created_backup{received.backup};
+				*backup_length = created_backup.has_value() ? created_backup->size() : 0;
+				*backup = created_backup.has_value() ? byte_to_uchar(created_backup->release()) : nullptr;
+			}
 		} catch (const std::exception& exception) {
 			return {status_type::EXCEPTION, exception.what()};
 		}
@@ -1032,40 +1574,1098 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	MOLCH_PUBLIC(char*) molch_print_status(size_t * const output_length, return_status status) {
-		if (output_length == nullptr) {
-			return nullptr;
+	struct EncryptedConversationBackup {
+		MallocBuffer backup;
+		BackupHash hash;
+	};
+
+	/*
+	 * Encrypt a packed conversation, conversation delta or user with the global backup key
+	 * and wrap it in an encrypted backup.
+	 */
+	static result<EncryptedConversationBackup> encrypt_conversation_backup(
+			const span<const std::byte> plaintext,
+			const Molch__Protobuf__EncryptedBackup__BackupType backup_type) {
+		ProtobufCEncryptedBackup encrypted_backup_struct;
+		molch__protobuf__encrypted_backup__init(&encrypted_backup_struct);
+
+		//generate the nonce
+		Buffer backup_nonce(BACKUP_NONCE_SIZE, BACKUP_NONCE_SIZE);
+		randombytes_buf(backup_nonce);
+
+		//allocate the output
+		Buffer backup_buffer{plaintext.size() + crypto_secretbox_MACBYTES, plaintext.size() + crypto_secretbox_MACBYTES};
+
+		//encrypt the backup
+		GlobalBackupKeyUnlocker unlocker;
+		auto status{crypto_secretbox_easy(
+				byte_to_uchar(backup_buffer.data()),
+				byte_to_uchar(plaintext.data()),
+				plaintext.size(),
+				byte_to_uchar(backup_nonce.data()),
+				byte_to_uchar(global_backup_key->data()))};
+		if (status != 0) {
+			OUTCOME_TRY(backup_buffer.setSize(0));
+			return Error(status_type::ENCRYPT_ERROR, "Failed to enrypt conversation state.");
 		}
 
-		auto printed{return_status_print(status)};
-		*output_length = printed.size();
-		return printed.data();
+		//fill in the encrypted backup struct
+		//metadata
+		encrypted_backup_struct.backup_version = 0;
+		encrypted_backup_struct.has_backup_type = true;
+		encrypted_backup_struct.backup_type = backup_type;
+		//nonce
+		encrypted_backup_struct.has_encrypted_backup_nonce = true;
+		encrypted_backup_struct.encrypted_backup_nonce.data = byte_to_uchar(backup_nonce.data());
+		encrypted_backup_struct.encrypted_backup_nonce.len = backup_nonce.size();
+		//encrypted backup
+		encrypted_backup_struct.has_encrypted_backup = true;
+		encrypted_backup_struct.encrypted_backup.data = byte_to_uchar(backup_buffer.data());
+		encrypted_backup_struct.encrypted_backup.len = backup_buffer.size();
+
+		OUTCOME_TRY(hash, hash_encrypted_backup(backup_nonce, backup_buffer));
+
+		//now pack the entire backup
+		const auto encrypted_backup_size{molch__protobuf__encrypted_backup__get_packed_size(&encrypted_backup_struct)};
+		MallocBuffer malloced_encrypted_backup{encrypted_backup_size, 0};
+		OUTCOME_TRY(malloced_encrypted_backup.setSize(molch__protobuf__encrypted_backup__pack(&encrypted_backup_struct, byte_to_uchar(malloced_encrypted_backup.data()))));
+		if (malloced_encrypted_backup.size() != encrypted_backup_size) {
+			return Error(status_type::PROTOBUF_PACK_ERROR, "Failed to pack encrypted conversation.");
+		}
+
+		return EncryptedConversationBackup{std::move(malloced_encrypted_backup), hash};
 	}
 
-	MOLCH_PUBLIC(const char*) molch_print_status_type(status_type type) {
-		return return_status_get_name(type);
-	}
+	/*
+	 * Encrypt a full backup of a conversation, the hash can become the base for deltas.
+	 */
+	static result<EncryptedConversationBackup> export_full_conversation(const Conversation& conversation) {
+		//export the conversation
+		Arena arena;
+		OUTCOME_TRY(conversation_struct, conversation.exportProtobuf(arena));
+
+		//pack the struct
+		auto conversation_size{molch__protobuf__conversation__get_packed_size(conversation_struct)};
+		auto conversation_buffer_content{arena.allocate<std::byte>(conversation_size)};
+		span<std::byte> conversation_buffer{conversation_buffer_content, conversation_size};
+		molch__protobuf__conversation__pack(conversation_struct, byte_to_uchar(conversation_buffer.data()));
+
+		return encrypt_conversation_backup(conversation_buffer, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP);
+	}
+
+	static result<MallocBuffer> export_conversation(const span<const std::byte> conversation_id) {
+		if ((global_backup_key == nullptr) || (global_backup_key->size() != BACKUP_KEY_SIZE)) {
+			return Error(status_type::INCORRECT_DATA, "No backup key found.");
+		}
+
+		//find the conversation
+		Molch::User *user{nullptr};
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id_key));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find the conversation.");
+		}
+
+		OUTCOME_TRY(encrypted_backup, export_full_conversation(*conversation));
+
+		return std::move(encrypted_backup.backup);
+	}
+
+	/*
+	 * Export many conversations into one backup that is encrypted at once.
+	 * The conversation ids are concatenated like in molch_list_conversations.
+	 */
+	static result<MallocBuffer> export_conversations(const span<const std::byte> conversation_ids) {
+		if ((global_backup_key == nullptr) || (global_backup_key->size() != BACKUP_KEY_SIZE)) {
+			return Error(status_type::INCORRECT_DATA, "No backup key found.");
+		}
+		if (conversation_ids.empty() || ((conversation_ids.size() % CONVERSATION_ID_SIZE) != 0)) {
+			return Error(status_type::INVALID_VALUE, "Invalid list of conversation ids.");
+		}
+		const auto conversation_count{conversation_ids.size() / CONVERSATION_ID_SIZE};
+
+		//export the conversations, dormant ones stay dormant
+		Arena arena;
+		auto conversation_structs{arena.allocate<ProtobufCConversation*>(conversation_count)};
+		for (size_t index{0}; index < conversation_count; index++) {
+			OUTCOME_TRY(conversation_id, ConversationId::fromSpan(conversation_ids.subspan(index * CONVERSATION_ID_SIZE, CONVERSATION_ID_SIZE)));
+			const auto owner{users.findConversationOwner(conversation_id)};
+			if (owner == nullptr) {
+				return Error(status_type::NOT_FOUND, "Failed to find the conversation.");
+			}
+
+			OUTCOME_TRY(conversation_struct, owner->conversations.exportProtobuf(conversation_id, arena));
+			if (conversation_struct == nullptr) {
+				return Error(status_type::NOT_FOUND, "Failed to find the conversation.");
+			}
+			conversation_structs[index] = conversation_struct;
+		}
+
+		//pack the struct
+		ProtobufCConversationsBackup conversations_backup_struct;
+		molch__protobuf__conversations_backup__init(&conversations_backup_struct);
+		conversations_backup_struct.n_conversations = conversation_count;
+		conversations_backup_struct.conversations = conversation_structs;
+		const auto conversations_size{molch__protobuf__conversations_backup__get_packed_size(&conversations_backup_struct)};
+		auto conversations_buffer_content{arena.allocate<std::byte>(conversations_size)};
+		span<std::byte> conversations_buffer{conversations_buffer_content, conversations_size};
+		molch__protobuf__conversations_backup__pack(&conversations_backup_struct, byte_to_uchar(conversations_buffer.data()));
+
+		OUTCOME_TRY(encrypted_backup, encrypt_conversation_backup(conversations_buffer, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATIONS_BACKUP));
+
+		return std::move(encrypted_backup.backup);
+	}
+
+	/*
+	 * Backup a conversation after it has changed. This only contains the changes
+	 * since the last backup this function created unless there is no full backup
+	 * of the conversation in the chain of deltas yet.
+	 */
+	static result<MallocBuffer> export_conversation_delta(const span<const std::byte> conversation_id) {
+		if ((global_backup_key == nullptr) || (global_backup_key->size() != BACKUP_KEY_SIZE)) {
+			return Error(status_type::INCORRECT_DATA, "No backup key found.");
+		}
+
+		//find the conversation
+		Molch::User *user{nullptr};
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id_key));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find the conversation.");
+		}
+
+		if (!conversation->hasBackupCheckpoint(backup_key_generation)) {
+			//start a new chain of deltas
+			OUTCOME_TRY(encrypted_backup, export_full_conversation(*conversation));
+			conversation->setBackupCheckpoint(encrypted_backup.hash, backup_key_generation);
+
+			return std::move(encrypted_backup.backup);
+		}
+
+		//export the changes
+		Arena arena;
+		OUTCOME_TRY(conversation_delta_struct, conversation->exportDeltaProtobuf(arena));
+
+		//pack the struct
+		auto delta_size{molch__protobuf__conversation_delta__get_packed_size(conversation_delta_struct)};
+		auto delta_buffer_content{arena.allocate<std::byte>(delta_size)};
+		span<std::byte> delta_buffer{delta_buffer_content, delta_size};
+		molch__protobuf__conversation_delta__pack(conversation_delta_struct, byte_to_uchar(delta_buffer.data()));
+
+		OUTCOME_TRY(encrypted_backup, encrypt_conversation_backup(delta_buffer, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_DELTA_BACKUP));
+		conversation->advanceBackupCheckpoint();
+
+		return std::move(encrypted_backup.backup);
+	}
+
+	struct EncryptResult {
+		MallocBuffer packet;
+		std::optional<MallocBuffer> conversation_backup;
+	};
+
+	static result<EncryptResult> encrypt_message(
+			const span<const std::byte> conversation_id,
+			const span<const std::byte> message,
+			const CreateBackup create_backup) {
+		//find the conversation
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
+		Molch::User *user;
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id_key));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find a conversation for the given ID.");
+		}
+
+		//encrypt directly into the output buffer
+		const auto packet_size{Conversation::packetSize(message.size(), molch_message_type::NORMAL_MESSAGE)};
+		EncryptResult encrypt_result;
+		encrypt_result.packet = MallocBuffer{packet_size, packet_size};
+		OUTCOME_TRY(packet, conversation->send(encrypt_result.packet, message, std::nullopt));
+		OUTCOME_TRY(encrypt_result.packet.setSize(packet.size()));
+		OUTCOME_TRY(persist_state());
+
+		if (create_backup == CreateBackup::YES) {
+			OUTCOME_TRY(conversation_backup, (conversation_backups == molch_conversation_backups::DELTA_BACKUPS) ? export_conversation_delta(conversation_id) : export_conversation(conversation_id));
+			encrypt_result.conversation_backup = std::move(conversation_backup);
+		}
+
+		return encrypt_result;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_encrypt_message(
+			//output
+			unsigned char ** const packet, //free with molch_free after use
+			size_t *packet_length,
+			//inputs
+			const unsigned char * const conversation_id,
+			const size_t conversation_id_length,
+			const unsigned char * const message,
+			const size_t message_length,
+			//optional output (can be nullptr)
+			unsigned char ** const conversation_backup, //exports the conversation, free after use, check if nullptr before use!
+			size_t * const conversation_backup_length
+			) {
+		if ((packet == nullptr) or (packet_length == nullptr)
+				or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
+				or (message == nullptr)
+				or ((conversation_backup != nullptr) and (conversation_backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_encrypt_message"};
+		}
+
+		try {
+			const auto create_backup{[&](){
+				if (conversation_backup == nullptr) {
+					return CreateBackup::NO;
+				}
+
+				return CreateBackup::YES;
+			}()};
+			auto encrypted_message_result = encrypt_message(
+					{uchar_to_byte(conversation_id), conversation_id_length},
+					{uchar_to_byte(message), message_length},
+					create_backup);
+			if (encrypted_message_result.has_error()) {
+				return encrypted_message_result.error().toReturnStatus();
+			}
+			auto& encrypted_message{encrypted_message_result.value()};
+
+			*packet_length = encrypted_message.packet.size();
+			*packet = byte_to_uchar(encrypted_message.packet.release());
+
+			if (create_backup == CreateBackup::YES) {
+				auto& backup{encrypted_message.conversation_backup.value()};
+				*conversation_backup_length = backup.size();
+				*conversation_backup = byte_to_uchar(backup.release());
+			}
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(size_t) molch_get_packet_size(const size_t message_length) {
+		return Conversation::packetSize(message_length, molch_message_type::NORMAL_MESSAGE);
+	}
+
+	static result<size_t> encrypt_message_to_buffer(
+			const span<std::byte> packet,
+			const span<const std::byte> conversation_id,
+			const span<const std::byte> message) {
+		//find the conversation
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
+		Molch::User *user;
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id_key));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find a conversation for the given ID.");
+		}
+
+		OUTCOME_TRY(encrypted_packet, conversation->send(packet, message, std::nullopt));
+		OUTCOME_TRY(persist_state());
+
+		return encrypted_packet.size();
+	}
+
+	MOLCH_PUBLIC(return_status) molch_encrypt_message_to_buffer(
+			//output
+			unsigned char * const packet,
+			const size_t packet_capacity,
+			size_t * const packet_length,
+			//inputs
+			const unsigned char * const conversation_id,
+			const size_t conversation_id_length,
+			const unsigned char * const message,
+			const size_t message_length) {
+		if ((packet == nullptr) or (packet_length == nullptr)
+				or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
+				or (message == nullptr)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_encrypt_message_to_buffer"};
+		}
+
+		try {
+			auto packet_length_result = encrypt_message_to_buffer(
+					{uchar_to_byte(packet), packet_capacity},
+					{uchar_to_byte(conversation_id), conversation_id_length},
+					{uchar_to_byte(message), message_length});
+			if (packet_length_result.has_error()) {
+				return packet_length_result.error().toReturnStatus();
+			}
+
+			*packet_length = packet_length_result.value();
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	struct DecryptResult {
+		uint32_t message_number = 0;
+		uint32_t previous_message_number = 0;
+		MallocBuffer message;
+		std::optional<MallocBuffer> conversation_backup;
+	};
+
+	static result<DecryptResult> decrypt_message(
+			const span<const std::byte> conversation_id,
+			const span<const std::byte> packet,
+			const CreateBackup create_backup) {
+		//find the conversation
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
+		Molch::User* user;
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id_key));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find conversation with the given ID.");
+		}
+
+		//decrypt directly into the output buffer
+		DecryptResult decrypt_result;
+		decrypt_result.message = MallocBuffer{packet.size(), packet.size()};
+		OUTCOME_TRY(received_message, conversation->receive(decrypt_result.message, packet));
+		OUTCOME_TRY(decrypt_result.message.setSize(received_message.message.size()));
+
+		decrypt_result.message_number = received_message.message_number;
+		decrypt_result.previous_message_number = received_message.previous_message_number;
+		OUTCOME_TRY(persist_state());
+
+		if (create_backup == CreateBackup::YES) {
+			OUTCOME_TRY(created_backup, (conversation_backups == molch_conversation_backups::DELTA_BACKUPS) ? export_conversation_delta(conversation_id) : export_conversation(conversation_id));
+			decrypt_result.conversation_backup = std::move(created_backup);
+		}
+
+		return decrypt_result;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_decrypt_message(
+			//outputs
+			unsigned char ** const message, //free with molch_free after use
+			size_t *message_length,
+			uint32_t * const receive_message_number,
+			uint32_t * const previous_receive_message_number,
+			//inputs
+			const unsigned char * const conversation_id,
+			const size_t conversation_id_length,
+			const unsigned char * const packet,
+			const size_t packet_length,
+			//optional output (can be nullptr)
+			unsigned char ** const conversation_backup, //exports the conversation, free after use, check if nullptr before use!
+			size_t * const conversation_backup_length) {
+		if ((message == nullptr) or (message_length == nullptr)
+				or (receive_message_number == nullptr) or (previous_receive_message_number == nullptr)
+				or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
+				or (packet == nullptr)
+				or ((conversation_backup != nullptr) and (conversation_backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_decrypt_message."};
+		}
+
+		try {
+			const auto create_backup{[&](){
+				if (conversation_backup == nullptr) {
+					return CreateBackup::NO;
+				}
+
+				return CreateBackup::YES;
+			}()};
+			auto decrypted_message_result = decrypt_message(
+					{uchar_to_byte(conversation_id), conversation_id_length},
+					{uchar_to_byte(packet), packet_length},
+					create_backup);
+			if (decrypted_message_result.has_error()) {
+				return decrypted_message_result.error().toReturnStatus();
+			}
+			auto& decrypted_message = decrypted_message_result.value();
+
+			*message_length = decrypted_message.message.size();
+			*message = byte_to_uchar(decrypted_message.message.release());
+
+			*receive_message_number = decrypted_message.message_number;
+			*previous_receive_message_number = decrypted_message.previous_message_number;
+
+			if (create_backup == CreateBackup::YES) {
+				auto& created_backup = decrypted_message.conversation_backup.value();
+				*conversation_backup_length = created_backup.size();
+				*conversation_backup = byte_to_uchar(created_backup.release());
+			}
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	static result<ReceivedMessageSpan> decrypt_message_to_buffer(
+			const span<std::byte> message,
+			const span<const std::byte> conversation_id,
+			const span<const std::byte> packet) {
+		//find the conversation
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan(conversation_id));
+		Molch::User* user;
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id_key));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find conversation with the given ID.");
+		}
+
+		OUTCOME_TRY(received_message, conversation->receive(message, packet));
+		OUTCOME_TRY(persist_state());
+
+		return received_message;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_decrypt_message_to_buffer(
+			//outputs
+			unsigned char * const message,
+			const size_t message_capacity,
+			size_t * const message_length,
+			uint32_t * const receive_message_number,
+			uint32_t * const previous_receive_message_number,
+			//inputs
+			const unsigned char * const conversation_id,
+			const size_t conversation_id_length,
+			const unsigned char * const packet,
+			const size_t packet_length) {
+		if ((message == nullptr) or (message_length == nullptr)
+				or (receive_message_number == nullptr) or (previous_receive_message_number == nullptr)
+				or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
+				or (packet == nullptr)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_decrypt_message_to_buffer."};
+		}
+
+		try {
+			auto received_message_result = decrypt_message_to_buffer(
+					{uchar_to_byte(message), message_capacity},
+					{uchar_to_byte(conversation_id), conversation_id_length},
+					{uchar_to_byte(packet), packet_length});
+			if (received_message_result.has_error()) {
+				return received_message_result.error().toReturnStatus();
+			}
+			const auto& received_message{received_message_result.value()};
+
+			*message_length = received_message.message.size();
+			*receive_message_number = received_message.message_number;
+			*previous_receive_message_number = received_message.previous_message_number;
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	static result<std::optional<MallocBuffer>> end_conversation(const span<const std::byte> conversation_id_span, CreateBackup create_backup) {
+		//find the conversation
+		OUTCOME_TRY(conversation_id, ConversationId::fromSpan(conversation_id_span));
+		Molch::User *user{nullptr};
+		OUTCOME_TRY(conversation, users.findConversation(user, conversation_id));
+		if (conversation == nullptr) {
+			return Error(status_type::NOT_FOUND, "Couldn't find conversation.");
+		}
+
+		user->conversations.remove(conversation_id);
+		forget_received_prekey_packets(conversation_id);
+		OUTCOME_TRY(persist_state());
+
+		if (create_backup == CreateBackup::YES) {
+			OUTCOME_TRY(created_backup, export_all());
+			return {std::move(created_backup)};
+		}
+
+		return std::nullopt;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_end_conversation(
+			//input
+			const unsigned char * const conversation_id,
+			const size_t conversation_id_length,
+			//optional output (can be nullptr)
+			unsigned char ** const backup,
+			size_t * const backup_length
+			) {
+		if ((conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)
+				or ((backup != nullptr) and (backup_length == nullptr))) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_end_conversation"};
+		}
+		try {
+			const auto create_backup{[&](){
+				if (backup == nullptr) {
+					return CreateBackup::NO;
+				}
+
+				return CreateBackup::YES;
+			}()};
+
+			auto backup_result = end_conversation({uchar_to_byte(conversation_id), conversation_id_length}, create_backup);
+			if (backup_result.has_error()) {
+				return backup_result.error().toReturnStatus();
+			}
+			if (create_backup == CreateBackup::YES) {
+				auto& created_backup{backup_result.value().value()};
+				*backup_length = created_backup.size();
+				*backup = byte_to_uchar(created_backup.release());
+			}
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	struct ConversationList {
+		MallocBuffer list;
+		size_t amount = 0;
+	};
+
+	static result<ConversationList> list_conversations(const span<const std::byte> user_public_master_key_span) {
+		OUTCOME_TRY(user_public_master_key, PublicSigningKey::fromSpan(user_public_master_key_span));
+		auto user = users.find(user_public_master_key);
+		if (user == nullptr) {
+			return Error(status_type::NOT_FOUND, "No user found for the given public identity.");
+		}
+
+		ConversationList conversation_list;
+		OUTCOME_TRY(conversation_list_buffer, user->conversations.list());
+		if (conversation_list_buffer.empty()) {
+			conversation_list.amount = 0;
+			return conversation_list;
+		}
+
+		if ((conversation_list_buffer.size() % CONVERSATION_ID_SIZE) != 0) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The conversation ID buffer has an incorrect length.");
+		}
+		conversation_list.amount = conversation_list_buffer.size() / CONVERSATION_ID_SIZE;
+
+		conversation_list.list = conversation_list_buffer;
+		return conversation_list;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_list_conversations(
+			//outputs
+			unsigned char ** const conversation_list,
+			size_t * const conversation_list_length,
+			size_t * const number,
+			//inputs
+			const unsigned char * const user_public_master_key,
+			const size_t user_public_master_key_length) {
+		if ((user_public_master_key == nullptr)
+				|| (user_public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				|| (conversation_list == nullptr)
+				|| (conversation_list_length == nullptr)
+				|| (number == nullptr)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_list_conversations."};
+		}
+
+		try {
+			auto conversation_list_result = list_conversations({uchar_to_byte(user_public_master_key), user_public_master_key_length});
+			if (conversation_list_result.has_error()) {
+				return conversation_list_result.error().toReturnStatus();
+			}
+			auto& conversation_list_value = conversation_list_result.value();
+
+			*number = conversation_list_value.amount;
+			*conversation_list_length = conversation_list_value.list.size();
+			*conversation_list = byte_to_uchar(conversation_list_value.list.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(char*) molch_print_status(size_t * const output_length, return_status status) {
+		if (output_length == nullptr) {
+			return nullptr;
+		}
+
+		auto printed{return_status_print(status)};
+		*output_length = printed.size();
+		return printed.data();
+	}
+
+	MOLCH_PUBLIC(const char*) molch_print_status_type(status_type type) {
+		return return_status_get_name(type);
+	}
+
+	MOLCH_PUBLIC(void) molch_destroy_return_status(return_status * const status) {
+		if (status == nullptr) {
+			return;
+		}
+	}
+
+	MOLCH_PUBLIC(return_status) molch_conversation_export(
+			//output
+			unsigned char ** const backup,
+			size_t * const backup_length,
+			//input
+			const unsigned char * const conversation_id,
+			const size_t conversation_id_length) {
+		if ((backup == nullptr) or (backup_length == nullptr)
+			or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)) {
+			return {status_type::INVALID_VALUE, "One of the inputs to molch_conversation_export was NULL or of incorrect length."};
+		}
+
+		try {
+			auto encrypted_backup_result = export_conversation({uchar_to_byte(conversation_id), conversation_id_length});
+			if (encrypted_backup_result.has_error()) {
+				return encrypted_backup_result.error().toReturnStatus();
+			}
+			auto& encrypted_backup{encrypted_backup_result.value()};
+			*backup_length = encrypted_backup.size();
+			*backup = byte_to_uchar(encrypted_backup.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_conversations_export(
+			//output
+			unsigned char ** const backup,
+			size_t * const backup_length,
+			//input
+			const unsigned char * const conversation_ids,
+			const size_t conversation_ids_length) {
+		if ((backup == nullptr) or (backup_length == nullptr)
+			or (conversation_ids == nullptr) or (conversation_ids_length == 0) or ((conversation_ids_length % CONVERSATION_ID_SIZE) != 0)) {
+			return {status_type::INVALID_VALUE, "One of the inputs to molch_conversations_export was NULL or of incorrect length."};
+		}
+
+		try {
+			auto encrypted_backup_result = export_conversations({uchar_to_byte(conversation_ids), conversation_ids_length});
+			if (encrypted_backup_result.has_error()) {
+				return encrypted_backup_result.error().toReturnStatus();
+			}
+			auto& encrypted_backup{encrypted_backup_result.value()};
+			*backup_length = encrypted_backup.size();
+			*backup = byte_to_uchar(encrypted_backup.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	static result<Molch::User*> find_conversation_owner(const ProtobufCBinaryData& conversation_id) {
+		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan({conversation_id}));
+		const auto owner{users.findConversationOwner(conversation_id_key)};
+		if (owner == nullptr) {
+			return Error(status_type::NOT_FOUND, "Containing store not found.");
+		}
+
+		return owner;
+	}
+
+	/*
+	 * Replace existing conversations with the ones from a backup. All of
+	 * them are imported before the first one is added, so a broken backup
+	 * doesn't change anything.
+	 */
+	static result<void> import_conversation_structs(
+			const span<ProtobufCConversation*> conversation_structs,
+			const BackupHash& backup_hash) {
+		std::vector<std::pair<Molch::User*,Conversation>> imported_conversations;
+		imported_conversations.reserve(conversation_structs.size());
+		for (const auto conversation_struct : conversation_structs) {
+			if (conversation_struct == nullptr) {
+				return Error(status_type::PROTOBUF_MISSING_ERROR, "Invalid conversation in the backup.");
+			}
+
+			OUTCOME_TRY(owner, find_conversation_owner(conversation_struct->id));
+			OUTCOME_TRY(conversation, Conversation::import(*conversation_struct));
+			//deltas that have been exported after this backup can be applied on top of it
+			conversation.setBackupCheckpoint(backup_hash, backup_key_generation);
+			imported_conversations.emplace_back(owner, std::move(conversation));
+		}
+
+		for (auto& [owner, conversation] : imported_conversations) {
+			OUTCOME_TRY(owner->conversations.add(std::move(conversation)));
+		}
+
+		return outcome::success();
+	}
+
+	/*
+	 * Import a conversation, conversation delta or conversations backup
+	 * without persisting the state or rotating the backup key.
+	 */
+	static result<void> import_conversation_backup(
+			const span<const std::byte> backup,
+			const span<const std::byte> backup_key) {
+		//unpack the encrypted backup
+		auto encrypted_backup_struct = std::unique_ptr<ProtobufCEncryptedBackup,EncryptedBackupDeleter>(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, std::size(backup), byte_to_uchar(std::data(backup))));
+		if (encrypted_backup_struct == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack encrypted backup from protobuf.");
+		}
+
+		//check the backup
+		if (encrypted_backup_struct->backup_version != 0) {
+			return Error(status_type::INCORRECT_DATA, "Incompatible backup.");
+		}
+		if (!encrypted_backup_struct->has_backup_type
+				|| ((encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)
+					&& (encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_DELTA_BACKUP)
+					&& (encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATIONS_BACKUP))) {
+			return Error(status_type::INCORRECT_DATA, "Backup is not a conversation backup.");
+		}
+		if (!encrypted_backup_struct->has_encrypted_backup || (encrypted_backup_struct->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted conversation state.");
+		}
+		if (!encrypted_backup_struct->has_encrypted_backup_nonce || (encrypted_backup_struct->encrypted_backup_nonce.len != BACKUP_NONCE_SIZE)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the nonce.");
+		}
+		const span<const std::byte> encrypted_backup{uchar_to_byte(encrypted_backup_struct->encrypted_backup.data), encrypted_backup_struct->encrypted_backup.len};
+		const span<const std::byte> backup_nonce{uchar_to_byte(encrypted_backup_struct->encrypted_backup_nonce.data), encrypted_backup_struct->encrypted_backup_nonce.len};
+
+		Arena arena;
+		auto decrypted_backup_content = arena.allocate<std::byte>(encrypted_backup.size() - crypto_secretbox_MACBYTES);
+		auto decrypted_backup = span<std::byte>(decrypted_backup_content, encrypted_backup.size() - crypto_secretbox_MACBYTES);
+
+		//decrypt the backup
+		OUTCOME_TRY(crypto_secretbox_open_easy(
+				decrypted_backup,
+				encrypted_backup,
+				backup_nonce,
+				backup_key));
+
+		auto arena_protoc_allocator = arena.getProtobufCAllocator();
+		if (encrypted_backup_struct->backup_type == MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_DELTA_BACKUP) {
+			//unpack the struct
+			auto conversation_delta_struct = molch__protobuf__conversation_delta__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()));
+			if (conversation_delta_struct == nullptr) {
+				return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack conversation delta protobuf-c.");
+			}
+			if (conversation_delta_struct->changes == nullptr) {
+				return Error(status_type::PROTOBUF_MISSING_ERROR, "The conversation delta has no changes.");
+			}
+
+			//apply the delta to the conversation
+			OUTCOME_TRY(owner, find_conversation_owner(conversation_delta_struct->changes->id));
+			OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan({conversation_delta_struct->changes->id}));
+			OUTCOME_TRY(existing_conversation, owner->conversations.find(conversation_id_key));
+			if (existing_conversation == nullptr) {
+				return Error(status_type::NOT_FOUND, "Conversation to apply the delta to not found.");
+			}
+			return existing_conversation->applyDelta(*conversation_delta_struct);
+		}
+
+		OUTCOME_TRY(backup_hash, hash_encrypted_backup(backup_nonce, encrypted_backup));
+		if (encrypted_backup_struct->backup_type == MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATIONS_BACKUP) {
+			//unpack the struct
+			auto conversations_backup_struct = molch__protobuf__conversations_backup__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()));
+			if (conversations_backup_struct == nullptr) {
+				return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack conversations protobuf-c.");
+			}
+
+			return import_conversation_structs(
+					{conversations_backup_struct->conversations, conversations_backup_struct->n_conversations},
+					backup_hash);
+		}
+
+		//unpack the struct
+		auto conversation_struct = molch__protobuf__conversation__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()));
+		if (conversation_struct == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack conversations protobuf-c.");
+		}
+
+		return import_conversation_structs({&conversation_struct, static_cast<size_t>(1)}, backup_hash);
+	}
+
+	static result<BackupKey> import_conversation(const span<const std::byte> backup, const span<const std::byte> backup_key) {
+		const auto imported{import_conversation_backup(backup, backup_key)};
+		//conversations that have been added before a failure stay, so they are persisted either way
+		OUTCOME_TRY(persist_state());
+		OUTCOME_TRY(imported);
+
+		OUTCOME_TRY(updated_backup_key, update_backup_key());
+		return std::move(updated_backup_key);
+	}
+
+	/*
+	 * Import backups in order, the state is persisted
+	 * and the backup key rotated only once at the end.
+	 * If a backup fails, the ones before it stay imported.
+	 */
+	static result<BackupKey> import_conversations(const span<const span<const std::byte>> backups, const span<const std::byte> backup_key) {
+		const auto imported{[&]() -> result<void> {
+			for (const auto& backup : backups) {
+				OUTCOME_TRY(import_conversation_backup(backup, backup_key));
+			}
+
+			return outcome::success();
+		}()};
+		OUTCOME_TRY(persist_state());
+		OUTCOME_TRY(imported);
+
+		OUTCOME_TRY(updated_backup_key, update_backup_key());
+		return std::move(updated_backup_key);
+	}
+
+	MOLCH_PUBLIC(return_status) molch_conversation_import(
+			//output
+			unsigned char * new_backup_key,
+			const size_t new_backup_key_length,
+			//inputs
+			const unsigned char * const backup,
+			const size_t backup_length,
+			const unsigned char * backup_key,
+			const size_t backup_key_length) {
+		if ((backup == nullptr)
+				|| (backup_key == nullptr) || (backup_key_length != BACKUP_KEY_SIZE)
+				|| (new_backup_key == nullptr) || (new_backup_key_length != BACKUP_KEY_SIZE)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_conversation_import"};
+		}
+
+		try {
+			const auto new_backup_key_key_result = import_conversation({uchar_to_byte(backup), backup_length}, {uchar_to_byte(backup_key), backup_key_length});
+			if (new_backup_key_key_result.has_error()) {
+				return new_backup_key_key_result.error().toReturnStatus();
+			}
+			const auto& new_backup_key_key = new_backup_key_key_result.value();
+			std::copy(std::cbegin(new_backup_key_key), std::cend(new_backup_key_key), uchar_to_byte(new_backup_key));
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_conversations_import(
+			//output
+			unsigned char * new_backup_key,
+			const size_t new_backup_key_length,
+			//inputs
+			const unsigned char * const * const backups,
+			const size_t * const backup_lengths,
+			const size_t backup_count,
+			const unsigned char * backup_key,
+			const size_t backup_key_length) {
+		if ((backups == nullptr) || (backup_lengths == nullptr) || (backup_count == 0)
+				|| (backup_key == nullptr) || (backup_key_length != BACKUP_KEY_SIZE)
+				|| (new_backup_key == nullptr) || (new_backup_key_length != BACKUP_KEY_SIZE)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_conversations_import"};
+		}
+
+		try {
+			std::vector<span<const std::byte>> backup_spans;
+			backup_spans.reserve(backup_count);
+			for (size_t index{0}; index < backup_count; index++) {
+				if (backups[index] == nullptr) {
+					return {status_type::INVALID_VALUE, "Invalid input to molch_conversations_import"};
+				}
+				backup_spans.emplace_back(uchar_to_byte(backups[index]), backup_lengths[index]);
+			}
+
+			const auto new_backup_key_key_result = import_conversations(backup_spans, {uchar_to_byte(backup_key), backup_key_length});
+			if (new_backup_key_key_result.has_error()) {
+				return new_backup_key_key_result.error().toReturnStatus();
+			}
+			const auto& new_backup_key_key = new_backup_key_key_result.value();
+			std::copy(std::cbegin(new_backup_key_key), std::cend(new_backup_key_key), uchar_to_byte(new_backup_key));
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_export(
+			unsigned char ** const backup,
+			size_t *backup_length) {
+		if ((backup == nullptr) or (backup_length == nullptr)) {
+			return {status_type::INVALID_VALUE, "backup or backup_length are NULL"};
+		}
+
+		try {
+			auto exported_backup_result{export_all()};
+			if (exported_backup_result.has_error()) {
+				return exported_backup_result.error().toReturnStatus();
+			}
+			auto& exported_backup{exported_backup_result.value()};
+			//now pack the entire backup
+			*backup_length = exported_backup.size();
+			*backup = byte_to_uchar(exported_backup.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	static result<BackupKey> import_user_store(UserStore&& imported_user_store) {
+		OUTCOME_TRY(updated_backup_key, update_backup_key());
+
+		OUTCOME_TRY(imported_user_store.enforceConversationBudget());
+
+		//everything worked, switch to the new user store
+		users = std::move(imported_user_store);
+		OUTCOME_TRY(persist_state());
+
+		return std::move(updated_backup_key);
+	}
+
+	static result<BackupKey> import_all(
+			const span<const std::byte> backup,
+			const span<const std::byte> backup_key,
+			const ConversationImport conversation_import) {
+		OUTCOME_TRY(Molch::sodium_init());
+
+		//unpack the encrypted backup
+		auto encrypted_backup_struct = std::unique_ptr<ProtobufCEncryptedBackup,EncryptedBackupDeleter>(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, backup.size(), byte_to_uchar(backup.data())));
+		if (encrypted_backup_struct == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack encrypted backup from protobuf.");
+		}
+
+		//check the backup
+		if (encrypted_backup_struct->backup_version != 0) {
+			return Error(status_type::INCORRECT_DATA, "Incompatible backup.");
+		}
+
+		if (encrypted_backup_struct->has_backup_type && (encrypted_backup_struct->backup_type == MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__SEGMENTED_BACKUP)) {
+			OUTCOME_TRY(imported_user_store, import_segmented_backup(*encrypted_backup_struct, backup_key, conversation_import));
+			return import_user_store(std::move(imported_user_store));
+		}
+
+		if (!encrypted_backup_struct->has_backup_type || (encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__FULL_BACKUP)) {
+			return Error(status_type::INCORRECT_DATA, "Backup is not a full backup.");
+		}
+		if (!encrypted_backup_struct->has_encrypted_backup || (encrypted_backup_struct->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted state.");
+		}
+		if (!encrypted_backup_struct->has_encrypted_backup_nonce || (encrypted_backup_struct->encrypted_backup_nonce.len != BACKUP_NONCE_SIZE)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the nonce.");
+		}
+
+		Arena arena;
+		auto decrypted_backup_content = arena.allocate<std::byte>(encrypted_backup_struct->encrypted_backup.len - crypto_secretbox_MACBYTES);
+		auto decrypted_backup = span<std::byte>(decrypted_backup_content, encrypted_backup_struct->encrypted_backup.len - crypto_secretbox_MACBYTES);
+
+		//decrypt the backup
+		OUTCOME_TRY(crypto_secretbox_open_easy(
+				decrypted_backup,
+				{uchar_to_byte(encrypted_backup_struct->encrypted_backup.data), encrypted_backup_struct->encrypted_backup.len},
+				{uchar_to_byte(encrypted_backup_struct->encrypted_backup_nonce.data), encrypted_backup_struct->encrypted_backup_nonce.len},
+				backup_key));
+
+		//unpack the struct
+		auto arena_protoc_allocator = arena.getProtobufCAllocator();
+		auto backup_struct{molch__protobuf__backup__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()))};
+		if (backup_struct == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack backups protobuf-c.");
+		}
+
+		OUTCOME_TRY(imported_user_store, UserStore::import({backup_struct->users, backup_struct->n_users}));
+		return import_user_store(std::move(imported_user_store));
+	}
+
+	MOLCH_PUBLIC(return_status) molch_import(
+			//output
+			unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+			const size_t new_backup_key_length,
+			//inputs
+			const unsigned char * const backup,
+			const size_t backup_length,
+			const unsigned char * const backup_key, //BACKUP_KEY_SIZE
+			const size_t backup_key_length
+			) {
+		if ((backup == nullptr)
+				|| (backup_key == nullptr) || (backup_key_length != BACKUP_KEY_SIZE)
+				|| (new_backup_key == nullptr) || (new_backup_key_length != BACKUP_KEY_SIZE)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_import"};
+		}
+
+		try {
+			const auto new_backup_key_key_result = import_all(
+					{uchar_to_byte(backup), backup_length},
+					{uchar_to_byte(backup_key), backup_key_length},
+					ConversationImport::EAGER);
+			if (new_backup_key_key_result.has_error()) {
+				return new_backup_key_key_result.error().toReturnStatus();
+			}
+			const auto& new_backup_key_key = new_backup_key_key_result.value();
+			std::copy(std::cbegin(new_backup_key_key), std::cend(new_backup_key_key), uchar_to_byte(new_backup_key));
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_import_lazy(
+			//output
+			unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
+			const size_t new_backup_key_length,
+			//inputs
+			const unsigned char * const backup,
+			const size_t backup_length,
+			const unsigned char * const backup_key, //BACKUP_KEY_SIZE
+			const size_t backup_key_length
+			) {
+		if ((backup == nullptr)
+				|| (backup_key == nullptr) || (backup_key_length != BACKUP_KEY_SIZE)
+				|| (new_backup_key == nullptr) || (new_backup_key_length != BACKUP_KEY_SIZE)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_import_lazy"};
+		}
+
+		try {
+			const auto new_backup_key_key_result = import_all(
+					{uchar_to_byte(backup), backup_length},
+					{uchar_to_byte(backup_key), backup_key_length},
+					ConversationImport::LAZY);
+			if (new_backup_key_key_result.has_error()) {
+				return new_backup_key_key_result.error().toReturnStatus();
+			}
+			const auto& new_backup_key_key = new_backup_key_key_result.value();
+			std::copy(std::cbegin(new_backup_key_key), std::cend(new_backup_key_key), uchar_to_byte(new_backup_key));
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	/*
+	 * Export a user with its master keys, prekeys and conversations, so
+	 * it can be moved to another instance of molch.
+	 */
+	static result<MallocBuffer> export_user(const span<const std::byte> user_id) {
+		if ((global_backup_key == nullptr) || (global_backup_key->size() != BACKUP_KEY_SIZE)) {
+			return Error(status_type::INCORRECT_DATA, "No backup key found.");
+		}
+
+		//find the user
+		OUTCOME_TRY(user_id_key, PublicSigningKey::fromSpan(user_id));
+		auto user{users.find(user_id_key)};
+		if (user == nullptr) {
+			return Error(status_type::NOT_FOUND, "Failed to find the user to export.");
+		}
+
+		//export the user
+		Arena arena;
+		OUTCOME_TRY(user_struct, user->exportProtobuf(arena));
+
+		//pack the struct
+		const auto user_size{molch__protobuf__user__get_packed_size(user_struct)};
+		auto user_buffer_content{arena.allocate<std::byte>(user_size)};
+		span<std::byte> user_buffer{user_buffer_content, user_size};
+		molch__protobuf__user__pack(user_struct, byte_to_uchar(user_buffer.data()));
+
+		OUTCOME_TRY(encrypted_backup, encrypt_conversation_backup(user_buffer, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__USER_BACKUP));
+		sodium_memzero(user_buffer);
 
-	MOLCH_PUBLIC(void) molch_destroy_return_status(return_status * const status) {
-		if (status == nullptr) {
-			return;
-		}
+		return std::move(encrypted_backup.backup);
 	}
 
-	MOLCH_PUBLIC(return_status) molch_conversation_export(
+	MOLCH_PUBLIC(return_status) molch_export_user(
 			//output
 			unsigned char ** const backup,
 			size_t * const backup_length,
 			//input
-			const unsigned char * const conversation_id,
-			const size_t conversation_id_length) {
+			const unsigned char * const public_master_key,
+			const size_t public_master_key_length) {
 		if ((backup == nullptr) or (backup_length == nullptr)
-			or (conversation_id == nullptr) or (conversation_id_length != CONVERSATION_ID_SIZE)) {
-			return {status_type::INVALID_VALUE, "One of the inputs to molch_conversation_export was NULL or of incorrect length."};
+			or (public_master_key == nullptr) or (public_master_key_length != PUBLIC_MASTER_KEY_SIZE)) {
+			return {status_type::INVALID_VALUE, "One of the inputs to molch_export_user was NULL or of incorrect length."};
 		}
 
 		try {
-			auto encrypted_backup_result = export_conversation({uchar_to_byte(conversation_id), conversation_id_length});
+			auto encrypted_backup_result = export_user({uchar_to_byte(public_master_key), public_master_key_length});
 			if (encrypted_backup_result.has_error()) {
 				return encrypted_backup_result.error().toReturnStatus();
 			}
@@ -1079,9 +2679,15 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	static result<BackupKey> import_conversation(const span<const std::byte> backup, const span<const std::byte> backup_key) {
+	/*
+	 * Add a user from a user backup, replaces the user if it already
+	 * exists and leaves all other users untouched.
+	 */
+	static result<BackupKey> import_user(const span<const std::byte> backup, const span<const std::byte> backup_key) {
+		OUTCOME_TRY(Molch::sodium_init());
+
 		//unpack the encrypted backup
-		auto encrypted_backup_struct = std::unique_ptr<ProtobufCEncryptedBackup,EncryptedBackupDeleter>(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, std::size(backup), byte_to_uchar(std::data(backup))));
+		auto encrypted_backup_struct = std::unique_ptr<ProtobufCEncryptedBackup,EncryptedBackupDeleter>(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, backup.size(), byte_to_uchar(backup.data())));
 		if (encrypted_backup_struct == nullptr) {
 			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack encrypted backup from protobuf.");
 		}
@@ -1090,11 +2696,11 @@ static result<PublicKey> verify_prekey_list(
 		if (encrypted_backup_struct->backup_version != 0) {
 			return Error(status_type::INCORRECT_DATA, "Incompatible backup.");
 		}
-		if (!encrypted_backup_struct->has_backup_type || (encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)) {
-			return Error(status_type::INCORRECT_DATA, "Backup is not a conversation backup.");
+		if (!encrypted_backup_struct->has_backup_type || (encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__USER_BACKUP)) {
+			return Error(status_type::INCORRECT_DATA, "Backup is not a user backup.");
 		}
 		if (!encrypted_backup_struct->has_encrypted_backup || (encrypted_backup_struct->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
-			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted conversation state.");
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted user.");
 		}
 		if (!encrypted_backup_struct->has_encrypted_backup_nonce || (encrypted_backup_struct->encrypted_backup_nonce.len != BACKUP_NONCE_SIZE)) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the nonce.");
@@ -1111,46 +2717,42 @@ static result<PublicKey> verify_prekey_list(
 				{uchar_to_byte(encrypted_backup_struct->encrypted_backup_nonce.data), encrypted_backup_struct->encrypted_backup_nonce.len},
 				backup_key));
 
-		//unpack the struct
+		//unpack and import the user
 		auto arena_protoc_allocator = arena.getProtobufCAllocator();
-		auto conversation_struct = molch__protobuf__conversation__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()));
-		if (conversation_struct == nullptr) {
-			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack conversations protobuf-c.");
+		auto user_struct{molch__protobuf__user__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()))};
+		sodium_memzero(decrypted_backup);
+		if (user_struct == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack user protobuf-c.");
 		}
+		OUTCOME_TRY(user, Molch::User::import(*user_struct));
+		OUTCOME_TRY(user.conversations.enforceBudget());
 
-		//import the conversation
-		ProtobufCConversation conversation_pointer{*conversation_struct};
-		Molch::User* containing_user{nullptr};
-		OUTCOME_TRY(conversation_id_key, ConversationId::fromSpan({conversation_struct->id}));
-		auto existing_conversation{users.findConversation(containing_user, conversation_id_key)};
-		if (existing_conversation == nullptr) {
-			return Error(status_type::NOT_FOUND, "Containing store not found.");
-		}
+		OUTCOME_TRY(updated_backup_key, update_backup_key());
 
-		OUTCOME_TRY(conversation, Conversation::import(conversation_pointer));
-		containing_user->conversations.add(std::move(conversation));
+		//everything worked, add the user
+		users.add(std::move(user));
+		OUTCOME_TRY(persist_state());
 
-		OUTCOME_TRY(updated_backup_key, update_backup_key());
 		return std::move(updated_backup_key);
 	}
 
-	MOLCH_PUBLIC(return_status) molch_conversation_import(
+	MOLCH_PUBLIC(return_status) molch_import_user(
 			//output
-			unsigned char * new_backup_key,
+			unsigned char * const new_backup_key,
 			const size_t new_backup_key_length,
 			//inputs
 			const unsigned char * const backup,
 			const size_t backup_length,
-			const unsigned char * backup_key,
+			const unsigned char * const backup_key,
 			const size_t backup_key_length) {
 		if ((backup == nullptr)
 				|| (backup_key == nullptr) || (backup_key_length != BACKUP_KEY_SIZE)
 				|| (new_backup_key == nullptr) || (new_backup_key_length != BACKUP_KEY_SIZE)) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_conversation_import"};
+			return {status_type::INVALID_VALUE, "Invalid input to molch_import_user"};
 		}
 
 		try {
-			const auto new_backup_key_key_result = import_conversation({uchar_to_byte(backup), backup_length}, {uchar_to_byte(backup_key), backup_key_length});
+			const auto new_backup_key_key_result = import_user({uchar_to_byte(backup), backup_length}, {uchar_to_byte(backup_key), backup_key_length});
 			if (new_backup_key_key_result.has_error()) {
 				return new_backup_key_key_result.error().toReturnStatus();
 			}
@@ -1163,22 +2765,27 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	MOLCH_PUBLIC(return_status) molch_export(
-			unsigned char ** const backup,
-			size_t *backup_length) {
-		if ((backup == nullptr) or (backup_length == nullptr)) {
-			return {status_type::INVALID_VALUE, "backup or backup_length are NULL"};
+	static result<void> export_stream(molch_write_function write, void * const stream_data) {
+		GlobalBackupKeyUnlocker unlocker;
+		if (global_backup_key == nullptr) {
+			return Error(status_type::INCORRECT_DATA, "No backup key found.");
+		}
+
+		return export_backup_stream(users, *global_backup_key, write, stream_data);
+	}
+
+	MOLCH_PUBLIC(return_status) molch_export_stream(
+			molch_write_function write,
+			void * const stream_data) {
+		if (write == nullptr) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_export_stream"};
 		}
 
 		try {
-			auto exported_backup_result{export_all()};
-			if (exported_backup_result.has_error()) {
-				return exported_backup_result.error().toReturnStatus();
+			const auto export_result{export_stream(write, stream_data)};
+			if (export_result.has_error()) {
+				return export_result.error().toReturnStatus();
 			}
-			auto& exported_backup{exported_backup_result.value()};
-			//now pack the entire backup
-			*backup_length = exported_backup.size();
-			*backup = byte_to_uchar(exported_backup.release());
 		} catch (const std::exception& exception) {
 			return {status_type::EXCEPTION, exception.what()};
 		}
@@ -1186,76 +2793,31 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
-	static result<BackupKey> import_all(const span<const std::byte> backup, const span<const std::byte> backup_key) {
+	static result<BackupKey> import_stream(molch_read_function read, void * const stream_data, const span<const std::byte> backup_key) {
 		OUTCOME_TRY(Molch::sodium_init());
 
-		//unpack the encrypted backup
-		auto encrypted_backup_struct = std::unique_ptr<ProtobufCEncryptedBackup,EncryptedBackupDeleter>(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, backup.size(), byte_to_uchar(backup.data())));
-		if (encrypted_backup_struct == nullptr) {
-			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack encrypted backup from protobuf.");
-		}
-
-		//check the backup
-		if (encrypted_backup_struct->backup_version != 0) {
-			return Error(status_type::INCORRECT_DATA, "Incompatible backup.");
-		}
-		if (!encrypted_backup_struct->has_backup_type || (encrypted_backup_struct->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__FULL_BACKUP)) {
-			return Error(status_type::INCORRECT_DATA, "Backup is not a full backup.");
-		}
-		if (!encrypted_backup_struct->has_encrypted_backup || (encrypted_backup_struct->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
-			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the encrypted state.");
-		}
-		if (!encrypted_backup_struct->has_encrypted_backup_nonce || (encrypted_backup_struct->encrypted_backup_nonce.len != BACKUP_NONCE_SIZE)) {
-			return Error(status_type::PROTOBUF_MISSING_ERROR, "The backup is missing the nonce.");
-		}
-
-		Arena arena;
-		auto decrypted_backup_content = arena.allocate<std::byte>(encrypted_backup_struct->encrypted_backup.len - crypto_secretbox_MACBYTES);
-		auto decrypted_backup = span<std::byte>(decrypted_backup_content, encrypted_backup_struct->encrypted_backup.len - crypto_secretbox_MACBYTES);
-
-		//decrypt the backup
-		OUTCOME_TRY(crypto_secretbox_open_easy(
-				decrypted_backup,
-				{uchar_to_byte(encrypted_backup_struct->encrypted_backup.data), encrypted_backup_struct->encrypted_backup.len},
-				{uchar_to_byte(encrypted_backup_struct->encrypted_backup_nonce.data), encrypted_backup_struct->encrypted_backup_nonce.len},
-				backup_key));
-
-		//unpack the struct
-		auto arena_protoc_allocator = arena.getProtobufCAllocator();
-		auto backup_struct{molch__protobuf__backup__unpack(&arena_protoc_allocator, decrypted_backup.size(), byte_to_uchar(decrypted_backup.data()))};
-		if (backup_struct == nullptr) {
-			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack backups protobuf-c.");
-		}
-
-		//import the user store
-		OUTCOME_TRY(imported_user_store, UserStore::import({backup_struct->users, backup_struct->n_users}));
-
-		OUTCOME_TRY(updated_backup_key, update_backup_key());
-
-		//everything worked, switch to the new user store
-		users = std::move(imported_user_store);
-
-		return std::move(updated_backup_key);
+		OUTCOME_TRY(imported_user_store, import_backup_stream(backup_key, read, stream_data));
+		return import_user_store(std::move(imported_user_store));
 	}
 
-	MOLCH_PUBLIC(return_status) molch_import(
+	MOLCH_PUBLIC(return_status) molch_import_stream(
 			//output
 			unsigned char * const new_backup_key, //BACKUP_KEY_SIZE, can be the same pointer as the backup key
 			const size_t new_backup_key_length,
 			//inputs
-			const unsigned char * const backup,
-			const size_t backup_length,
+			molch_read_function read,
+			void * const stream_data,
 			const unsigned char * const backup_key, //BACKUP_KEY_SIZE
 			const size_t backup_key_length
 			) {
-		if ((backup == nullptr)
+		if ((read == nullptr)
 				|| (backup_key == nullptr) || (backup_key_length != BACKUP_KEY_SIZE)
 				|| (new_backup_key == nullptr) || (new_backup_key_length != BACKUP_KEY_SIZE)) {
-			return {status_type::INVALID_VALUE, "Invalid input to molch_import"};
+			return {status_type::INVALID_VALUE, "Invalid input to molch_import_stream"};
 		}
 
 		try {
-			const auto new_backup_key_key_result = import_all({uchar_to_byte(backup), backup_length}, {uchar_to_byte(backup_key), backup_key_length});
+			const auto new_backup_key_key_result = import_stream(read, stream_data, {uchar_to_byte(backup_key), backup_key_length});
 			if (new_backup_key_key_result.has_error()) {
 				return new_backup_key_key_result.error().toReturnStatus();
 			}
@@ -1270,16 +2832,27 @@ static result<PublicKey> verify_prekey_list(
 
 	static result<MallocBuffer> get_prekey_list(const span<const std::byte> public_master_key) {
 		OUTCOME_TRY(public_signing_key_key, PublicSigningKey::fromSpan(public_master_key));
-		OUTCOME_TRY(prekey_list_buffer, create_prekey_list(public_signing_key_key));
-		MallocBuffer malloced_prekey_list{prekey_list_buffer.size(), 0};
-		OUTCOME_TRY(malloced_prekey_list.cloneFrom(prekey_list_buffer));
+		auto user{users.find(public_signing_key_key)};
+		if (user == nullptr) {
+			return Error(status_type::NOT_FOUND, "Couldn't find the user to create a prekey list from.");
+		}
+
+		const auto prekeys_version{user->prekeys.version().value()};
+		OUTCOME_TRY(signed_prekey_list, update_signed_prekey_list(*user));
+		MallocBuffer malloced_prekey_list{signed_prekey_list->size(), 0};
+		OUTCOME_TRY(malloced_prekey_list.cloneFrom(*signed_prekey_list));
+
+		//only rotating the prekeys changes the state, fetching the list again doesn't
+		if (user->prekeys.version().value() != prekeys_version) {
+			OUTCOME_TRY(persist_state());
+		}
 
 		return malloced_prekey_list;
 	}
 
 	MOLCH_PUBLIC(return_status) molch_get_prekey_list(
 			//output
-			unsigned char ** const prekey_list,  //free after use
+			unsigned char ** const prekey_list,  //free with molch_free after use
 			size_t * const prekey_list_length,
 			//input
 			unsigned char * const public_master_key,
@@ -1305,6 +2878,242 @@ static result<PublicKey> verify_prekey_list(
 		return success_status;
 	}
 
+	static result<MallocBuffer> set_prekey_amount(const span<const std::byte> public_master_key, const size_t amount) {
+		OUTCOME_TRY(public_signing_key_key, PublicSigningKey::fromSpan(public_master_key));
+		auto user{users.find(public_signing_key_key)};
+		if (user == nullptr) {
+			return Error(status_type::NOT_FOUND, "Couldn't find the user to change the number of prekeys of.");
+		}
+
+		OUTCOME_TRY(user->prekeys.resize(amount));
+		OUTCOME_TRY(prekey_list, get_prekey_list(public_master_key));
+		OUTCOME_TRY(persist_state());
+
+		return prekey_list;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_set_prekey_amount(
+			//output
+			unsigned char ** const prekey_list,  //free with molch_free after use
+			size_t * const prekey_list_length,
+			//input
+			unsigned char * const public_master_key,
+			const size_t public_master_key_length,
+			const size_t amount) {
+		if ((public_master_key == nullptr) || (public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				|| (prekey_list == nullptr)
+				|| (prekey_list_length == nullptr)
+				|| (amount == 0)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_set_prekey_amount."};
+		}
+
+		try {
+			auto malloced_prekey_list_result = set_prekey_amount({uchar_to_byte(public_master_key), public_master_key_length}, amount);
+			if (malloced_prekey_list_result.has_error()) {
+				return malloced_prekey_list_result.error().toReturnStatus();
+			}
+			auto& malloced_prekey_list = malloced_prekey_list_result.value();
+			*prekey_list_length = malloced_prekey_list.size();
+			*prekey_list = byte_to_uchar(malloced_prekey_list.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	/*
+	 * Layout of a prekey list delta:
+	 * signature of the new prekey list, hash of the signed base prekey list,
+	 * expiration date (8 bytes), number of prekeys (4 bytes), number of replaced prekeys (4 bytes),
+	 * replaced prekeys as slot index (4 bytes) and prekey, in increasing slot order
+	 *
+	 * The signature doesn't cover the delta but the new prekey list, senders rebuild
+	 * the new list from the base list and the delta and verify it like any other prekey list.
+	 */
+	constexpr size_t prekey_list_delta_header_size{SIGNATURE_SIZE + crypto_generichash_BYTES + sizeof(int64_t) + sizeof(uint32_t) + sizeof(uint32_t)};
+	constexpr size_t prekey_list_delta_entry_size{sizeof(uint32_t) + PUBLIC_KEY_SIZE};
+
+	struct PrekeyListDelta {
+		MallocBuffer delta;
+		MallocBuffer prekey_list;
+	};
+
+	static result<PrekeyListDelta> get_prekey_list_delta(
+			const span<const std::byte> public_master_key,
+			const span<const std::byte> base_prekey_list) {
+		OUTCOME_TRY(public_signing_key_key, PublicSigningKey::fromSpan(public_master_key));
+		OUTCOME_TRY(base, open_prekey_list(base_prekey_list, public_signing_key_key));
+		OUTCOME_TRY(prekey_list, get_prekey_list(public_master_key));
+		OUTCOME_TRY(current, open_prekey_list(prekey_list, public_signing_key_key));
+		if (current.identity != base.identity) {
+			return Error(status_type::INVALID_VALUE, "The base prekey list belongs to a different identity key.");
+		}
+
+		//find the slots with new prekeys
+		const auto base_amount{base.prekeys.size() / PUBLIC_KEY_SIZE};
+		const auto amount{current.prekeys.size() / PUBLIC_KEY_SIZE};
+		std::vector<size_t> replaced_slots;
+		for (size_t slot{0}; slot < amount; slot++) {
+			const auto prekey{current.prekeys.subspan(slot * PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE)};
+			if ((slot >= base_amount)
+					|| !std::equal(std::cbegin(prekey), std::cend(prekey), std::cbegin(base.prekeys.subspan(slot * PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE)))) {
+				replaced_slots.push_back(slot);
+			}
+		}
+
+		const auto delta_size{prekey_list_delta_header_size + (replaced_slots.size() * prekey_list_delta_entry_size)};
+		PrekeyListDelta delta{MallocBuffer{delta_size, delta_size}, MallocBuffer{}};
+		SnapshotWriter writer{delta.delta};
+		OUTCOME_TRY(writer.write(span<const std::byte>(prekey_list).subspan(0, SIGNATURE_SIZE)));
+		OUTCOME_TRY(base_hash, hash_prekey_list(base_prekey_list));
+		OUTCOME_TRY(writer.write(base_hash));
+		OUTCOME_TRY(writer.writeInteger(current.expiration_date));
+		OUTCOME_TRY(writer.writeInteger(gsl::narrow<uint32_t>(amount)));
+		OUTCOME_TRY(writer.writeInteger(gsl::narrow<uint32_t>(replaced_slots.size())));
+		for (const auto slot : replaced_slots) {
+			OUTCOME_TRY(writer.writeInteger(gsl::narrow<uint32_t>(slot)));
+			OUTCOME_TRY(writer.write(current.prekeys.subspan(slot * PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE)));
+		}
+		delta.prekey_list = std::move(prekey_list);
+
+		return delta;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_get_prekey_list_delta(
+			//output
+			unsigned char ** const prekey_list_delta,  //free with molch_free after use
+			size_t * const prekey_list_delta_length,
+			unsigned char ** const prekey_list,  //free with molch_free after use
+			size_t * const prekey_list_length,
+			//input
+			const unsigned char * const public_master_key,
+			const size_t public_master_key_length,
+			const unsigned char * const base_prekey_list,
+			const size_t base_prekey_list_length) {
+		if ((public_master_key == nullptr) || (public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				|| (prekey_list_delta == nullptr) || (prekey_list_delta_length == nullptr)
+				|| (prekey_list == nullptr) || (prekey_list_length == nullptr)
+				|| (base_prekey_list == nullptr)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_get_prekey_list_delta."};
+		}
+
+		try {
+			auto delta_result = get_prekey_list_delta(
+					{uchar_to_byte(public_master_key), public_master_key_length},
+					{uchar_to_byte(base_prekey_list), base_prekey_list_length});
+			if (delta_result.has_error()) {
+				return delta_result.error().toReturnStatus();
+			}
+			auto& delta = delta_result.value();
+			*prekey_list_delta_length = delta.delta.size();
+			*prekey_list_delta = byte_to_uchar(delta.delta.release());
+			*prekey_list_length = delta.prekey_list.size();
+			*prekey_list = byte_to_uchar(delta.prekey_list.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	static result<MallocBuffer> apply_prekey_list_delta(
+			const span<const std::byte> public_master_key,
+			const span<const std::byte> base_prekey_list,
+			const span<const std::byte> prekey_list_delta) {
+		OUTCOME_TRY(public_signing_key_key, PublicSigningKey::fromSpan(public_master_key));
+		OUTCOME_TRY(base, open_prekey_list(base_prekey_list, public_signing_key_key));
+
+		SnapshotReader reader{prekey_list_delta};
+		std::array<std::byte,SIGNATURE_SIZE> signature;
+		OUTCOME_TRY(reader.read(signature));
+		PrekeyListHash base_hash;
+		OUTCOME_TRY(reader.read(base_hash));
+		OUTCOME_TRY(expected_base_hash, hash_prekey_list(base_prekey_list));
+		if (base_hash != expected_base_hash) {
+			return Error(status_type::INVALID_VALUE, "The prekey list delta doesn't belong to the base prekey list.");
+		}
+		OUTCOME_TRY(expiration_date, reader.readInteger<int64_t>());
+		OUTCOME_TRY(amount, reader.readInteger<uint32_t>());
+		OUTCOME_TRY(replaced_amount, reader.readInteger<uint32_t>());
+		if ((amount == 0) || (amount > maximum_prekey_amount) || (replaced_amount > amount)) {
+			return Error(status_type::INCORRECT_DATA, "Prekey list delta has an invalid number of prekeys.");
+		}
+
+		//rebuild the new prekey list
+		const size_t prekeys_size{amount * PUBLIC_KEY_SIZE};
+		const size_t prekey_list_size{SIGNATURE_SIZE + PREKEY_LIST_PREKEYS_OFFSET + prekeys_size + sizeof(int64_t)};
+		MallocBuffer prekey_list{prekey_list_size, prekey_list_size};
+		SnapshotWriter writer{prekey_list};
+		OUTCOME_TRY(writer.write(signature));
+		OUTCOME_TRY(writer.write(base.identity));
+		OUTCOME_TRY(writer.writeInteger(amount));
+		const auto prekeys{span<std::byte>(prekey_list).subspan(SIGNATURE_SIZE + PREKEY_LIST_PREKEYS_OFFSET, prekeys_size)};
+		const auto base_amount{base.prekeys.size() / PUBLIC_KEY_SIZE};
+		const auto kept_amount{std::min(base_amount, static_cast<size_t>(amount))};
+		OUTCOME_TRY(writer.write(base.prekeys.subspan(0, kept_amount * PUBLIC_KEY_SIZE)));
+
+		//slots that didn't exist in the base list have to be part of the delta
+		size_t new_slots{0};
+		std::optional<uint32_t> previous_slot;
+		for (uint32_t replaced{0}; replaced < replaced_amount; replaced++) {
+			OUTCOME_TRY(slot, reader.readInteger<uint32_t>());
+			if ((slot >= amount) || (previous_slot.has_value() && (slot <= previous_slot.value()))) {
+				return Error(status_type::INCORRECT_DATA, "Prekey list delta has an invalid slot.");
+			}
+			previous_slot = slot;
+			if (slot >= kept_amount) {
+				new_slots++;
+			}
+			OUTCOME_TRY(reader.read(prekeys.subspan(slot * PUBLIC_KEY_SIZE, PUBLIC_KEY_SIZE)));
+		}
+		if ((new_slots != (amount - kept_amount)) || !reader.done()) {
+			return Error(status_type::INCORRECT_DATA, "Prekey list delta is incomplete.");
+		}
+		const auto big_endian_expiration_date{span<std::byte>(prekey_list).subspan(prekey_list_size - sizeof(int64_t), sizeof(int64_t))};
+		OUTCOME_TRY(to_big_endian(expiration_date, big_endian_expiration_date));
+
+		OUTCOME_TRY(verify_prekey_list(prekey_list, public_signing_key_key));
+
+		return prekey_list;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_apply_prekey_list_delta(
+			//output
+			unsigned char ** const prekey_list,  //free with molch_free after use
+			size_t * const prekey_list_length,
+			//input
+			const unsigned char * const public_master_key,
+			const size_t public_master_key_length,
+			const unsigned char * const base_prekey_list,
+			const size_t base_prekey_list_length,
+			const unsigned char * const prekey_list_delta,
+			const size_t prekey_list_delta_length) {
+		if ((public_master_key == nullptr) || (public_master_key_length != PUBLIC_MASTER_KEY_SIZE)
+				|| (prekey_list == nullptr) || (prekey_list_length == nullptr)
+				|| (base_prekey_list == nullptr)
+				|| (prekey_list_delta == nullptr)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_apply_prekey_list_delta."};
+		}
+
+		try {
+			auto prekey_list_result = apply_prekey_list_delta(
+					{uchar_to_byte(public_master_key), public_master_key_length},
+					{uchar_to_byte(base_prekey_list), base_prekey_list_length},
+					{uchar_to_byte(prekey_list_delta), prekey_list_delta_length});
+			if (prekey_list_result.has_error()) {
+				return prekey_list_result.error().toReturnStatus();
+			}
+			auto& malloced_prekey_list = prekey_list_result.value();
+			*prekey_list_length = malloced_prekey_list.size();
+			*prekey_list = byte_to_uchar(malloced_prekey_list.release());
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
 	MOLCH_PUBLIC(return_status) molch_update_backup_key(
 			unsigned char * const new_key, //output, BACKUP_KEY_SIZE
 			const size_t new_key_length) {
@@ -1325,3 +3134,147 @@ static result<PublicKey> verify_prekey_list(
 
 		return success_status;
 	}
+
+	MOLCH_PUBLIC(return_status) molch_set_allocator(
+			molch_allocate_function allocate,
+			molch_free_function deallocate,
+			void *allocator_data) {
+		if ((allocate == nullptr) and (deallocate == nullptr)) {
+			reset_output_allocator();
+			return success_status;
+		}
+
+		if ((allocate == nullptr) or (deallocate == nullptr)) {
+			return {status_type::INVALID_VALUE, "Either both or none of allocate and deallocate have to be set."};
+		}
+
+		output_allocator.allocate = allocate;
+		output_allocator.deallocate = deallocate;
+		output_allocator.allocator_data = allocator_data;
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(void) molch_free(void *pointer) {
+		output_free(pointer);
+	}
+
+	MOLCH_PUBLIC(void) molch_set_memory_protection(const molch_memory_protection protection) {
+		set_memory_protection(protection);
+		//relock everything that a more relaxed policy kept unlocked
+		if (not in_protection_batch()) {
+			lock_all_private_keys();
+		}
+	}
+
+	MOLCH_PUBLIC(molch_memory_protection) molch_get_memory_protection() {
+		return memory_protection();
+	}
+
+	MOLCH_PUBLIC(return_status) molch_set_conversation_budget(const size_t resident_conversations) {
+		try {
+			set_conversation_budget(resident_conversations);
+			auto enforced{users.enforceConversationBudget()};
+			if (enforced.has_error()) {
+				return enforced.error().toReturnStatus();
+			}
+		} catch (const std::exception& exception) {
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(void) molch_set_conversation_backups(const molch_conversation_backups backups) {
+		if (backups != conversation_backups) {
+			//a chain of deltas never continues across a change
+			backup_key_generation++;
+		}
+		conversation_backups = backups;
+	}
+
+	MOLCH_PUBLIC(molch_residency_statistics) molch_get_residency_statistics() {
+		return residency_statistics();
+	}
+
+	MOLCH_PUBLIC(void) molch_begin_batch() {
+		begin_protection_batch();
+	}
+
+	MOLCH_PUBLIC(return_status) molch_end_batch() {
+		end_protection_batch();
+		if (memory_protection() == molch_memory_protection::BATCHED) {
+			lock_all_private_keys();
+		}
+		if (state_store.has_value()) {
+			//a failed fsync is retried with the next change or when the store is closed
+			const auto synced{state_store->sync()};
+			if (synced.has_error()) {
+				return synced.error().toReturnStatus();
+			}
+		}
+
+		return success_status;
+	}
+
+	static result<void> open_store(const char * const path, const span<const std::byte> store_key) {
+		OUTCOME_TRY(Molch::sodium_init());
+
+		//the file might be the one that is open already
+		if (state_store.has_value()) {
+			const auto closed{state_store->close()};
+			state_store.reset();
+			OUTCOME_TRY(closed);
+		}
+
+		OUTCOME_TRY(opened_store, StateStore::open(path, store_key));
+		auto& [store, stored_users]{opened_store};
+		state_store.emplace(std::move(store));
+		if (stored_users.size() == 0) {
+			//a new store starts with the current state
+			OUTCOME_TRY(state_store->persist(users));
+			return state_store->sync();
+		}
+
+		OUTCOME_TRY(stored_users.enforceConversationBudget());
+		users = std::move(stored_users);
+		backup_segment_cache.clear();
+
+		return outcome::success();
+	}
+
+	MOLCH_PUBLIC(return_status) molch_open_store(
+			const char * const path,
+			const unsigned char * const store_key,
+			const size_t store_key_length) {
+		if ((path == nullptr) or (store_key == nullptr) or (store_key_length != BACKUP_KEY_SIZE)) {
+			return {status_type::INVALID_VALUE, "Invalid input to molch_open_store."};
+		}
+
+		try {
+			auto opened{open_store(path, {uchar_to_byte(store_key), store_key_length})};
+			if (opened.has_error()) {
+				state_store.reset();
+				return opened.error().toReturnStatus();
+			}
+		} catch (const std::exception& exception) {
+			state_store.reset();
+			return {status_type::EXCEPTION, exception.what()};
+		}
+
+		return success_status;
+	}
+
+	MOLCH_PUBLIC(return_status) molch_close_store() {
+		if (not state_store.has_value()) {
+			return success_status;
+		}
+
+		const auto closed{state_store->close()};
+		state_store.reset();
+		if (closed.has_error()) {
+			return closed.error().toReturnStatus();
+		}
+
+		return success_status;
+	}
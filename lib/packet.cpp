@@ -25,6 +25,7 @@
 #include "packet.hpp"
 #include "molch/constants.h"
 #include "protobuf.hpp"
+#include "copy.hpp"
 #include "gsl.hpp"
 
 namespace Molch {
@@ -61,77 +62,96 @@ namespace Molch {
 		}
 	}
 
-	/*!
-	 * Unpacks a packet via Protobuf-C into a struct and verifies that all the necessary
-	 * fields exist.
-	 *
-	 * \param packet
-	 *   The binary packet.
-	 *
-	 * \return
-	 *   The unpacked struct.
+	/*
+	 * The Packet message is only an envelope around three length delimited fields.
+	 * It is written and read directly instead of going through Protobuf-C, because
+	 * Protobuf-C would copy the encrypted message to the heap on every unpack.
 	 */
-	static result<std::unique_ptr<ProtobufCPacket,PacketDeleter>> packet_unpack(const span<const std::byte> packet) {
-		//unpack the packet
-		auto packet_struct{std::unique_ptr<ProtobufCPacket,PacketDeleter>(molch__protobuf__packet__unpack(&protobuf_c_allocator, packet.size(), byte_to_uchar(packet.data())))};
-		if (!packet_struct) {
-			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+	constexpr uint64_t packet_header_field{1};
+	constexpr uint64_t encrypted_axolotl_header_field{2};
+	constexpr uint64_t encrypted_message_field{3};
+
+	constexpr uint64_t wire_type_varint{0};
+	constexpr uint64_t wire_type_64bit{1};
+	constexpr uint64_t wire_type_length_delimited{2};
+	constexpr uint64_t wire_type_32bit{5};
+
+	constexpr size_t maximum_varint_size{10};
+
+	static constexpr size_t varint_size(uint64_t value) noexcept {
+		size_t size{1};
+		while (value >= 0x80) {
+			value >>= 7;
+			size++;
 		}
 
-		if (packet_struct->packet_header->current_protocol_version != 0) {
-			return Error(status_type::UNSUPPORTED_PROTOCOL_VERSION, "The packet has an unsuported protocol version.");
-		}
+		return size;
+	}
 
-		//check if the packet contains the necessary fields
-		if (!packet_struct->has_encrypted_axolotl_header
-			|| !packet_struct->has_encrypted_message
-			|| !packet_struct->packet_header->has_packet_type
-			|| !packet_struct->packet_header->has_header_nonce
-			|| !packet_struct->packet_header->has_message_nonce) {
-			return Error(status_type::PROTOBUF_MISSING_ERROR, "Some fields are missing in the packet.");
-		}
+	static constexpr size_t length_delimited_field_size(const uint64_t field, const size_t length) noexcept {
+		return varint_size((field << 3) | wire_type_length_delimited) + varint_size(length) + length;
+	}
 
-		//check the size of the nonces
-		if ((packet_struct->packet_header->header_nonce.len != HEADER_NONCE_SIZE)
-			|| (packet_struct->packet_header->message_nonce.len != MESSAGE_NONCE_SIZE)) {
-			return Error(status_type::INCORRECT_BUFFER_SIZE, "At least one of the nonces has an incorrect length.");
+	/*
+	 * Write a varint to the start of output and return the remaining part.
+	 * The caller has to make sure that output is long enough.
+	 */
+	static span<std::byte> write_varint(span<std::byte> output, uint64_t value) noexcept {
+		while (value >= 0x80) {
+			output[0] = uchar_to_byte(static_cast<unsigned char>((value & 0x7fU) | 0x80U));
+			output = output.subspan(1);
+			value >>= 7;
 		}
+		output[0] = uchar_to_byte(static_cast<unsigned char>(value));
 
-		if (packet_struct->packet_header->packet_type == MOLCH__PROTOBUF__PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
-			//check if the public keys for prekey messages are there
-			if (!packet_struct->packet_header->has_public_identity_key
-				|| !packet_struct->packet_header->has_public_ephemeral_key
-				|| !packet_struct->packet_header->has_public_prekey) {
-				return Error(status_type::PROTOBUF_MISSING_ERROR, "The prekey packet misses at least one public key.");
-			}
+		return output.subspan(1);
+	}
 
-			//check the sizes of the public keys
-			if ((packet_struct->packet_header->public_identity_key.len != PUBLIC_KEY_SIZE)
-				|| (packet_struct->packet_header->public_ephemeral_key.len != PUBLIC_KEY_SIZE)
-				|| (packet_struct->packet_header->public_prekey.len != PUBLIC_KEY_SIZE)) {
-				return Error(status_type::INCORRECT_BUFFER_SIZE, "At least one of the public keys of the prekey packet has an incorrect length.");
+	static span<std::byte> write_length_delimited_key(const span<std::byte> output, const uint64_t field, const size_t length) noexcept {
+		return write_varint(write_varint(output, (field << 3) | wire_type_length_delimited), length);
+	}
+
+	/*
+	 * Read a varint from the start of input and advance input past it.
+	 */
+	static result<uint64_t> read_varint(span<const std::byte>& input) noexcept {
+		uint64_t value{0};
+		for (size_t index{0}; (index < input.size()) and (index < maximum_varint_size); index++) {
+			const auto byte{byte_to_uchar(input[gsl::narrow_cast<ptrdiff_t>(index)])};
+			value |= static_cast<uint64_t>(byte & 0x7fU) << (7 * index);
+			if ((byte & 0x80U) == 0) {
+				input = input.subspan(index + 1);
+				return value;
 			}
 		}
 
-		return packet_struct;
+		return Error(status_type::PROTOBUF_UNPACK_ERROR, "Invalid varint in packet.");
 	}
 
-	result<Buffer> packet_encrypt(
-			const molch_message_type packet_type,
-			const span<const std::byte> axolotl_header,
-			const EmptyableHeaderKey& axolotl_header_key,
-			const span<const std::byte> message,
-			const MessageKey& message_key,
-			const std::optional<PrekeyMetadata>& prekey_metadata) {
-		FulfillOrFail((packet_type != molch_message_type::INVALID)
-			&& !axolotl_header_key.empty);
+	/*
+	 * Read length bytes from the start of input and advance input past them.
+	 */
+	static result<span<const std::byte>> read_bytes(span<const std::byte>& input, const uint64_t length) noexcept {
+		if (length > input.size()) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Field in packet is longer than the packet.");
+		}
 
-		//initialize the protobuf structs
-		ProtobufCPacket packet_struct;
-		molch__protobuf__packet__init(&packet_struct);
-		ProtobufCPacketHeader packet_header_struct;
+		const auto bytes{input.subspan(0, static_cast<size_t>(length))};
+		input = input.subspan(static_cast<size_t>(length));
+
+		return bytes;
+	}
+
+	/*!
+	 * Fill a packet header struct. The binary data only points to the given keys and nonces.
+	 */
+	static void packet_header_fill(
+			ProtobufCPacketHeader& packet_header_struct,
+			const molch_message_type packet_type,
+			const PrekeyMetadata * const prekey_metadata, //only for prekey messages
+			const span<const std::byte> header_nonce,
+			const span<const std::byte> message_nonce) noexcept {
 		molch__protobuf__packet_header__init(&packet_header_struct);
-		packet_struct.packet_header = &packet_header_struct;
 
 		//set the protocol version
 		packet_header_struct.current_protocol_version = 0;
@@ -141,129 +161,293 @@ namespace Molch {
 		packet_header_struct.has_packet_type = true;
 		packet_header_struct.packet_type = to_packet_header_packet_type(packet_type);
 
-		if (packet_type == molch_message_type::PREKEY_MESSAGE) {
-			FulfillOrFail(prekey_metadata.has_value());
-			const auto& metadata{prekey_metadata.value()};
-
+		if (prekey_metadata != nullptr) {
 			//set the public identity key
 			packet_header_struct.has_public_identity_key = true;
-			packet_header_struct.public_identity_key.data = const_cast<uint8_t*>(byte_to_uchar(metadata.identity.data())); //NOLINT
-			packet_header_struct.public_identity_key.len = metadata.identity.size();
+			packet_header_struct.public_identity_key.data = const_cast<uint8_t*>(byte_to_uchar(prekey_metadata->identity.data())); //NOLINT
+			packet_header_struct.public_identity_key.len = prekey_metadata->identity.size();
 
 			//set the public ephemeral key
 			packet_header_struct.has_public_ephemeral_key = true;
-			packet_header_struct.public_ephemeral_key.data = const_cast<uint8_t*>(byte_to_uchar(metadata.ephemeral.data())); //NOLINT
-			packet_header_struct.public_ephemeral_key.len = metadata.ephemeral.size();
+			packet_header_struct.public_ephemeral_key.data = const_cast<uint8_t*>(byte_to_uchar(prekey_metadata->ephemeral.data())); //NOLINT
+			packet_header_struct.public_ephemeral_key.len = prekey_metadata->ephemeral.size();
 
 			//set the public prekey
 			packet_header_struct.has_public_prekey = true;
-			packet_header_struct.public_prekey.data = const_cast<uint8_t*>(byte_to_uchar(metadata.prekey.data())); //NOLINT
-			packet_header_struct.public_prekey.len = metadata.prekey.size();
+			packet_header_struct.public_prekey.data = const_cast<uint8_t*>(byte_to_uchar(prekey_metadata->prekey.data())); //NOLINT
+			packet_header_struct.public_prekey.len = prekey_metadata->prekey.size();
 		}
 
-		//generate the header nonce and add it to the packet header
-		Buffer header_nonce(HEADER_NONCE_SIZE, HEADER_NONCE_SIZE);
-		randombytes_buf(header_nonce);
+		//add the nonces
 		packet_header_struct.has_header_nonce = true;
-		packet_header_struct.header_nonce.data = byte_to_uchar(header_nonce.data());
+		packet_header_struct.header_nonce.data = const_cast<uint8_t*>(byte_to_uchar(header_nonce.data())); //NOLINT
 		packet_header_struct.header_nonce.len = header_nonce.size();
+		packet_header_struct.has_message_nonce = true;
+		packet_header_struct.message_nonce.data = const_cast<uint8_t*>(byte_to_uchar(message_nonce.data())); //NOLINT
+		packet_header_struct.message_nonce.len = message_nonce.size();
+	}
 
-		//encrypt the header
-		Buffer encrypted_axolotl_header{
-			axolotl_header.size() + crypto_secretbox_MACBYTES,
-			axolotl_header.size() + crypto_secretbox_MACBYTES};
-		OUTCOME_TRY(crypto_secretbox_easy(
-				encrypted_axolotl_header,
-				axolotl_header,
+	static constexpr size_t padded_message_size(const size_t message_size) noexcept {
+		//ISO/IEC 7816-4 padding to 255 byte blocks
+		return message_size + (padding_blocksize - (message_size % padding_blocksize));
+	}
+
+	size_t packet_size(
+			const molch_message_type packet_type,
+			const size_t axolotl_header_size,
+			const size_t message_size) noexcept {
+		//only the lengths matter for the packed size
+		PrekeyMetadata prekey_metadata;
+		const std::array<std::byte,HEADER_NONCE_SIZE> header_nonce{};
+		const std::array<std::byte,MESSAGE_NONCE_SIZE> message_nonce{};
+		ProtobufCPacketHeader packet_header_struct;
+		packet_header_fill(
+				packet_header_struct,
+				packet_type,
+				(packet_type == molch_message_type::PREKEY_MESSAGE) ? &prekey_metadata : nullptr,
 				header_nonce,
-				axolotl_header_key));
+				message_nonce);
 
-		//add the encrypted header to the protobuf struct
-		packet_struct.has_encrypted_axolotl_header = true;
-		packet_struct.encrypted_axolotl_header.data = byte_to_uchar(encrypted_axolotl_header.data());
-		packet_struct.encrypted_axolotl_header.len = encrypted_axolotl_header.size();
+		return length_delimited_field_size(packet_header_field, molch__protobuf__packet_header__get_packed_size(&packet_header_struct))
+			+ length_delimited_field_size(encrypted_axolotl_header_field, axolotl_header_size + crypto_secretbox_MACBYTES)
+			+ length_delimited_field_size(encrypted_message_field, padded_message_size(message_size) + crypto_secretbox_MACBYTES);
+	}
 
-		//generate the message nonce and add it to the packet header
-		Buffer message_nonce{MESSAGE_NONCE_SIZE, MESSAGE_NONCE_SIZE};
+	result<Buffer> packet_encrypt(
+			const molch_message_type packet_type,
+			const span<const std::byte> axolotl_header,
+			const EmptyableHeaderKey& axolotl_header_key,
+			const span<const std::byte> message,
+			const MessageKey& message_key,
+			const std::optional<PrekeyMetadata>& prekey_metadata) {
+		const auto packed_size{packet_size(packet_type, axolotl_header.size(), message.size())};
+		Buffer packet{packed_size, packed_size};
+		OUTCOME_TRY(packet_encrypt(
+				packet,
+				packet_type,
+				axolotl_header,
+				axolotl_header_key,
+				message,
+				message_key,
+				prekey_metadata));
+
+		return packet;
+	}
+
+	result<span<std::byte>> packet_encrypt(
+			const span<std::byte> packet,
+			const molch_message_type packet_type,
+			const span<const std::byte> axolotl_header,
+			const EmptyableHeaderKey& axolotl_header_key,
+			const span<const std::byte> message,
+			const MessageKey& message_key,
+			const std::optional<PrekeyMetadata>& prekey_metadata) {
+		FulfillOrFail((packet_type != molch_message_type::INVALID)
+			&& !axolotl_header_key.empty);
+
+		const PrekeyMetadata *metadata{nullptr};
+		if (packet_type == molch_message_type::PREKEY_MESSAGE) {
+			FulfillOrFail(prekey_metadata.has_value());
+			metadata = &prekey_metadata.value();
+		}
+
+		const auto packed_size{packet_size(packet_type, axolotl_header.size(), message.size())};
+		if (packet.size() < packed_size) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The buffer is too small for the packet.");
+		}
+
+		//generate the nonces
+		std::array<std::byte,HEADER_NONCE_SIZE> header_nonce;
+		randombytes_buf(header_nonce);
+		std::array<std::byte,MESSAGE_NONCE_SIZE> message_nonce;
 		randombytes_buf(message_nonce);
-		packet_header_struct.has_message_nonce = true;
-		packet_header_struct.message_nonce.data = byte_to_uchar(message_nonce.data());
-		packet_header_struct.message_nonce.len = message_nonce.size();
 
-		//pad the message (ISO/IEC 7816-4 padding to 255 byte blocks)
-		size_t padding_amount{padding_blocksize - (message.size() % padding_blocksize)};
-		Buffer padded_message{message.size() + padding_amount, 0};
-		OUTCOME_TRY(padded_message.cloneFromRaw(message));
-		OUTCOME_TRY(padded_message.setSize(padded_message.capacity()));
-		OUTCOME_TRY(padded_span, sodium_pad(padded_message, message.size(), 255));
-		if (padded_span.size() != padded_message.size()) {
+		//pack the packet header
+		ProtobufCPacketHeader packet_header_struct;
+		packet_header_fill(packet_header_struct, packet_type, metadata, header_nonce, message_nonce);
+		const auto packet_header_size{molch__protobuf__packet_header__get_packed_size(&packet_header_struct)};
+		auto remaining{write_length_delimited_key(packet, packet_header_field, packet_header_size)};
+		if (molch__protobuf__packet_header__pack(&packet_header_struct, byte_to_uchar(remaining.data())) != packet_header_size) {
+			return Error(status_type::PROTOBUF_PACK_ERROR, "Packet header has incorrect length.");
+		}
+		remaining = remaining.subspan(packet_header_size);
+
+		//encrypt the header
+		const size_t encrypted_axolotl_header_size{axolotl_header.size() + crypto_secretbox_MACBYTES};
+		remaining = write_length_delimited_key(remaining, encrypted_axolotl_header_field, encrypted_axolotl_header_size);
+		OUTCOME_TRY(crypto_secretbox_easy(
+				remaining.subspan(0, encrypted_axolotl_header_size),
+				axolotl_header,
+				header_nonce,
+				axolotl_header_key));
+		remaining = remaining.subspan(encrypted_axolotl_header_size);
+
+		//pad the message in place
+		const size_t padded_size{padded_message_size(message.size())};
+		const size_t encrypted_message_size{padded_size + crypto_secretbox_MACBYTES};
+		remaining = write_length_delimited_key(remaining, encrypted_message_field, encrypted_message_size);
+		auto padded_message{remaining.subspan(0, padded_size)};
+		OUTCOME_TRY(copyFromTo(message, padded_message, message.size()));
+		OUTCOME_TRY(padded_span, sodium_pad(padded_message, message.size(), padding_blocksize));
+		if (padded_span.size() != padded_size) {
 			return Error(status_type::GENERIC_ERROR, "Padding doesn't have the expected size.");
 		}
 
-		//encrypt the message
-		Buffer encrypted_message{
-			padded_message.size() + crypto_secretbox_MACBYTES,
-			padded_message.size() + crypto_secretbox_MACBYTES};
+		//encrypt the message in place
 		OUTCOME_TRY(crypto_secretbox_easy(
-				encrypted_message,
+				remaining.subspan(0, encrypted_message_size),
 				padded_message,
 				message_nonce,
 				message_key));
+		remaining = remaining.subspan(encrypted_message_size);
 
-		//add the encrypted message to the protobuf struct
-		packet_struct.has_encrypted_message = true;
-		packet_struct.encrypted_message.data = byte_to_uchar(encrypted_message.data());
-		packet_struct.encrypted_message.len = encrypted_message.size();
-
-		//calculate the required length
-		const size_t packed_length{molch__protobuf__packet__get_packed_size(&packet_struct)};
-		//pack the packet
-		Buffer packet{packed_length, 0};
-		OUTCOME_TRY(packet.setSize(molch__protobuf__packet__pack(&packet_struct, byte_to_uchar(packet.data()))));
-		if (packet.size() != packed_length) {
-			return Error(status_type::PROTOBUF_PACK_ERROR, "Packet packet has incorrect length.");
+		if ((packet.size() - remaining.size()) != packed_size) {
+			return Error(status_type::PROTOBUF_PACK_ERROR, "Packet has incorrect length.");
 		}
 
-		return packet;
+		return packet.subspan(0, packed_size);
+	}
+
+	result<PacketView> packet_parse(const span<const std::byte> packet) {
+		std::optional<span<const std::byte>> packed_packet_header;
+		std::optional<span<const std::byte>> encrypted_axolotl_header;
+		std::optional<span<const std::byte>> encrypted_message;
+
+		//read the envelope, skipping unknown fields
+		auto remaining{packet};
+		while (not remaining.empty()) {
+			OUTCOME_TRY(key, read_varint(remaining));
+			const auto field{key >> 3};
+			switch (key & 0x7U) {
+				case wire_type_varint: {
+					OUTCOME_TRY(read_varint(remaining));
+					break;
+				}
+
+				case wire_type_64bit: {
+					OUTCOME_TRY(read_bytes(remaining, sizeof(uint64_t)));
+					break;
+				}
+
+				case wire_type_32bit: {
+					OUTCOME_TRY(read_bytes(remaining, sizeof(uint32_t)));
+					break;
+				}
+
+				case wire_type_length_delimited: {
+					OUTCOME_TRY(length, read_varint(remaining));
+					OUTCOME_TRY(bytes, read_bytes(remaining, length));
+					if (field == packet_header_field) {
+						packed_packet_header = bytes;
+					} else if (field == encrypted_axolotl_header_field) {
+						encrypted_axolotl_header = bytes;
+					} else if (field == encrypted_message_field) {
+						encrypted_message = bytes;
+					}
+					break;
+				}
+
+				default:
+					return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+			}
+		}
+		if (not packed_packet_header.has_value()) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+		}
+
+		//unpack the packet header, it lives in the allocator, so it doesn't need to be freed
+		FixedProtobufCAllocator<1024> allocator;
+		const auto packet_header{molch__protobuf__packet_header__unpack(
+				allocator.get(),
+				packed_packet_header.value().size(),
+				byte_to_uchar(packed_packet_header.value().data()))};
+		if (packet_header == nullptr) {
+			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack packet.");
+		}
+
+		if (packet_header->current_protocol_version != 0) {
+			return Error(status_type::UNSUPPORTED_PROTOCOL_VERSION, "The packet has an unsuported protocol version.");
+		}
+
+		//check if the packet contains the necessary fields
+		if (!encrypted_axolotl_header.has_value()
+			|| !encrypted_message.has_value()
+			|| !packet_header->has_packet_type
+			|| !packet_header->has_header_nonce
+			|| !packet_header->has_message_nonce) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "Some fields are missing in the packet.");
+		}
+
+		//check the size of the nonces
+		if ((packet_header->header_nonce.len != HEADER_NONCE_SIZE)
+			|| (packet_header->message_nonce.len != MESSAGE_NONCE_SIZE)) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "At least one of the nonces has an incorrect length.");
+		}
+
+		PacketView view;
+		if (packet_header->packet_type == MOLCH__PROTOBUF__PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
+			//check if the public keys for prekey messages are there
+			if (!packet_header->has_public_identity_key
+				|| !packet_header->has_public_ephemeral_key
+				|| !packet_header->has_public_prekey) {
+				return Error(status_type::PROTOBUF_MISSING_ERROR, "The prekey packet misses at least one public key.");
+			}
+
+			//check the sizes of the public keys
+			if ((packet_header->public_identity_key.len != PUBLIC_KEY_SIZE)
+				|| (packet_header->public_ephemeral_key.len != PUBLIC_KEY_SIZE)
+				|| (packet_header->public_prekey.len != PUBLIC_KEY_SIZE)) {
+				return Error(status_type::INCORRECT_BUFFER_SIZE, "At least one of the public keys of the prekey packet has an incorrect length.");
+			}
+
+			view.metadata.prekey_metadata = PrekeyMetadata();
+			auto& prekey_metadata{view.metadata.prekey_metadata.value()};
+			//copy the public keys
+			OUTCOME_TRY(identity, PublicKey::fromSpan({packet_header->public_identity_key}));
+			prekey_metadata.identity = identity;
+			OUTCOME_TRY(ephemeral, PublicKey::fromSpan({packet_header->public_ephemeral_key}));
+			prekey_metadata.ephemeral = ephemeral;
+			OUTCOME_TRY(prekey, PublicKey::fromSpan({packet_header->public_prekey}));
+			prekey_metadata.prekey = prekey;
+		}
+
+		view.metadata.current_protocol_version = packet_header->current_protocol_version;
+		view.metadata.highest_supported_protocol_version = packet_header->highest_supported_protocol_version;
+		view.metadata.packet_type = to_molch_message_type(packet_header->packet_type);
+
+		OUTCOME_TRY(copyFromTo({packet_header->header_nonce}, view.header_nonce));
+		OUTCOME_TRY(copyFromTo({packet_header->message_nonce}, view.message_nonce));
+		view.encrypted_axolotl_header = encrypted_axolotl_header.value();
+		view.encrypted_message = encrypted_message.value();
+
+		return view;
 	}
 
 	result<DecryptedPacket> packet_decrypt(
 			const span<const std::byte> packet,
 			const EmptyableHeaderKey& axolotl_header_key,
 			const MessageKey& message_key) {
-		OUTCOME_TRY(unverified_metadata, packet_get_metadata_without_verification(packet));
-		OUTCOME_TRY(axolotl_header, packet_decrypt_header(packet, axolotl_header_key));
-		OUTCOME_TRY(message, packet_decrypt_message(packet, message_key));
+		OUTCOME_TRY(packet_view, packet_parse(packet));
+		if (packet_view.encrypted_axolotl_header.size() < crypto_secretbox_MACBYTES) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The ciphertext of the axolotl header is too short.");
+		}
+		const size_t axolotl_header_length{packet_view.encrypted_axolotl_header.size() - crypto_secretbox_MACBYTES};
 
 		DecryptedPacket decrypted_packet;
-		decrypted_packet.header = std::move(axolotl_header);
-		decrypted_packet.message = std::move(message);
-		decrypted_packet.metadata = std::move(unverified_metadata);
+		decrypted_packet.header = Buffer{axolotl_header_length, axolotl_header_length};
+		OUTCOME_TRY(packet_decrypt_header(decrypted_packet.header, packet_view, axolotl_header_key));
+		decrypted_packet.message = Buffer{packet.size(), packet.size()};
+		OUTCOME_TRY(message, packet_decrypt_message(decrypted_packet.message, packet_view, message_key));
+		OUTCOME_TRY(decrypted_packet.message.setSize(message.size()));
+		decrypted_packet.metadata = std::move(packet_view.metadata);
 
 		return decrypted_packet;
 	}
 
 	result<Metadata> packet_get_metadata_without_verification(const span<const std::byte> packet) {
-		OUTCOME_TRY(packet_struct, packet_unpack(packet));
+		OUTCOME_TRY(packet_view, packet_parse(packet));
 
-		Metadata metadata;
-		if (packet_struct->packet_header->packet_type == MOLCH__PROTOBUF__PACKET_HEADER__PACKET_TYPE__PREKEY_MESSAGE) {
-			metadata.prekey_metadata = PrekeyMetadata();
-			auto& prekey_metadata{metadata.prekey_metadata.value()};
-			//copy the public keys
-			OUTCOME_TRY(identity, PublicKey::fromSpan({packet_struct->packet_header->public_identity_key}));
-			prekey_metadata.identity = identity;
-			OUTCOME_TRY(ephemeral, PublicKey::fromSpan({packet_struct->packet_header->public_ephemeral_key}));
-			prekey_metadata.ephemeral = ephemeral;
-			OUTCOME_TRY(prekey, PublicKey::fromSpan({packet_struct->packet_header->public_prekey}));
-			prekey_metadata.prekey = prekey;
-		}
-
-		metadata.current_protocol_version = packet_struct->packet_header->current_protocol_version;
-		metadata.highest_supported_protocol_version = packet_struct->packet_header->highest_supported_protocol_version;
-		metadata.packet_type = to_molch_message_type(packet_struct->packet_header->packet_type);
-
-		return metadata;
+		return std::move(packet_view.metadata);
 	}
 
 	result<Buffer> packet_decrypt_header(
@@ -275,56 +459,91 @@ namespace Molch {
 			return Error(status_type::INVALID_VALUE, "Header key is empty.");
 		}
 
-		const auto packet_struct_result = packet_unpack(packet);
-		if (not packet_struct_result.has_value()) {
+		const auto packet_view_result = packet_parse(packet);
+		if (not packet_view_result.has_value()) {
 			return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack header.");
 		}
-		const auto& packet_struct{packet_struct_result.value()};
+		const auto& packet_view{packet_view_result.value()};
 
-		if (packet_struct->encrypted_axolotl_header.len < crypto_secretbox_MACBYTES) {
+		if (packet_view.encrypted_axolotl_header.size() < crypto_secretbox_MACBYTES) {
 			return Error(status_type::INCORRECT_BUFFER_SIZE, "The ciphertext of the axolotl header is too short.");
 		}
 
-		const size_t axolotl_header_length{packet_struct->encrypted_axolotl_header.len - crypto_secretbox_MACBYTES};
+		const size_t axolotl_header_length{packet_view.encrypted_axolotl_header.size() - crypto_secretbox_MACBYTES};
 		Buffer axolotl_header(axolotl_header_length, axolotl_header_length);
+		OUTCOME_TRY(packet_decrypt_header(axolotl_header, packet_view, axolotl_header_key));
+
+		return axolotl_header;
+	}
+
+	result<Buffer> packet_decrypt_message(const span<const std::byte> packet, const MessageKey& message_key) {
+		OUTCOME_TRY(packet_view, packet_parse(packet));
+
+		Buffer message{packet.size(), packet.size()};
+		OUTCOME_TRY(decrypted_message, packet_decrypt_message(message, packet_view, message_key));
+		OUTCOME_TRY(message.setSize(decrypted_message.size()));
 
+		return message;
+	}
+
+	result<span<std::byte>> packet_decrypt_header(
+			const span<std::byte> axolotl_header,
+			const PacketView& packet,
+			const EmptyableHeaderKey& axolotl_header_key) {
+		//check input
+		if (axolotl_header_key.empty) {
+			return Error(status_type::INVALID_VALUE, "Header key is empty.");
+		}
+
+		if (packet.encrypted_axolotl_header.size() < crypto_secretbox_MACBYTES) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The ciphertext of the axolotl header is too short.");
+		}
+
+		const size_t axolotl_header_length{packet.encrypted_axolotl_header.size() - crypto_secretbox_MACBYTES};
+		if (axolotl_header.size() < axolotl_header_length) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The buffer is too small for the axolotl header.");
+		}
+
+		const auto decrypted_axolotl_header{axolotl_header.subspan(0, axolotl_header_length)};
 		if (!crypto_secretbox_open_easy(
-				axolotl_header,
-				{uchar_to_byte(packet_struct->encrypted_axolotl_header.data), packet_struct->encrypted_axolotl_header.len},
-				{uchar_to_byte(packet_struct->packet_header->header_nonce.data), packet_struct->packet_header->header_nonce.len},
+				decrypted_axolotl_header,
+				packet.encrypted_axolotl_header,
+				packet.header_nonce,
 				axolotl_header_key)) {
 			return Error(status_type::DECRYPT_ERROR, "Failed to decrypt");
 		}
 
-		return axolotl_header;
+		return decrypted_axolotl_header;
 	}
 
-	result<Buffer> packet_decrypt_message(const span<const std::byte> packet, const MessageKey& message_key) {
-		OUTCOME_TRY(packet_struct, packet_unpack(packet));
-
-		if (packet_struct->encrypted_message.len < crypto_secretbox_MACBYTES) {
+	result<span<std::byte>> packet_decrypt_message(
+			const span<std::byte> message,
+			const PacketView& packet,
+			const MessageKey& message_key) {
+		if (packet.encrypted_message.size() < crypto_secretbox_MACBYTES) {
 			return Error(status_type::INCORRECT_BUFFER_SIZE, "The ciphertext of the message is too short.");
 		}
 
-		const size_t padded_message_length{packet_struct->encrypted_message.len - crypto_secretbox_MACBYTES};
+		const size_t padded_message_length{packet.encrypted_message.size() - crypto_secretbox_MACBYTES};
 		if (padded_message_length < padding_blocksize) {
 			return Error(status_type::INCORRECT_BUFFER_SIZE, "The padded message is too short.");
 		}
+		if (message.size() < padded_message_length) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "The buffer is too small for the message.");
+		}
 
-		Buffer padded_message(padded_message_length, padded_message_length);
-
+		const auto padded_message{message.subspan(0, padded_message_length)};
 		if (!crypto_secretbox_open_easy(
 				padded_message,
-				{uchar_to_byte(packet_struct->encrypted_message.data), packet_struct->encrypted_message.len},
-				{uchar_to_byte(packet_struct->packet_header->message_nonce.data), packet_struct->packet_header->message_nonce.len},
+				packet.encrypted_message,
+				packet.message_nonce,
 				message_key)) {
 			return Error(status_type::DECRYPT_ERROR, "Failed to decrypt packet.");
 		}
 
 		//undo the padding
 		OUTCOME_TRY(unpadded_span, sodium_unpad(padded_message, padding_blocksize));
-		OUTCOME_TRY(padded_message.setSize(unpadded_span.size()));
 
-		return padded_message;
+		return unpadded_span;
 	}
 }
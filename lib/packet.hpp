@@ -22,11 +22,13 @@
 #ifndef LIB_PACKET_H
 #define LIB_PACKET_H
 
+#include <array>
 #include <memory>
 #include <optional>
 
 #include "buffer.hpp"
 #include "molch.h"
+#include "molch/constants.h"
 #include "key.hpp"
 #include "gsl.hpp"
 
@@ -55,6 +57,36 @@ namespace Molch {
 		Metadata metadata;
 	};
 
+	/*!
+	 * A parsed, but not yet decrypted packet. The encrypted parts point into the
+	 * packet it was parsed from, so it must not outlive it.
+	 */
+	struct PacketView {
+		Metadata metadata;
+		std::array<std::byte,HEADER_NONCE_SIZE> header_nonce;
+		std::array<std::byte,MESSAGE_NONCE_SIZE> message_nonce;
+		span<const std::byte> encrypted_axolotl_header;
+		span<const std::byte> encrypted_message;
+	};
+
+	/*!
+	 * Calculate the size of a packet created by packet_encrypt.
+	 *
+	 * \param packet_type
+	 *   The type of the packet (prekey message, normal message ...)
+	 * \param axolotl_header_size
+	 *   The size of the unencrypted axolotl header.
+	 * \param message_size
+	 *   The size of the unencrypted and unpadded message.
+	 *
+	 * \return
+	 *   The exact size of the packet.
+	 */
+	size_t packet_size(
+			const molch_message_type packet_type,
+			const size_t axolotl_header_size,
+			const size_t message_size) noexcept;
+
 	/*!
 	 * Construct and encrypt a packet given the keys and metadata.
 	 *
@@ -81,6 +113,48 @@ namespace Molch {
 			const MessageKey& message_key,
 			const std::optional<PrekeyMetadata>& prekey_metadata);
 
+	/*!
+	 * Construct and encrypt a packet into a buffer provided by the caller,
+	 * without allocating any memory.
+	 *
+	 * \param packet
+	 *   The output buffer, needs to be at least packet_size() long.
+	 * \param packet_type
+	 *   The type of the packet (prekey message, normal message ...)
+	 * \param axolotl_header
+	 *   The axolotl header containing all the necessary information for the ratchet.
+	 * \param axolotl_header_key
+	 *   The header key with which the axolotl header is encrypted.
+	 * \param message
+	 *   The message that should be sent.
+	 * \param message_key
+	 *   The key to encrypt the message with.
+	 * \param prekey_metadata Optional prekey metadata (for prekey packets)
+	 *
+	 * \return
+	 *   The part of the output buffer that contains the packet.
+	 */
+	result<span<std::byte>> packet_encrypt(
+			const span<std::byte> packet,
+			const molch_message_type packet_type,
+			const span<const std::byte> axolotl_header,
+			const EmptyableHeaderKey& axolotl_header_key,
+			const span<const std::byte> message,
+			const MessageKey& message_key,
+			const std::optional<PrekeyMetadata>& prekey_metadata);
+
+	/*!
+	 * Parse a packet without decrypting or verifying anything and without copying
+	 * the encrypted parts.
+	 *
+	 * \param packet
+	 *   The encrypted packet.
+	 *
+	 * \return
+	 *   A view into the packet.
+	 */
+	result<PacketView> packet_parse(const span<const std::byte> packet);
+
 	/*!
 	 * Extract and decrypt a packet and the metadata inside of it.
 	 *
@@ -129,5 +203,43 @@ namespace Molch {
 	 *   A buffer for the decrypted message.
 	 */
 	result<Buffer> packet_decrypt_message(const span<const std::byte> packet, const MessageKey& message_key);
+
+	/*!
+	 * Decrypt the axolotl header part of a parsed packet into a buffer provided by the caller.
+	 *
+	 * \param axolotl_header
+	 *   The output buffer, needs to be at least as long as the encrypted header minus its MAC.
+	 * \param packet
+	 *   The parsed packet.
+	 * \param axolotl_header_key
+	 *   The key to decrypt the axolotl header with.
+	 *
+	 * \return
+	 *   The part of the output buffer that contains the decrypted axolotl header.
+	 */
+	result<span<std::byte>> packet_decrypt_header(
+			const span<std::byte> axolotl_header,
+			const PacketView& packet,
+			const EmptyableHeaderKey& axolotl_header_key);
+
+	/*!
+	 * Decrypt the message part of a parsed packet into a buffer provided by the caller.
+	 * The buffer is also used for removing the padding, a buffer as long as the
+	 * packet itself is always sufficient.
+	 *
+	 * \param message
+	 *   The output buffer, needs to be at least as long as the encrypted message minus its MAC.
+	 * \param packet
+	 *   The parsed packet.
+	 * \param message_key
+	 *   The key to decrypt the message with.
+	 *
+	 * \return
+	 *   The part of the output buffer that contains the decrypted message.
+	 */
+	result<span<std::byte>> packet_decrypt_message(
+			const span<std::byte> message,
+			const PacketView& packet,
+			const MessageKey& message_key);
 }
 #endif
@@ -0,0 +1,104 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "parallel.hpp"
+
+namespace Molch {
+	result<void> parallel_for(const size_t count, const std::function<result<void>(size_t)>& work) {
+		const auto thread_count{std::min(static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 1U)), count)};
+		//not worth starting any threads
+		if (thread_count <= 1) {
+			for (size_t index{0}; index < count; index++) {
+				OUTCOME_TRY(work(index));
+			}
+
+			return outcome::success();
+		}
+
+		std::atomic<size_t> next_index{0};
+		std::atomic<bool> failed{false};
+		std::mutex failure_lock;
+		std::optional<Error> error;
+		std::exception_ptr exception;
+
+		const auto worker{[&]() {
+			while (!failed) {
+				const auto index{next_index++};
+				if (index >= count) {
+					return;
+				}
+
+				try {
+					auto work_result{work(index)};
+					if (work_result.has_error()) {
+						std::lock_guard<std::mutex> guard{failure_lock};
+						if (!failed.exchange(true)) {
+							error = work_result.error();
+						}
+					}
+				} catch (...) {
+					std::lock_guard<std::mutex> guard{failure_lock};
+					if (!failed.exchange(true)) {
+						exception = std::current_exception();
+					}
+				}
+			}
+		}};
+
+		//the calling thread is one of the workers
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
+		const auto join_all{[&]() {
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}};
+		try {
+			for (size_t thread_index{1}; thread_index < thread_count; thread_index++) {
+				threads.emplace_back(worker);
+			}
+		} catch (...) {
+			//destroying joinable threads would terminate, so stop the ones that are already running first
+			failed = true;
+			join_all();
+			throw;
+		}
+		worker();
+		join_all();
+
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+		if (error.has_value()) {
+			return error.value();
+		}
+
+		return outcome::success();
+	}
+}
@@ -0,0 +1,41 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_PARALLEL_H
+#define LIB_PARALLEL_H
+
+#include <functional>
+
+#include "result.hpp"
+
+namespace Molch {
+	/*
+	 * Call work with every index from 0 to count - 1, spread across as many
+	 * threads as there are cores. The work items have to be independent of
+	 * each other.
+	 *
+	 * No new work is started after the first error, which is returned.
+	 * Exceptions are rethrown on the calling thread.
+	 */
+	result<void> parallel_for(const size_t count, const std::function<result<void>(size_t)>& work);
+}
+
+#endif /* LIB_PARALLEL_H */
@@ -22,6 +22,7 @@
 #include <sodium.h>
 #include <algorithm>
 #include <climits>
+#include <cstring>
 #include <iterator>
 
 #include "prekey-store.hpp"
@@ -143,26 +144,55 @@ namespace Molch {
 		return stream;
 	}
 
-	PrekeyStore::PrekeyStore([[maybe_unused]] uninitialized_t uninitialized) {}
+	PrekeyIndex::PrekeyIndex() noexcept {
+		randombytes_buf(this->hash_key);
+	}
+
+	uint64_t PrekeyIndex::hash(const PublicKey& public_key) const noexcept {
+		std::array<unsigned char,crypto_shorthash_BYTES> hash;
+		crypto_shorthash(hash.data(), byte_to_uchar(public_key.data()), public_key.size(), byte_to_uchar(this->hash_key.data()));
+		uint64_t integer{0};
+		std::memcpy(&integer, hash.data(), sizeof(integer));
+
+		return integer;
+	}
 
-	void PrekeyStore::init() {
-		this->prekeys_storage = std::unique_ptr<std::array<Prekey,PREKEY_AMOUNT>,SodiumDeleter<std::array<Prekey,PREKEY_AMOUNT>>>(sodium_malloc<std::array<Prekey,PREKEY_AMOUNT>>(1));
-		new (this->prekeys_storage.get()) std::array<Prekey,PREKEY_AMOUNT>;
+	void PrekeyIndex::add(const PublicKey& public_key, const size_t position) {
+		this->positions.emplace(this->hash(public_key), position);
 	}
 
-	result<void> PrekeyStore::generateKeys() {
-		for (auto& key : *this->prekeys_storage) {
-			OUTCOME_TRY(key.generate());
+	void PrekeyIndex::remove(const PublicKey& public_key, const size_t position) noexcept {
+		const auto [begin, end]{this->positions.equal_range(this->hash(public_key))};
+		for (auto candidate{begin}; candidate != end; ++candidate) {
+			if (candidate->second == position) {
+				this->positions.erase(candidate);
+				return;
+			}
+		}
+	}
+
+	PrekeyStore::PrekeyStore([[maybe_unused]] uninitialized_t uninitialized) {}
+
+	result<void> PrekeyStore::generateKeys(const size_t amount) {
+		this->prekeys_storage.reserve(amount);
+		while (this->prekeys_storage.size() < amount) {
+			Prekey prekey;
+			OUTCOME_TRY(prekey.generate());
+			this->prekeys_storage.push_back(prekey);
+			this->prekeys_index.add(prekey.public_key, this->prekeys_storage.size() - 1);
 		}
 		this->updateExpirationDate();
 
 		return outcome::success();
 	}
 
-	result<PrekeyStore> PrekeyStore::create() {
+	result<PrekeyStore> PrekeyStore::create(const size_t amount) {
+		if ((amount == 0) || (amount > maximum_prekey_amount)) {
+			return Error(status_type::INVALID_VALUE, "Invalid number of prekeys.");
+		}
+
 		PrekeyStore store(uninitialized);
-		store.init();
-		OUTCOME_TRY(store.generateKeys());
+		OUTCOME_TRY(store.generateKeys(amount));
 
 		return store;
 	}
@@ -170,19 +200,18 @@ namespace Molch {
 	result<PrekeyStore> PrekeyStore::import(
 			const span<ProtobufCPrekey*> keypairs,
 			const span<ProtobufCPrekey*> deprecated_keypairs) {
-		FulfillOrFail(keypairs.size() == PREKEY_AMOUNT);
+		if (keypairs.empty() || (keypairs.size() > maximum_prekey_amount)) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "Invalid number of prekeys.");
+		}
 
 		PrekeyStore store(uninitialized);
-		store.init();
-
-		size_t index{0};
+		store.prekeys_storage.reserve(keypairs.size());
 		for (auto const& keypair : keypairs) {
 			if (keypair == nullptr) {
 				return Error(status_type::PROTOBUF_MISSING_ERROR, "Prekey missing.");
 			}
 			OUTCOME_TRY(imported_prekey, Prekey::import(*keypair));
-			new (&(*store.prekeys_storage)[index]) Prekey(std::move(imported_prekey));
-			++index;
+			store.prekeys_storage.emplace_back(std::move(imported_prekey));
 		}
 
 		for (auto const& keypair : deprecated_keypairs) {
@@ -193,6 +222,8 @@ namespace Molch {
 			store.deprecated_prekeys_storage.emplace_back(std::move(imported_prekey));
 		}
 
+		store.prekeys_index.rebuild(store.prekeys_storage);
+		store.deprecated_prekeys_index.rebuild(store.deprecated_prekeys_storage);
 		store.updateExpirationDate();
 		store.updateDeprecatedExpirationDate();
 
@@ -204,7 +235,7 @@ namespace Molch {
 	}
 
 	void PrekeyStore::updateExpirationDate() noexcept {
-		const auto& oldest{std::min_element(std::cbegin(*this->prekeys_storage), std::cend(*this->prekeys_storage), compare_expiration_dates)};
+		const auto& oldest{std::min_element(std::cbegin(this->prekeys_storage), std::cend(this->prekeys_storage), compare_expiration_dates)};
 		this->oldest_expiration_date = oldest->expiration_date;
 	}
 
@@ -219,51 +250,50 @@ namespace Molch {
 	}
 
 	result<void> PrekeyStore::deprecate(const size_t index) {
-		auto& at_index{(*this->prekeys_storage)[index]};
+		this->state_version.bump();
+
+		auto& at_index{this->prekeys_storage[index]};
 		at_index.expiration_date = now() + deprecated_prekey_expiration_time;
 		this->deprecated_prekeys_storage.push_back(at_index);
-
-		this->updateExpirationDate();
-		this->updateDeprecatedExpirationDate();
+		this->deprecated_prekeys_index.add(at_index.public_key, this->deprecated_prekeys_storage.size() - 1);
+		this->prekeys_index.remove(at_index.public_key, index);
 
 		//generate new prekey
 		OUTCOME_TRY(at_index.generate());
+		this->prekeys_index.add(at_index.public_key, index);
+
+		this->updateExpirationDate();
+		this->updateDeprecatedExpirationDate();
 
 		return outcome::success();
 	}
 
 	result<PrivateKey> PrekeyStore::getPrekey(const PublicKey& public_key) {
-		//lambda for comparing PrekeyNodes to public_key
-		auto key_comparer{[&public_key] (const Prekey& node) -> bool {
-			return public_key == node.public_key;
-		}};
-
-		auto found_prekey{std::find_if(std::cbegin(*this->prekeys_storage), std::cend(*this->prekeys_storage), key_comparer)};
-		if (found_prekey != this->prekeys_storage->end()) {
+		const auto found_prekey{this->prekeys_index.find(public_key, this->prekeys_storage)};
+		if (found_prekey.has_value()) {
 			//copy the private key
-			auto private_key{found_prekey->private_key};
+			auto private_key{this->prekeys_storage[found_prekey.value()].private_key};
 
 			//and deprecate key
-			auto index{gsl::narrow_cast<size_t>(found_prekey - std::begin(*this->prekeys_storage))};
-			OUTCOME_TRY(this->deprecate(index));
+			OUTCOME_TRY(this->deprecate(found_prekey.value()));
 
 			return private_key;
 		}
 
-		auto found_deprecated_prekey{std::find_if(std::cbegin(this->deprecated_prekeys_storage), std::cend(this->deprecated_prekeys_storage), key_comparer)};
-		if (found_deprecated_prekey == this->deprecated_prekeys_storage.end()) {
+		const auto found_deprecated_prekey{this->deprecated_prekeys_index.find(public_key, this->deprecated_prekeys_storage)};
+		if (!found_deprecated_prekey.has_value()) {
 			return Error(status_type::NOT_FOUND, "No matching prekey found.");
 		}
 
-		return found_deprecated_prekey->private_key;
+		return this->deprecated_prekeys_storage[found_deprecated_prekey.value()].private_key;
 	}
 
-	result<Buffer> PrekeyStore::list() const { //output, PREKEY_AMOUNT * PUBLIC_KEY_SIZE
-		const auto buffer_length{PREKEY_AMOUNT * PUBLIC_KEY_SIZE};
+	result<Buffer> PrekeyStore::list() const { //output, size() * PUBLIC_KEY_SIZE
+		const auto buffer_length{this->prekeys_storage.size() * PUBLIC_KEY_SIZE};
 		Buffer list(buffer_length, buffer_length);
 
 		size_t index{0};
-		for (const auto& key_bundle : *this->prekeys_storage) {
+		for (const auto& key_bundle : this->prekeys_storage) {
 			auto key_span{key_bundle.public_key};
 			std::copy(std::cbegin(key_span), std::cend(key_span), std::begin(list) + gsl::narrow_cast<ptrdiff_t>(PUBLIC_KEY_SIZE * index));
 			index++;
@@ -272,6 +302,33 @@ namespace Molch {
 		return list;
 	}
 
+	size_t PrekeyStore::size() const noexcept {
+		return this->prekeys_storage.size();
+	}
+
+	result<void> PrekeyStore::resize(const size_t amount) {
+		if ((amount == 0) || (amount > maximum_prekey_amount)) {
+			return Error(status_type::INVALID_VALUE, "Invalid number of prekeys.");
+		}
+		if (amount == this->prekeys_storage.size()) {
+			return outcome::success();
+		}
+
+		this->state_version.bump();
+		while (this->prekeys_storage.size() > amount) {
+			auto& last{this->prekeys_storage.back()};
+			last.expiration_date = now() + deprecated_prekey_expiration_time;
+			this->deprecated_prekeys_storage.push_back(last);
+			this->deprecated_prekeys_index.add(last.public_key, this->deprecated_prekeys_storage.size() - 1);
+			this->prekeys_index.remove(last.public_key, this->prekeys_storage.size() - 1);
+			this->prekeys_storage.pop_back();
+		}
+		OUTCOME_TRY(this->generateKeys(amount));
+		this->updateDeprecatedExpirationDate();
+
+		return outcome::success();
+	}
+
 	result<void> PrekeyStore::rotate() {
 		seconds current_time{now()};
 
@@ -279,7 +336,8 @@ namespace Molch {
 		if ((current_time + prekey_expiration_time) < this->oldest_expiration_date) {
 			//TODO: Is this correct behavior?
 			//Set the expiration date of everything to the current time + PREKEY_EXPIRATION_TIME
-			for (auto& prekey : *this->prekeys_storage) {
+			this->state_version.bump();
+			for (auto& prekey : this->prekeys_storage) {
 				prekey.expiration_date = current_time + prekey_expiration_time;
 			}
 		}
@@ -287,6 +345,7 @@ namespace Molch {
 		//Is the deprecated expiration date too far into the future?
 		if ((current_time + deprecated_prekey_expiration_time) < this->oldest_deprecated_expiration_date) {
 			//Set the expiration date of everything to the current time + DEPRECATED_PREKEY_EXPIRATION_TIME
+			this->state_version.bump();
 			for (auto& prekey : this->deprecated_prekeys_storage) {
 				prekey.expiration_date = current_time + deprecated_prekey_expiration_time;
 			}
@@ -294,19 +353,16 @@ namespace Molch {
 
 		//At least one outdated prekey
 		if (this->oldest_expiration_date < current_time) {
-			size_t index{0};
-			for (size_t index{0}; index < this->prekeys_storage->size(); ++index) {
-			}
-			for (const auto& prekey : *this->prekeys_storage) {
-				if (prekey.expiration_date < current_time) {
+			for (size_t index{0}; index < this->prekeys_storage.size(); ++index) {
+				if (this->prekeys_storage[index].expiration_date < current_time) {
 					OUTCOME_TRY(this->deprecate(index));
 				}
-				index++;
 			}
 		}
 
 		//At least one key to be removed
 		if (this->oldest_deprecated_expiration_date < current_time) {
+			this->state_version.bump();
 			for (size_t index{0}; index < this->deprecated_prekeys_storage.size(); index++) {
 				auto& prekey = this->deprecated_prekeys_storage[index];
 				if (prekey.expiration_date < current_time) {
@@ -314,6 +370,7 @@ namespace Molch {
 					index--;
 				}
 			}
+			this->deprecated_prekeys_index.rebuild(this->deprecated_prekeys_storage);
 			this->updateDeprecatedExpirationDate();
 		}
 
@@ -339,7 +396,7 @@ namespace Molch {
 
 	result<PrekeyStore::ExportedPrekeyStore> PrekeyStore::exportProtobuf(Arena& arena) const {
 		ExportedPrekeyStore prekey_store;
-		OUTCOME_TRY(keypairs, export_keypairs(arena, *this->prekeys_storage));
+		OUTCOME_TRY(keypairs, export_keypairs(arena, this->prekeys_storage));
 		prekey_store.keypairs = keypairs;
 		OUTCOME_TRY(deprecated_keypairs, export_keypairs(arena, this->deprecated_prekeys_storage));
 		prekey_store.deprecated_keypairs = deprecated_keypairs;
@@ -363,8 +420,8 @@ namespace Molch {
 		return stream;
 	}
 
-	const std::array<Prekey,PREKEY_AMOUNT>& PrekeyStore::prekeys() const noexcept {
-		return *this->prekeys_storage;
+	const std::vector<Prekey,SodiumAllocator<Prekey>>& PrekeyStore::prekeys() const noexcept {
+		return this->prekeys_storage;
 	}
 	const std::vector<Prekey,SodiumAllocator<Prekey>>& PrekeyStore::deprecatedPrekeys() const noexcept {
 		return this->deprecated_prekeys_storage;
@@ -376,12 +433,17 @@ namespace Molch {
 		return this->oldest_deprecated_expiration_date;
 	}
 
+	const StateVersion& PrekeyStore::version() const noexcept {
+		return this->state_version;
+	}
+
 	result<void> PrekeyStore::timeshiftForTestingOnly(size_t index, seconds timeshift) {
-		if (!this->prekeys_storage) {
-			return Error(status_type::INCORRECT_DATA, "The prekey storage is null.");
+		if (index >= this->prekeys_storage.size()) {
+			return Error(status_type::INCORRECT_DATA, "The prekey doesn't exist.");
 		}
-		(*this->prekeys_storage)[index].expiration_date += timeshift;
+		this->prekeys_storage[index].expiration_date += timeshift;
 		this->updateExpirationDate();
+		this->state_version.bump();
 
 		return outcome::success();
 	}
@@ -389,5 +451,6 @@ namespace Molch {
 	void PrekeyStore::timeshiftDeprecatedForTestingOnly(size_t index, seconds timeshift) noexcept {
 		this->deprecated_prekeys_storage[index].expiration_date += timeshift;
 		this->updateDeprecatedExpirationDate();
+		this->state_version.bump();
 	}
 }
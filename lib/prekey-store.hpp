@@ -24,6 +24,8 @@
 
 #include <memory>
 #include <array>
+#include <optional>
+#include <unordered_map>
 #include <vector>
 #include <ostream>
 
@@ -36,6 +38,7 @@
 #include "gsl.hpp"
 #include "time.hpp"
 #include "protobuf-arena.hpp"
+#include "state-version.hpp"
 
 namespace Molch {
 	class Prekey {
@@ -75,13 +78,59 @@ namespace Molch {
 
 	std::ostream& operator<<(std::ostream& stream, const Prekey& prekey);
 
+	//! Upper limit of the number of prekeys of a user.
+	constexpr size_t maximum_prekey_amount{65536};
+
+	/*
+	 * Finds the position of a public prekey with a keyed hash (SipHash), so that
+	 * the time to find a prekey doesn't grow with the number of prekeys. The
+	 * hash key is random, so nobody can craft prekeys that collide.
+	 */
+	class PrekeyIndex {
+	private:
+		std::array<std::byte,crypto_shorthash_KEYBYTES> hash_key;
+		std::unordered_multimap<uint64_t,size_t> positions;
+
+		uint64_t hash(const PublicKey& public_key) const noexcept;
+
+	public:
+		PrekeyIndex() noexcept;
+
+		void add(const PublicKey& public_key, const size_t position);
+		void remove(const PublicKey& public_key, const size_t position) noexcept;
+
+		//! Index all prekeys of a container by their position.
+		template <typename Container>
+		void rebuild(const Container& prekeys) {
+			this->positions.clear();
+			this->positions.reserve(prekeys.size());
+			size_t position{0};
+			for (const auto& prekey : prekeys) {
+				this->add(prekey.publicKey(), position);
+				position++;
+			}
+		}
+
+		//! Position of the public key in the indexed container.
+		template <typename Container>
+		std::optional<size_t> find(const PublicKey& public_key, const Container& prekeys) const {
+			const auto [begin, end]{this->positions.equal_range(this->hash(public_key))};
+			for (auto candidate{begin}; candidate != end; ++candidate) {
+				if (prekeys[candidate->second].publicKey() == public_key) {
+					return candidate->second;
+				}
+			}
+
+			return std::nullopt;
+		}
+	};
+
 	class PrekeyStore {
 	private:
 		seconds oldest_expiration_date{0};
 		seconds oldest_deprecated_expiration_date{0};
 
-		void init();
-		result<void> generateKeys();
+		result<void> generateKeys(const size_t amount);
 
 		void updateExpirationDate() noexcept;
 		void updateDeprecatedExpirationDate() noexcept;
@@ -91,8 +140,12 @@ namespace Molch {
 		 */
 		result<void> deprecate(const size_t index);
 
-		std::unique_ptr<std::array<Prekey,PREKEY_AMOUNT>,SodiumDeleter<std::array<Prekey,PREKEY_AMOUNT>>> prekeys_storage;
+		std::vector<Prekey,SodiumAllocator<Prekey>> prekeys_storage;
 		std::vector<Prekey,SodiumAllocator<Prekey>> deprecated_prekeys_storage;
+		PrekeyIndex prekeys_index;
+		PrekeyIndex deprecated_prekeys_index;
+
+		StateVersion state_version;
 
 	public:
 
@@ -101,8 +154,10 @@ namespace Molch {
 
 		/*
 		 * Create a new keystore. Generates all the keys.
+		 *
+		 * \param amount Number of prekeys, between 1 and maximum_prekey_amount.
 		 */
-		static result<PrekeyStore> create();
+		static result<PrekeyStore> create(const size_t amount = PREKEY_AMOUNT);
 
 		/*! Import a prekey store from a protobuf-c struct.
 		 * \param keypairs An array of prekey pairs.
@@ -125,7 +180,16 @@ namespace Molch {
 		 * Generate a list containing all public prekeys.
 		 * (this list can then be stored on a public server).
 		 */
-		result<Buffer> list() const; //output, PREKEY_AMOUNT * PUBLIC_KEY_SIZE
+		result<Buffer> list() const; //output, size() * PUBLIC_KEY_SIZE
+
+		//! Number of prekeys that aren't deprecated.
+		size_t size() const noexcept;
+
+		/*
+		 * Change the number of prekeys. Prekeys that are dropped are deprecated,
+		 * because they might still be in prekey lists that have been published.
+		 */
+		result<void> resize(const size_t amount);
 
 		/*
 		 * Automatically deprecate old keys and generate new ones
@@ -145,11 +209,14 @@ namespace Molch {
 		 */
 		result<ExportedPrekeyStore> exportProtobuf(Arena& arena) const;
 
-		const std::array<Prekey,PREKEY_AMOUNT>& prekeys() const noexcept;
+		const std::vector<Prekey,SodiumAllocator<Prekey>>& prekeys() const noexcept;
 		const std::vector<Prekey,SodiumAllocator<Prekey>>& deprecatedPrekeys() const noexcept;
 		const seconds& oldestExpirationDate() const noexcept;
 		const seconds& oldestDeprecatedExpirationDate() const noexcept;
 
+		//! Changes whenever prekeys are deprecated, generated or thrown away.
+		const StateVersion& version() const noexcept;
+
 		//DON'T USE, THIS IS ONLY FOR TESTING!
 		result<void> timeshiftForTestingOnly(size_t index, seconds timeshift);
 		void timeshiftDeprecatedForTestingOnly(size_t index, seconds timeshift) noexcept;
@@ -19,6 +19,9 @@
 #ifndef LIB_PROTOBUF_DELETERS_H
 #define LIB_PROTOBUF_DELETERS_H
 
+#include <array>
+#include <cstddef>
+
 extern "C" {
 	#include <backup.pb-c.h>
 	#include <conversation.pb-c.h>
@@ -33,8 +36,14 @@ extern "C" {
 }
 
 using ProtobufCBackup = Molch__Protobuf__Backup;
+using ProtobufCBackupManifest = Molch__Protobuf__BackupManifest;
+using ProtobufCBackupManifestSegment = Molch__Protobuf__BackupManifest__Segment;
+using ProtobufCConversationsBackup = Molch__Protobuf__ConversationsBackup;
 using ProtobufCConversation = Molch__Protobuf__Conversation;
+using ProtobufCConversationDelta = Molch__Protobuf__ConversationDelta;
+using ProtobufCConversationCheckpoint = Molch__Protobuf__ConversationCheckpoint;
 using ProtobufCEncryptedBackup = Molch__Protobuf__EncryptedBackup;
+using ProtobufCEncryptedSegment = Molch__Protobuf__EncryptedSegment;
 using ProtobufCHeader = Molch__Protobuf__Header;
 using ProtobufCKey = Molch__Protobuf__Key;
 using ProtobufCKeyBundle = Molch__Protobuf__KeyBundle;
@@ -63,6 +72,50 @@ namespace Molch {
 	void protobuf_c_delete(void *allocator_data, void *pointer);
 
 	extern ProtobufCAllocator protobuf_c_allocator;
+
+	/*!
+	 * Protobuf-C allocator that hands out memory from a fixed size buffer
+	 * inside of the object itself. This allows unpacking small messages
+	 * without touching the heap. Allocations fail once the buffer is exhausted
+	 * and memory is only given back when the allocator goes out of scope.
+	 */
+	template <size_t capacity>
+	class FixedProtobufCAllocator {
+	private:
+		alignas(std::max_align_t) std::array<std::byte,capacity> storage;
+		size_t used{0};
+		ProtobufCAllocator allocator{&FixedProtobufCAllocator::allocate, &FixedProtobufCAllocator::deallocate, this};
+
+		static void *allocate(void *allocator_data, size_t size) noexcept {
+			auto& self{*static_cast<FixedProtobufCAllocator*>(allocator_data)};
+			constexpr size_t alignment{alignof(std::max_align_t)};
+			const size_t aligned_size{((size + alignment - 1) / alignment) * alignment};
+			if ((aligned_size < size) or (aligned_size > (capacity - self.used))) {
+				return nullptr;
+			}
+
+			auto pointer{&self.storage[self.used]};
+			self.used += aligned_size;
+			return pointer;
+		}
+
+		static void deallocate(void *allocator_data, void *pointer) noexcept {
+			(void)allocator_data;
+			(void)pointer;
+		}
+
+	public:
+		FixedProtobufCAllocator() = default;
+		FixedProtobufCAllocator(const FixedProtobufCAllocator&) = delete;
+		FixedProtobufCAllocator(FixedProtobufCAllocator&&) = delete;
+		FixedProtobufCAllocator& operator=(const FixedProtobufCAllocator&) = delete;
+		FixedProtobufCAllocator& operator=(FixedProtobufCAllocator&&) = delete;
+		~FixedProtobufCAllocator() = default;
+
+		ProtobufCAllocator *get() noexcept {
+			return &this->allocator;
+		}
+	};
 }
 
 #define protobuf_arena_create(arena, type, name) \
@@ -29,6 +29,9 @@
 #include "gsl.hpp"
 
 namespace Molch {
+	//sodium_malloc puts the allocation at the end of a page, so this keeps the storage cache line aligned
+	static_assert((sizeof(RatchetStorage) % cache_line_size) == 0, "RatchetStorage isn't a multiple of the cache line size.");
+
 	void Ratchet::init() {
 		this->storage = std::unique_ptr<RatchetStorage,SodiumDeleter<RatchetStorage>>(sodium_malloc<RatchetStorage>(1));
 		new (this->storage.get()) RatchetStorage{};
@@ -58,7 +61,7 @@ namespace Molch {
 				return Error(status_type::SHOULDNT_HAPPEN, "This mustn't happen, both conversation partners have the same public key!");
 			}
 		}());
-		ratchet.role = role;
+		ratchet.storage->role = role;
 
 		//derive initial chain, root and header keys
 		OUTCOME_TRY(derived_keys, derive_initial_root_chain_and_header_keys(
@@ -68,7 +71,7 @@ namespace Molch {
 			our_private_ephemeral,
 			our_public_ephemeral,
 			their_public_ephemeral,
-			ratchet.role));
+			ratchet.storage->role));
 		auto& storage{ratchet.storage};
 		storage->root_key = derived_keys.root_key;
 		if (derived_keys.send_chain_key.has_value()) {
@@ -81,7 +84,11 @@ namespace Molch {
 		} else {
 			storage->receive_chain_key.clearKey();
 		}
-		storage->send_header_key = std::move(derived_keys.send_header_key);
+		if (derived_keys.send_header_key.has_value()) {
+			storage->send_header_key = derived_keys.send_header_key.value();
+		} else {
+			storage->send_header_key.clearKey();
+		}
 		if (derived_keys.receive_header_key.has_value()) {
 			storage->receive_header_key = derived_keys.receive_header_key.value();
 		} else {
@@ -103,12 +110,12 @@ namespace Molch {
 		storage->their_public_ephemeral = their_public_ephemeral;
 
 		//set other state
-		ratchet.ratchet_flag = static_cast<bool>(ratchet.role);
-		ratchet.received_valid = true; //allowing the receival of new messages
-		ratchet.header_decryptable = HeaderDecryptability::NOT_TRIED;
-		ratchet.send_message_number = 0;
-		ratchet.receive_message_number = 0;
-		ratchet.previous_message_number = 0;
+		ratchet.storage->ratchet_flag = static_cast<bool>(ratchet.storage->role);
+		ratchet.storage->received_valid = true; //allowing the receival of new messages
+		ratchet.storage->header_decryptable = HeaderDecryptability::NOT_TRIED;
+		ratchet.storage->send_message_number = 0;
+		ratchet.storage->receive_message_number = 0;
+		ratchet.storage->previous_message_number = 0;
 
 		return ratchet;
 	}
@@ -116,7 +123,7 @@ namespace Molch {
 	result<Ratchet::SendData> Ratchet::getSendData() {
 		auto& storage{this->storage};
 		SendData data;
-		if (this->ratchet_flag) {
+		if (this->storage->ratchet_flag) {
 			//DHRs = generateECDH()
 			OUTCOME_TRY(crypto_box_keypair(
 					storage->our_public_ephemeral,
@@ -134,19 +141,19 @@ namespace Molch {
 				storage->our_public_ephemeral,
 				storage->their_public_ephemeral,
 				root_key_backup,
-				this->role));
+				this->storage->role));
 			storage->root_key = derived_keys.root_key;
 			storage->next_send_header_key = derived_keys.next_header_key;
 			storage->send_chain_key = derived_keys.chain_key;
 
 			//PNs = Ns
-			this->previous_message_number = this->send_message_number;
+			this->storage->previous_message_number = this->storage->send_message_number;
 
 			//Ns = 0
-			this->send_message_number = 0;
+			this->storage->send_message_number = 0;
 
 			//ratchet_flag = False
-			this->ratchet_flag = false;
+			this->storage->ratchet_flag = false;
 		}
 
 		//MK = HMAC-HASH(CKs, "0")
@@ -158,19 +165,19 @@ namespace Molch {
 		//  msg = Enc(HKs, Ns || PNs || DHRs) || Enc(MK, plaintext)
 		//  in the axolotl specification)
 		//HKs:
-		if (not storage->send_header_key.has_value()) {
+		if (storage->send_header_key.isNone()) {
 			return {status_type::INVALID_STATE, "Send header key is missing."};
 		}
-		data.header_key = storage->send_header_key.value();
+		data.header_key = storage->send_header_key;
 		//Ns
-		data.message_number = this->send_message_number;
+		data.message_number = this->storage->send_message_number;
 		//PNs
-		data.previous_message_number = this->previous_message_number;
+		data.previous_message_number = this->storage->previous_message_number;
 		//DHRs
 		data.ephemeral = storage->our_public_ephemeral;
 
 		//Ns = Ns + 1
-		this->send_message_number++;
+		this->storage->send_message_number++;
 
 		//CKs = HMAC-HASH(CKs, "1")
 		OUTCOME_TRY(send_chain_key, storage->send_chain_key.deriveChainKey());
@@ -188,10 +195,10 @@ namespace Molch {
 	}
 
 	result<void> Ratchet::setHeaderDecryptability(const HeaderDecryptability header_decryptable) noexcept {
-		FulfillOrFail((this->header_decryptable == HeaderDecryptability::NOT_TRIED)
+		FulfillOrFail((this->storage->header_decryptable == HeaderDecryptability::NOT_TRIED)
 				&& (header_decryptable != HeaderDecryptability::NOT_TRIED));
 
-		this->header_decryptable = header_decryptable;
+		this->storage->header_decryptable = header_decryptable;
 
 		return outcome::success();
 	}
@@ -267,22 +274,22 @@ namespace Molch {
 			const PublicKey& their_purported_public_ephemeral,
 			const uint32_t purported_message_number,
 			const uint32_t purported_previous_message_number) {
-		if (!this->received_valid) {
+		if (!this->storage->received_valid) {
 			//abort because the previously received message hasn't been verified yet.
 			return Error(status_type::INVALID_STATE, "Previously received message hasn't been verified yet.");
 		}
 
 		//header decryption hasn't been tried yet
-		if (this->header_decryptable == HeaderDecryptability::NOT_TRIED) {
+		if (this->storage->header_decryptable == HeaderDecryptability::NOT_TRIED) {
 			return Error(status_type::INVALID_STATE, "Header decryption hasn't been tried yet.");
 		}
 
 		auto& storage{this->storage};
 
 		MessageKey message_key;
-		if (!storage->receive_header_key.isNone() && (this->header_decryptable == HeaderDecryptability::CURRENT_DECRYPTABLE)) { //still the same message chain
+		if (!storage->receive_header_key.isNone() && (this->storage->header_decryptable == HeaderDecryptability::CURRENT_DECRYPTABLE)) { //still the same message chain
 			//Np = read(): get the purported message number from the input
-			this->purported_message_number = purported_message_number;
+			this->storage->purported_message_number = purported_message_number;
 
 			//CKp, MK = stage_skipped_header_and_message_keys(HKr, Nr, Np, CKr)
 			OUTCOME_TRY(stageSkippedHeaderAndMessageKeys(
@@ -290,19 +297,19 @@ namespace Molch {
 				&storage->purported_receive_chain_key,
 				&message_key,
 				storage->receive_header_key,
-				this->receive_message_number,
+				this->storage->receive_message_number,
 				purported_message_number,
 				storage->receive_chain_key));
 		} else { //new message chain
 			//if ratchet_flag or not Dec(NHKr, header)
-			if (this->ratchet_flag || (this->header_decryptable != HeaderDecryptability::NEXT_DECRYPTABLE)) {
+			if (this->storage->ratchet_flag || (this->storage->header_decryptable != HeaderDecryptability::NEXT_DECRYPTABLE)) {
 				return Error(status_type::DECRYPT_ERROR, "Undecryptable.");
 			}
 
 			//Np = read(): get the purported message number from the input
-			this->purported_message_number = purported_message_number;
+			this->storage->purported_message_number = purported_message_number;
 			//PNp = read(): get the purported previous message number from the input
-			this->purported_previous_message_number = purported_previous_message_number;
+			this->storage->purported_previous_message_number = purported_previous_message_number;
 			//DHRp = read(): get the purported ephemeral from the input
 			storage->their_purported_public_ephemeral = their_purported_public_ephemeral;
 
@@ -312,7 +319,7 @@ namespace Molch {
 					nullptr, //output_chain_key
 					nullptr, //output_message_key
 					storage->receive_header_key,
-					this->receive_message_number,
+					this->storage->receive_message_number,
 					purported_previous_message_number,
 					storage->receive_chain_key));
 
@@ -325,7 +332,7 @@ namespace Molch {
 					storage->our_public_ephemeral,
 					their_purported_public_ephemeral,
 					storage->root_key,
-					this->role));
+					this->storage->role));
 			storage->purported_root_key = derived_keys.root_key;
 			storage->purported_next_receive_header_key = derived_keys.next_header_key;
 			storage->purported_receive_chain_key = derived_keys.chain_key;
@@ -344,7 +351,7 @@ namespace Molch {
 					purported_chain_key_backup));
 		}
 
-		this->received_valid = false; //waiting for validation (feedback, if the message could actually be decrypted)
+		this->storage->received_valid = false; //waiting for validation (feedback, if the message could actually be decrypted)
 
 		return message_key;
 	}
@@ -355,11 +362,11 @@ namespace Molch {
 	 */
 	result<void> Ratchet::setLastMessageAuthenticity(bool valid) noexcept {
 		//prepare for being able to receive new messages
-		this->received_valid = true;
+		this->storage->received_valid = true;
 
 		//backup header decryptability
-		auto header_decryptable{this->header_decryptable};
-		this->header_decryptable = HeaderDecryptability::NOT_TRIED;
+		auto header_decryptable{this->storage->header_decryptable};
+		this->storage->header_decryptable = HeaderDecryptability::NOT_TRIED;
 
 		if (!valid) { //message couldn't be decrypted
 			this->staged_header_and_message_keys.clear();
@@ -367,7 +374,7 @@ namespace Molch {
 		}
 
 		if (this->storage->receive_header_key.isNone() || (header_decryptable != HeaderDecryptability::CURRENT_DECRYPTABLE)) { //new message chain
-			if (this->ratchet_flag || (header_decryptable != HeaderDecryptability::NEXT_DECRYPTABLE)) {
+			if (this->storage->ratchet_flag || (header_decryptable != HeaderDecryptability::NEXT_DECRYPTABLE)) {
 				//if ratchet_flag or not Dec(NHKr, header)
 				//clear purported message and header keys
 				this->staged_header_and_message_keys.clear();
@@ -383,25 +390,65 @@ namespace Molch {
 			//NHKr = NHKp
 			this->storage->next_receive_header_key = this->storage->purported_next_receive_header_key;
 			//DHRr = DHRp
-			if (not this->storage->their_purported_public_ephemeral.has_value()) {
+			const auto their_purported_public_ephemeral{this->storage->their_purported_public_ephemeral.toKey()};
+			if (not their_purported_public_ephemeral.has_value()) {
 				return Error(status_type::INVALID_VALUE, "Their purported public ephemeral key is missing.");
 			}
-			this->storage->their_public_ephemeral = this->storage->their_purported_public_ephemeral.value();
+			this->storage->their_public_ephemeral = their_purported_public_ephemeral.value();
 			//erase(DHRs)
 			this->storage->our_private_ephemeral.zero();
 			//ratchet_flag = True
-			this->ratchet_flag = true;
+			this->storage->ratchet_flag = true;
 		}
 
 		//commit_skipped_header_and_message_keys
 		this->commitSkippedHeaderAndMessageKeys();
 		//Nr = Np + 1
-		this->receive_message_number = this->purported_message_number + 1;
+		this->storage->receive_message_number = this->storage->purported_message_number + 1;
 		//CKr = CKp
 		this->storage->receive_chain_key = this->storage->purported_receive_chain_key;
 		return outcome::success();
 	}
 
+	static result<Molch__Protobuf__Conversation__HeaderDecryptability> export_header_decryptability(const Ratchet::HeaderDecryptability header_decryptable) {
+		switch (header_decryptable) {
+			case Ratchet::HeaderDecryptability::CURRENT_DECRYPTABLE:
+				return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__CURRENT_DECRYPTABLE;
+
+			case Ratchet::HeaderDecryptability::NEXT_DECRYPTABLE:
+				return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NEXT_DECRYPTABLE;
+
+			case Ratchet::HeaderDecryptability::UNDECRYPTABLE:
+				return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__UNDECRYPTABLE;
+
+			case Ratchet::HeaderDecryptability::NOT_TRIED:
+				return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NOT_TRIED;
+
+			default:
+				return Error(status_type::INVALID_VALUE, "Invalid value of ratchet->header_decryptable.");
+		}
+	}
+
+	static result<Ratchet::HeaderDecryptability> import_header_decryptability(const Molch__Protobuf__Conversation__HeaderDecryptability header_decryptable) {
+		switch (header_decryptable) {
+			case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__CURRENT_DECRYPTABLE:
+				return Ratchet::HeaderDecryptability::CURRENT_DECRYPTABLE;
+
+			case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NEXT_DECRYPTABLE:
+				return Ratchet::HeaderDecryptability::NEXT_DECRYPTABLE;
+
+			case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__UNDECRYPTABLE:
+				return Ratchet::HeaderDecryptability::UNDECRYPTABLE;
+
+			case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NOT_TRIED:
+				return Ratchet::HeaderDecryptability::NOT_TRIED;
+
+			case _MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY_IS_INT_SIZE:
+			default:
+				return Error(status_type::INVALID_VALUE, "header_decryptable has an invalid value.");
+		}
+	}
+
 #define error_if_missing(name) \
 	if ((name).empty) {\
 		return Error(status_type::EXPORT_ERROR, "Missing ");\
@@ -425,13 +472,13 @@ namespace Molch {
 
 		//header keys
 		//send header key
-		const auto& role = this->role;
-		if (not storage.send_header_key.has_value()) {
+		const auto& role = this->storage->role;
+		const auto& send_header_key{storage.send_header_key};
+		if (send_header_key.empty) {
 			if (role == Role::BOB) {
 				return Error(status_type::EXPORT_ERROR, "send_header_key missing or has an incorrect size.");
 			}
 		} else {
-			const auto& send_header_key{storage.send_header_key.value()};
 			outcome_protobuf_optional_bytes_arena_export(arena, conversation, send_header_key, HEADER_KEY_SIZE);
 		}
 
@@ -499,43 +546,25 @@ namespace Molch {
 		const auto& their_public_ephemeral_key{storage.their_public_ephemeral};
 		outcome_protobuf_optional_bytes_arena_export(arena, conversation, their_public_ephemeral_key, PUBLIC_KEY_SIZE);
 		//their purported public ephemeral key
-		const auto& their_purported_public_ephemeral_optional{storage.their_purported_public_ephemeral};
-		if (their_purported_public_ephemeral_optional.has_value()) {
-			const auto& their_purported_public_ephemeral{their_purported_public_ephemeral_optional.value()};
+		const auto& their_purported_public_ephemeral{storage.their_purported_public_ephemeral};
+		if (!their_purported_public_ephemeral.empty) {
 			outcome_protobuf_optional_bytes_arena_export(arena, conversation, their_purported_public_ephemeral, PUBLIC_KEY_SIZE);
 		}
 
 		//message numbers
-		protobuf_optional_export(conversation, send_message_number, this->send_message_number);
-		protobuf_optional_export(conversation, receive_message_number, this->receive_message_number);
-		protobuf_optional_export(conversation, purported_message_number, this->purported_message_number);
-		protobuf_optional_export(conversation, previous_message_number, this->previous_message_number);
-		protobuf_optional_export(conversation, purported_previous_message_number, this->purported_previous_message_number);
+		protobuf_optional_export(conversation, send_message_number, this->storage->send_message_number);
+		protobuf_optional_export(conversation, receive_message_number, this->storage->receive_message_number);
+		protobuf_optional_export(conversation, purported_message_number, this->storage->purported_message_number);
+		protobuf_optional_export(conversation, previous_message_number, this->storage->previous_message_number);
+		protobuf_optional_export(conversation, purported_previous_message_number, this->storage->purported_previous_message_number);
 
 		//flags
-		protobuf_optional_export(conversation, ratchet_flag, this->ratchet_flag);
+		protobuf_optional_export(conversation, ratchet_flag, this->storage->ratchet_flag);
 		protobuf_optional_export(conversation, am_i_alice, static_cast<bool>(role));
-		protobuf_optional_export(conversation, received_valid, this->received_valid);
+		protobuf_optional_export(conversation, received_valid, this->storage->received_valid);
 
 		//header decryptability
-		OUTCOME_TRY(header_decryptable, [&] () -> result<Molch__Protobuf__Conversation__HeaderDecryptability> {
-				switch (this->header_decryptable) {
-					case HeaderDecryptability::CURRENT_DECRYPTABLE:
-						return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__CURRENT_DECRYPTABLE;
-
-					case HeaderDecryptability::NEXT_DECRYPTABLE:
-						return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NEXT_DECRYPTABLE;
-
-					case HeaderDecryptability::UNDECRYPTABLE:
-						return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__UNDECRYPTABLE;
-
-					case HeaderDecryptability::NOT_TRIED:
-						return MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NOT_TRIED;
-
-					default:
-						return Error(status_type::INVALID_VALUE, "Invalid value of ratchet->header_decryptable.");
-			}
-		}());
+		OUTCOME_TRY(header_decryptable, export_header_decryptability(this->storage->header_decryptable));
 		protobuf_optional_export(conversation, header_decryptable, header_decryptable);
 
 		//keystores
@@ -556,27 +585,27 @@ namespace Molch {
 		if (!conversation.has_send_message_number) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No send message number in Protobuf-C struct.");
 		}
-		ratchet.send_message_number = conversation.send_message_number;
+		ratchet.storage->send_message_number = conversation.send_message_number;
 		//receive message number
 		if (!conversation.has_receive_message_number) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No receive message number in Protobuf-C struct.");
 		}
-		ratchet.receive_message_number = conversation.receive_message_number;
+		ratchet.storage->receive_message_number = conversation.receive_message_number;
 		//purported message number
 		if (!conversation.has_purported_message_number) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No purported message number in Protobuf-C struct.");
 		}
-		ratchet.purported_message_number = conversation.purported_message_number;
+		ratchet.storage->purported_message_number = conversation.purported_message_number;
 		//previous message number
 		if (!conversation.has_previous_message_number) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No previous message number in Protobuf-C struct.");
 		}
-		ratchet.previous_message_number = conversation.previous_message_number;
+		ratchet.storage->previous_message_number = conversation.previous_message_number;
 		//purported previous message number
 		if (!conversation.has_purported_previous_message_number) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No purported previous message number in Protobuf-C struct.");
 		}
-		ratchet.purported_previous_message_number = conversation.purported_previous_message_number;
+		ratchet.storage->purported_previous_message_number = conversation.purported_previous_message_number;
 
 
 		//flags
@@ -584,43 +613,25 @@ namespace Molch {
 		if (!conversation.has_ratchet_flag) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No ratchet flag in Protobuf-C struct.");
 		}
-		ratchet.ratchet_flag = conversation.ratchet_flag;
+		ratchet.storage->ratchet_flag = conversation.ratchet_flag;
 		//am I Alice
 		if (!conversation.has_am_i_alice) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No am I Alice flag in Protobuf-C struct.");
 		}
-		ratchet.role = static_cast<Role>(conversation.am_i_alice);
+		ratchet.storage->role = static_cast<Role>(conversation.am_i_alice);
 		//received valid
 		if (!conversation.has_received_valid) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No received valid flag in Protobuf-C struct.");
 		}
-		ratchet.received_valid = conversation.received_valid;
+		ratchet.storage->received_valid = conversation.received_valid;
 
 
 		//header decryptable
 		if (!conversation.has_header_decryptable) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "No header decryptable enum in Protobuf-C struct.");
 		}
-		OUTCOME_TRY(header_decryptability, [&] () -> result<HeaderDecryptability> {
-			switch (conversation.header_decryptable) {
-				case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__CURRENT_DECRYPTABLE:
-					return HeaderDecryptability::CURRENT_DECRYPTABLE;
-
-				case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NEXT_DECRYPTABLE:
-					return HeaderDecryptability::NEXT_DECRYPTABLE;
-
-				case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__UNDECRYPTABLE:
-					return HeaderDecryptability::UNDECRYPTABLE;
-
-				case MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY__NOT_TRIED:
-					return HeaderDecryptability::NOT_TRIED;
-
-				case _MOLCH__PROTOBUF__CONVERSATION__HEADER_DECRYPTABILITY_IS_INT_SIZE:
-				default:
-					return Error(status_type::INVALID_VALUE, "header_decryptable has an invalid value.");
-			}
-		}());
-		ratchet.header_decryptable = header_decryptability;
+		OUTCOME_TRY(header_decryptability, import_header_decryptability(conversation.header_decryptable));
+		ratchet.storage->header_decryptable = header_decryptability;
 
 		//root keys
 		//root key
@@ -638,16 +649,16 @@ namespace Molch {
 		//header key
 		//send header key
 		if (!conversation.has_send_header_key || (conversation.send_header_key.len != HEADER_KEY_SIZE)) {
-			if (ratchet.role == Role::BOB) {
+			if (ratchet.storage->role == Role::BOB) {
 				return Error(status_type::PROTOBUF_MISSING_ERROR, "send_header_key is missing from the protobuf.");
 			}
-			ratchet.storage->send_header_key.reset();
+			ratchet.storage->send_header_key.clearKey();
 		} else {
-		    OUTCOME_TRY(send_header_key, EmptyableHeaderKey::fromSpan({uchar_to_byte(conversation.send_header_key.data), conversation.send_header_key.len}));
-			ratchet.storage->send_header_key.emplace(send_header_key);
+			OUTCOME_TRY(send_header_key, EmptyableHeaderKey::fromSpan({uchar_to_byte(conversation.send_header_key.data), conversation.send_header_key.len}));
+			ratchet.storage->send_header_key = send_header_key;
 		}
 		//receive header key
-		if ((ratchet.role == Role::ALICE) &&
+		if ((ratchet.storage->role == Role::ALICE) &&
 				(!conversation.has_receive_header_key || (conversation.receive_header_key.len != HEADER_KEY_SIZE))) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "receive_header_key is missing from protobuf.");
 		}
@@ -678,14 +689,14 @@ namespace Molch {
 
 		//chain keys
 		//send chain key
-		if ((ratchet.role == Role::BOB) &&
+		if ((ratchet.storage->role == Role::BOB) &&
 				(!conversation.has_send_chain_key || (conversation.send_chain_key.len != CHAIN_KEY_SIZE))) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "send_chain_key is missing from the potobuf.");
 		}
 		OUTCOME_TRY(send_chain_key, EmptyableChainKey::fromSpan({conversation.send_chain_key}));
 		ratchet.storage->send_chain_key = send_chain_key;
 		//receive chain key
-		if ((ratchet.role == Role::ALICE) &&
+		if ((ratchet.storage->role == Role::ALICE) &&
 				(!conversation.has_receive_chain_key || (conversation.receive_chain_key.len != CHAIN_KEY_SIZE))) {
 			return Error(status_type::PROTOBUF_MISSING_ERROR, "receive_chain_key is missing from the protobuf.");
 		}
@@ -732,7 +743,7 @@ namespace Molch {
 		ratchet.storage->their_public_ephemeral = their_public_ephemeral;
 		//their purported public ephemeral key
 		if (conversation.has_their_purported_public_ephemeral && (conversation.their_purported_public_ephemeral.len == PUBLIC_KEY_SIZE)) {
-			OUTCOME_TRY(their_purported_public_ephemeral, PublicKey::fromSpan({conversation.their_purported_public_ephemeral}));
+			OUTCOME_TRY(their_purported_public_ephemeral, EmptyablePublicKey::fromSpan({conversation.their_purported_public_ephemeral}));
 			ratchet.storage->their_purported_public_ephemeral = their_purported_public_ephemeral;
 		}
 
@@ -751,6 +762,454 @@ namespace Molch {
 		return ratchet;
 	}
 
+	/*
+	 * Layout of a ratchet snapshot, version 0:
+	 *
+	 * version (1 byte)
+	 * send, receive, purported, previous and purported previous message number (4 bytes each)
+	 * flags (1 byte): ratchet_flag, role is Alice, received_valid
+	 * header decryptability (1 byte)
+	 * presence bits of the emptyable keys (2 bytes)
+	 * the emptyable keys and then the other keys, empty keys are written as zeroes
+	 * skipped header and message keys
+	 * staged header and message keys
+	 */
+	constexpr uint8_t ratchet_snapshot_version{0};
+	constexpr uint8_t ratchet_snapshot_ratchet_flag{1U << 0U};
+	constexpr uint8_t ratchet_snapshot_alice{1U << 1U};
+	constexpr uint8_t ratchet_snapshot_received_valid{1U << 2U};
+	constexpr size_t ratchet_snapshot_emptyable_keys{12};
+	constexpr size_t ratchet_snapshot_fixed_size{
+		sizeof(uint8_t)
+		+ (5 * sizeof(uint32_t))
+		+ (2 * sizeof(uint8_t))
+		+ sizeof(uint16_t)
+		+ (3 * CHAIN_KEY_SIZE)
+		+ (6 * HEADER_KEY_SIZE)
+		+ (2 * ROOT_KEY_SIZE)
+		+ (5 * PUBLIC_KEY_SIZE)
+		+ PRIVATE_KEY_SIZE};
+
+	//calls a function on every emptyable key, the order is the order of the presence bits
+	template <typename Storage, typename Function>
+	static result<void> for_each_emptyable_key(Storage& storage, Function&& function) {
+		OUTCOME_TRY(function(storage.send_chain_key));
+		OUTCOME_TRY(function(storage.receive_chain_key));
+		OUTCOME_TRY(function(storage.send_header_key));
+		OUTCOME_TRY(function(storage.receive_header_key));
+		OUTCOME_TRY(function(storage.next_receive_header_key));
+		OUTCOME_TRY(function(storage.root_key));
+		OUTCOME_TRY(function(storage.next_send_header_key));
+		OUTCOME_TRY(function(storage.purported_root_key));
+		OUTCOME_TRY(function(storage.purported_receive_header_key));
+		OUTCOME_TRY(function(storage.purported_next_receive_header_key));
+		OUTCOME_TRY(function(storage.purported_receive_chain_key));
+		OUTCOME_TRY(function(storage.their_purported_public_ephemeral));
+
+		return outcome::success();
+	}
+
+	template <typename Storage, typename Function>
+	static result<void> for_each_other_key(Storage& storage, Function&& function) {
+		OUTCOME_TRY(function(storage.our_public_ephemeral));
+		OUTCOME_TRY(function(storage.their_public_ephemeral));
+		OUTCOME_TRY(function(storage.our_private_ephemeral));
+		OUTCOME_TRY(function(storage.our_public_identity));
+		OUTCOME_TRY(function(storage.their_public_identity));
+
+		return outcome::success();
+	}
+
+	size_t Ratchet::maximumSnapshotSize() const noexcept {
+		return ratchet_snapshot_fixed_size
+			+ this->skipped_header_and_message_keys.maximumSnapshotSize()
+			+ this->staged_header_and_message_keys.maximumSnapshotSize();
+	}
+
+	result<void> Ratchet::exportSnapshot(SnapshotWriter& writer) const {
+		const auto& storage{*this->storage};
+
+		OUTCOME_TRY(writer.writeInteger(ratchet_snapshot_version));
+
+		//message numbers
+		OUTCOME_TRY(writer.writeInteger(storage.send_message_number));
+		OUTCOME_TRY(writer.writeInteger(storage.receive_message_number));
+		OUTCOME_TRY(writer.writeInteger(storage.purported_message_number));
+		OUTCOME_TRY(writer.writeInteger(storage.previous_message_number));
+		OUTCOME_TRY(writer.writeInteger(storage.purported_previous_message_number));
+
+		//flags
+		uint8_t flags{0};
+		if (storage.ratchet_flag) {
+			flags |= ratchet_snapshot_ratchet_flag;
+		}
+		if (storage.role == Role::ALICE) {
+			flags |= ratchet_snapshot_alice;
+		}
+		if (storage.received_valid) {
+			flags |= ratchet_snapshot_received_valid;
+		}
+		OUTCOME_TRY(writer.writeInteger(flags));
+		OUTCOME_TRY(writer.writeInteger(static_cast<uint8_t>(storage.header_decryptable)));
+
+		//keys
+		uint16_t present{0};
+		size_t index{0};
+		OUTCOME_TRY(for_each_emptyable_key(storage, [&present, &index](const auto& key) -> result<void> {
+			if (!key.empty) {
+				present = static_cast<uint16_t>(present | (1U << index));
+			}
+			index++;
+			return outcome::success();
+		}));
+		OUTCOME_TRY(writer.writeInteger(present));
+		const auto write_key{[&writer](const auto& key) {
+			return writer.write(key);
+		}};
+		OUTCOME_TRY(for_each_emptyable_key(storage, write_key));
+		OUTCOME_TRY(for_each_other_key(storage, write_key));
+
+		//header and message keystores
+		OUTCOME_TRY(this->skipped_header_and_message_keys.exportSnapshot(writer));
+		OUTCOME_TRY(this->staged_header_and_message_keys.exportSnapshot(writer));
+
+		return outcome::success();
+	}
+
+	result<Ratchet> Ratchet::importSnapshot(SnapshotReader& reader) {
+		OUTCOME_TRY(version, reader.readInteger<uint8_t>());
+		if (version != ratchet_snapshot_version) {
+			return Error(status_type::INCORRECT_DATA, "Unsupported ratchet snapshot version.");
+		}
+
+		Ratchet ratchet;
+		auto& storage{*ratchet.storage};
+
+		//message numbers
+		OUTCOME_TRY(send_message_number, reader.readInteger<uint32_t>());
+		storage.send_message_number = send_message_number;
+		OUTCOME_TRY(receive_message_number, reader.readInteger<uint32_t>());
+		storage.receive_message_number = receive_message_number;
+		OUTCOME_TRY(purported_message_number, reader.readInteger<uint32_t>());
+		storage.purported_message_number = purported_message_number;
+		OUTCOME_TRY(previous_message_number, reader.readInteger<uint32_t>());
+		storage.previous_message_number = previous_message_number;
+		OUTCOME_TRY(purported_previous_message_number, reader.readInteger<uint32_t>());
+		storage.purported_previous_message_number = purported_previous_message_number;
+
+		//flags
+		OUTCOME_TRY(flags, reader.readInteger<uint8_t>());
+		if ((flags & ~(ratchet_snapshot_ratchet_flag | ratchet_snapshot_alice | ratchet_snapshot_received_valid)) != 0) {
+			return Error(status_type::INCORRECT_DATA, "Invalid flags in ratchet snapshot.");
+		}
+		storage.ratchet_flag = (flags & ratchet_snapshot_ratchet_flag) != 0;
+		storage.role = ((flags & ratchet_snapshot_alice) != 0) ? Role::ALICE : Role::BOB;
+		storage.received_valid = (flags & ratchet_snapshot_received_valid) != 0;
+		OUTCOME_TRY(header_decryptable, reader.readInteger<uint8_t>());
+		if (header_decryptable > static_cast<uint8_t>(HeaderDecryptability::NOT_TRIED)) {
+			return Error(status_type::INCORRECT_DATA, "Invalid header decryptability in ratchet snapshot.");
+		}
+		storage.header_decryptable = static_cast<HeaderDecryptability>(header_decryptable);
+
+		//keys
+		OUTCOME_TRY(present, reader.readInteger<uint16_t>());
+		if ((present >> ratchet_snapshot_emptyable_keys) != 0) {
+			return Error(status_type::INCORRECT_DATA, "Invalid presence bits in ratchet snapshot.");
+		}
+		size_t index{0};
+		OUTCOME_TRY(for_each_emptyable_key(storage, [&reader, present, &index](auto& key) -> result<void> {
+			OUTCOME_TRY(reader.read(key));
+			key.empty = ((present >> index) & 1U) == 0;
+			index++;
+			return outcome::success();
+		}));
+		OUTCOME_TRY(for_each_other_key(storage, [&reader](auto& key) {
+			return reader.read(key);
+		}));
+		if (storage.root_key.empty || storage.next_send_header_key.empty || storage.next_receive_header_key.empty) {
+			return Error(status_type::INCORRECT_DATA, "Ratchet snapshot is missing keys.");
+		}
+
+		//header and message keystores
+		OUTCOME_TRY(skipped_header_and_message_keys, HeaderAndMessageKeyStore::importSnapshot(reader));
+		ratchet.skipped_header_and_message_keys = std::move(skipped_header_and_message_keys);
+		OUTCOME_TRY(staged_header_and_message_keys, HeaderAndMessageKeyStore::importSnapshot(reader));
+		ratchet.staged_header_and_message_keys = std::move(staged_header_and_message_keys);
+
+		return ratchet;
+	}
+
+	void Ratchet::updateCheckpoint(RatchetCheckpoint& checkpoint) const {
+		if (checkpoint.storage == nullptr) {
+			checkpoint.storage = std::unique_ptr<RatchetStorage,SodiumDeleter<RatchetStorage>>(sodium_malloc<RatchetStorage>(1));
+			new (checkpoint.storage.get()) RatchetStorage{*this->storage};
+		} else {
+			*checkpoint.storage = *this->storage;
+		}
+		checkpoint.skipped_keys_version = this->skipped_header_and_message_keys.version().value();
+		checkpoint.staged_keys_version = this->staged_header_and_message_keys.version().value();
+	}
+
+	template <size_t length, KeyType type>
+	static bool is_empty([[maybe_unused]] const Key<length,type>& key) noexcept {
+		return false;
+	}
+
+	template <size_t length, KeyType type>
+	static bool is_empty(const EmptyableKey<length,type>& key) noexcept {
+		return key.empty;
+	}
+
+	/*
+	 * Export a key to the delta if it differs from the checkpoint,
+	 * keys that have been cleared are exported with a length of 0.
+	 */
+	template <typename KeyClass>
+	static result<void> export_changed_key(
+			Arena& arena,
+			protobuf_c_boolean& has_field,
+			ProtobufCBinaryData& field,
+			const KeyClass& key,
+			const KeyClass& checkpoint_key) {
+		if (key == checkpoint_key) {
+			return outcome::success();
+		}
+
+		has_field = true;
+		if (is_empty(key)) {
+			field.data = nullptr;
+			field.len = 0;
+			return outcome::success();
+		}
+
+		field.data = arena.allocate<unsigned char>(key.size());
+		field.len = key.size();
+		OUTCOME_TRY(copyFromTo(key, {uchar_to_byte(field.data), field.len}));
+
+		return outcome::success();
+	}
+
+	result<ProtobufCConversationDelta*> Ratchet::exportDeltaProtobuf(Arena& arena, const RatchetCheckpoint& checkpoint) const {
+		if (checkpoint.storage == nullptr) {
+			return Error(status_type::INCORRECT_DATA, "No checkpoint to export a delta from.");
+		}
+
+		protobuf_arena_create(arena, ProtobufCConversationDelta, conversation_delta);
+		protobuf_arena_create(arena, ProtobufCConversation, conversation);
+		conversation_delta->changes = conversation;
+
+		const auto& storage{*this->storage};
+		const auto& checkpoint_storage{*checkpoint.storage};
+
+		//root keys
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_root_key, conversation->root_key, storage.root_key, checkpoint_storage.root_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_purported_root_key, conversation->purported_root_key, storage.purported_root_key, checkpoint_storage.purported_root_key));
+
+		//header keys
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_send_header_key, conversation->send_header_key, storage.send_header_key, checkpoint_storage.send_header_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_receive_header_key, conversation->receive_header_key, storage.receive_header_key, checkpoint_storage.receive_header_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_next_send_header_key, conversation->next_send_header_key, storage.next_send_header_key, checkpoint_storage.next_send_header_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_next_receive_header_key, conversation->next_receive_header_key, storage.next_receive_header_key, checkpoint_storage.next_receive_header_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_purported_receive_header_key, conversation->purported_receive_header_key, storage.purported_receive_header_key, checkpoint_storage.purported_receive_header_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_purported_next_receive_header_key, conversation->purported_next_receive_header_key, storage.purported_next_receive_header_key, checkpoint_storage.purported_next_receive_header_key));
+
+		//chain keys
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_send_chain_key, conversation->send_chain_key, storage.send_chain_key, checkpoint_storage.send_chain_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_receive_chain_key, conversation->receive_chain_key, storage.receive_chain_key, checkpoint_storage.receive_chain_key));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_purported_receive_chain_key, conversation->purported_receive_chain_key, storage.purported_receive_chain_key, checkpoint_storage.purported_receive_chain_key));
+
+		//identity keys
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_our_public_identity_key, conversation->our_public_identity_key, storage.our_public_identity, checkpoint_storage.our_public_identity));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_their_public_identity_key, conversation->their_public_identity_key, storage.their_public_identity, checkpoint_storage.their_public_identity));
+
+		//ephemeral keys
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_our_private_ephemeral_key, conversation->our_private_ephemeral_key, storage.our_private_ephemeral, checkpoint_storage.our_private_ephemeral));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_our_public_ephemeral_key, conversation->our_public_ephemeral_key, storage.our_public_ephemeral, checkpoint_storage.our_public_ephemeral));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_their_public_ephemeral_key, conversation->their_public_ephemeral_key, storage.their_public_ephemeral, checkpoint_storage.their_public_ephemeral));
+		OUTCOME_TRY(export_changed_key(arena, conversation->has_their_purported_public_ephemeral, conversation->their_purported_public_ephemeral, storage.their_purported_public_ephemeral, checkpoint_storage.their_purported_public_ephemeral));
+
+		//message numbers
+		if (storage.send_message_number != checkpoint_storage.send_message_number) {
+			protobuf_optional_export(conversation, send_message_number, storage.send_message_number);
+		}
+		if (storage.receive_message_number != checkpoint_storage.receive_message_number) {
+			protobuf_optional_export(conversation, receive_message_number, storage.receive_message_number);
+		}
+		if (storage.purported_message_number != checkpoint_storage.purported_message_number) {
+			protobuf_optional_export(conversation, purported_message_number, storage.purported_message_number);
+		}
+		if (storage.previous_message_number != checkpoint_storage.previous_message_number) {
+			protobuf_optional_export(conversation, previous_message_number, storage.previous_message_number);
+		}
+		if (storage.purported_previous_message_number != checkpoint_storage.purported_previous_message_number) {
+			protobuf_optional_export(conversation, purported_previous_message_number, storage.purported_previous_message_number);
+		}
+
+		//flags
+		if (storage.ratchet_flag != checkpoint_storage.ratchet_flag) {
+			protobuf_optional_export(conversation, ratchet_flag, storage.ratchet_flag);
+		}
+		if (storage.role != checkpoint_storage.role) {
+			protobuf_optional_export(conversation, am_i_alice, static_cast<bool>(storage.role));
+		}
+		if (storage.received_valid != checkpoint_storage.received_valid) {
+			protobuf_optional_export(conversation, received_valid, storage.received_valid);
+		}
+		if (storage.header_decryptable != checkpoint_storage.header_decryptable) {
+			OUTCOME_TRY(header_decryptable, export_header_decryptability(storage.header_decryptable));
+			protobuf_optional_export(conversation, header_decryptable, header_decryptable);
+		}
+
+		//keystores, these are replaced entirely if they have changed
+		if (this->skipped_header_and_message_keys.version().value() != checkpoint.skipped_keys_version) {
+			protobuf_optional_export(conversation_delta, skipped_keys_changed, true);
+			outcome_protobuf_array_arena_export(arena, conversation, skipped_header_and_message_keys, this->skipped_header_and_message_keys);
+		}
+		if (this->staged_header_and_message_keys.version().value() != checkpoint.staged_keys_version) {
+			protobuf_optional_export(conversation_delta, staged_keys_changed, true);
+			outcome_protobuf_array_arena_export(arena, conversation, staged_header_and_message_keys, this->staged_header_and_message_keys);
+		}
+
+		return conversation_delta;
+	}
+
+	template <size_t length, KeyType type>
+	static result<void> clear_key([[maybe_unused]] Key<length,type>& key) {
+		return Error(status_type::INCORRECT_DATA, "Delta clears a key that can't be empty.");
+	}
+
+	template <size_t length, KeyType type>
+	static result<void> clear_key(EmptyableKey<length,type>& key) {
+		key.clearKey();
+		return outcome::success();
+	}
+
+	/*
+	 * Apply a key from the delta if it is present,
+	 * a length of 0 means that the key has been cleared.
+	 */
+	template <typename KeyClass>
+	static result<void> apply_changed_key(
+			const protobuf_c_boolean has_field,
+			const ProtobufCBinaryData& field,
+			KeyClass& key) {
+		if (!has_field) {
+			return outcome::success();
+		}
+
+		if (field.len == 0) {
+			return clear_key(key);
+		}
+
+		if (field.len != key.size()) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "Key in the delta has an incorrect size.");
+		}
+		OUTCOME_TRY(changed_key, KeyClass::fromSpan({field}));
+		key = changed_key;
+
+		return outcome::success();
+	}
+
+	result<void> Ratchet::applyDelta(const ProtobufCConversationDelta& delta) {
+		if (delta.changes == nullptr) {
+			return Error(status_type::PROTOBUF_MISSING_ERROR, "The delta doesn't contain any changes.");
+		}
+		const auto& conversation{*delta.changes};
+
+		//apply everything to a copy first, so nothing changes if the delta is invalid
+		auto changed_storage{std::unique_ptr<RatchetStorage,SodiumDeleter<RatchetStorage>>(sodium_malloc<RatchetStorage>(1))};
+		new (changed_storage.get()) RatchetStorage{*this->storage};
+		auto& storage{*changed_storage};
+
+		//root keys
+		OUTCOME_TRY(apply_changed_key(conversation.has_root_key, conversation.root_key, storage.root_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_purported_root_key, conversation.purported_root_key, storage.purported_root_key));
+
+		//header keys
+		OUTCOME_TRY(apply_changed_key(conversation.has_send_header_key, conversation.send_header_key, storage.send_header_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_receive_header_key, conversation.receive_header_key, storage.receive_header_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_next_send_header_key, conversation.next_send_header_key, storage.next_send_header_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_next_receive_header_key, conversation.next_receive_header_key, storage.next_receive_header_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_purported_receive_header_key, conversation.purported_receive_header_key, storage.purported_receive_header_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_purported_next_receive_header_key, conversation.purported_next_receive_header_key, storage.purported_next_receive_header_key));
+
+		//chain keys
+		OUTCOME_TRY(apply_changed_key(conversation.has_send_chain_key, conversation.send_chain_key, storage.send_chain_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_receive_chain_key, conversation.receive_chain_key, storage.receive_chain_key));
+		OUTCOME_TRY(apply_changed_key(conversation.has_purported_receive_chain_key, conversation.purported_receive_chain_key, storage.purported_receive_chain_key));
+
+		//identity keys
+		OUTCOME_TRY(apply_changed_key(conversation.has_our_public_identity_key, conversation.our_public_identity_key, storage.our_public_identity));
+		OUTCOME_TRY(apply_changed_key(conversation.has_their_public_identity_key, conversation.their_public_identity_key, storage.their_public_identity));
+
+		//ephemeral keys
+		OUTCOME_TRY(apply_changed_key(conversation.has_our_private_ephemeral_key, conversation.our_private_ephemeral_key, storage.our_private_ephemeral));
+		OUTCOME_TRY(apply_changed_key(conversation.has_our_public_ephemeral_key, conversation.our_public_ephemeral_key, storage.our_public_ephemeral));
+		OUTCOME_TRY(apply_changed_key(conversation.has_their_public_ephemeral_key, conversation.their_public_ephemeral_key, storage.their_public_ephemeral));
+		OUTCOME_TRY(apply_changed_key(conversation.has_their_purported_public_ephemeral, conversation.their_purported_public_ephemeral, storage.their_purported_public_ephemeral));
+
+		//message numbers
+		if (conversation.has_send_message_number) {
+			storage.send_message_number = conversation.send_message_number;
+		}
+		if (conversation.has_receive_message_number) {
+			storage.receive_message_number = conversation.receive_message_number;
+		}
+		if (conversation.has_purported_message_number) {
+			storage.purported_message_number = conversation.purported_message_number;
+		}
+		if (conversation.has_previous_message_number) {
+			storage.previous_message_number = conversation.previous_message_number;
+		}
+		if (conversation.has_purported_previous_message_number) {
+			storage.purported_previous_message_number = conversation.purported_previous_message_number;
+		}
+
+		//flags
+		if (conversation.has_ratchet_flag) {
+			storage.ratchet_flag = conversation.ratchet_flag;
+		}
+		if (conversation.has_am_i_alice) {
+			storage.role = static_cast<Role>(conversation.am_i_alice);
+		}
+		if (conversation.has_received_valid) {
+			storage.received_valid = conversation.received_valid;
+		}
+		if (conversation.has_header_decryptable) {
+			OUTCOME_TRY(header_decryptable, import_header_decryptability(conversation.header_decryptable));
+			storage.header_decryptable = header_decryptable;
+		}
+
+		//keystores
+		const bool skipped_keys_changed{delta.has_skipped_keys_changed && delta.skipped_keys_changed};
+		HeaderAndMessageKeyStore skipped_header_and_message_keys;
+		if (skipped_keys_changed) {
+			OUTCOME_TRY(imported_skipped_keys, HeaderAndMessageKeyStore::import({
+					conversation.skipped_header_and_message_keys,
+					conversation.n_skipped_header_and_message_keys}));
+			skipped_header_and_message_keys = std::move(imported_skipped_keys);
+		}
+		const bool staged_keys_changed{delta.has_staged_keys_changed && delta.staged_keys_changed};
+		HeaderAndMessageKeyStore staged_header_and_message_keys;
+		if (staged_keys_changed) {
+			OUTCOME_TRY(imported_staged_keys, HeaderAndMessageKeyStore::import({
+					conversation.staged_header_and_message_keys,
+					conversation.n_staged_header_and_message_keys}));
+			staged_header_and_message_keys = std::move(imported_staged_keys);
+		}
+
+		//everything worked, switch to the changed state
+		this->storage = std::move(changed_storage);
+		if (skipped_keys_changed) {
+			this->skipped_header_and_message_keys = std::move(skipped_header_and_message_keys);
+		}
+		if (staged_keys_changed) {
+			this->staged_header_and_message_keys = std::move(staged_header_and_message_keys);
+		}
+
+		return outcome::success();
+	}
+
 	std::ostream& Ratchet::print(std::ostream& stream) const {
 		const auto& storage{this->storage};
 		//root keys
@@ -760,9 +1219,9 @@ namespace Molch {
 		stream << storage->purported_root_key << '\n';
 
 		//header keys
-		if (storage->send_header_key.has_value()) {
+		if (!storage->send_header_key.empty) {
 			stream << "Send header key:\n";
-			stream << storage->send_header_key.value() << '\n';
+			stream << storage->send_header_key << '\n';
 		}
 		stream << "Receive header key:\n";
 		stream << storage->receive_header_key << '\n';
@@ -797,24 +1256,20 @@ namespace Molch {
 		stream << "Their public ephemeral key:\n";
 		stream << storage->their_public_ephemeral << '\n';
 		stream << "Their purported public ephemeral key:\n";
-		if (storage->their_purported_public_ephemeral.has_value()) {
-			stream << storage->their_purported_public_ephemeral.value() << '\n';
-		} else {
-			stream << "(empty)\n";
-		}
+		stream << storage->their_purported_public_ephemeral << '\n';
 
 		//numbers
-		stream << "Send message number: " << this->send_message_number << '\n';
-		stream << "Receive message number: " << this->receive_message_number << '\n';
-		stream << "Purported message number: " << this->purported_message_number << '\n';
-		stream << "Previous message number: " << this->previous_message_number << '\n';
-		stream << "Purported previous message number: " << this->purported_previous_message_number << '\n';
+		stream << "Send message number: " << this->storage->send_message_number << '\n';
+		stream << "Receive message number: " << this->storage->receive_message_number << '\n';
+		stream << "Purported message number: " << this->storage->purported_message_number << '\n';
+		stream << "Previous message number: " << this->storage->previous_message_number << '\n';
+		stream << "Purported previous message number: " << this->storage->purported_previous_message_number << '\n';
 
 		//others
-		stream << "Ratchet flag: " << this->ratchet_flag << '\n';
-		stream << "Am I Alice: " << static_cast<bool>(this->role) << '\n';
-		stream << "Received valid: " << this->received_valid << '\n';
-		stream << "Header decryptability: " << static_cast<unsigned int>(this->header_decryptable) << '\n';
+		stream << "Ratchet flag: " << this->storage->ratchet_flag << '\n';
+		stream << "Am I Alice: " << static_cast<bool>(this->storage->role) << '\n';
+		stream << "Received valid: " << this->storage->received_valid << '\n';
+		stream << "Header decryptability: " << static_cast<unsigned int>(this->storage->header_decryptable) << '\n';
 
 		//header and message keystores
 		stream << "Skipped header and message keys:\n";
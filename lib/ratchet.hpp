@@ -23,7 +23,6 @@
 #define LIB_RATCHET_H
 
 #include <ostream>
-#include <optional>
 
 #include "molch/constants.h"
 #include "header-and-message-keystore.hpp"
@@ -33,29 +32,78 @@
 #include "protobuf-arena.hpp"
 
 namespace Molch {
+	constexpr size_t cache_line_size{64};
+
+	/*
+	 * The state of a ratchet, allocated in one piece of sodium_malloc'ed memory.
+	 *
+	 * The hot part (message numbers, flags and the keys of the current chains) is
+	 * needed for every message that is sent or received, the cold part only when
+	 * the ratchet advances, while staging purported keys or when exporting. Both
+	 * parts start on their own cache line.
+	 */
 	class RatchetStorage {
 	public:
-		EmptyableRootKey root_key; //RK
-		EmptyableRootKey purported_root_key; //RKp
-		//header keys
-		std::optional<EmptyableHeaderKey> send_header_key;
-		EmptyableHeaderKey receive_header_key;
-		EmptyableHeaderKey next_send_header_key;
-		EmptyableHeaderKey next_receive_header_key;
-		EmptyableHeaderKey purported_receive_header_key;
-		EmptyableHeaderKey purported_next_receive_header_key;
+		enum class Role : bool {
+			ALICE = true,
+			BOB = false
+		};
+		enum class HeaderDecryptability : uint8_t {
+			CURRENT_DECRYPTABLE, //decryptable with current receive header key
+			NEXT_DECRYPTABLE, //decryptable with next receive header key
+			UNDECRYPTABLE, //not decryptable
+			NOT_TRIED //not tried to decrypt yet
+		};
+
+		//hot
+		//message numbers
+		alignas(cache_line_size) uint32_t send_message_number{0}; //Ns
+		uint32_t receive_message_number{0}; //Nr
+		uint32_t purported_message_number{0}; //Np
+		uint32_t previous_message_number{0}; //PNs (number of messages sent in previous chain)
+		uint32_t purported_previous_message_number{0}; //PNp
+		//flags
+		bool ratchet_flag{false};
+		Role role{Role::BOB};
+		bool received_valid{false}; //is false until the validity of a received message has been verified,
+		                            //this is necessary to be able to split key derivation from message
+		                            //decryption
+		HeaderDecryptability header_decryptable{HeaderDecryptability::NOT_TRIED}; //could the last received header be decrypted?
 		//chain keys
 		EmptyableChainKey send_chain_key; //CKs
 		EmptyableChainKey receive_chain_key; //CKr
-		EmptyableChainKey purported_receive_chain_key; //CKp
-		//identity keys
-		PublicKey our_public_identity; //DHIs
-		PublicKey their_public_identity; //DHIr
+		//header keys
+		EmptyableHeaderKey send_header_key; //HKs, empty for Alice until the first ratchet step
+		EmptyableHeaderKey receive_header_key; //HKr
+		EmptyableHeaderKey next_receive_header_key; //NHKr
 		//ephemeral keys (ratchet keys)
-		PrivateKey our_private_ephemeral; //DHRs
 		PublicKey our_public_ephemeral; //DHRs
 		PublicKey their_public_ephemeral; //DHRr
-		std::optional<PublicKey> their_purported_public_ephemeral; //DHp
+
+		//cold
+		alignas(cache_line_size) EmptyableRootKey root_key; //RK
+		EmptyableHeaderKey next_send_header_key; //NHKs
+		PrivateKey our_private_ephemeral; //DHRs
+		//identity keys
+		PublicKey our_public_identity; //DHIs
+		PublicKey their_public_identity; //DHIr
+		//purported keys, staged while receiving a message
+		EmptyableRootKey purported_root_key; //RKp
+		EmptyableHeaderKey purported_receive_header_key; //HKp
+		EmptyableHeaderKey purported_next_receive_header_key; //NHKp
+		EmptyableChainKey purported_receive_chain_key; //CKp
+		EmptyablePublicKey their_purported_public_ephemeral; //DHp
+	};
+
+	/*
+	 * Copy of a ratchet state at the time of the last backup of its
+	 * conversation, so that delta backups only need to contain what has
+	 * changed since then.
+	 */
+	struct RatchetCheckpoint {
+		std::unique_ptr<RatchetStorage,SodiumDeleter<RatchetStorage>> storage;
+		uint64_t skipped_keys_version{0};
+		uint64_t staged_keys_version{0};
 	};
 
 	class Ratchet {
@@ -65,31 +113,11 @@ namespace Molch {
 		void commitSkippedHeaderAndMessageKeys();
 
 	public:
+		using Role = RatchetStorage::Role;
+		using HeaderDecryptability = RatchetStorage::HeaderDecryptability;
+
 		std::unique_ptr<RatchetStorage,SodiumDeleter<RatchetStorage>> storage;
 
-		//message numbers
-		uint32_t send_message_number{0}; //Ns
-		uint32_t receive_message_number{0}; //Nr
-		uint32_t purported_message_number{0}; //Np
-		uint32_t previous_message_number{0}; //PNs (number of messages sent in previous chain)
-		uint32_t purported_previous_message_number{0}; //PNp
-		//ratchet flag
-		bool ratchet_flag{false};
-		enum class Role : bool {
-			ALICE = true,
-			BOB = false
-		};
-		Role role{Role::BOB};
-		bool received_valid{false}; //is false until the validity of a received message has been verified until the validity of a received message has been verified,
-							 //this is necessary to be able to split key derivation from message
-							 //decryption
-		enum class HeaderDecryptability{
-			CURRENT_DECRYPTABLE, //decryptable with current receive header key
-			NEXT_DECRYPTABLE, //decryptable with next receive header key
-			UNDECRYPTABLE, //not decryptable
-			NOT_TRIED //not tried to decrypt yet
-		};
-		HeaderDecryptability header_decryptable{HeaderDecryptability::NOT_TRIED}; //could the last received header be decrypted?
 		//list of previous message and header keys
 		HeaderAndMessageKeyStore skipped_header_and_message_keys; //skipped_HK_MK (list containing message keys for messages that weren't received)
 		HeaderAndMessageKeyStore staged_header_and_message_keys; //this represents the staging area specified in the axolotl ratchet
@@ -117,6 +145,11 @@ namespace Molch {
 		 */
 		static result<Ratchet> import(const ProtobufCConversation& conversation);
 
+		/*! Import a ratchet from a fixed layout snapshot.
+		 * \param reader Reader positioned at the start of a snapshot written by exportSnapshot.
+		 */
+		static result<Ratchet> importSnapshot(SnapshotReader& reader);
+
 		Ratchet(const Ratchet& ratchet) = delete;
 		Ratchet(Ratchet&& ratchet) = default;
 		Ratchet& operator=(const Ratchet& ratchet) = delete;
@@ -178,6 +211,33 @@ namespace Molch {
 		 */
 		result<ProtobufCConversation*> exportProtobuf(Arena& arena) const;
 
+		/*
+		 * Upper bound of the size of a snapshot of the ratchet.
+		 */
+		size_t maximumSnapshotSize() const noexcept;
+
+		/*! Export a ratchet state to a fixed layout snapshot.
+		 * The message numbers, flags and keys are copied as they
+		 * are, followed by both header and message keystores.
+		 */
+		result<void> exportSnapshot(SnapshotWriter& writer) const;
+
+		/*
+		 * Make the checkpoint a copy of the current state.
+		 */
+		void updateCheckpoint(RatchetCheckpoint& checkpoint) const;
+
+		/*! Export everything that has changed since a checkpoint.
+		 * NOTE: This doesn't fill the Id field of the changes
+		 * or the sequence number and base hash of the delta.
+		 */
+		result<ProtobufCConversationDelta*> exportDeltaProtobuf(Arena& arena, const RatchetCheckpoint& checkpoint) const;
+
+		/*! Apply the changes of a delta.
+		 * Either all of the changes are applied or none of them.
+		 */
+		result<void> applyDelta(const ProtobufCConversationDelta& delta);
+
 		std::ostream& print(std::ostream& stream) const;
 	};
 }
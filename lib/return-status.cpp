@@ -139,6 +139,9 @@ namespace Molch {
 			case status_type::EXPECTATION_FAILED:
 				return "EXPECTATION_FAILED";
 
+			case status_type::DUPLICATE_MESSAGE:
+				return "DUPLICATE_MESSAGE";
+
 			default:
 				return "(nullptr)";
 		}
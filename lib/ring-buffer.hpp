@@ -0,0 +1,293 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_RING_BUFFER_HPP
+#define LIB_RING_BUFFER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace Molch {
+	/*!
+	 * Double ended queue in a single allocation.
+	 *
+	 * Appending to the back and removing from the front are O(1) and don't touch
+	 * the other elements. The allocation only grows (doubling its capacity) and
+	 * is reused after removing elements or clearing, so a RingBuffer with a bounded
+	 * size stops reallocating once it has been filled once.
+	 */
+	template <typename T, typename Allocator = std::allocator<T>>
+	class RingBuffer {
+	private:
+		static constexpr size_t minimum_capacity{8};
+
+		T *storage{nullptr};
+		size_t storage_capacity{0};
+		size_t first{0};
+		size_t length{0};
+
+		size_t position(const size_t index) const noexcept {
+			auto position{this->first + index};
+			if (position >= this->storage_capacity) {
+				position -= this->storage_capacity;
+			}
+
+			return position;
+		}
+
+		T& at(const size_t index) noexcept {
+			return this->storage[this->position(index)];
+		}
+
+		const T& at(const size_t index) const noexcept {
+			return this->storage[this->position(index)];
+		}
+
+		void release() noexcept {
+			this->clear();
+			if (this->storage != nullptr) {
+				Allocator().deallocate(this->storage, this->storage_capacity);
+			}
+			this->storage = nullptr;
+			this->storage_capacity = 0;
+		}
+
+		RingBuffer& copy(const RingBuffer& ring) {
+			this->release();
+			this->reserve(ring.length);
+			for (const auto& element : ring) {
+				this->push_back(element);
+			}
+
+			return *this;
+		}
+
+		RingBuffer& move(RingBuffer&& ring) noexcept {
+			this->release();
+			this->storage = ring.storage;
+			this->storage_capacity = ring.storage_capacity;
+			this->first = ring.first;
+			this->length = ring.length;
+
+			ring.storage = nullptr;
+			ring.storage_capacity = 0;
+			ring.first = 0;
+			ring.length = 0;
+
+			return *this;
+		}
+
+	public:
+		class const_iterator {
+		private:
+			const RingBuffer *ring{nullptr};
+			size_t index{0};
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() = default;
+			const_iterator(const RingBuffer& ring, const size_t index) noexcept : ring{&ring}, index{index} {}
+
+			reference operator*() const noexcept {
+				return (*this->ring)[this->index];
+			}
+			pointer operator->() const noexcept {
+				return &(*this->ring)[this->index];
+			}
+
+			const_iterator& operator++() noexcept {
+				this->index++;
+				return *this;
+			}
+			const_iterator operator++(int) noexcept {
+				auto copy{*this};
+				this->index++;
+				return copy;
+			}
+
+			bool operator==(const const_iterator& other) const noexcept {
+				return (this->ring == other.ring) and (this->index == other.index);
+			}
+			bool operator!=(const const_iterator& other) const noexcept {
+				return !(*this == other);
+			}
+		};
+
+		RingBuffer() = default;
+		RingBuffer(const RingBuffer& ring) {
+			this->copy(ring);
+		}
+		RingBuffer(RingBuffer&& ring) noexcept {
+			this->move(std::move(ring));
+		}
+		~RingBuffer() noexcept {
+			this->release();
+		}
+
+		RingBuffer& operator=(const RingBuffer& ring) {
+			if (this == &ring) {
+				return *this;
+			}
+			return this->copy(ring);
+		}
+		RingBuffer& operator=(RingBuffer&& ring) noexcept {
+			if (this == &ring) {
+				return *this;
+			}
+			return this->move(std::move(ring));
+		}
+
+		size_t size() const noexcept {
+			return this->length;
+		}
+
+		bool empty() const noexcept {
+			return this->length == 0;
+		}
+
+		size_t capacity() const noexcept {
+			return this->storage_capacity;
+		}
+
+		T& operator[](const size_t index) noexcept {
+			return this->at(index);
+		}
+
+		const T& operator[](const size_t index) const noexcept {
+			return this->at(index);
+		}
+
+		const T& front() const noexcept {
+			return this->at(0);
+		}
+
+		const T& back() const noexcept {
+			return this->at(this->length - 1);
+		}
+
+		const_iterator begin() const noexcept {
+			return {*this, 0};
+		}
+		const_iterator end() const noexcept {
+			return {*this, this->length};
+		}
+		const_iterator cbegin() const noexcept {
+			return this->begin();
+		}
+		const_iterator cend() const noexcept {
+			return this->end();
+		}
+
+		/*!
+		 * Make sure that at least capacity elements fit without reallocating.
+		 */
+		void reserve(const size_t capacity) {
+			if (capacity <= this->storage_capacity) {
+				return;
+			}
+
+			auto new_storage{Allocator().allocate(capacity)};
+			for (size_t index{0}; index < this->length; index++) {
+				new (&new_storage[index]) T(std::move(this->at(index)));
+				this->at(index).~T();
+			}
+
+			if (this->storage != nullptr) {
+				Allocator().deallocate(this->storage, this->storage_capacity);
+			}
+			this->storage = new_storage;
+			this->storage_capacity = capacity;
+			this->first = 0;
+		}
+
+		void push_back(const T& element) {
+			if (this->length == this->storage_capacity) {
+				this->reserve(std::max(minimum_capacity, 2 * this->storage_capacity));
+			}
+
+			new (&this->storage[this->position(this->length)]) T(element);
+			this->length++;
+		}
+
+		void pop_front() noexcept {
+			this->at(0).~T();
+			this->first = this->position(1);
+			this->length--;
+			if (this->length == 0) {
+				this->first = 0;
+			}
+		}
+
+		void pop_back() noexcept {
+			this->at(this->length - 1).~T();
+			this->length--;
+		}
+
+		/*!
+		 * Insert before the element at index, shifts all the elements after it.
+		 */
+		void insert(const size_t index, const T& element) {
+			this->push_back(element);
+			for (size_t position{this->length - 1}; position > index; position--) {
+				std::swap(this->at(position), this->at(position - 1));
+			}
+		}
+
+		/*!
+		 * Remove the element at index, shifts whichever side is shorter.
+		 */
+		void erase(const size_t index) noexcept {
+			if (index < (this->length / 2)) {
+				for (size_t position{index}; position > 0; position--) {
+					this->at(position) = std::move(this->at(position - 1));
+				}
+				this->pop_front();
+				return;
+			}
+
+			for (size_t position{index}; (position + 1) < this->length; position++) {
+				this->at(position) = std::move(this->at(position + 1));
+			}
+			this->pop_back();
+		}
+
+		/*!
+		 * Remove all elements but keep the allocation.
+		 */
+		void clear() noexcept {
+			while (!this->empty()) {
+				this->pop_back();
+			}
+			this->first = 0;
+		}
+	};
+}
+
+#endif /* LIB_RING_BUFFER_HPP */
@@ -0,0 +1,112 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_SNAPSHOT_H
+#define LIB_SNAPSHOT_H
+
+#include <array>
+#include <cstring>
+
+#include "endianness.hpp"
+#include "gsl.hpp"
+#include "return-status.hpp"
+
+/*
+ * Fixed layout snapshots are written and read field by field, keys are
+ * copied as they are and integers are stored in big endian. Unlike
+ * Protobuf-C there are no tags, no length prefixes and no allocations per field.
+ */
+
+namespace Molch {
+	//! Writes a snapshot into a buffer that is big enough for it.
+	class SnapshotWriter {
+	private:
+		span<std::byte> output;
+		size_t offset{0};
+
+	public:
+		explicit SnapshotWriter(const span<std::byte> output) noexcept : output{output} {}
+
+		result<void> write(const span<const std::byte> data) noexcept {
+			if (data.size() > (this->output.size() - this->offset)) {
+				return Error(status_type::INCORRECT_BUFFER_SIZE, "Snapshot doesn't fit into the buffer.");
+			}
+
+			if (!data.empty()) {
+				std::memcpy(this->output.data() + this->offset, data.data(), data.size());
+			}
+			this->offset += data.size();
+
+			return outcome::success();
+		}
+
+		template <typename IntegerType>
+		result<void> writeInteger(const IntegerType integer) noexcept {
+			std::array<std::byte,sizeof(IntegerType)> bytes;
+			OUTCOME_TRY(to_big_endian(integer, bytes));
+			return this->write(bytes);
+		}
+
+		//! Number of bytes written so far.
+		size_t size() const noexcept {
+			return this->offset;
+		}
+	};
+
+	//! Reads a snapshot, fails instead of reading past its end.
+	class SnapshotReader {
+	private:
+		span<const std::byte> input;
+		size_t offset{0};
+
+	public:
+		explicit SnapshotReader(const span<const std::byte> input) noexcept : input{input} {}
+
+		result<void> read(const span<std::byte> output) noexcept {
+			if (output.size() > (this->input.size() - this->offset)) {
+				return Error(status_type::INCORRECT_DATA, "Snapshot is truncated.");
+			}
+
+			if (!output.empty()) {
+				std::memcpy(output.data(), this->input.data() + this->offset, output.size());
+			}
+			this->offset += output.size();
+
+			return outcome::success();
+		}
+
+		template <typename IntegerType>
+		result<IntegerType> readInteger() noexcept {
+			std::array<std::byte,sizeof(IntegerType)> bytes;
+			OUTCOME_TRY(this->read(bytes));
+			IntegerType integer{0};
+			OUTCOME_TRY(from_big_endian(integer, bytes));
+			return integer;
+		}
+
+		//! If the whole snapshot has been read.
+		bool done() const noexcept {
+			return this->offset == this->input.size();
+		}
+	};
+}
+
+#endif /* LIB_SNAPSHOT_H */
@@ -323,6 +323,88 @@ namespace Molch {
 		return outcome::success();
 	}
 
+	CryptoSecretstreamPush::CryptoSecretstreamPush(const crypto_secretstream_xchacha20poly1305_state& state) noexcept :
+	state(state)
+	{}
+
+	result<CryptoSecretstreamPush> CryptoSecretstreamPush::construct(const span<std::byte> header, const span<const std::byte> key) {
+		FulfillOrFail((header.size() == crypto_secretstream_xchacha20poly1305_HEADERBYTES)
+				&& (key.size() == crypto_secretstream_xchacha20poly1305_KEYBYTES));
+
+		crypto_secretstream_xchacha20poly1305_state state;
+		auto status{::crypto_secretstream_xchacha20poly1305_init_push(
+				&state,
+				byte_to_uchar(header.data()),
+				byte_to_uchar(key.data()))};
+		if (status != 0) {
+			return Error(status_type::ENCRYPT_ERROR, "Failed to initialize secretstream.");
+		}
+
+		return CryptoSecretstreamPush(state);
+	}
+
+	result<void> CryptoSecretstreamPush::push(const span<std::byte> ciphertext, const span<const std::byte> message, const unsigned char tag) {
+		FulfillOrFail(ciphertext.size() == (message.size() + crypto_secretstream_xchacha20poly1305_ABYTES));
+
+		auto status{::crypto_secretstream_xchacha20poly1305_push(
+				&this->state,
+				byte_to_uchar(ciphertext.data()), nullptr,
+				byte_to_uchar(message.data()), message.size(),
+				nullptr, 0,
+				tag)};
+		if (status != 0) {
+			return Error(status_type::ENCRYPT_ERROR, "Failed to encrypt secretstream message.");
+		}
+
+		return outcome::success();
+	}
+
+	CryptoSecretstreamPush::~CryptoSecretstreamPush() noexcept {
+		sodium_memzero(&this->state, sizeof(this->state));
+	}
+
+	CryptoSecretstreamPull::CryptoSecretstreamPull(const crypto_secretstream_xchacha20poly1305_state& state) noexcept :
+	state(state)
+	{}
+
+	result<CryptoSecretstreamPull> CryptoSecretstreamPull::construct(const span<const std::byte> header, const span<const std::byte> key) {
+		FulfillOrFail((header.size() == crypto_secretstream_xchacha20poly1305_HEADERBYTES)
+				&& (key.size() == crypto_secretstream_xchacha20poly1305_KEYBYTES));
+
+		crypto_secretstream_xchacha20poly1305_state state;
+		auto status{::crypto_secretstream_xchacha20poly1305_init_pull(
+				&state,
+				byte_to_uchar(header.data()),
+				byte_to_uchar(key.data()))};
+		if (status != 0) {
+			return Error(status_type::DECRYPT_ERROR, "Invalid secretstream header.");
+		}
+
+		return CryptoSecretstreamPull(state);
+	}
+
+	result<unsigned char> CryptoSecretstreamPull::pull(const span<std::byte> message, const span<const std::byte> ciphertext) {
+		FulfillOrFail((ciphertext.size() >= crypto_secretstream_xchacha20poly1305_ABYTES)
+				&& (message.size() == (ciphertext.size() - crypto_secretstream_xchacha20poly1305_ABYTES)));
+
+		unsigned char tag{0};
+		auto status{::crypto_secretstream_xchacha20poly1305_pull(
+				&this->state,
+				byte_to_uchar(message.data()), nullptr,
+				&tag,
+				byte_to_uchar(ciphertext.data()), ciphertext.size(),
+				nullptr, 0)};
+		if (status != 0) {
+			return Error(status_type::DECRYPT_ERROR, "Failed to decrypt secretstream message.");
+		}
+
+		return tag;
+	}
+
+	CryptoSecretstreamPull::~CryptoSecretstreamPull() noexcept {
+		sodium_memzero(&this->state, sizeof(this->state));
+	}
+
 	result<void> crypto_sign(
 			const span<std::byte> signed_message,
 			const span<const std::byte> message,
@@ -360,6 +442,24 @@ namespace Molch {
 		return outcome::success();
 	}
 
+	result<void> crypto_sign_verify_detached(
+			const span<const std::byte> signature,
+			const span<const std::byte> message,
+			const span<const std::byte> signing_key) noexcept {
+		FulfillOrFail((signature.size() == crypto_sign_BYTES)
+				&& (signing_key.size() == crypto_sign_PUBLICKEYBYTES));
+
+		auto status{::crypto_sign_verify_detached(
+				byte_to_uchar(signature.data()),
+				byte_to_uchar(message.data()), message.size(),
+				byte_to_uchar(signing_key.data()))};
+		if (status != 0) {
+			return Error(status_type::VERIFICATION_FAILED, "Failed to verify signed message.");
+		}
+
+		return outcome::success();
+	}
+
 	void sodium_mprotect_noaccess(void *pointer) noexcept {
 		auto status{::sodium_mprotect_noaccess(pointer)};
 		if (status != 0) {
@@ -161,6 +161,33 @@ namespace Molch {
 			const span<const std::byte> nonce,
 			const span<const std::byte> key) noexcept;
 
+	struct CryptoSecretstreamPush {
+		crypto_secretstream_xchacha20poly1305_state state;
+
+		static result<CryptoSecretstreamPush> construct(const span<std::byte> header, const span<const std::byte> key);
+
+		result<void> push(const span<std::byte> ciphertext, const span<const std::byte> message, const unsigned char tag);
+
+		~CryptoSecretstreamPush() noexcept;
+
+	private:
+		CryptoSecretstreamPush(const crypto_secretstream_xchacha20poly1305_state& state) noexcept;
+	};
+
+	struct CryptoSecretstreamPull {
+		crypto_secretstream_xchacha20poly1305_state state;
+
+		static result<CryptoSecretstreamPull> construct(const span<const std::byte> header, const span<const std::byte> key);
+
+		//returns the tag of the decrypted message
+		result<unsigned char> pull(const span<std::byte> message, const span<const std::byte> ciphertext);
+
+		~CryptoSecretstreamPull() noexcept;
+
+	private:
+		CryptoSecretstreamPull(const crypto_secretstream_xchacha20poly1305_state& state) noexcept;
+	};
+
 	result<void> crypto_sign(
 			const span<std::byte> signed_message,
 			const span<const std::byte> message,
@@ -171,6 +198,11 @@ namespace Molch {
 			const span<const std::byte> signed_message,
 			const span<const std::byte> signing_key) noexcept;
 
+	result<void> crypto_sign_verify_detached(
+			const span<const std::byte> signature,
+			const span<const std::byte> message,
+			const span<const std::byte> signing_key) noexcept;
+
 	void sodium_mprotect_noaccess(void *pointer) noexcept;
 	void sodium_mprotect_readonly(void *pointer) noexcept;
 	void sodium_mprotect_readwrite(void *pointer) noexcept;
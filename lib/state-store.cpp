@@ -0,0 +1,668 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <optional>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "state-store.hpp"
+#include "dormant-conversation.hpp"
+#include "endianness.hpp"
+#include "gsl.hpp"
+#include "protobuf-arena.hpp"
+
+namespace Molch {
+	constexpr std::array<std::byte,8> state_store_magic{
+		std::byte{'m'}, std::byte{'o'}, std::byte{'l'}, std::byte{'c'},
+		std::byte{'h'}, std::byte{'s'}, std::byte{'t'},
+		std::byte{1} //version
+	};
+	//the magic is followed by a nonce and a secretbox of the magic, which checks the key before any record is read
+	constexpr size_t state_store_header_size{state_store_magic.size() + BACKUP_NONCE_SIZE + state_store_magic.size() + crypto_secretbox_MACBYTES};
+	constexpr size_t state_store_length_size{sizeof(uint32_t)};
+	constexpr size_t state_store_minimum_record_size{BACKUP_NONCE_SIZE + crypto_secretbox_MACBYTES + 1 + CONVERSATION_ID_SIZE};
+
+	enum class StoreRecordType : unsigned char {
+		USER = 0,
+		CONVERSATION = 1,
+		REMOVED_USER = 2,
+		REMOVED_CONVERSATION = 3,
+	};
+
+	namespace {
+		//read only mapping of an entire file
+		class FileMapping {
+		private:
+			void *mapping;
+			size_t length;
+
+		public:
+			FileMapping(const int file, const size_t length) noexcept : length{length} {
+				this->mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+			}
+
+			FileMapping(const FileMapping& mapping) = delete;
+			FileMapping& operator=(const FileMapping& mapping) = delete;
+
+			~FileMapping() noexcept {
+				if (this->valid()) {
+					munmap(this->mapping, this->length);
+				}
+			}
+
+			bool valid() const noexcept {
+				return this->mapping != MAP_FAILED;
+			}
+
+			span<const std::byte> data() const noexcept {
+				return {static_cast<const std::byte*>(this->mapping), this->length};
+			}
+		};
+
+		//decrypted content of the last record for an id
+		struct LoadedRecord {
+			StoreRecordType type;
+			size_t offset;
+			size_t size;
+			Buffer plaintext;
+		};
+	}
+
+	static result<void> write_all(const int file, span<const std::byte> data) {
+		while (!data.empty()) {
+			const auto written{::write(file, data.data(), data.size())};
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				return Error(status_type::EXPORT_ERROR, "Failed to write to the state store.");
+			}
+
+			data = data.subspan(gsl::narrow_cast<size_t>(written));
+		}
+
+		return outcome::success();
+	}
+
+	static result<void> sync_file(const int file) {
+		if (fsync(file) != 0) {
+			return Error(status_type::EXPORT_ERROR, "Failed to sync the state store to disk.");
+		}
+
+		return outcome::success();
+	}
+
+	//make a rename durable by syncing the directory containing the file
+	static result<void> sync_directory(const std::string& path) {
+		const auto separator{path.find_last_of('/')};
+		const std::string directory_path{(separator == std::string::npos) ? std::string(".") : path.substr(0, separator + 1)};
+		const auto directory{::open(directory_path.c_str(), O_RDONLY | O_CLOEXEC)};
+		if (directory < 0) {
+			return Error(status_type::EXPORT_ERROR, "Failed to open the directory of the state store.");
+		}
+		const auto status{sync_file(directory)};
+		::close(directory);
+
+		return status;
+	}
+
+	static result<int> open_file(const std::string& path, const int flags) {
+		const auto file{::open(path.c_str(), flags | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR)};
+		if (file < 0) {
+			return Error(status_type::IMPORT_ERROR, "Failed to open the state store.");
+		}
+
+		//two processes appending to the same file would corrupt it
+		if (flock(file, LOCK_EX | LOCK_NB) != 0) {
+			::close(file);
+			return Error(status_type::IMPORT_ERROR, "The state store is already in use.");
+		}
+
+		return file;
+	}
+
+	static result<std::array<std::byte,state_store_header_size>> create_header(const BackupKey& store_key) {
+		std::array<std::byte,state_store_header_size> header;
+		const span<std::byte> header_span{header};
+		OUTCOME_TRY(copyFromTo(state_store_magic, header_span.subspan(0, state_store_magic.size())));
+		const auto nonce{header_span.subspan(state_store_magic.size(), BACKUP_NONCE_SIZE)};
+		randombytes_buf(nonce);
+		OUTCOME_TRY(crypto_secretbox_easy(header_span.subspan(state_store_magic.size() + BACKUP_NONCE_SIZE), state_store_magic, nonce, store_key));
+
+		return header;
+	}
+
+	static result<void> check_header(const span<const std::byte> content, const BackupKey& store_key) {
+		if ((content.size() < state_store_header_size)
+				or !std::equal(std::cbegin(state_store_magic), std::cend(state_store_magic), std::cbegin(content))) {
+			return Error(status_type::INCORRECT_DATA, "File is not a compatible state store.");
+		}
+
+		const auto nonce{content.subspan(state_store_magic.size(), BACKUP_NONCE_SIZE)};
+		const auto key_check{content.subspan(state_store_magic.size() + BACKUP_NONCE_SIZE, state_store_magic.size() + crypto_secretbox_MACBYTES)};
+		std::array<std::byte,state_store_magic.size()> magic;
+		if (crypto_secretbox_open_easy(magic, key_check, nonce, store_key).has_error()
+				or !std::equal(std::cbegin(state_store_magic), std::cend(state_store_magic), std::cbegin(magic))) {
+			return Error(status_type::DECRYPT_ERROR, "Wrong key for the state store.");
+		}
+
+		return outcome::success();
+	}
+
+	/*
+	 * Encrypt a record and append it to the output.
+	 *
+	 * \return Offset of the record in the output.
+	 */
+	static result<size_t> encrypt_record(
+			std::vector<std::byte>& output,
+			const BackupKey& store_key,
+			const StoreRecordType type,
+			const span<const std::byte> id,
+			const span<const std::byte> owner,
+			const ProtobufCMessage* const message) {
+		const auto message_size{(message == nullptr) ? 0 : protobuf_c_message_get_packed_size(message)};
+		const auto plaintext_size{1 + id.size() + owner.size() + message_size};
+		Buffer plaintext{plaintext_size, plaintext_size};
+		plaintext[0] = static_cast<std::byte>(type);
+		std::copy(std::cbegin(id), std::cend(id), std::begin(plaintext) + 1);
+		std::copy(std::cbegin(owner), std::cend(owner), std::begin(plaintext) + gsl::narrow<ptrdiff_t>(1 + id.size()));
+		if (message != nullptr) {
+			protobuf_c_message_pack(message, byte_to_uchar(plaintext.data() + 1 + id.size() + owner.size()));
+		}
+
+		const auto record_size{BACKUP_NONCE_SIZE + plaintext_size + crypto_secretbox_MACBYTES};
+		if (record_size > state_store_maximum_record_size) {
+			return Error(status_type::EXPORT_ERROR, "State is too large for a single record of the state store.");
+		}
+
+		const auto offset{output.size()};
+		output.resize(offset + state_store_length_size + record_size);
+		span<std::byte> record{output.data() + offset, state_store_length_size + record_size};
+		OUTCOME_TRY(to_big_endian(gsl::narrow<uint32_t>(record_size), record.subspan(0, state_store_length_size)));
+		const auto nonce{record.subspan(state_store_length_size, BACKUP_NONCE_SIZE)};
+		randombytes_buf(nonce);
+		const auto ciphertext{record.subspan(state_store_length_size + BACKUP_NONCE_SIZE)};
+		OUTCOME_TRY(crypto_secretbox_easy(ciphertext, plaintext, nonce, store_key));
+		sodium_memzero(plaintext);
+
+		return offset;
+	}
+
+	StateStore& StateStore::move(StateStore&& store) noexcept {
+		//there is no way to report an error here, close the store explicitly for that
+		[[maybe_unused]] const auto closed{this->close()};
+
+		this->path = std::move(store.path);
+		this->file = store.file;
+		store.file = -1;
+		this->store_key = std::move(store.store_key);
+		this->user_records = std::move(store.user_records);
+		this->conversation_records = std::move(store.conversation_records);
+		this->file_size = store.file_size;
+		this->live_size = store.live_size;
+		this->unsynced = store.unsynced;
+
+		return *this;
+	}
+
+	StateStore::StateStore(StateStore&& store) noexcept {
+		this->move(std::move(store));
+	}
+
+	StateStore& StateStore::operator=(StateStore&& store) noexcept {
+		return this->move(std::move(store));
+	}
+
+	StateStore::~StateStore() noexcept {
+		[[maybe_unused]] const auto closed{this->close()};
+	}
+
+	result<void> StateStore::close() noexcept {
+		if (this->file < 0) {
+			return outcome::success();
+		}
+
+		const auto synced{(not this->unsynced) or (fsync(this->file) == 0)};
+		const auto closed{::close(this->file) == 0};
+		this->file = -1;
+		this->unsynced = false;
+		if (not synced) {
+			return Error(status_type::EXPORT_ERROR, "Failed to sync the state store to disk.");
+		}
+		if (not closed) {
+			return Error(status_type::EXPORT_ERROR, "Failed to close the state store.");
+		}
+
+		return outcome::success();
+	}
+
+	size_t StateStore::size() const noexcept {
+		return this->file_size;
+	}
+
+	result<std::pair<StateStore,UserStore>> StateStore::open(const std::string& path, const span<const std::byte> store_key) {
+		if (store_key.size() != BACKUP_KEY_SIZE) {
+			return Error(status_type::INCORRECT_BUFFER_SIZE, "State store key has an incorrect size.");
+		}
+
+		StateStore store;
+		store.path = path;
+		OUTCOME_TRY(shared_key, share_backup_key(store_key));
+		store.store_key = std::move(shared_key);
+		OUTCOME_TRY(file, open_file(path, O_CREAT));
+		store.file = file;
+
+		struct stat file_status;
+		if (fstat(store.file, &file_status) != 0) {
+			return Error(status_type::IMPORT_ERROR, "Failed to get the size of the state store.");
+		}
+		const auto file_size{gsl::narrow<size_t>(file_status.st_size)};
+
+		//new file, only write the header
+		if (file_size < state_store_header_size) {
+			if ((ftruncate(store.file, 0) != 0) || (lseek(store.file, 0, SEEK_SET) != 0)) {
+				return Error(status_type::EXPORT_ERROR, "Failed to initialize the state store.");
+			}
+			OUTCOME_TRY(header, create_header(*store.store_key));
+			OUTCOME_TRY(write_all(store.file, header));
+			OUTCOME_TRY(sync_file(store.file));
+			OUTCOME_TRY(sync_directory(path));
+			store.file_size = state_store_header_size;
+			store.live_size = store.file_size;
+
+			return std::pair<StateStore,UserStore>{std::move(store), UserStore()};
+		}
+
+		std::map<PublicSigningKey,LoadedRecord> users;
+		std::map<ConversationId,LoadedRecord> conversations;
+		//users and conversations are restored in the order in which they have been added
+		std::vector<PublicSigningKey> user_order;
+		std::vector<ConversationId> conversation_order;
+		size_t valid_size{state_store_header_size};
+		{
+			FileMapping mapping{store.file, file_size};
+			if (!mapping.valid()) {
+				return Error(status_type::IMPORT_ERROR, "Failed to map the state store.");
+			}
+			const auto content{mapping.data()};
+			OUTCOME_TRY(check_header(content, *store.store_key));
+
+			while ((file_size - valid_size) >= state_store_length_size) {
+				const auto offset{valid_size};
+				uint32_t record_size{0};
+				OUTCOME_TRY(from_big_endian(record_size, content.subspan(offset, state_store_length_size)));
+				const auto record_end{offset + state_store_length_size + record_size};
+				if (record_end > file_size) {
+					//the last append didn't complete, this is the only case that is truncated
+					break;
+				}
+				if ((record_size < state_store_minimum_record_size) || (record_size > state_store_maximum_record_size)) {
+					return Error(status_type::INCORRECT_DATA, "State store record has an invalid length.");
+				}
+
+				const auto nonce{content.subspan(offset + state_store_length_size, BACKUP_NONCE_SIZE)};
+				const auto ciphertext{content.subspan(offset + state_store_length_size + BACKUP_NONCE_SIZE, record_size - BACKUP_NONCE_SIZE)};
+				const auto plaintext_size{ciphertext.size() - crypto_secretbox_MACBYTES};
+				Buffer plaintext{plaintext_size, plaintext_size};
+				//the key has been checked already, so this is corruption and nothing is thrown away
+				if (crypto_secretbox_open_easy(plaintext, ciphertext, nonce, *store.store_key).has_error()) {
+					return Error(status_type::DECRYPT_ERROR, "Failed to decrypt a record of the state store.");
+				}
+				valid_size = record_end;
+
+				const auto type{static_cast<StoreRecordType>(plaintext[0])};
+				const span<const std::byte> id{plaintext.data() + 1, CONVERSATION_ID_SIZE};
+				switch (type) {
+					case StoreRecordType::USER:
+					case StoreRecordType::REMOVED_USER: {
+						OUTCOME_TRY(user_id, PublicSigningKey::fromSpan(id));
+						const auto existing{users.find(user_id)};
+						if (existing == std::end(users)) {
+							user_order.push_back(user_id);
+						}
+						users.insert_or_assign(user_id, LoadedRecord{type, offset, record_end - offset, std::move(plaintext)});
+						break;
+					}
+
+					case StoreRecordType::CONVERSATION:
+					case StoreRecordType::REMOVED_CONVERSATION: {
+						OUTCOME_TRY(conversation_id, ConversationId::fromSpan(id));
+						const auto existing{conversations.find(conversation_id)};
+						if (existing == std::end(conversations)) {
+							conversation_order.push_back(conversation_id);
+						}
+						conversations.insert_or_assign(conversation_id, LoadedRecord{type, offset, record_end - offset, std::move(plaintext)});
+						break;
+					}
+
+					default:
+						return Error(status_type::INCORRECT_DATA, "Invalid record type in the state store.");
+				}
+			}
+		}
+
+		//throw away an incomplete append at the end
+		if (valid_size != file_size) {
+			if ((ftruncate(store.file, gsl::narrow<off_t>(valid_size)) != 0) || (fsync(store.file) != 0)) {
+				return Error(status_type::EXPORT_ERROR, "Failed to truncate an incomplete record of the state store.");
+			}
+		}
+		if (lseek(store.file, 0, SEEK_END) < 0) {
+			return Error(status_type::IMPORT_ERROR, "Failed to seek to the end of the state store.");
+		}
+		store.file_size = valid_size;
+		store.live_size = state_store_header_size;
+
+		//import the users
+		std::map<PublicSigningKey,User> imported_users;
+		for (const auto& [user_id, record] : users) {
+			if (record.type == StoreRecordType::REMOVED_USER) {
+				continue;
+			}
+
+			Arena arena;
+			auto arena_protoc_allocator{arena.getProtobufCAllocator()};
+			const auto packed_user{span<const std::byte>{record.plaintext}.subspan(1 + PUBLIC_MASTER_KEY_SIZE)};
+			auto user_struct{molch__protobuf__user__unpack(&arena_protoc_allocator, packed_user.size(), byte_to_uchar(packed_user.data()))};
+			if (user_struct == nullptr) {
+				return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack a user from the state store.");
+			}
+			OUTCOME_TRY(user, User::import(*user_struct));
+			if (user.id() != user_id) {
+				return Error(status_type::INCORRECT_DATA, "User in the state store has a different id than its record.");
+			}
+			store.user_records.insert_or_assign(user_id, StoredRecord{user.prekeys.version().value(), record.offset, record.size});
+			store.live_size += record.size;
+			imported_users.insert_or_assign(user_id, std::move(user));
+		}
+
+		//import the conversations, conversations of removed users are dropped
+		for (const auto& conversation_id : conversation_order) {
+			const auto& record{conversations.at(conversation_id)};
+			if (record.type == StoreRecordType::REMOVED_CONVERSATION) {
+				continue;
+			}
+
+			const span<const std::byte> plaintext{record.plaintext};
+			const auto owner_span{plaintext.subspan(1 + CONVERSATION_ID_SIZE, PUBLIC_MASTER_KEY_SIZE)};
+			OUTCOME_TRY(owner_id, PublicSigningKey::fromSpan(owner_span));
+			auto owner{imported_users.find(owner_id)};
+			if (owner == std::end(imported_users)) {
+				continue;
+			}
+
+			Arena arena;
+			auto arena_protoc_allocator{arena.getProtobufCAllocator()};
+			const auto packed_conversation{plaintext.subspan(1 + CONVERSATION_ID_SIZE + PUBLIC_MASTER_KEY_SIZE)};
+			auto conversation_struct{molch__protobuf__conversation__unpack(&arena_protoc_allocator, packed_conversation.size(), byte_to_uchar(packed_conversation.data()))};
+			if (conversation_struct == nullptr) {
+				return Error(status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack a conversation from the state store.");
+			}
+			OUTCOME_TRY(conversation, Conversation::importWithCheckpoint(*conversation_struct));
+			if (conversation.id() != conversation_id) {
+				return Error(status_type::INCORRECT_DATA, "Conversation in the state store has a different id than its record.");
+			}
+			store.conversation_records.insert_or_assign(conversation_id, StoredRecord{conversation.version().value(), record.offset, record.size});
+			store.live_size += record.size;
+			OUTCOME_TRY(owner->second.conversations.add(std::move(conversation)));
+		}
+
+		UserStore user_store;
+		for (const auto& user_id : user_order) {
+			auto user{imported_users.find(user_id)};
+			if (user != std::end(imported_users)) {
+				user_store.add(std::move(user->second));
+			}
+		}
+		//everything in it is stored already
+		user_store.clearChanges();
+
+		return std::pair<StateStore,UserStore>{std::move(store), std::move(user_store)};
+	}
+
+	result<void> StateStore::append(const span<const std::byte> records) {
+		if (records.empty()) {
+			return outcome::success();
+		}
+
+		const auto status{write_all(this->file, records)};
+		if (status.has_error()) {
+			//don't leave a partial record in front of the next append
+			if (ftruncate(this->file, gsl::narrow<off_t>(this->file_size)) == 0) {
+				lseek(this->file, 0, SEEK_END);
+			}
+			return status;
+		}
+		this->file_size += records.size();
+		this->unsynced = true;
+
+		return outcome::success();
+	}
+
+	result<void> StateStore::persist(UserStore& users) {
+		std::vector<std::byte> records;
+		//applied once the records have been appended, an empty record means the state has been removed
+		std::vector<std::pair<PublicSigningKey,std::optional<StoredRecord>>> user_updates;
+		std::vector<std::pair<ConversationId,std::optional<StoredRecord>>> conversation_updates;
+
+		//encrypt a new record unless the stored one has the same version
+		const auto persist_record{[&](const auto& stored_records, auto& updates, const auto& id, const StateVersion& version, const StoreRecordType type, const span<const std::byte> owner, auto&& export_protobuf) -> result<void> {
+			const auto stored_record{stored_records.find(id)};
+			if ((stored_record != std::end(stored_records)) and (stored_record->second.version == version.value())) {
+				return outcome::success();
+			}
+
+			Arena arena;
+			OUTCOME_TRY(message, export_protobuf(arena));
+			OUTCOME_TRY(offset, encrypt_record(records, *this->store_key, type, id, owner, message));
+			updates.emplace_back(id, StoredRecord{version.value(), this->file_size + offset, records.size() - offset});
+			return outcome::success();
+		}};
+		const auto persist_conversation{[&](const User& user, const ConversationId& conversation_id) -> result<void> {
+			const auto version{user.conversations.version(conversation_id)};
+			if (version == nullptr) {
+				if (this->conversation_records.count(conversation_id) != 0) {
+					OUTCOME_TRY(encrypt_record(records, *this->store_key, StoreRecordType::REMOVED_CONVERSATION, conversation_id, {}, nullptr));
+					conversation_updates.emplace_back(conversation_id, std::nullopt);
+				}
+				return outcome::success();
+			}
+
+			return persist_record(this->conversation_records, conversation_updates, conversation_id, *version, StoreRecordType::CONVERSATION, user.id(),
+					[&](Arena& arena) -> result<const ProtobufCMessage*> {
+						OUTCOME_TRY(exported_conversation, user.conversations.exportProtobufWithCheckpoint(conversation_id, arena));
+						return &exported_conversation->base;
+					});
+		}};
+		const auto persist_user{[&](const User& user, const bool all_conversations) -> result<void> {
+			OUTCOME_TRY(persist_record(this->user_records, user_updates, user.id(), user.prekeys.version(), StoreRecordType::USER, {},
+					[&user](Arena& arena) -> result<const ProtobufCMessage*> {
+						OUTCOME_TRY(exported_user, user.exportProtobufWithoutConversations(arena));
+						return &exported_user->base;
+					}));
+
+			if (not all_conversations) {
+				for (const auto& conversation_id : user.conversations.changes()) {
+					OUTCOME_TRY(persist_conversation(user, conversation_id));
+				}
+				return outcome::success();
+			}
+
+			for (const auto& conversation : user.conversations) {
+				OUTCOME_TRY(persist_conversation(user, conversation.id()));
+			}
+			for (const auto& conversation : user.conversations.dormant()) {
+				OUTCOME_TRY(persist_conversation(user, conversation.id()));
+			}
+			return outcome::success();
+		}};
+
+		if (users.changedEverything() or this->user_records.empty()) {
+			//compare every user and conversation, everything that isn't there anymore has been removed
+			std::set<PublicSigningKey> user_ids;
+			std::set<ConversationId> conversation_ids;
+			for (const auto& user : users) {
+				OUTCOME_TRY(persist_user(user, true));
+				user_ids.insert(user.id());
+				for (const auto& conversation : user.conversations) {
+					conversation_ids.insert(conversation.id());
+				}
+				for (const auto& conversation : user.conversations.dormant()) {
+					conversation_ids.insert(conversation.id());
+				}
+			}
+			for (const auto& [user_id, record] : this->user_records) {
+				if (user_ids.count(user_id) == 0) {
+					OUTCOME_TRY(encrypt_record(records, *this->store_key, StoreRecordType::REMOVED_USER, user_id, {}, nullptr));
+					user_updates.emplace_back(user_id, std::nullopt);
+				}
+			}
+			for (const auto& [conversation_id, record] : this->conversation_records) {
+				if (conversation_ids.count(conversation_id) == 0) {
+					OUTCOME_TRY(encrypt_record(records, *this->store_key, StoreRecordType::REMOVED_CONVERSATION, conversation_id, {}, nullptr));
+					conversation_updates.emplace_back(conversation_id, std::nullopt);
+				}
+			}
+		} else {
+			//only the users and conversations that have been used can have changed
+			for (const auto& user_id : users.changes()) {
+				const auto user{std::as_const(users).find(user_id)};
+				if (user == nullptr) {
+					continue;
+				}
+
+				//the conversations of a user that is new to the store haven't been stored yet
+				const auto new_user{this->user_records.count(user_id) == 0};
+				OUTCOME_TRY(persist_user(*user, new_user));
+			}
+		}
+
+		OUTCOME_TRY(this->append(records));
+		users.clearChanges();
+
+		const auto apply_updates{[this](auto& stored_records, const auto& updates) {
+			for (const auto& [id, record] : updates) {
+				const auto stored_record{stored_records.find(id)};
+				if (stored_record != std::end(stored_records)) {
+					this->live_size -= stored_record->second.size;
+					stored_records.erase(stored_record);
+				}
+				if (record.has_value()) {
+					this->live_size += record->size;
+					stored_records.emplace(id, *record);
+				}
+			}
+		}};
+		apply_updates(this->user_records, user_updates);
+		apply_updates(this->conversation_records, conversation_updates);
+
+		//most of the file is outdated
+		if ((this->file_size > state_store_compaction_threshold) && (this->file_size > (2 * this->live_size))) {
+			return this->compact(users);
+		}
+
+		return outcome::success();
+	}
+
+	result<void> StateStore::sync() {
+		if (!this->unsynced) {
+			return outcome::success();
+		}
+
+		OUTCOME_TRY(sync_file(this->file));
+		this->unsynced = false;
+
+		return outcome::success();
+	}
+
+	result<void> StateStore::compact(const UserStore& users) {
+		//copy the live records into a new file
+		std::vector<std::byte> compacted;
+		compacted.reserve(this->live_size);
+		std::map<PublicSigningKey,StoredRecord> compacted_user_records;
+		std::map<ConversationId,StoredRecord> compacted_conversation_records;
+		{
+			FileMapping mapping{this->file, this->file_size};
+			if (!mapping.valid()) {
+				return Error(status_type::IMPORT_ERROR, "Failed to map the state store.");
+			}
+			const auto content{mapping.data()};
+			//the header with the key check stays the same
+			const auto header{content.subspan(0, state_store_header_size)};
+			compacted.insert(std::end(compacted), std::cbegin(header), std::cend(header));
+			const auto copy_record{[&](const auto& records, auto& compacted_records, const auto& id) {
+				const auto& record{records.at(id)};
+				const auto record_content{content.subspan(record.offset, record.size)};
+				compacted_records.insert_or_assign(id, StoredRecord{record.version, compacted.size(), record.size});
+				compacted.insert(std::end(compacted), std::cbegin(record_content), std::cend(record_content));
+			}};
+			//keep the order of the users and conversations
+			for (const auto& user : users) {
+				copy_record(this->user_records, compacted_user_records, user.id());
+				for (const auto& conversation : user.conversations) {
+					copy_record(this->conversation_records, compacted_conversation_records, conversation.id());
+				}
+				for (const auto& conversation : user.conversations.dormant()) {
+					copy_record(this->conversation_records, compacted_conversation_records, conversation.id());
+				}
+			}
+		}
+
+		const auto compacted_path{this->path + ".compact"};
+		OUTCOME_TRY(compacted_file, open_file(compacted_path, O_CREAT | O_TRUNC));
+		const auto written{[&]() -> result<void> {
+			OUTCOME_TRY(write_all(compacted_file, compacted));
+			OUTCOME_TRY(sync_file(compacted_file));
+			if (rename(compacted_path.c_str(), this->path.c_str()) != 0) {
+				return Error(status_type::EXPORT_ERROR, "Failed to replace the state store with the compacted one.");
+			}
+
+			return sync_directory(this->path);
+		}()};
+		if (written.has_error()) {
+			::close(compacted_file);
+			unlink(compacted_path.c_str());
+			return written;
+		}
+
+		//everything in the old file is in the compacted one as well
+		::close(this->file);
+		this->file = compacted_file;
+		this->file_size = compacted.size();
+		this->live_size = compacted.size();
+		this->unsynced = false;
+		this->user_records = std::move(compacted_user_records);
+		this->conversation_records = std::move(compacted_conversation_records);
+
+		return outcome::success();
+	}
+}
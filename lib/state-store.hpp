@@ -0,0 +1,124 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_STATE_STORE_H
+#define LIB_STATE_STORE_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "molch/constants.h"
+#include "key.hpp"
+#include "user-store.hpp"
+
+/*
+ * A state store is an append only file of records that are encrypted
+ * individually with the store key. A record contains one user (without its
+ * conversations), one conversation or the removal of either, the last record
+ * for an id wins. After a change, only the users and conversations that the
+ * user store marked as changed are looked at and the ones whose state version
+ * changed are appended. Once most of the file consists of outdated records,
+ * the live ones are copied to a new file that atomically replaces the old one.
+ *
+ * The file starts with the magic "molchst" and a version byte, followed by a
+ * nonce and a secretbox of the magic that checks the key, and then the records.
+ * Every record is a 4 byte big endian length, the nonce and a secretbox of the
+ * record type, the id, the id of the owning user (only for conversations) and
+ * the packed Protobuf-C struct.
+ *
+ * Only a record that extends past the end of the file is treated as an
+ * incomplete append and truncated. A record that fails to decrypt with the
+ * checked key is corruption, the file is left alone and opening fails.
+ */
+
+namespace Molch {
+	//! Upper bound for the size of a single record, protects against huge allocations from corrupted files.
+	constexpr size_t state_store_maximum_record_size{16 * 1024 * 1024};
+	//! Files below this size are never compacted.
+	constexpr size_t state_store_compaction_threshold{64 * 1024};
+
+	class StateStore {
+	private:
+		struct StoredRecord {
+			uint64_t version{0}; //version of the state in this record
+			size_t offset{0};
+			size_t size{0};
+		};
+
+		std::string path;
+		int file{-1};
+		std::shared_ptr<const BackupKey> store_key;
+		std::map<PublicSigningKey,StoredRecord> user_records;
+		std::map<ConversationId,StoredRecord> conversation_records;
+		size_t file_size{0};
+		size_t live_size{0};
+		bool unsynced{false};
+
+		StateStore() = default;
+
+		StateStore& move(StateStore&& store) noexcept;
+
+		result<void> append(const span<const std::byte> records);
+		//users has to be the state that has just been persisted
+		result<void> compact(const UserStore& users);
+
+	public:
+		/*! Open or create a state store.
+		 * \param path Path of the file, it is created if it doesn't exist yet.
+		 * \param store_key The key all records are encrypted with.
+		 *
+		 * \return The store together with the users and conversations in it.
+		 */
+		static result<std::pair<StateStore,UserStore>> open(const std::string& path, const span<const std::byte> store_key);
+
+		StateStore(const StateStore& store) = delete;
+		StateStore(StateStore&& store) noexcept;
+		StateStore& operator=(const StateStore& store) = delete;
+		StateStore& operator=(StateStore&& store) noexcept;
+		~StateStore() noexcept;
+
+		/*
+		 * Append the users and conversations that changed since they have
+		 * been persisted the last time and the removal of the ones that are gone.
+		 * Only the users and conversations in the changes of the user store
+		 * are compared, unless users have been removed or replaced.
+		 * The changes are cleared afterwards.
+		 * The file is only flushed to disk by sync.
+		 */
+		result<void> persist(UserStore& users);
+
+		//! fsync everything that has been appended.
+		result<void> sync();
+
+		/*
+		 * Sync and close the file, the store can't be used afterwards. The
+		 * file is closed even if syncing it fails. Destroying an open store
+		 * closes it as well, but without a way to find out if syncing failed.
+		 */
+		result<void> close() noexcept;
+
+		//! Size of the file in bytes.
+		size_t size() const noexcept;
+	};
+}
+
+#endif /* LIB_STATE_STORE_H */
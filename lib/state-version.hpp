@@ -0,0 +1,49 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIB_STATE_VERSION_H
+#define LIB_STATE_VERSION_H
+
+#include <cstdint>
+
+namespace Molch {
+	/*
+	 * Version of a piece of state that is backed up in its own segment.
+	 *
+	 * Every new or changed state gets a fresh value from a global counter,
+	 * so two states with the same version always have the same content,
+	 * even if one of them has been moved or replaced in the meantime.
+	 */
+	class StateVersion {
+	private:
+		uint64_t version;
+
+	public:
+		StateVersion() noexcept;
+
+		//! Mark the state as changed.
+		void bump() noexcept;
+
+		uint64_t value() const noexcept;
+	};
+}
+
+#endif /* LIB_STATE_VERSION_H */
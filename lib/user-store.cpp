@@ -22,10 +22,13 @@
 #include <algorithm>
 #include <exception>
 #include <iterator>
+#include <optional>
+#include <vector>
 
 #include "molch/constants.h"
 #include "user-store.hpp"
 #include "destroyers.hpp"
+#include "parallel.hpp"
 
 namespace Molch {
 	User::User(uninitialized_t uninitialized) noexcept : master_keys{uninitialized}, prekeys{uninitialized} {}
@@ -35,6 +38,7 @@ namespace Molch {
 		this->master_keys = std::move(node.master_keys);
 		this->prekeys = std::move(node.prekeys);
 		this->conversations = std::move(node.conversations);
+		this->signed_prekey_list = std::move(node.signed_prekey_list);
 
 		return *this;
 	}
@@ -113,14 +117,22 @@ namespace Molch {
 	}
 
 	result<UserStore> UserStore::import(const span<ProtobufCUser*> users) {
-		UserStore store;
-		for (const auto& user : users) {
+		//users are independent of each other, so they are imported in parallel
+		std::vector<std::optional<User>> imported_users(users.size());
+		OUTCOME_TRY(parallel_for(users.size(), [&users, &imported_users](const size_t index) -> result<void> {
+			const auto& user{users[index]};
 			if (user == nullptr) {
 				return Error(status_type::PROTOBUF_MISSING_ERROR, "Array of users is missing a user.");
 			}
 
 			OUTCOME_TRY(imported_user, User::import(*user));
-			store.add(std::move(imported_user));
+			imported_users[index].emplace(std::move(imported_user));
+			return outcome::success();
+		}));
+
+		UserStore store;
+		for (auto& imported_user : imported_users) {
+			store.add(std::move(*imported_user));
 		}
 
 		return store;
@@ -135,15 +147,25 @@ namespace Molch {
 				})};
 		//if none exists, just add the conversation
 		if (existing_user == std::cend(this->users)) {
+			this->changed.insert(public_signing_key);
 			this->users.emplace_back(std::move(user));
 			return;
 		}
 
-		//otherwise replace the existing one
+		//otherwise replace the existing one, conversations of the old one might be gone
 		auto existing_index{gsl::narrow_cast<size_t>(existing_user - std::cbegin(this->users))};
+		this->changed_everything = true;
 		this->users[existing_index] = std::move(user);
 	}
 
+	void UserStore::addCreated(std::vector<User>&& created_users) {
+		this->users.reserve(this->users.size() + created_users.size());
+		for (auto& user : created_users) {
+			this->changed.insert(user.id());
+			this->users.emplace_back(std::move(user));
+		}
+	}
+
 	User* UserStore::find(const PublicSigningKey& public_signing_key) {
 		auto user{std::find_if(std::begin(this->users), std::end(this->users),
 				[public_signing_key](const User& user) {
@@ -153,22 +175,45 @@ namespace Molch {
 			return nullptr;
 		}
 
+		//the caller is free to change it
+		this->changed.insert(public_signing_key);
 		return &(*user);
 	}
 
-	Conversation* UserStore::findConversation(User*& user, const ConversationId& conversation_id) {
-		Conversation* conversation{nullptr};
-		auto containing_user{std::find_if(std::begin(this->users), std::end(this->users),
-				[&conversation_id, &conversation](User& user) {
-					conversation = user.conversations.find(conversation_id);
-					return conversation != nullptr;
+	const User* UserStore::find(const PublicSigningKey& public_signing_key) const {
+		auto user{std::find_if(std::cbegin(this->users), std::cend(this->users),
+				[public_signing_key](const User& user) {
+					return user.id() == public_signing_key;
 				})};
-		if (conversation != nullptr) {
-			user = &(*containing_user);
-			return conversation;
+		if (user == std::cend(this->users)) {
+			return nullptr;
 		}
 
+		return &(*user);
+	}
+
+	result<Conversation*> UserStore::findConversation(User*& user, const ConversationId& conversation_id) {
 		user = nullptr;
+		for (auto& containing_user : this->users) {
+			OUTCOME_TRY(conversation, containing_user.conversations.find(conversation_id));
+			if (conversation != nullptr) {
+				this->changed.insert(containing_user.id());
+				user = &containing_user;
+				return conversation;
+			}
+		}
+
+		return nullptr;
+	}
+
+	User* UserStore::findConversationOwner(const ConversationId& conversation_id) {
+		for (auto& user : this->users) {
+			if (user.conversations.contains(conversation_id)) {
+				this->changed.insert(user.id());
+				return &user;
+			}
+		}
+
 		return nullptr;
 	}
 
@@ -197,6 +242,7 @@ namespace Molch {
 					return &node == user;
 				})};
 		if (found_node != std::cend(this->users)) {
+			this->changed_everything = true;
 			this->users.erase(found_node);
 		}
 	}
@@ -208,15 +254,56 @@ namespace Molch {
 				})};
 
 		if (found_node != std::cend(this->users)) {
+			this->changed_everything = true;
 			this->users.erase(found_node);
 		}
 	}
 
 	void UserStore::clear() {
+		this->changed_everything = true;
 		this->users.clear();
 	}
 
+	const std::set<PublicSigningKey>& UserStore::changes() const noexcept {
+		return this->changed;
+	}
+
+	bool UserStore::changedEverything() const noexcept {
+		return this->changed_everything;
+	}
+
+	void UserStore::clearChanges() noexcept {
+		for (auto& user : this->users) {
+			user.conversations.clearChanges();
+		}
+		this->changed.clear();
+		this->changed_everything = false;
+	}
+
+	void UserStore::lockMasterKeys() const noexcept {
+		for (const auto& user : this->users) {
+			user.masterKeys().forceLock();
+		}
+	}
+
+	result<void> UserStore::enforceConversationBudget() {
+		for (auto& user : this->users) {
+			OUTCOME_TRY(user.conversations.enforceBudget());
+		}
+
+		return outcome::success();
+	}
+
 	result<ProtobufCUser*> User::exportProtobuf(Arena& arena) const {
+		OUTCOME_TRY(user, this->exportProtobufWithoutConversations(arena));
+
+		//export the conversation store
+		outcome_protobuf_array_arena_export(arena, user, conversations, this->conversations);
+
+		return user;
+	}
+
+	result<ProtobufCUser*> User::exportProtobufWithoutConversations(Arena& arena) const {
 		protobuf_arena_create(arena, ProtobufCUser, user);
 
 		OUTCOME_TRY(exported_master_keys, this->master_keys.exportProtobuf(arena));
@@ -225,9 +312,6 @@ namespace Molch {
 		user->public_identity_key = exported_master_keys.public_identity_key;
 		user->private_identity_key = exported_master_keys.private_identity_key;
 
-		//export the conversation store
-		outcome_protobuf_array_arena_export(arena, user, conversations, this->conversations);
-
 		//export the prekeys
 		OUTCOME_TRY(exported_prekeys, this->prekeys.exportProtobuf(arena));
 		user->prekeys = exported_prekeys.keypairs.data();
@@ -257,4 +341,12 @@ namespace Molch {
 	size_t UserStore::size() const {
 		return this->users.size();
 	}
+
+	std::vector<User>::const_iterator UserStore::begin() const noexcept {
+		return std::cbegin(this->users);
+	}
+
+	std::vector<User>::const_iterator UserStore::end() const noexcept {
+		return std::cend(this->users);
+	}
 }
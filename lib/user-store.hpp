@@ -23,8 +23,11 @@
 #define LIB_USER_STORE_H
 
 #include <sodium.h>
+#include <map>
 #include <memory>
+#include <optional>
 #include <ostream>
+#include <set>
 
 #include "molch/constants.h"
 #include "buffer.hpp"
@@ -34,6 +37,7 @@
 #include "protobuf.hpp"
 #include "gsl.hpp"
 #include "protobuf-arena.hpp"
+#include "time.hpp"
 
 //The user store stores a list of all users identified by their public keys
 
@@ -52,6 +56,14 @@ namespace Molch {
 		PrekeyStore prekeys;
 		ConversationStore conversations;
 
+		//! The last signed prekey list, it stays valid as long as the prekey store doesn't change.
+		struct SignedPrekeyList {
+			uint64_t prekeys_version{0};
+			seconds signing_time{0};
+			Buffer list;
+		};
+		std::optional<SignedPrekeyList> signed_prekey_list;
+
 		/*
 		 * Create a new user.
 		 *
@@ -74,6 +86,9 @@ namespace Molch {
 
 		result<ProtobufCUser*> exportProtobuf(Arena& arena) const;
 
+		/*! Export a user to a Protobuf-C struct, but leave out the conversations. */
+		result<ProtobufCUser*> exportProtobufWithoutConversations(Arena& arena) const;
+
 		const PublicSigningKey& id() const noexcept;
 		const MasterKeys& masterKeys() const noexcept;
 	};
@@ -84,6 +99,10 @@ namespace Molch {
 	class UserStore {
 	private:
 			std::vector<User> users;
+			//users that have been handed out or added since clearChanges
+			std::set<PublicSigningKey> changed;
+			//users have been removed or replaced, so everything has to be compared
+			bool changed_everything{true};
 
 	public:
 		UserStore() = default;
@@ -101,19 +120,35 @@ namespace Molch {
 
 		void add(User&& user);
 
+		/*
+		 * Add users that have just been created, without looking for
+		 * existing users with the same id. Fresh random signing keys
+		 * can't collide with the ones that are already in the store.
+		 */
+		void addCreated(std::vector<User>&& created_users);
+
 		/*
 		 * Find a user with a given public signing key.
 		 *
 		 * Returns nullptr if no user was found.
 		 */
 		User* find(const PublicSigningKey& public_signing_key);
+		const User* find(const PublicSigningKey& public_signing_key) const;
 
 		/*
 		 * Find a conversation with a given public signing key.
 		 *
 		 * return nullptr if no conversation was found.
 		 */
-		Conversation* findConversation(User*& user, const ConversationId& conversation_id);
+		result<Conversation*> findConversation(User*& user, const ConversationId& conversation_id);
+
+		/*
+		 * Find the user a conversation belongs to, dormant conversations
+		 * stay dormant.
+		 *
+		 * Returns nullptr if no conversation was found.
+		 */
+		User* findConversationOwner(const ConversationId& conversation_id);
 
 		/*
 		 * List all of the users.
@@ -128,10 +163,30 @@ namespace Molch {
 
 		void clear();
 
+		/*
+		 * Ids of the users that might have changed since the last call of
+		 * clearChanges, the ones that have been found or added. The changed
+		 * conversations of a user are tracked by its conversation store.
+		 */
+		const std::set<PublicSigningKey>& changes() const noexcept;
+		//! If users have been removed or replaced, changes() isn't enough then.
+		bool changedEverything() const noexcept;
+		//! Forget the changes of the users and their conversation stores.
+		void clearChanges() noexcept;
+
+		/*! Lock the master keys of all users, no matter the memory protection policy. */
+		void lockMasterKeys() const noexcept;
+
+		/*! Evict conversations of all users until the conversation budget is met. */
+		result<void> enforceConversationBudget();
+
 		/*! Export a user store to an array of Protobuf-C structs */
 		result<span<ProtobufCUser*>> exportProtobuf(Arena& arena) const;
 
 		size_t size() const;
+
+		std::vector<User>::const_iterator begin() const noexcept;
+		std::vector<User>::const_iterator end() const noexcept;
 	};
 }
 
@@ -0,0 +1,322 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Counts the heap allocations of sending and receiving normal messages by
+ * interposing malloc, calloc, realloc and sodium_malloc. Interposing the libc
+ * allocator relies on glibc, so the test is skipped everywhere else.
+ */
+
+#include <sodium.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "integration-utils.hpp"
+#include "inline-utils.hpp"
+#include "molch.h"
+
+//the only allocation allowed is the output that is handed to the caller
+constexpr size_t allocating_budget{1};
+constexpr size_t to_buffer_budget{0};
+
+constexpr size_t rounds{10};
+
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+
+static std::atomic<bool> counting{false};
+static std::atomic<size_t> allocations{0};
+
+static void count_allocation() noexcept {
+	if (counting) {
+		allocations++;
+	}
+}
+
+extern "C" {
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t amount, size_t size);
+	void *__libc_realloc(void *pointer, size_t size);
+
+	__attribute__((visibility("default"))) void *malloc(size_t size) noexcept {
+		count_allocation();
+		return __libc_malloc(size);
+	}
+
+	__attribute__((visibility("default"))) void *calloc(size_t amount, size_t size) noexcept {
+		count_allocation();
+		return __libc_calloc(amount, size);
+	}
+
+	__attribute__((visibility("default"))) void *realloc(void *pointer, size_t size) noexcept {
+		count_allocation();
+		return __libc_realloc(pointer, size);
+	}
+
+	__attribute__((visibility("default"))) void *sodium_malloc(const size_t size) {
+		using sodium_malloc_function = void *(*)(const size_t);
+		static const auto real_sodium_malloc{[]() {
+			//function pointers can't be casted from void* portably
+			auto symbol{dlsym(RTLD_NEXT, "sodium_malloc")};
+			sodium_malloc_function function{nullptr};
+			std::memcpy(&function, &symbol, sizeof(function));
+			return function;
+		}()};
+		count_allocation();
+		return real_sodium_malloc(size);
+	}
+}
+
+template <typename Function>
+static void count_allocations(const char *name, const size_t budget, Function&& function) {
+	allocations = 0;
+	counting = true;
+	const auto status{function()};
+	counting = false;
+	const size_t counted{allocations};
+
+	if (status.status != status_type::SUCCESS) {
+		throw Exception(std::string(name) + " failed.");
+	}
+
+	std::cout << name << ": " << counted << " allocations (budget " << budget << ")\n";
+	if (counted > budget) {
+		throw Exception(std::string(name) + " exceeded its allocation budget.");
+	}
+}
+
+struct Participant {
+	PublicIdentity identity;
+	AutoFreeBuffer prekeys;
+	ConversationID conversation;
+};
+
+static void create_user(Participant& participant, BackupKeyArray& backup_key) {
+	auto status{molch_create_user(
+			participant.identity.data(),
+			participant.identity.size(),
+			&participant.prekeys.pointer,
+			&participant.prekeys.length,
+			backup_key.data(),
+			backup_key.size(),
+			nullptr,
+			nullptr,
+			nullptr,
+			0)};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to create user.");
+	}
+}
+
+static std::vector<unsigned char> send(const Participant& sender, const std::string& message) {
+	AutoFreeBuffer packet;
+	auto status{molch_encrypt_message(
+			&packet.pointer,
+			&packet.length,
+			sender.conversation.data(),
+			sender.conversation.size(),
+			char_to_uchar(message.data()),
+			message.size(),
+			nullptr,
+			nullptr)};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to encrypt message.");
+	}
+
+	return {packet.data(), packet.data() + packet.size()};
+}
+
+static void receive(const Participant& receiver, const std::vector<unsigned char>& packet) {
+	AutoFreeBuffer message;
+	uint32_t message_number{0};
+	uint32_t previous_message_number{0};
+	auto status{molch_decrypt_message(
+			&message.pointer,
+			&message.length,
+			&message_number,
+			&previous_message_number,
+			receiver.conversation.data(),
+			receiver.conversation.size(),
+			packet.data(),
+			packet.size(),
+			nullptr,
+			nullptr)};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to decrypt message.");
+	}
+}
+
+int main() {
+	try {
+		if (sodium_init() != 0) {
+			throw Exception("Failed to initialize libsodium.");
+		}
+
+		BackupKeyArray backup_key;
+		{
+			auto status{molch_update_backup_key(backup_key.data(), backup_key.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to update backup key.");
+			}
+		}
+
+		Participant alice;
+		Participant bob;
+		create_user(alice, backup_key);
+		create_user(bob, backup_key);
+
+		const std::string message(1000, 'x');
+
+		//start the conversation
+		{
+			AutoFreeBuffer packet;
+			auto status{molch_start_send_conversation(
+					alice.conversation.data(),
+					alice.conversation.size(),
+					&packet.pointer,
+					&packet.length,
+					alice.identity.data(),
+					alice.identity.size(),
+					bob.identity.data(),
+					bob.identity.size(),
+					bob.prekeys.data(),
+					bob.prekeys.size(),
+					char_to_uchar(message.data()),
+					message.size(),
+					nullptr,
+					nullptr)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to start send conversation.");
+			}
+
+			AutoFreeBuffer new_prekeys;
+			AutoFreeBuffer received_message;
+			status = molch_start_receive_conversation(
+					bob.conversation.data(),
+					bob.conversation.size(),
+					&new_prekeys.pointer,
+					&new_prekeys.length,
+					&received_message.pointer,
+					&received_message.length,
+					bob.identity.data(),
+					bob.identity.size(),
+					alice.identity.data(),
+					alice.identity.size(),
+					packet.data(),
+					packet.size(),
+					nullptr,
+					nullptr);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to start receive conversation.");
+			}
+		}
+
+		//warm up, so that both sides had their first ratchet step
+		receive(alice, send(bob, message));
+		receive(bob, send(alice, message));
+
+		std::vector<unsigned char> packet(molch_get_packet_size(message.size()));
+		std::vector<unsigned char> received_message(packet.size());
+		for (size_t round{0}; round < rounds; round++) {
+			//allocating API, the output is the only allocation
+			AutoFreeBuffer allocated_packet;
+			count_allocations("molch_encrypt_message", allocating_budget, [&]() {
+				return molch_encrypt_message(
+						&allocated_packet.pointer,
+						&allocated_packet.length,
+						alice.conversation.data(),
+						alice.conversation.size(),
+						char_to_uchar(message.data()),
+						message.size(),
+						nullptr,
+						nullptr);
+			});
+
+			AutoFreeBuffer allocated_message;
+			uint32_t message_number{0};
+			uint32_t previous_message_number{0};
+			count_allocations("molch_decrypt_message", allocating_budget, [&]() {
+				return molch_decrypt_message(
+						&allocated_message.pointer,
+						&allocated_message.length,
+						&message_number,
+						&previous_message_number,
+						bob.conversation.data(),
+						bob.conversation.size(),
+						allocated_packet.data(),
+						allocated_packet.size(),
+						nullptr,
+						nullptr);
+			});
+
+			//caller provided buffers, no allocations at all
+			size_t packet_length{0};
+			count_allocations("molch_encrypt_message_to_buffer", to_buffer_budget, [&]() {
+				return molch_encrypt_message_to_buffer(
+						packet.data(),
+						packet.size(),
+						&packet_length,
+						bob.conversation.data(),
+						bob.conversation.size(),
+						char_to_uchar(message.data()),
+						message.size());
+			});
+			if (packet_length != packet.size()) {
+				throw Exception("molch_get_packet_size returned the wrong size.");
+			}
+
+			size_t message_length{0};
+			count_allocations("molch_decrypt_message_to_buffer", to_buffer_budget, [&]() {
+				return molch_decrypt_message_to_buffer(
+						received_message.data(),
+						received_message.size(),
+						&message_length,
+						&message_number,
+						&previous_message_number,
+						alice.conversation.data(),
+						alice.conversation.size(),
+						packet.data(),
+						packet_length);
+			});
+			if ((message_length != message.size())
+					or (sodium_memcmp(received_message.data(), message.data(), message.size()) != 0)) {
+				throw Exception("Received message doesn't match the sent message.");
+			}
+		}
+
+		molch_destroy_all_users();
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+#else
+int main() {
+	std::cout << "Counting allocations is only supported with glibc, skipping.\n";
+	return 77;
+}
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "../lib/bounded-cache.hpp"
+#include "exception.hpp"
+
+using namespace Molch;
+
+int main() {
+	try {
+		BoundedCache<int,std::string,4> cache;
+		if ((cache.size() != 0) or (cache.find(0) != nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "New cache isn't empty."};
+		}
+
+		for (int i{0}; i < 4; i++) {
+			cache.add(i, std::to_string(i));
+		}
+		if ((cache.size() != 4) or (cache.find(2) == nullptr) or (*cache.find(2) != "2")) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Failed to add entries."};
+		}
+
+		//existing entries aren't replaced
+		cache.add(2, "two");
+		if ((cache.size() != 4) or (*cache.find(2) != "2")) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Adding an existing key replaced the entry."};
+		}
+
+		//the oldest entry is evicted when the cache is full
+		cache.add(4, "4");
+		if ((cache.size() != 4) or (cache.find(0) != nullptr) or (cache.find(4) == nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Failed to evict the oldest entry."};
+		}
+
+		//removed entries don't count towards the eviction order anymore
+		cache.remove(1);
+		if ((cache.size() != 3) or (cache.find(1) != nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Failed to remove an entry."};
+		}
+		cache.add(5, "5");
+		cache.add(6, "6");
+		if ((cache.size() != 4) or (cache.find(2) != nullptr) or (cache.find(3) == nullptr) or (cache.find(6) == nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Evicted the wrong entry after removing one."};
+		}
+
+		//entries can be removed by their content
+		cache.removeIf([](const int key, const std::string& value) {
+			return (key == 3) or (value == "6");
+		});
+		if ((cache.size() != 2) or (cache.find(3) != nullptr) or (cache.find(6) != nullptr) or (cache.find(5) == nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Failed to remove entries by content."};
+		}
+		cache.add(7, "7");
+		cache.add(8, "8");
+		cache.add(9, "9");
+		if ((cache.size() != 4) or (cache.find(4) != nullptr) or (cache.find(5) == nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Evicted the wrong entry after removing by content."};
+		}
+
+		cache.clear();
+		if ((cache.size() != 0) or (cache.find(5) != nullptr)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Failed to clear."};
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
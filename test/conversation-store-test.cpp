@@ -97,7 +97,7 @@ static void test_add_conversation(ConversationStore& store) {
 		our_public_ephemeral,
 		their_public_ephemeral));
 
-	store.add(std::move(conversation.value()));
+	TRY_VOID(store.add(std::move(conversation.value())));
 }
 
 static void protobuf_empty_store() {
@@ -120,6 +120,134 @@ static void protobuf_empty_store() {
 	std::cout << "Successful.\n";
 }
 
+static void evict_least_recently_used() {
+	std::cout << "Testing eviction of least recently used conversations.\n";
+
+	ConversationStore store;
+	for (size_t i{0}; i < 5; i++) {
+		test_add_conversation(store);
+	}
+	TRY_WITH_RESULT(conversation_list_result, store.list());
+	const auto& conversation_list{conversation_list_result.value()};
+	std::vector<ConversationId> ids;
+	for (size_t i{0}; i < store.size(); i++) {
+		TRY_WITH_RESULT(id_result, ConversationId::fromSpan({&conversation_list[CONVERSATION_ID_SIZE * i], CONVERSATION_ID_SIZE}));
+		ids.push_back(id_result.value());
+	}
+	const auto exported_before{protobuf_export(store)};
+
+	const auto statistics_before{residency_statistics()};
+	set_conversation_budget(2);
+	TRY_VOID(store.enforceBudget());
+	if ((store.size() != 5) or (store.dormant().size() != 3)) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Conversations haven't been evicted."};
+	}
+	//the first ones have been used least recently
+	auto dormant_conversation{std::cbegin(store.dormant())};
+	for (size_t i{0}; i < 3; i++) {
+		if (dormant_conversation->id() != ids[i]) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Evicted the wrong conversation."};
+		}
+		dormant_conversation++;
+	}
+
+	//every conversation can still be found, evicting another one each time
+	for (const auto& id : ids) {
+		TRY_WITH_RESULT(conversation, store.find(id));
+		if ((conversation.value() == nullptr) or (conversation.value()->id() != id)) {
+			throw Molch::Exception{status_type::NOT_FOUND, "Failed to find evicted conversation."};
+		}
+	}
+	TRY_WITH_RESULT(resident_conversation, store.find(ids.back()));
+	if (resident_conversation.value() == nullptr) {
+		throw Molch::Exception{status_type::NOT_FOUND, "Failed to find resident conversation."};
+	}
+	const auto statistics_after{residency_statistics()};
+	if (((statistics_after.misses - statistics_before.misses) != 5)
+			or ((statistics_after.hits - statistics_before.hits) != 1)
+			or ((statistics_after.evictions - statistics_before.evictions) != 8)) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Residency statistics are wrong."};
+	}
+
+	//the content survives eviction, only the order changes
+	const auto exported_after{protobuf_export(store)};
+	if (exported_before.size() != exported_after.size()) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Exported a different number of conversations after eviction."};
+	}
+	for (const auto& conversation : exported_before) {
+		if (std::find(std::cbegin(exported_after), std::cend(exported_after), conversation) == std::cend(exported_after)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Conversation changed after eviction."};
+		}
+	}
+
+	set_conversation_budget(0);
+	std::cout << "Successful.\n";
+}
+
+static void keep_checkpoint_through_eviction() {
+	std::cout << "Testing that eviction keeps the backup checkpoint.\n";
+
+	ConversationStore store;
+	test_add_conversation(store);
+	TRY_WITH_RESULT(conversation_list_result, store.list());
+	TRY_WITH_RESULT(id_result, ConversationId::fromSpan({conversation_list_result.value().data(), CONVERSATION_ID_SIZE}));
+	const auto& id{id_result.value()};
+	TRY_WITH_RESULT(conversation, store.find(id));
+	BackupHash base_hash;
+	randombytes_buf(base_hash);
+	conversation.value()->setBackupCheckpoint(base_hash, 1);
+
+	//adding a second conversation evicts the first one
+	set_conversation_budget(1);
+	test_add_conversation(store);
+	if (store.dormant().size() != 1) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Conversation hasn't been evicted."};
+	}
+
+	TRY_WITH_RESULT(hydrated_conversation, store.find(id));
+	if ((hydrated_conversation.value() == nullptr) or not hydrated_conversation.value()->hasBackupCheckpoint(1)) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Lost the backup checkpoint during eviction."};
+	}
+
+	set_conversation_budget(0);
+	std::cout << "Successful.\n";
+}
+
+static void export_dormant_conversation() {
+	std::cout << "Testing export of a dormant conversation without hydrating it.\n";
+
+	ConversationStore store;
+	set_conversation_budget(1);
+	test_add_conversation(store);
+	test_add_conversation(store);
+	if (store.dormant().size() != 1) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Conversation hasn't been evicted."};
+	}
+	const auto id{store.dormant().front().id()};
+
+	const auto statistics_before{residency_statistics()};
+	Arena arena;
+	TRY_WITH_RESULT(exported_conversation, store.exportProtobuf(id, arena));
+	if (exported_conversation.value() == nullptr) {
+		throw Molch::Exception{status_type::NOT_FOUND, "Failed to export the dormant conversation."};
+	}
+	BackupHash base_hash;
+	randombytes_buf(base_hash);
+	TRY_VOID(store.setBackupCheckpoint(id, base_hash, 1));
+	const auto statistics_after{residency_statistics()};
+	if ((store.dormant().size() != 1) or (statistics_after.misses != statistics_before.misses)) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Exporting hydrated the dormant conversation."};
+	}
+
+	TRY_WITH_RESULT(hydrated_conversation, store.find(id));
+	if ((hydrated_conversation.value() == nullptr) or not hydrated_conversation.value()->hasBackupCheckpoint(1)) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, "Backup checkpoint of the dormant conversation is missing."};
+	}
+
+	set_conversation_budget(0);
+	std::cout << "Successful.\n";
+}
+
 int main() {
 	try {
 		TRY_VOID(Molch::sodium_init());
@@ -156,8 +284,8 @@ int main() {
 		for (size_t i{0}; i < (conversation_list.size() / CONVERSATION_ID_SIZE); i++) {
 		    TRY_WITH_RESULT(current_id_result, ConversationId::fromSpan({&conversation_list[CONVERSATION_ID_SIZE * i], CONVERSATION_ID_SIZE}));
 		    const auto& current_id{current_id_result.value()};
-			auto found_node{store.find(current_id)};
-			if (found_node == nullptr) {
+			TRY_WITH_RESULT(found_node, store.find(current_id));
+			if (found_node.value() == nullptr) {
 				throw Molch::Exception{status_type::INCORRECT_DATA, "Exported list of conversations was incorrect."};
 			}
 
@@ -199,8 +327,8 @@ int main() {
 		std::cout << "Exported Protobuf-C strings match.\n";
 
 		//remove nodes
-		auto first{store.find(first_id)};
-		store.remove(first);
+		TRY_WITH_RESULT(first, store.find(first_id));
+		store.remove(first.value());
 		std::cout << "Removed head.\n";
 		store.remove(middle_id);
 		std::cout << "Removed tail.\n";
@@ -215,6 +343,12 @@ int main() {
 		std::cout << "Clear the conversation store.\n";
 
 		protobuf_empty_store();
+
+		evict_least_recently_used();
+
+		keep_checkpoint_through_eviction();
+
+		export_dormant_conversation();
 	} catch (const std::exception& exception) {
 		std::cerr << exception.what() << std::endl;
 		return EXIT_FAILURE;
@@ -68,9 +68,7 @@ struct AutoFreeBuffer {
 	}
 
 	~AutoFreeBuffer() noexcept {
-		if (pointer != nullptr) {
-			free(pointer);
-		}
+		molch_free(pointer);
 	}
 };
 
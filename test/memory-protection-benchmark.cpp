@@ -0,0 +1,204 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures how long a round of starting a conversation and exporting a
+ * backup takes with every memory protection policy. The policies only
+ * differ in the number of mprotect syscalls, memory-protection-test counts
+ * them. This isn't run with the tests, run it with "meson test --benchmark".
+ */
+
+#include <sodium.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "integration-utils.hpp"
+#include "inline-utils.hpp"
+#include "molch.h"
+
+constexpr size_t rounds{40};
+//the policies take turns and the fastest repetition counts
+constexpr size_t repetitions{5};
+
+static void create_user(PublicIdentity& identity, BackupKeyArray& backup_key) {
+	AutoFreeBuffer prekeys;
+	auto status{molch_create_user(
+			identity.data(),
+			identity.size(),
+			&prekeys.pointer,
+			&prekeys.length,
+			backup_key.data(),
+			backup_key.size(),
+			nullptr,
+			nullptr,
+			nullptr,
+			0)};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to create user.");
+	}
+}
+
+/*
+ * Start a conversation with a prekey message and export a backup.
+ */
+static void prekey_round(PublicIdentity& alice, PublicIdentity& bob) {
+	AutoFreeBuffer prekeys;
+	auto status{molch_get_prekey_list(&prekeys.pointer, &prekeys.length, bob.data(), bob.size())};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to get prekey list.");
+	}
+
+	const std::string message{"Hello Bob!"};
+	ConversationID alice_conversation;
+	AutoFreeBuffer packet;
+	status = molch_start_send_conversation(
+			alice_conversation.data(),
+			alice_conversation.size(),
+			&packet.pointer,
+			&packet.length,
+			alice.data(),
+			alice.size(),
+			bob.data(),
+			bob.size(),
+			prekeys.data(),
+			prekeys.size(),
+			char_to_uchar(message.data()),
+			message.size(),
+			nullptr,
+			nullptr);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to start send conversation.");
+	}
+
+	ConversationID bob_conversation;
+	AutoFreeBuffer new_prekeys;
+	AutoFreeBuffer received_message;
+	status = molch_start_receive_conversation(
+			bob_conversation.data(),
+			bob_conversation.size(),
+			&new_prekeys.pointer,
+			&new_prekeys.length,
+			&received_message.pointer,
+			&received_message.length,
+			bob.data(),
+			bob.size(),
+			alice.data(),
+			alice.size(),
+			packet.data(),
+			packet.size(),
+			nullptr,
+			nullptr);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to start receive conversation.");
+	}
+
+	AutoFreeBuffer backup;
+	status = molch_export(&backup.pointer, &backup.length);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to export backup.");
+	}
+
+	//keep the number of conversations the same in every round
+	status = molch_end_conversation(alice_conversation.data(), alice_conversation.size(), nullptr, nullptr);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to end Alice's conversation.");
+	}
+	status = molch_end_conversation(bob_conversation.data(), bob_conversation.size(), nullptr, nullptr);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to end Bob's conversation.");
+	}
+}
+
+struct Policy {
+	const char *name;
+	molch_memory_protection protection;
+	bool batch;
+	double fastest{std::numeric_limits<double>::max()};
+};
+
+static void time_rounds(BackupKeyArray& backup_key, Policy& policy) {
+	//new users every time, so every policy starts with the same state
+	PublicIdentity alice;
+	PublicIdentity bob;
+	create_user(alice, backup_key);
+	create_user(bob, backup_key);
+
+	molch_set_memory_protection(policy.protection);
+	const auto start{std::chrono::steady_clock::now()};
+	if (policy.batch) {
+		molch_begin_batch();
+	}
+	for (size_t round{0}; round < rounds; round++) {
+		prekey_round(alice, bob);
+	}
+	if (policy.batch) {
+		auto status{molch_end_batch()};
+		if (status.status != status_type::SUCCESS) {
+			throw Exception("Failed to end the batch.");
+		}
+	}
+	const auto duration{std::chrono::steady_clock::now() - start};
+	const auto microseconds{std::chrono::duration_cast<std::chrono::microseconds>(duration).count()};
+	policy.fastest = std::min(policy.fastest, static_cast<double>(microseconds) / rounds);
+
+	molch_set_memory_protection(molch_memory_protection::STRICT);
+	molch_destroy_all_users();
+}
+
+int main() {
+	try {
+		if (sodium_init() != 0) {
+			throw Exception("Failed to initialize libsodium.");
+		}
+
+		BackupKeyArray backup_key;
+		{
+			auto status{molch_update_backup_key(backup_key.data(), backup_key.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to update backup key.");
+			}
+		}
+
+		std::array<Policy,3> policies{{
+			{"strict", molch_memory_protection::STRICT, false},
+			{"batched", molch_memory_protection::BATCHED, true},
+			{"locked-only", molch_memory_protection::LOCKED_ONLY, false},
+		}};
+		for (size_t repetition{0}; repetition < repetitions; repetition++) {
+			for (auto& policy : policies) {
+				time_rounds(backup_key, policy);
+			}
+		}
+		for (const auto& policy : policies) {
+			std::cout << policy.name << ": " << policy.fastest << " us per round\n";
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
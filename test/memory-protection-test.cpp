@@ -0,0 +1,253 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Counts the mprotect syscalls that are done for the private keys with every
+ * memory protection policy by interposing the sodium_mprotect_* functions.
+ */
+
+#include <sodium.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "integration-utils.hpp"
+#include "inline-utils.hpp"
+#include "molch.h"
+
+constexpr size_t rounds{10};
+
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+
+static size_t mprotect_calls{0};
+
+using mprotect_function = int (*)(void *);
+
+static mprotect_function next_mprotect(const char *name) noexcept {
+	//function pointers can't be casted from void* portably
+	auto symbol{dlsym(RTLD_NEXT, name)};
+	mprotect_function function{nullptr};
+	std::memcpy(&function, &symbol, sizeof(function));
+	return function;
+}
+
+extern "C" {
+	__attribute__((visibility("default"))) int sodium_mprotect_noaccess(void *pointer) {
+		static const auto real_function{next_mprotect("sodium_mprotect_noaccess")};
+		mprotect_calls++;
+		return real_function(pointer);
+	}
+
+	__attribute__((visibility("default"))) int sodium_mprotect_readonly(void *pointer) {
+		static const auto real_function{next_mprotect("sodium_mprotect_readonly")};
+		mprotect_calls++;
+		return real_function(pointer);
+	}
+
+	__attribute__((visibility("default"))) int sodium_mprotect_readwrite(void *pointer) {
+		static const auto real_function{next_mprotect("sodium_mprotect_readwrite")};
+		mprotect_calls++;
+		return real_function(pointer);
+	}
+}
+
+static void create_user(PublicIdentity& identity, BackupKeyArray& backup_key) {
+	AutoFreeBuffer prekeys;
+	auto status{molch_create_user(
+			identity.data(),
+			identity.size(),
+			&prekeys.pointer,
+			&prekeys.length,
+			backup_key.data(),
+			backup_key.size(),
+			nullptr,
+			nullptr,
+			nullptr,
+			0)};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to create user.");
+	}
+}
+
+/*
+ * Start a conversation with a prekey message and export a backup.
+ */
+static void prekey_round(PublicIdentity& alice, PublicIdentity& bob) {
+	AutoFreeBuffer prekeys;
+	auto status{molch_get_prekey_list(&prekeys.pointer, &prekeys.length, bob.data(), bob.size())};
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to get prekey list.");
+	}
+
+	const std::string message{"Hello Bob!"};
+	ConversationID alice_conversation;
+	AutoFreeBuffer packet;
+	status = molch_start_send_conversation(
+			alice_conversation.data(),
+			alice_conversation.size(),
+			&packet.pointer,
+			&packet.length,
+			alice.data(),
+			alice.size(),
+			bob.data(),
+			bob.size(),
+			prekeys.data(),
+			prekeys.size(),
+			char_to_uchar(message.data()),
+			message.size(),
+			nullptr,
+			nullptr);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to start send conversation.");
+	}
+
+	ConversationID bob_conversation;
+	AutoFreeBuffer new_prekeys;
+	AutoFreeBuffer received_message;
+	status = molch_start_receive_conversation(
+			bob_conversation.data(),
+			bob_conversation.size(),
+			&new_prekeys.pointer,
+			&new_prekeys.length,
+			&received_message.pointer,
+			&received_message.length,
+			bob.data(),
+			bob.size(),
+			alice.data(),
+			alice.size(),
+			packet.data(),
+			packet.size(),
+			nullptr,
+			nullptr);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to start receive conversation.");
+	}
+
+	AutoFreeBuffer backup;
+	status = molch_export(&backup.pointer, &backup.length);
+	if (status.status != status_type::SUCCESS) {
+		throw Exception("Failed to export backup.");
+	}
+}
+
+template <typename Function>
+static size_t count_mprotect(const char *name, Function&& function) {
+	mprotect_calls = 0;
+	function();
+	const auto counted{mprotect_calls};
+	std::cout << name << ": " << counted << " mprotect calls for " << rounds << " rounds\n";
+
+	return counted;
+}
+
+int main() {
+	try {
+		if (sodium_init() != 0) {
+			throw Exception("Failed to initialize libsodium.");
+		}
+
+		BackupKeyArray backup_key;
+		{
+			auto status{molch_update_backup_key(backup_key.data(), backup_key.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to update backup key.");
+			}
+		}
+
+		PublicIdentity alice;
+		PublicIdentity bob;
+		create_user(alice, backup_key);
+		create_user(bob, backup_key);
+
+		//two users and the backup key
+		constexpr size_t protected_keys{3};
+
+		const auto strict_calls{count_mprotect("strict", [&]() {
+			molch_set_memory_protection(molch_memory_protection::STRICT);
+			for (size_t round{0}; round < rounds; round++) {
+				prekey_round(alice, bob);
+			}
+		})};
+		if (strict_calls < (2 * protected_keys * rounds)) {
+			throw Exception("Strict mode didn't protect the keys on every access.");
+		}
+
+		//unlock every key once, lock it again when the batch ends
+		const auto batched_calls{count_mprotect("batched", [&]() {
+			molch_set_memory_protection(molch_memory_protection::BATCHED);
+			molch_begin_batch();
+			for (size_t round{0}; round < rounds; round++) {
+				prekey_round(alice, bob);
+			}
+			auto status{molch_end_batch()};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to end the batch.");
+			}
+		})};
+		if (batched_calls > (2 * protected_keys)) {
+			throw Exception("Batched mode did more than one unlock per key.");
+		}
+
+		//outside of a batch, batched mode is as strict as strict mode
+		count_mprotect("batched (no batch)", [&]() {
+			for (size_t round{0}; round < rounds; round++) {
+				prekey_round(alice, bob);
+			}
+		});
+
+		//unlock every key once, never lock it again
+		const auto locked_only_calls{count_mprotect("locked-only", [&]() {
+			molch_set_memory_protection(molch_memory_protection::LOCKED_ONLY);
+			for (size_t round{0}; round < rounds; round++) {
+				prekey_round(alice, bob);
+			}
+		})};
+		if (locked_only_calls > protected_keys) {
+			throw Exception("Locked-only mode changed the protection more than once per key.");
+		}
+
+		//going back to strict locks all the keys again
+		const auto relock_calls{count_mprotect("back to strict", [&]() {
+			molch_set_memory_protection(molch_memory_protection::STRICT);
+		})};
+		if (relock_calls < protected_keys) {
+			throw Exception("Not all keys have been locked again.");
+		}
+		if (molch_get_memory_protection() != molch_memory_protection::STRICT) {
+			throw Exception("Memory protection policy wasn't set.");
+		}
+
+		molch_destroy_all_users();
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+#else
+int main() {
+	std::cout << "Interposing sodium_mprotect_* is only supported with glibc, skipping.\n";
+	return 77;
+}
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sodium.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "molch.h"
+#include "integration-utils.hpp"
+#include "inline-utils.hpp"
+
+struct CountingAllocator {
+	size_t allocations{0};
+	size_t outstanding{0};
+};
+
+static void *counting_allocate(void *allocator_data, size_t size) {
+	auto& allocator{*static_cast<CountingAllocator*>(allocator_data)};
+	auto pointer{malloc(size)}; //NOLINT
+	if (pointer != nullptr) {
+		allocator.allocations++;
+		allocator.outstanding++;
+	}
+
+	return pointer;
+}
+
+static void counting_free(void *allocator_data, void *pointer) {
+	auto& allocator{*static_cast<CountingAllocator*>(allocator_data)};
+	allocator.outstanding--;
+	free(pointer); //NOLINT
+}
+
+int main() noexcept {
+	try {
+		if (::sodium_init() != 0) {
+			throw ::Exception("Failed to initialize libsodium.");
+		}
+
+		//only one of the functions is invalid
+		{
+			auto status{molch_set_allocator(counting_allocate, nullptr, nullptr)};
+			if (status.status != status_type::INVALID_VALUE) {
+				throw ::Exception("Accepted allocator without free function.");
+			}
+		}
+
+		CountingAllocator allocator;
+		{
+			auto status{molch_set_allocator(counting_allocate, counting_free, &allocator)};
+			if (status.status != status_type::SUCCESS) {
+				throw ::Exception("Failed to set the allocator.");
+			}
+		}
+
+		{
+			BackupKeyArray backup_key;
+			AutoFreeBuffer backup;
+			AutoFreeBuffer prekey_list;
+			PublicIdentity user_id;
+			auto status{molch_create_user(
+					user_id.data(),
+					user_id.size(),
+					&prekey_list.pointer,
+					&prekey_list.length,
+					backup_key.data(),
+					backup_key.size(),
+					&backup.pointer,
+					&backup.length,
+					nullptr,
+					0)};
+			if (status.status != status_type::SUCCESS) {
+				throw ::Exception("Failed to create user.");
+			}
+
+			size_t printed_length{0};
+			auto printed{molch_print_status(&printed_length, status)};
+			if (printed == nullptr) {
+				throw ::Exception("Failed to print status.");
+			}
+
+			if (allocator.outstanding != 3) {
+				throw ::Exception("Not all outputs were allocated by the custom allocator.");
+			}
+
+			molch_free(printed);
+		}
+
+		if (allocator.outstanding != 0) {
+			throw ::Exception("molch_free didn't use the custom allocator.");
+		}
+
+		std::cout << "Allocated " << allocator.allocations << " buffers with the custom allocator.\n";
+		const auto allocations{allocator.allocations};
+
+		molch_destroy_all_users();
+
+		//go back to malloc and free
+		{
+			auto status{molch_set_allocator(nullptr, nullptr, nullptr)};
+			if (status.status != status_type::SUCCESS) {
+				throw ::Exception("Failed to reset the allocator.");
+			}
+		}
+		AutoFreeBuffer conversation_list;
+		{
+			size_t count{0};
+			auto status{molch_list_users(&conversation_list.pointer, &conversation_list.length, &count)};
+			if (status.status != status_type::SUCCESS) {
+				throw ::Exception("Failed to list users.");
+			}
+		}
+		if (allocator.allocations != allocations) {
+			throw ::Exception("The custom allocator was still used after resetting it.");
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
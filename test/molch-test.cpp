@@ -58,7 +58,8 @@ struct AutoFreeEncryptedBackup {
 
 static std::vector<unsigned char> decrypt_conversation_backup(
 		const AutoFreeBuffer& backup,
-		const BackupKeyArray& backup_key) {
+		const BackupKeyArray& backup_key,
+		const Molch__Protobuf__EncryptedBackup__BackupType backup_type) {
 	if (backup.empty()) {
 		throw Exception("The backup was empty.");
 	}
@@ -73,8 +74,8 @@ static std::vector<unsigned char> decrypt_conversation_backup(
 	if (encrypted_backup.protobuf->backup_version != 0) {
 		throw Exception("Incompatible backup.");
 	}
-	if (!encrypted_backup.protobuf->has_backup_type || (encrypted_backup.protobuf->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)) {
-		throw Exception("Backup is not a conversation backup.");
+	if (!encrypted_backup.protobuf->has_backup_type || (encrypted_backup.protobuf->backup_type != backup_type)) {
+		throw Exception("Backup has the wrong type.");
 	}
 	if (!encrypted_backup.protobuf->has_encrypted_backup || (encrypted_backup.protobuf->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
 		throw Exception("The backup is missing the encrypted conversation state.");
@@ -99,6 +100,33 @@ static std::vector<unsigned char> decrypt_conversation_backup(
 	return decrypted_backup;
 }
 
+static std::vector<unsigned char> decrypt(
+		const ProtobufCBinaryData& ciphertext,
+		const ProtobufCBinaryData& nonce,
+		const BackupKeyArray& backup_key) {
+	if ((ciphertext.len < crypto_secretbox_MACBYTES) || (nonce.len != crypto_secretbox_NONCEBYTES)) {
+		throw Exception("Invalid ciphertext or nonce.");
+	}
+
+	std::vector<unsigned char> plaintext(ciphertext.len - crypto_secretbox_MACBYTES, 0);
+	auto status{crypto_secretbox_open_easy(
+			plaintext.data(),
+			ciphertext.data,
+			ciphertext.len,
+			nonce.data,
+			backup_key.data())};
+	if (status != 0) {
+		throw Exception("Failed to decrypt backup.");
+	}
+
+	return plaintext;
+}
+
+/*
+ * Decrypt all segments of a segmented backup and concatenate them. The
+ * manifest is only checked for being decryptable because it contains
+ * hashes of the encrypted segments, which change with every new key.
+ */
 static std::vector<unsigned char> decrypt_full_backup(const AutoFreeBuffer& backup, const BackupKeyArray& backup_key) {
 	//check input
 	if (backup.empty()) {
@@ -115,32 +143,50 @@ static std::vector<unsigned char> decrypt_full_backup(const AutoFreeBuffer& back
 	if (encrypted_backup.protobuf->backup_version != 0) {
 		throw Exception("Incompatible backup.");
 	}
-	if (!encrypted_backup.protobuf->has_backup_type || (encrypted_backup.protobuf->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__FULL_BACKUP)) {
-		throw Exception("Backup is not a conversation backup.");
+	if (!encrypted_backup.protobuf->has_backup_type || (encrypted_backup.protobuf->backup_type != MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__SEGMENTED_BACKUP)) {
+		throw Exception("Backup is not a segmented backup.");
 	}
-	if (!encrypted_backup.protobuf->has_encrypted_backup || (encrypted_backup.protobuf->encrypted_backup.len < crypto_secretbox_MACBYTES)) {
-		throw Exception("The backup is missing the encrypted conversation state.");
-	}
-	if (!encrypted_backup.protobuf->has_encrypted_backup_nonce || (encrypted_backup.protobuf->encrypted_backup_nonce.len != 24)) {
-		throw Exception("The backup is missing the nonce.");
+	if (!encrypted_backup.protobuf->has_encrypted_backup || !encrypted_backup.protobuf->has_encrypted_backup_nonce) {
+		throw Exception("The backup is missing the manifest.");
 	}
 
-	std::vector<unsigned char> decrypted_backup(encrypted_backup.protobuf->encrypted_backup.len - crypto_secretbox_MACBYTES, 0);
+	decrypt(encrypted_backup.protobuf->encrypted_backup, encrypted_backup.protobuf->encrypted_backup_nonce, backup_key);
 
-	//decrypt the backup
-	auto status{crypto_secretbox_open_easy(
-			decrypted_backup.data(),
-			encrypted_backup.protobuf->encrypted_backup.data,
-			encrypted_backup.protobuf->encrypted_backup.len,
-			encrypted_backup.protobuf->encrypted_backup_nonce.data,
-			backup_key.data())};
-	if (status != 0) {
-		throw Exception("Failed to decrypt conversation backup.");
+	std::vector<unsigned char> decrypted_backup;
+	for (size_t index{0}; index < encrypted_backup.protobuf->n_segments; index++) {
+		const auto& segment{*encrypted_backup.protobuf->segments[index]};
+		const auto decrypted_segment{decrypt(segment.encrypted_segment, segment.nonce, backup_key)};
+		decrypted_backup.insert(std::end(decrypted_backup), std::cbegin(decrypted_segment), std::cend(decrypted_segment));
 	}
 
 	return decrypted_backup;
 }
 
+/*
+ * Check how many encrypted segments two segmented backups have in common.
+ */
+static size_t count_reused_segments(const AutoFreeBuffer& first_backup, const AutoFreeBuffer& second_backup) {
+	auto first{AutoFreeEncryptedBackup(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, first_backup.size(), first_backup.data()))};
+	auto second{AutoFreeEncryptedBackup(molch__protobuf__encrypted_backup__unpack(&protobuf_c_allocator, second_backup.size(), second_backup.data()))};
+	if ((first.protobuf == nullptr) || (second.protobuf == nullptr)) {
+		throw Exception("Failed to unpack encrypted backup from protobuf.");
+	}
+
+	size_t reused{0};
+	for (size_t first_index{0}; first_index < first.protobuf->n_segments; first_index++) {
+		const auto& first_segment{first.protobuf->segments[first_index]->encrypted_segment};
+		for (size_t second_index{0}; second_index < second.protobuf->n_segments; second_index++) {
+			const auto& second_segment{second.protobuf->segments[second_index]->encrypted_segment};
+			if ((first_segment.len == second_segment.len)
+					&& (std::memcmp(first_segment.data, second_segment.data, first_segment.len) == 0)) {
+				reused++;
+			}
+		}
+	}
+
+	return reused;
+}
+
 int main() {
 	try {
 	    if (sodium_init() != 0) {
@@ -318,6 +364,19 @@ int main() {
 			if (status.status != status_type::SUCCESS) {
 				throw Exception("Failed to get prekey list.");
 			}
+
+			//nothing changed, so the same signed list is returned
+			AutoFreeBuffer same_prekey_list;
+			status = molch_get_prekey_list(
+					&same_prekey_list.pointer,
+					&same_prekey_list.length,
+					alice_public_identity.data(),
+					alice_public_identity.size());
+			if ((status.status != status_type::SUCCESS)
+					|| (same_prekey_list.size() != prekey_list.size())
+					|| (memcmp(same_prekey_list.data(), prekey_list.data(), prekey_list.size()) != 0)) {
+				throw Exception("Prekey list changed without changing the prekeys.");
+			}
 		}
 
 		//create a new receive conversation (bob receives from alice)
@@ -353,6 +412,49 @@ int main() {
 			throw Exception("Incorrect message received.");
 		}
 
+		//receiving the same prekey message again returns the existing conversation
+		{
+			ConversationID redelivered_conversation;
+			AutoFreeBuffer redelivered_message;
+			AutoFreeBuffer redelivered_prekeys;
+			auto status{molch_start_receive_conversation(
+					redelivered_conversation.data(),
+					redelivered_conversation.size(),
+					&redelivered_prekeys.pointer,
+					&redelivered_prekeys.length,
+					&redelivered_message.pointer,
+					&redelivered_message.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					alice_public_identity.data(),
+					alice_public_identity.size(),
+					alice_send_packet.data(),
+					alice_send_packet.size(),
+					nullptr,
+					nullptr)};
+			if ((status.status != status_type::SUCCESS)
+					|| (redelivered_conversation != bob_conversation)
+					|| (redelivered_message.size() != bob_receive_message.size())
+					|| (memcmp(redelivered_message.data(), bob_receive_message.data(), bob_receive_message.size()) != 0)) {
+				throw Exception("Receiving a prekey message again didn't return the existing conversation.");
+			}
+			if ((redelivered_prekeys.pointer != nullptr) || (redelivered_prekeys.length != 0)) {
+				throw Exception("Receiving a prekey message again created a new prekey list.");
+			}
+
+			size_t number_of_bobs_conversations{0};
+			AutoFreeBuffer bobs_conversations;
+			status = molch_list_conversations(
+					&bobs_conversations.pointer,
+					&bobs_conversations.length,
+					&number_of_bobs_conversations,
+					bob_public_identity.data(),
+					bob_public_identity.size());
+			if ((status.status != status_type::SUCCESS) || (number_of_bobs_conversations != 1)) {
+				throw Exception("Receiving a prekey message again created a new conversation.");
+			}
+		}
+
 		//bob replies
 		std::string bob_send_message{"Welcome Alice!"};
 		AutoFreeBuffer conversation_export;
@@ -413,8 +515,8 @@ int main() {
 					bob_send_packet.size(),
 					nullptr,
 					nullptr);
-			if (status.status == status_type::SUCCESS) {
-				throw Exception("Failed to reject repeated message.");
+			if (status.status != status_type::DUPLICATE_MESSAGE) {
+				throw Exception("Failed to recognize repeated message.");
 			}
 		}
 
@@ -481,6 +583,156 @@ int main() {
 			throw Exception("Imported backup is incorrect.");
 		}
 
+		//nothing changed, so all of the segments are reused
+		{
+			AutoFreeBuffer unchanged_backup;
+			auto status{molch_export(&unchanged_backup.pointer, &unchanged_backup.length)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export unchanged backup.");
+			}
+
+			//2 users and 2 conversations
+			if (count_reused_segments(imported_backup, unchanged_backup) != 4) {
+				throw Exception("Unchanged segments haven't been reused.");
+			}
+			if (decrypt_full_backup(unchanged_backup, backup_key) != decrypted_imported_backup) {
+				throw Exception("Unchanged backup is incorrect.");
+			}
+		}
+
+		//streaming export and import
+		{
+			std::vector<unsigned char> stream;
+			auto status{molch_export_stream(
+					[](void *stream_data, const unsigned char *data, size_t length) {
+						auto& output{*static_cast<std::vector<unsigned char>*>(stream_data)};
+						output.insert(std::end(output), data, data + length);
+						return 0;
+					},
+					&stream)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export backup stream.");
+			}
+
+			struct StreamReader {
+				const std::vector<unsigned char>& stream;
+				size_t length;
+				size_t position{0};
+			};
+			const auto read{[](void *stream_data, unsigned char *data, size_t length) {
+				auto& reader{*static_cast<StreamReader*>(stream_data)};
+				if ((reader.length - reader.position) < length) {
+					return -1;
+				}
+				std::copy(std::cbegin(reader.stream) + static_cast<ptrdiff_t>(reader.position), std::cbegin(reader.stream) + static_cast<ptrdiff_t>(reader.position + length), data);
+				reader.position += length;
+				return 0;
+			}};
+
+			//a truncated stream is rejected
+			StreamReader truncated_reader{stream, stream.size() - 1};
+			status = molch_import_stream(
+					new_backup_key.data(),
+					new_backup_key.size(),
+					read,
+					&truncated_reader,
+					backup_key.data(),
+					backup_key.size());
+			if (status.status == status_type::SUCCESS) {
+				throw Exception("Imported a truncated backup stream.");
+			}
+
+			StreamReader reader{stream, stream.size()};
+			status = molch_import_stream(
+					new_backup_key.data(),
+					new_backup_key.size(),
+					read,
+					&reader,
+					backup_key.data(),
+					backup_key.size());
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to import backup stream.");
+			}
+			backup_key = new_backup_key;
+
+			AutoFreeBuffer stream_imported_backup;
+			status = molch_export(&stream_imported_backup.pointer, &stream_imported_backup.length);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export state imported from a stream.");
+			}
+			if (decrypt_full_backup(stream_imported_backup, backup_key) != decrypted_imported_backup) {
+				throw Exception("State imported from a stream is incorrect.");
+			}
+		}
+
+		//lazy import, the conversations are only imported when they are used
+		{
+			AutoFreeBuffer lazy_backup;
+			auto status{molch_export(&lazy_backup.pointer, &lazy_backup.length)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export backup for lazy import.");
+			}
+
+			status = molch_import_lazy(
+					new_backup_key.data(),
+					new_backup_key.size(),
+					lazy_backup.data(),
+					lazy_backup.size(),
+					backup_key.data(),
+					backup_key.size());
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to import backup lazily.");
+			}
+			backup_key = new_backup_key;
+
+			//dormant conversations are exported without importing them
+			AutoFreeBuffer lazy_imported_backup;
+			status = molch_export(&lazy_imported_backup.pointer, &lazy_imported_backup.length);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export lazily imported state.");
+			}
+			if (decrypt_full_backup(lazy_imported_backup, backup_key) != decrypted_imported_backup) {
+				throw Exception("Lazily imported state is incorrect.");
+			}
+		}
+
+		//state store, the state survives losing everything in memory
+		{
+			const std::string store_path{"molch-test.store"};
+			std::remove(store_path.c_str());
+			BackupKeyArray store_key;
+			randombytes_buf(store_key.data(), store_key.size());
+
+			auto status{molch_open_store(store_path.c_str(), store_key.data(), store_key.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to open the state store.");
+			}
+			//closes the store without removing the users from it
+			molch_destroy_all_users();
+
+			status = molch_open_store(store_path.c_str(), store_key.data(), store_key.size());
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to open the state store again.");
+			}
+			if (molch_user_count() != 2) {
+				throw Exception("Failed to restore the users from the state store.");
+			}
+
+			AutoFreeBuffer stored_backup;
+			status = molch_export(&stored_backup.pointer, &stored_backup.length);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export the state restored from the state store.");
+			}
+			if (decrypt_full_backup(stored_backup, backup_key) != decrypted_imported_backup) {
+				throw Exception("State restored from the state store is incorrect.");
+			}
+			status = molch_close_store();
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to close the state store.");
+			}
+			std::remove(store_path.c_str());
+		}
+
 		//test conversation export
 		AutoFreeBuffer second_backup;
 		{
@@ -510,7 +762,7 @@ int main() {
 			}
 		}
 
-		auto decrypted_conversation_backup{decrypt_conversation_backup(second_backup, backup_key)};
+		auto decrypted_conversation_backup{decrypt_conversation_backup(second_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)};
 
 		//copy the backup key
 		backup_key = new_backup_key;
@@ -529,13 +781,472 @@ int main() {
 			}
 		}
 
-		auto decrypted_imported_conversation_backup{decrypt_conversation_backup(second_imported_backup, backup_key)};
+		auto decrypted_imported_conversation_backup{decrypt_conversation_backup(second_imported_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)};
 
 		//compare
 		if (decrypted_conversation_backup != decrypted_imported_conversation_backup) {
 			throw Exception("Protobuf of imported conversation is incorrect.");
 		}
 
+		const auto encrypt_with_backup{[&](AutoFreeBuffer& conversation_backup) {
+			AutoFreeBuffer packet;
+			const std::string message{"Delta"};
+			auto status{molch_encrypt_message(
+					&packet.pointer,
+					&packet.length,
+					alice_conversation.data(),
+					alice_conversation.size(),
+					char_to_uchar(message.data()),
+					message.size(),
+					&conversation_backup.pointer,
+					&conversation_backup.length)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to encrypt message with a conversation backup.");
+			}
+		}};
+
+		//messages create full conversation backups by default
+		AutoFreeBuffer full_backup;
+		encrypt_with_backup(full_backup);
+		decrypt_conversation_backup(full_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP);
+
+		//with delta backups, the first backup is the full base of the following deltas
+		molch_set_conversation_backups(molch_conversation_backups::DELTA_BACKUPS);
+		AutoFreeBuffer delta_base;
+		encrypt_with_backup(delta_base);
+		const auto decrypted_delta_base{decrypt_conversation_backup(delta_base, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)};
+		AutoFreeBuffer first_delta;
+		encrypt_with_backup(first_delta);
+
+		//exporting the conversation doesn't interrupt the chain of deltas
+		{
+			AutoFreeBuffer exported_backup;
+			auto status{molch_conversation_export(
+					&exported_backup.pointer,
+					&exported_backup.length,
+					alice_conversation.data(),
+					alice_conversation.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export Alice's conversation.");
+			}
+		}
+		AutoFreeBuffer second_delta;
+		encrypt_with_backup(second_delta);
+
+		const auto decrypted_delta{decrypt_conversation_backup(first_delta, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_DELTA_BACKUP)};
+		std::cout << "Conversation backup: " << decrypted_delta_base.size() << " bytes, delta: " << decrypted_delta.size() << " bytes\n";
+		if (decrypted_delta.size() >= decrypted_delta_base.size()) {
+			throw Exception("Delta isn't smaller than the full conversation backup.");
+		}
+
+		AutoFreeBuffer reference_backup;
+		{
+			auto status{molch_conversation_export(
+					&reference_backup.pointer,
+					&reference_backup.length,
+					alice_conversation.data(),
+					alice_conversation.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export Alice's conversation.");
+			}
+		}
+		const auto decrypted_reference_backup{decrypt_conversation_backup(reference_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)};
+
+		//restore the full conversation backup and apply the deltas on top of it
+		const auto delta_backup_key{backup_key};
+		const auto import_conversation_backup{[&](const AutoFreeBuffer& conversation_backup) {
+			return molch_conversation_import(
+					new_backup_key.data(),
+					new_backup_key.size(),
+					conversation_backup.data(),
+					conversation_backup.size(),
+					delta_backup_key.data(),
+					delta_backup_key.size());
+		}};
+		if (import_conversation_backup(delta_base).status != status_type::SUCCESS) {
+			throw Exception("Failed to import the full conversation backup.");
+		}
+		if (import_conversation_backup(second_delta).status == status_type::SUCCESS) {
+			throw Exception("Imported a delta out of order.");
+		}
+		if (import_conversation_backup(first_delta).status != status_type::SUCCESS) {
+			throw Exception("Failed to import the first delta.");
+		}
+		if (import_conversation_backup(second_delta).status != status_type::SUCCESS) {
+			throw Exception("Failed to import the second delta.");
+		}
+		backup_key = new_backup_key;
+
+		AutoFreeBuffer restored_backup;
+		{
+			auto status{molch_conversation_export(
+					&restored_backup.pointer,
+					&restored_backup.length,
+					alice_conversation.data(),
+					alice_conversation.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export Alice's conversation.");
+			}
+		}
+		if (decrypt_conversation_backup(restored_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP) != decrypted_reference_backup) {
+			throw Exception("Conversation restored from deltas is incorrect.");
+		}
+
+		//export both conversations at once and restore them together with the following deltas
+		std::vector<unsigned char> conversation_ids(std::cbegin(alice_conversation), std::cend(alice_conversation));
+		conversation_ids.insert(std::cend(conversation_ids), std::cbegin(bob_conversation), std::cend(bob_conversation));
+		AutoFreeBuffer conversations_backup;
+		{
+			auto status{molch_conversations_export(
+					&conversations_backup.pointer,
+					&conversations_backup.length,
+					conversation_ids.data(),
+					conversation_ids.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export both conversations.");
+			}
+		}
+		decrypt_conversation_backup(conversations_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATIONS_BACKUP);
+		//the backup key changed with the import, so the chain of deltas starts again
+		AutoFreeBuffer conversations_delta_base;
+		encrypt_with_backup(conversations_delta_base);
+		decrypt_conversation_backup(conversations_delta_base, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP);
+		AutoFreeBuffer conversations_delta;
+		encrypt_with_backup(conversations_delta);
+		molch_set_conversation_backups(molch_conversation_backups::FULL_BACKUPS);
+
+		AutoFreeBuffer conversations_reference_backup;
+		{
+			auto status{molch_conversation_export(
+					&conversations_reference_backup.pointer,
+					&conversations_reference_backup.length,
+					alice_conversation.data(),
+					alice_conversation.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export Alice's conversation.");
+			}
+		}
+		const auto decrypted_conversations_reference_backup{decrypt_conversation_backup(conversations_reference_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP)};
+
+		{
+			const std::array<const unsigned char*,3> backups{{conversations_backup.data(), conversations_delta_base.data(), conversations_delta.data()}};
+			const std::array<size_t,3> backup_lengths{{conversations_backup.size(), conversations_delta_base.size(), conversations_delta.size()}};
+			auto status{molch_conversations_import(
+					new_backup_key.data(),
+					new_backup_key.size(),
+					backups.data(),
+					backup_lengths.data(),
+					backups.size(),
+					backup_key.data(),
+					backup_key.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to import both conversations and the deltas.");
+			}
+		}
+		backup_key = new_backup_key;
+
+		AutoFreeBuffer conversations_restored_backup;
+		{
+			auto status{molch_conversation_export(
+					&conversations_restored_backup.pointer,
+					&conversations_restored_backup.length,
+					alice_conversation.data(),
+					alice_conversation.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export Alice's conversation.");
+			}
+		}
+		if (decrypt_conversation_backup(conversations_restored_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__CONVERSATION_BACKUP) != decrypted_conversations_reference_backup) {
+			throw Exception("Conversations restored from a bulk backup are incorrect.");
+		}
+
+		//move Alice out and back in with a user backup
+		const auto export_alice{[&](AutoFreeBuffer& user_backup) {
+			auto status{molch_export_user(
+					&user_backup.pointer,
+					&user_backup.length,
+					alice_public_identity.data(),
+					alice_public_identity.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to export Alice.");
+			}
+		}};
+		AutoFreeBuffer user_backup;
+		export_alice(user_backup);
+		const auto decrypted_user_backup{decrypt_conversation_backup(user_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__USER_BACKUP)};
+		{
+			auto status{molch_import_user(
+					new_backup_key.data(),
+					new_backup_key.size(),
+					user_backup.data(),
+					user_backup.size(),
+					backup_key.data(),
+					backup_key.size())};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to import Alice.");
+			}
+		}
+		backup_key = new_backup_key;
+		if (molch_user_count() != 2) {
+			throw Exception("Importing a user changed the number of users.");
+		}
+		AutoFreeBuffer imported_user_backup;
+		export_alice(imported_user_backup);
+		if (decrypt_conversation_backup(imported_user_backup, backup_key, MOLCH__PROTOBUF__ENCRYPTED_BACKUP__BACKUP_TYPE__USER_BACKUP) != decrypted_user_backup) {
+			throw Exception("Alice changed when moving her with a user backup.");
+		}
+
+		//bob uses a bigger prekey pool and receives many conversations at once
+		{
+			AutoFreeBuffer bob_big_prekey_list;
+			auto status{molch_set_prekey_amount(
+					&bob_big_prekey_list.pointer,
+					&bob_big_prekey_list.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					300)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to change the number of Bob's prekeys.");
+			}
+
+			constexpr size_t batch_size{3};
+			std::array<ConversationID,batch_size> alice_batch_conversations;
+			std::array<AutoFreeBuffer,batch_size> alice_batch_packets;
+			for (size_t index{0}; index < batch_size; index++) {
+				status = molch_start_send_conversation(
+						alice_batch_conversations[index].data(),
+						alice_batch_conversations[index].size(),
+						&alice_batch_packets[index].pointer,
+						&alice_batch_packets[index].length,
+						alice_public_identity.data(),
+						alice_public_identity.size(),
+						bob_public_identity.data(),
+						bob_public_identity.size(),
+						bob_big_prekey_list.data(),
+						bob_big_prekey_list.size(),
+						char_to_uchar(alice_send_message.data()),
+						alice_send_message.size(),
+						nullptr,
+						nullptr);
+				if (status.status != status_type::SUCCESS) {
+					throw Exception("Failed to start Alice's batch of send conversations.");
+				}
+			}
+
+			//a verified prekey list is remembered, but changing it still breaks the signature
+			std::vector<unsigned char> forged_prekey_list(bob_big_prekey_list.data(), bob_big_prekey_list.data() + bob_big_prekey_list.size());
+			forged_prekey_list.back() ^= 1;
+			{
+				ConversationID forged_conversation;
+				AutoFreeBuffer forged_packet;
+				status = molch_start_send_conversation(
+						forged_conversation.data(),
+						forged_conversation.size(),
+						&forged_packet.pointer,
+						&forged_packet.length,
+						alice_public_identity.data(),
+						alice_public_identity.size(),
+						bob_public_identity.data(),
+						bob_public_identity.size(),
+						forged_prekey_list.data(),
+						forged_prekey_list.size(),
+						char_to_uchar(alice_send_message.data()),
+						alice_send_message.size(),
+						nullptr,
+						nullptr);
+				if (status.status != status_type::VERIFICATION_FAILED) {
+					throw Exception("Accepted a forged prekey list.");
+				}
+			}
+
+			//the last packet is broken
+			const std::array<unsigned char,10> broken_packet{};
+			const std::array<const unsigned char*,batch_size + 1> packets{
+				alice_batch_packets[0].data(),
+				alice_batch_packets[1].data(),
+				alice_batch_packets[2].data(),
+				broken_packet.data()};
+			const std::array<size_t,batch_size + 1> packet_lengths{
+				alice_batch_packets[0].size(),
+				alice_batch_packets[1].size(),
+				alice_batch_packets[2].size(),
+				broken_packet.size()};
+			std::vector<unsigned char> bob_batch_conversations(packets.size() * sizeof(ConversationID));
+			std::array<unsigned char*,batch_size + 1> messages{};
+			std::array<size_t,batch_size + 1> message_lengths{};
+			std::array<status_type,batch_size + 1> packet_statuses{};
+			AutoFreeBuffer bob_batch_prekey_list;
+			status = molch_start_receive_conversations(
+					bob_batch_conversations.data(),
+					bob_batch_conversations.size(),
+					messages.data(),
+					message_lengths.data(),
+					packet_statuses.data(),
+					&bob_batch_prekey_list.pointer,
+					&bob_batch_prekey_list.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					packets.data(),
+					packet_lengths.data(),
+					packets.size(),
+					nullptr,
+					nullptr);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to receive Alice's batch of conversations.");
+			}
+			std::array<AutoFreeBuffer,batch_size + 1> received_messages;
+			for (size_t index{0}; index < messages.size(); index++) {
+				received_messages[index].pointer = messages[index];
+				received_messages[index].length = message_lengths[index];
+			}
+
+			if ((packet_statuses[batch_size] == status_type::SUCCESS) || (received_messages[batch_size].pointer != nullptr)) {
+				throw Exception("Received a conversation from a broken packet.");
+			}
+			if (bob_batch_prekey_list.size() != bob_big_prekey_list.size()) {
+				throw Exception("The prekey list after the batch has the wrong size.");
+			}
+			for (size_t index{0}; index < batch_size; index++) {
+				if ((packet_statuses[index] != status_type::SUCCESS)
+						|| (received_messages[index].size() != alice_send_message.size())
+						|| (memcmp(received_messages[index].data(), alice_send_message.data(), alice_send_message.size()) != 0)) {
+					throw Exception("Incorrect message received in the batch.");
+				}
+
+				status = molch_end_conversation(alice_batch_conversations[index].data(), alice_batch_conversations[index].size(), nullptr, nullptr);
+				if (status.status != status_type::SUCCESS) {
+					throw Exception("Failed to end Alice's batch conversation.");
+				}
+				status = molch_end_conversation(&bob_batch_conversations[index * sizeof(ConversationID)], sizeof(ConversationID), nullptr, nullptr);
+				if (status.status != status_type::SUCCESS) {
+					throw Exception("Failed to end Bob's batch conversation.");
+				}
+			}
+
+			//only the replaced prekeys have to be published
+			AutoFreeBuffer prekey_list_delta;
+			AutoFreeBuffer bob_new_prekey_list;
+			status = molch_get_prekey_list_delta(
+					&prekey_list_delta.pointer,
+					&prekey_list_delta.length,
+					&bob_new_prekey_list.pointer,
+					&bob_new_prekey_list.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					bob_big_prekey_list.data(),
+					bob_big_prekey_list.size());
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to get a prekey list delta.");
+			}
+			if (prekey_list_delta.size() >= (bob_new_prekey_list.size() / 10)) {
+				throw Exception("The prekey list delta isn't smaller than the prekey list.");
+			}
+			AutoFreeBuffer applied_prekey_list;
+			status = molch_apply_prekey_list_delta(
+					&applied_prekey_list.pointer,
+					&applied_prekey_list.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					bob_big_prekey_list.data(),
+					bob_big_prekey_list.size(),
+					prekey_list_delta.data(),
+					prekey_list_delta.size());
+			if ((status.status != status_type::SUCCESS)
+					|| (applied_prekey_list.size() != bob_new_prekey_list.size())
+					|| (memcmp(applied_prekey_list.data(), bob_new_prekey_list.data(), bob_new_prekey_list.size()) != 0)) {
+				throw Exception("Failed to apply the prekey list delta.");
+			}
+
+			//a delta doesn't apply to a different base list
+			AutoFreeBuffer wrongly_applied_prekey_list;
+			status = molch_apply_prekey_list_delta(
+					&wrongly_applied_prekey_list.pointer,
+					&wrongly_applied_prekey_list.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					bob_new_prekey_list.data(),
+					bob_new_prekey_list.size(),
+					prekey_list_delta.data(),
+					prekey_list_delta.size());
+			if (status.status == status_type::SUCCESS) {
+				throw Exception("Applied a prekey list delta to the wrong base list.");
+			}
+
+			//prepare a conversation before the first message is known
+			ConversationID prepared_conversation;
+			status = molch_prepare_send_conversation(
+					prepared_conversation.data(),
+					prepared_conversation.size(),
+					alice_public_identity.data(),
+					alice_public_identity.size(),
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					applied_prekey_list.data(),
+					applied_prekey_list.size());
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to prepare a conversation.");
+			}
+			AutoFreeBuffer prepared_packet;
+			status = molch_send_prepared_conversation(
+					&prepared_packet.pointer,
+					&prepared_packet.length,
+					prepared_conversation.data(),
+					prepared_conversation.size(),
+					char_to_uchar(alice_send_message.data()),
+					alice_send_message.size(),
+					nullptr,
+					nullptr);
+			if ((status.status != status_type::SUCCESS)
+					|| (molch_get_message_type(prepared_packet.data(), prepared_packet.size()) != molch_message_type::PREKEY_MESSAGE)) {
+				throw Exception("Failed to send the first message of a prepared conversation.");
+			}
+			AutoFreeBuffer second_prepared_packet;
+			status = molch_send_prepared_conversation(
+					&second_prepared_packet.pointer,
+					&second_prepared_packet.length,
+					prepared_conversation.data(),
+					prepared_conversation.size(),
+					char_to_uchar(alice_send_message.data()),
+					alice_send_message.size(),
+					nullptr,
+					nullptr);
+			if (status.status != status_type::NOT_FOUND) {
+				throw Exception("Sent the first message of a prepared conversation twice.");
+			}
+
+			ConversationID bob_prepared_conversation;
+			AutoFreeBuffer bob_prepared_prekey_list;
+			AutoFreeBuffer bob_prepared_message;
+			status = molch_start_receive_conversation(
+					bob_prepared_conversation.data(),
+					bob_prepared_conversation.size(),
+					&bob_prepared_prekey_list.pointer,
+					&bob_prepared_prekey_list.length,
+					&bob_prepared_message.pointer,
+					&bob_prepared_message.length,
+					bob_public_identity.data(),
+					bob_public_identity.size(),
+					alice_public_identity.data(),
+					alice_public_identity.size(),
+					prepared_packet.data(),
+					prepared_packet.size(),
+					nullptr,
+					nullptr);
+			if ((status.status != status_type::SUCCESS)
+					|| (bob_prepared_message.size() != alice_send_message.size())
+					|| (memcmp(bob_prepared_message.data(), alice_send_message.data(), alice_send_message.size()) != 0)) {
+				throw Exception("Failed to receive the first message of a prepared conversation.");
+			}
+			status = molch_end_conversation(prepared_conversation.data(), prepared_conversation.size(), nullptr, nullptr);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to end the prepared conversation.");
+			}
+			status = molch_end_conversation(bob_prepared_conversation.data(), bob_prepared_conversation.size(), nullptr, nullptr);
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to end Bob's side of the prepared conversation.");
+			}
+		}
+
 		//destroy the conversations
 		{
 			auto status{molch_end_conversation(alice_conversation.data(), alice_conversation.size(), nullptr, nullptr)};
@@ -569,6 +1280,159 @@ int main() {
 		}
 		std::cout << "Alice' conversation has ended successfully.\n";
 
+		//create many users at once
+		{
+			constexpr size_t user_count{8};
+			const auto previous_user_count{molch_user_count()};
+			AutoFreeBuffer created_users;
+			AutoFreeBuffer created_users_backup;
+			size_t prekey_list_length{0};
+			auto status{molch_create_users(
+					&created_users.pointer,
+					&created_users.length,
+					&prekey_list_length,
+					backup_key.data(),
+					backup_key.size(),
+					user_count,
+					&created_users_backup.pointer,
+					&created_users_backup.length,
+					nullptr,
+					0)};
+			if (status.status != status_type::SUCCESS) {
+				throw Exception("Failed to create many users.");
+			}
+			const auto entry_length{sizeof(PublicIdentity) + prekey_list_length};
+			if ((molch_user_count() != (previous_user_count + user_count))
+					|| (created_users.size() != (user_count * entry_length))
+					|| (created_users_backup.pointer == nullptr)) {
+				throw Exception("Created the wrong number of users.");
+			}
+
+			//every created user can receive conversations
+			for (size_t index{0}; index < user_count; index++) {
+				const auto entry{created_users.data() + (index * entry_length)};
+				ConversationID conversation;
+				AutoFreeBuffer packet;
+				status = molch_start_send_conversation(
+						conversation.data(),
+						conversation.size(),
+						&packet.pointer,
+						&packet.length,
+						alice_public_identity.data(),
+						alice_public_identity.size(),
+						entry,
+						sizeof(PublicIdentity),
+						entry + sizeof(PublicIdentity),
+						prekey_list_length,
+						char_to_uchar(alice_send_message.data()),
+						alice_send_message.size(),
+						nullptr,
+						nullptr);
+				if (status.status != status_type::SUCCESS) {
+					throw Exception("Failed to use the prekey list of a created user.");
+				}
+				status = molch_end_conversation(conversation.data(), conversation.size(), nullptr, nullptr);
+				if (status.status != status_type::SUCCESS) {
+					throw Exception("Failed to end the conversation with a created user.");
+				}
+			}
+
+			//start conversations with all of them at once
+			std::vector<unsigned char> receivers;
+			std::vector<const unsigned char*> prekey_lists;
+			std::vector<size_t> prekey_list_lengths(user_count, prekey_list_length);
+			std::vector<const unsigned char*> messages(user_count, char_to_uchar(alice_send_message.data()));
+			std::vector<size_t> message_lengths(user_count, alice_send_message.size());
+			for (size_t index{0}; index < user_count; index++) {
+				const auto entry{created_users.data() + (index * entry_length)};
+				receivers.insert(std::end(receivers), entry, entry + sizeof(PublicIdentity));
+				prekey_lists.push_back(entry + sizeof(PublicIdentity));
+			}
+			//the last prekey list is forged
+			std::vector<unsigned char> forged_prekey_list(prekey_lists.back(), prekey_lists.back() + prekey_list_length);
+			forged_prekey_list.back() ^= 1;
+			prekey_lists.back() = forged_prekey_list.data();
+
+			std::vector<unsigned char> conversations(user_count * sizeof(ConversationID));
+			std::vector<unsigned char*> packets(user_count, nullptr);
+			std::vector<size_t> packet_lengths(user_count, 0);
+			std::vector<status_type> conversation_statuses(user_count, status_type::SUCCESS);
+			AutoFreeBuffer fan_out_backup;
+			status = molch_start_send_conversations(
+					conversations.data(),
+					conversations.size(),
+					packets.data(),
+					packet_lengths.data(),
+					conversation_statuses.data(),
+					alice_public_identity.data(),
+					alice_public_identity.size(),
+					receivers.data(),
+					receivers.size(),
+					prekey_lists.data(),
+					prekey_list_lengths.data(),
+					messages.data(),
+					message_lengths.data(),
+					user_count,
+					&fan_out_backup.pointer,
+					&fan_out_backup.length);
+			if ((status.status != status_type::SUCCESS) || (fan_out_backup.pointer == nullptr)) {
+				throw Exception("Failed to start conversations with many users.");
+			}
+			std::vector<AutoFreeBuffer> received_packets(user_count);
+			for (size_t index{0}; index < user_count; index++) {
+				received_packets[index].pointer = packets[index];
+				received_packets[index].length = packet_lengths[index];
+			}
+			if ((conversation_statuses.back() != status_type::VERIFICATION_FAILED) || (received_packets.back().pointer != nullptr)) {
+				throw Exception("Started a conversation with a forged prekey list.");
+			}
+
+			//the first receiver gets the message
+			{
+				ConversationID receiver_conversation;
+				AutoFreeBuffer receiver_prekey_list;
+				AutoFreeBuffer receiver_message;
+				status = molch_start_receive_conversation(
+						receiver_conversation.data(),
+						receiver_conversation.size(),
+						&receiver_prekey_list.pointer,
+						&receiver_prekey_list.length,
+						&receiver_message.pointer,
+						&receiver_message.length,
+						created_users.data(),
+						sizeof(PublicIdentity),
+						alice_public_identity.data(),
+						alice_public_identity.size(),
+						received_packets.front().data(),
+						received_packets.front().size(),
+						nullptr,
+						nullptr);
+				if ((status.status != status_type::SUCCESS)
+						|| (receiver_message.size() != alice_send_message.size())
+						|| (memcmp(receiver_message.data(), alice_send_message.data(), alice_send_message.size()) != 0)) {
+					throw Exception("Failed to receive a conversation that was started for many users.");
+				}
+			}
+
+			for (size_t index{0}; index < user_count; index++) {
+				const auto entry{created_users.data() + (index * entry_length)};
+				if (index < (user_count - 1)) {
+					if ((conversation_statuses[index] != status_type::SUCCESS)
+							|| (molch_get_message_type(received_packets[index].data(), received_packets[index].size()) != molch_message_type::PREKEY_MESSAGE)) {
+						throw Exception("Failed to start a conversation with a created user.");
+					}
+					status = molch_end_conversation(&conversations[index * sizeof(ConversationID)], sizeof(ConversationID), nullptr, nullptr);
+					if (status.status != status_type::SUCCESS) {
+						throw Exception("Failed to end the conversation with a created user.");
+					}
+				}
+				status = molch_destroy_user(entry, sizeof(PublicIdentity), nullptr, nullptr);
+				if (status.status != status_type::SUCCESS) {
+					throw Exception("Failed to destroy a created user.");
+				}
+			}
+		}
+
 		//destroy the users again
 		molch_destroy_all_users();
 
@@ -0,0 +1,95 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "../lib/parallel.hpp"
+#include "exception.hpp"
+
+using namespace Molch;
+
+int main() {
+	try {
+		//every index is visited exactly once
+		constexpr size_t count{10000};
+		std::vector<std::atomic<size_t>> visits(count);
+		auto visit_result{parallel_for(count, [&visits](const size_t index) -> result<void> {
+			visits[index]++;
+			return outcome::success();
+		})};
+		if (visit_result.has_error()) {
+			throw Molch::Exception{visit_result.error()};
+		}
+		for (const auto& visit : visits) {
+			if (visit != 1) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Index hasn't been visited exactly once."};
+			}
+		}
+
+		//nothing to do
+		auto empty_result{parallel_for(0, [](const size_t) -> result<void> {
+			throw std::logic_error("Work without any work items.");
+		})};
+		if (empty_result.has_error()) {
+			throw Molch::Exception{empty_result.error()};
+		}
+
+		//errors are returned
+		auto error_result{parallel_for(count, [](const size_t index) -> result<void> {
+			if (index == (count / 2)) {
+				return Error(status_type::INCORRECT_DATA, "Expected failure.");
+			}
+
+			return outcome::success();
+		})};
+		if (!error_result.has_error() || (error_result.error().type != status_type::INCORRECT_DATA)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Error of a work item wasn't returned."};
+		}
+
+		//exceptions are rethrown on the calling thread
+		bool caught{false};
+		try {
+			auto exception_result{parallel_for(count, [](const size_t index) -> result<void> {
+				if (index == 0) {
+					throw std::runtime_error("Expected exception.");
+				}
+
+				return outcome::success();
+			})};
+			static_cast<void>(exception_result);
+		} catch (const std::runtime_error&) {
+			caught = true;
+		}
+		if (!caught) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Exception of a work item wasn't rethrown."};
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
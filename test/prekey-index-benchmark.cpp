@@ -0,0 +1,106 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures how long finding a prekey takes through the hashed index and
+ * through a linear search, for pools of 100 to 10000 prekeys. This isn't
+ * run with the tests, run it with "meson test --benchmark".
+ */
+
+#include <sodium.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+
+#include "utils.hpp"
+#include "exception.hpp"
+#include "../lib/prekey-store.hpp"
+
+using namespace Molch;
+
+//every pool is searched about this often through the index, so small and big pools take similar time
+constexpr size_t indexed_lookups{1000000};
+//the linear search is much slower, so it only looks for a sample of evenly spread prekeys
+constexpr size_t linear_lookups{1000};
+
+template <typename Function>
+static double nanoseconds_per_lookup(const size_t lookups, Function&& function) {
+	const auto start{std::chrono::steady_clock::now()};
+	function();
+	const auto duration{std::chrono::steady_clock::now() - start};
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()) / static_cast<double>(lookups);
+}
+
+static void benchmark(const size_t amount) {
+	TRY_WITH_RESULT(prekeys_result, PrekeyStore::create(amount));
+	const auto& prekeys{prekeys_result.value().prekeys()};
+
+	PrekeyIndex index;
+	index.rebuild(prekeys);
+
+	//checking the positions keeps the searches from being optimized away
+	const auto check_position{[](const size_t found, const size_t position) {
+		if (found != position) {
+			throw Exception{status_type::INCORRECT_DATA, "Found the wrong prekey."};
+		}
+	}};
+
+	const auto rounds{std::max(indexed_lookups / amount, size_t{1})};
+	const auto indexed{nanoseconds_per_lookup(rounds * amount, [&]() {
+		for (size_t round{0}; round < rounds; round++) {
+			for (size_t position{0}; position < amount; position++) {
+				check_position(index.find(prekeys[position].publicKey(), prekeys).value_or(amount), position);
+			}
+		}
+	})};
+
+	const auto stride{std::max(amount / linear_lookups, size_t{1})};
+	const auto lookups{(amount + stride - 1) / stride};
+	const auto linear{nanoseconds_per_lookup(lookups, [&]() {
+		for (size_t position{0}; position < amount; position += stride) {
+			const auto& public_key{prekeys[position].publicKey()};
+			const auto match{std::find_if(std::cbegin(prekeys), std::cend(prekeys),
+					[&public_key](const Prekey& candidate) {
+						return candidate.publicKey() == public_key;
+					})};
+			check_position(gsl::narrow_cast<size_t>(match - std::cbegin(prekeys)), position);
+		}
+	})};
+
+	std::cout << amount << " prekeys: " << indexed << " ns per indexed lookup, " << linear << " ns per linear lookup\n";
+}
+
+int main() {
+	try {
+		TRY_VOID(Molch::sodium_init());
+
+		for (const auto amount : {size_t{100}, size_t{1000}, size_t{10000}}) {
+			benchmark(amount);
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Checks that prekeys are found through the hashed index in pools of all
+ * sizes, also after keys have been deprecated, and that receiving a
+ * conversation works with a big pool.
+ */
+
+#include <sodium.h>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "utils.hpp"
+#include "exception.hpp"
+#include "../lib/conversation.hpp"
+
+using namespace Molch;
+
+static void keypair(PrivateKey& private_key, PublicKey& public_key) {
+	TRY_VOID(crypto_box_keypair(public_key, private_key));
+}
+
+static void check_index(const size_t amount) {
+	TRY_WITH_RESULT(prekeys_result, PrekeyStore::create(amount));
+	const auto& prekeys{prekeys_result.value().prekeys()};
+	if (prekeys.size() != amount) {
+		throw Exception{status_type::INCORRECT_DATA, "Prekey store has the wrong size."};
+	}
+
+	PrekeyIndex index;
+	index.rebuild(prekeys);
+	for (size_t position{0}; position < prekeys.size(); position++) {
+		const auto found{index.find(prekeys[position].publicKey(), prekeys)};
+		if (!found.has_value() or (found.value() != position)) {
+			throw Exception{status_type::INCORRECT_DATA, "Failed to find a prekey in the index."};
+		}
+	}
+
+	PrivateKey unknown_private_key;
+	PublicKey unknown_public_key;
+	keypair(unknown_private_key, unknown_public_key);
+	if (index.find(unknown_public_key, prekeys).has_value()) {
+		throw Exception{status_type::INCORRECT_DATA, "Found a prekey that isn't in the index."};
+	}
+
+	index.remove(prekeys.front().publicKey(), 0);
+	if (index.find(prekeys.front().publicKey(), prekeys).has_value()) {
+		throw Exception{status_type::INCORRECT_DATA, "Found a prekey that has been removed from the index."};
+	}
+}
+
+static void check_store(const size_t amount) {
+	TRY_WITH_RESULT(prekeys_result, PrekeyStore::create(amount));
+	auto& prekeys{prekeys_result.value()};
+	const std::vector<Prekey> original{std::cbegin(prekeys.prekeys()), std::cend(prekeys.prekeys())};
+
+	//first from the current prekeys, which deprecates them, then from the deprecated ones
+	for (size_t round{0}; round < 2; round++) {
+		for (const auto& prekey : original) {
+			TRY_WITH_RESULT(private_key, prekeys.getPrekey(prekey.publicKey()));
+			if (private_key.value() != prekey.privateKey()) {
+				throw Exception{status_type::INCORRECT_DATA, "Got the wrong private prekey."};
+			}
+		}
+	}
+	if (prekeys.size() != amount) {
+		throw Exception{status_type::INCORRECT_DATA, "Deprecating prekeys changed the size of the store."};
+	}
+
+	PrivateKey unknown_private_key;
+	PublicKey unknown_public_key;
+	keypair(unknown_private_key, unknown_public_key);
+	if (prekeys.getPrekey(unknown_public_key).has_value()) {
+		throw Exception{status_type::INCORRECT_DATA, "Got a private key for an unknown prekey."};
+	}
+}
+
+static void check_receive(const size_t amount) {
+	PrivateKey sender_private_identity;
+	PublicKey sender_public_identity;
+	keypair(sender_private_identity, sender_public_identity);
+	PrivateKey receiver_private_identity;
+	PublicKey receiver_public_identity;
+	keypair(receiver_private_identity, receiver_public_identity);
+
+	TRY_WITH_RESULT(prekeys_result, PrekeyStore::create(amount));
+	auto& prekeys{prekeys_result.value()};
+	TRY_WITH_RESULT(prekey_list_result, prekeys.list());
+	const auto& prekey_list{prekey_list_result.value()};
+	if (prekey_list.size() != (amount * PUBLIC_KEY_SIZE)) {
+		throw Exception{status_type::INCORRECT_DATA, "Prekey list has the wrong size."};
+	}
+
+	Buffer message{"Hello there!"};
+	for (size_t sender{0}; sender < 10; sender++) {
+		TRY_WITH_RESULT(send_conversation, Conversation::createSendConversation(
+				message,
+				sender_public_identity,
+				sender_private_identity,
+				receiver_public_identity,
+				prekey_list));
+		TRY_WITH_RESULT(receive_conversation, Conversation::createReceiveConversation(
+				send_conversation.value().packet,
+				receiver_public_identity,
+				receiver_private_identity,
+				prekeys));
+		TRY_WITH_RESULT(comparison, receive_conversation.value().message.compare(message));
+		if (!comparison.value()) {
+			throw Exception{status_type::INCORRECT_DATA, "Message was decrypted incorrectly."};
+		}
+	}
+}
+
+int main() {
+	try {
+		TRY_VOID(Molch::sodium_init());
+
+		for (const auto amount : {size_t{1}, size_t{100}, size_t{10000}}) {
+			check_index(amount);
+		}
+		check_store(1000);
+		check_receive(10000);
+
+		//pools that are too small or too big
+		if (PrekeyStore::create(0).has_value() or PrekeyStore::create(maximum_prekey_amount + 1).has_value()) {
+			throw Exception{status_type::INCORRECT_DATA, "Created a prekey store with an invalid size."};
+		}
+
+		//shrinking deprecates the prekeys that were dropped
+		TRY_WITH_RESULT(prekeys_result, PrekeyStore::create(1000));
+		auto& prekeys{prekeys_result.value()};
+		const auto dropped_key{prekeys.prekeys().back().publicKey()};
+		TRY_VOID(prekeys.resize(10));
+		if (prekeys.size() != 10) {
+			throw Exception{status_type::INCORRECT_DATA, "Failed to shrink the prekey store."};
+		}
+		TRY_WITH_RESULT(private_key, prekeys.getPrekey(dropped_key));
+		TRY_VOID(prekeys.resize(2000));
+		TRY_WITH_RESULT(prekey_list, prekeys.list());
+		if (prekey_list.value().size() != (2000 * PUBLIC_KEY_SIZE)) {
+			throw Exception{status_type::INCORRECT_DATA, "Failed to grow the prekey store."};
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Round trips a ratchet with a few hundred skipped keys through the fixed
+ * layout snapshot and compares its size and speed with Protobuf-C.
+ */
+
+#include <sodium.h>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+
+#include "../lib/ratchet.hpp"
+#include "utils.hpp"
+#include "exception.hpp"
+
+using namespace Molch;
+
+constexpr size_t skipped_chains{8};
+constexpr size_t skipped_keys_per_chain{60};
+constexpr size_t staged_keys{5};
+constexpr size_t iterations{200};
+
+static void keypair(PrivateKey& private_key, PublicKey& public_key) {
+	TRY_VOID(crypto_box_keypair(public_key, private_key));
+}
+
+static void add_chain(HeaderAndMessageKeyStore& keystore, const size_t keys) {
+	EmptyableHeaderKey header_key;
+	randombytes_buf(header_key);
+	header_key.empty = false;
+	for (size_t index{0}; index < keys; index++) {
+		MessageKey message_key;
+		randombytes_buf(message_key);
+		keystore.add(header_key, message_key);
+	}
+}
+
+static Buffer protobuf_export(const Ratchet& ratchet) {
+	Arena pool;
+	TRY_WITH_RESULT(exported_ratchet_result, ratchet.exportProtobuf(pool));
+	const auto& exported_ratchet{exported_ratchet_result.value()};
+
+	auto export_size{molch__protobuf__conversation__get_packed_size(exported_ratchet)};
+	Buffer export_buffer{export_size, 0};
+	TRY_VOID(export_buffer.setSize(molch__protobuf__conversation__pack(exported_ratchet, byte_to_uchar(export_buffer.data()))));
+
+	return export_buffer;
+}
+
+static Ratchet protobuf_import(const Buffer& import_buffer) {
+	Arena pool;
+	auto pool_protoc_allocator{pool.getProtobufCAllocator()};
+	auto ratchet_protobuf{molch__protobuf__conversation__unpack(
+		&pool_protoc_allocator,
+		import_buffer.size(),
+		byte_to_uchar(import_buffer.data()))};
+	if (ratchet_protobuf == nullptr) {
+		throw Exception{status_type::PROTOBUF_UNPACK_ERROR, "Failed to unpack ratchet from protobuf."};
+	}
+
+	TRY_WITH_RESULT(imported_ratchet, Ratchet::import(*ratchet_protobuf));
+	return std::move(imported_ratchet.value());
+}
+
+static Buffer snapshot_export(const Ratchet& ratchet) {
+	const auto maximum_size{ratchet.maximumSnapshotSize()};
+	Buffer snapshot{maximum_size, maximum_size};
+	SnapshotWriter writer{snapshot};
+	TRY_VOID(ratchet.exportSnapshot(writer));
+	TRY_VOID(snapshot.setSize(writer.size()));
+
+	return snapshot;
+}
+
+static result<Ratchet> snapshot_import(const span<const std::byte> snapshot) {
+	SnapshotReader reader{snapshot};
+	OUTCOME_TRY(ratchet, Ratchet::importSnapshot(reader));
+	if (!reader.done()) {
+		return Error(status_type::INCORRECT_DATA, "Trailing data after the ratchet snapshot.");
+	}
+
+	return std::move(ratchet);
+}
+
+template <typename Function>
+static double microseconds_per_iteration(Function&& function) {
+	const auto start{std::chrono::steady_clock::now()};
+	for (size_t iteration{0}; iteration < iterations; iteration++) {
+		function();
+	}
+	const auto duration{std::chrono::steady_clock::now() - start};
+
+	return std::chrono::duration<double,std::micro>(duration).count() / static_cast<double>(iterations);
+}
+
+int main() {
+	try {
+		TRY_VOID(Molch::sodium_init());
+
+		PrivateKey our_private_identity;
+		PublicKey our_public_identity;
+		keypair(our_private_identity, our_public_identity);
+		PrivateKey our_private_ephemeral;
+		PublicKey our_public_ephemeral;
+		keypair(our_private_ephemeral, our_public_ephemeral);
+		PrivateKey their_private_identity;
+		PublicKey their_public_identity;
+		keypair(their_private_identity, their_public_identity);
+		PrivateKey their_private_ephemeral;
+		PublicKey their_public_ephemeral;
+		keypair(their_private_ephemeral, their_public_ephemeral);
+
+		TRY_WITH_RESULT(ratchet_result, Ratchet::create(
+			our_private_identity,
+			our_public_identity,
+			their_public_identity,
+			our_private_ephemeral,
+			our_public_ephemeral,
+			their_public_ephemeral));
+		auto& ratchet{ratchet_result.value()};
+		for (size_t chain{0}; chain < skipped_chains; chain++) {
+			add_chain(ratchet.skipped_header_and_message_keys, skipped_keys_per_chain);
+		}
+		add_chain(ratchet.staged_header_and_message_keys, staged_keys);
+
+		//round trip
+		const auto protobuf{protobuf_export(ratchet)};
+		const auto snapshot{snapshot_export(ratchet)};
+		TRY_WITH_RESULT(imported_ratchet, snapshot_import(snapshot));
+		TRY_WITH_RESULT(comparison, protobuf_export(imported_ratchet.value()).compare(protobuf));
+		if (!comparison.value()) {
+			throw Exception{status_type::INCORRECT_DATA, "Ratchet changed in the snapshot round trip."};
+		}
+
+		//damaged snapshots have to be rejected
+		for (const auto size : {size_t{0}, size_t{1}, snapshot.size() / 2, snapshot.size() - 1}) {
+			if (snapshot_import(span<const std::byte>{snapshot}.subspan(0, size)).has_value()) {
+				throw Exception{status_type::INCORRECT_DATA, "Imported a truncated snapshot."};
+			}
+		}
+		auto wrong_version{snapshot};
+		wrong_version[0] = std::byte{1};
+		if (snapshot_import(wrong_version).has_value()) {
+			throw Exception{status_type::INCORRECT_DATA, "Imported a snapshot with an unknown version."};
+		}
+
+		//compare with Protobuf-C
+		const auto protobuf_export_time{microseconds_per_iteration([&]() {
+			protobuf_export(ratchet);
+		})};
+		const auto protobuf_import_time{microseconds_per_iteration([&]() {
+			protobuf_import(protobuf);
+		})};
+		const auto snapshot_export_time{microseconds_per_iteration([&]() {
+			snapshot_export(ratchet);
+		})};
+		const auto snapshot_import_time{microseconds_per_iteration([&]() {
+			TRY_VOID(snapshot_import(snapshot));
+		})};
+
+		std::cout << "Ratchet with " << ratchet.skipped_header_and_message_keys.keys().size() << " skipped and "
+			<< ratchet.staged_header_and_message_keys.keys().size() << " staged keys:\n";
+		std::cout << "Protobuf-C: " << protobuf.size() << " bytes, export " << protobuf_export_time << "us, import " << protobuf_import_time << "us\n";
+		std::cout << "Snapshot:   " << snapshot.size() << " bytes, export " << snapshot_export_time << "us, import " << snapshot_import_time << "us\n";
+
+		//every header key is only stored once
+		if (snapshot.size() >= protobuf.size()) {
+			throw Exception{status_type::INCORRECT_DATA, "Snapshot isn't smaller than the Protobuf-C export."};
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reports the memory footprint of a conversation and checks that the hot part
+ * of the ratchet storage stays together at the start of the allocation.
+ */
+
+#include <cstdlib>
+#include <cstdint>
+#include <sodium.h>
+#include <exception>
+#include <iostream>
+
+#include "../lib/conversation.hpp"
+#include "utils.hpp"
+#include "exception.hpp"
+
+using namespace Molch;
+
+//message numbers, flags, two chain keys, three header keys and two ephemerals
+constexpr size_t maximum_hot_cache_lines{4};
+
+static size_t offset(const RatchetStorage& storage, const void * const member) {
+	return gsl::narrow<size_t>(static_cast<const std::byte*>(member) - reinterpret_cast<const std::byte*>(&storage));
+}
+
+int main() {
+	try {
+		TRY_VOID(Molch::sodium_init());
+
+		Ratchet ratchet;
+		const auto& storage{*ratchet.storage};
+
+		if ((reinterpret_cast<uintptr_t>(&storage) % cache_line_size) != 0) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "The ratchet storage isn't cache line aligned."};
+		}
+
+		const auto hot_size{offset(storage, &storage.root_key)};
+		std::cout << "Ratchet storage: " << sizeof(RatchetStorage) << " bytes, "
+			<< hot_size << " of them hot (" << (hot_size / cache_line_size) << " cache lines)\n";
+		if (hot_size > (maximum_hot_cache_lines * cache_line_size)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "The hot part of the ratchet storage is too big."};
+		}
+
+		//everything that is used when receiving within the current chain
+		for (const void * const member : {
+					static_cast<const void*>(&storage.receive_message_number),
+					static_cast<const void*>(&storage.header_decryptable),
+					static_cast<const void*>(&storage.receive_chain_key),
+					static_cast<const void*>(&storage.receive_header_key),
+					static_cast<const void*>(&storage.next_receive_header_key),
+					static_cast<const void*>(&storage.their_public_ephemeral)}) {
+			if (offset(storage, member) >= hot_size) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Key for receiving isn't in the hot part of the ratchet storage."};
+			}
+		}
+
+		std::cout << "Conversation: " << sizeof(Conversation) << " bytes + " << sizeof(RatchetStorage) << " bytes of ratchet storage\n";
+		std::cout << "Skipped header and message key: " << sizeof(HeaderAndMessageKey) << " bytes\n";
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "../lib/ring-buffer.hpp"
+#include "exception.hpp"
+
+using namespace Molch;
+
+static void check(const RingBuffer<int>& ring, const std::vector<int>& expected, const char * const message) {
+	if (ring.size() != expected.size()) {
+		throw Molch::Exception{status_type::INCORRECT_DATA, message};
+	}
+
+	size_t index{0};
+	for (const auto& element : ring) {
+		if ((element != expected[index]) or (ring[index] != expected[index])) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, message};
+		}
+		index++;
+	}
+}
+
+int main() {
+	try {
+		RingBuffer<int> ring;
+		if (!ring.empty() or (ring.capacity() != 0)) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "New ring buffer isn't empty."};
+		}
+
+		for (int i{0}; i < 8; i++) {
+			ring.push_back(i);
+		}
+		check(ring, {0, 1, 2, 3, 4, 5, 6, 7}, "Failed to push back.");
+		const auto capacity{ring.capacity()};
+
+		//wrap around without reallocating
+		for (int i{8}; i < 20; i++) {
+			ring.pop_front();
+			ring.push_back(i);
+		}
+		check(ring, {12, 13, 14, 15, 16, 17, 18, 19}, "Failed to wrap around.");
+		if (ring.capacity() != capacity) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Ring buffer reallocated while wrapping around."};
+		}
+
+		ring.insert(0, 11);
+		ring.insert(5, 100);
+		ring.insert(ring.size(), 20);
+		check(ring, {11, 12, 13, 14, 15, 100, 16, 17, 18, 19, 20}, "Failed to insert.");
+
+		ring.erase(5);
+		ring.erase(0);
+		ring.erase(ring.size() - 1);
+		check(ring, {12, 13, 14, 15, 16, 17, 18, 19}, "Failed to erase.");
+
+		const auto copy{ring};
+		check(copy, {12, 13, 14, 15, 16, 17, 18, 19}, "Failed to copy.");
+
+		auto moved{std::move(ring)};
+		check(moved, {12, 13, 14, 15, 16, 17, 18, 19}, "Failed to move.");
+		check(ring, {}, "Moved from ring buffer isn't empty.");
+
+		const auto moved_capacity{moved.capacity()};
+		moved.clear();
+		check(moved, {}, "Failed to clear.");
+		if (moved.capacity() != moved_capacity) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Clearing released the allocation."};
+		}
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
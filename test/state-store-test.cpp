@@ -0,0 +1,308 @@
+/*
+ * Molch, an implementation of the axolotl ratchet based on libsodium
+ *
+ * ISC License
+ *
+ * Copyright (C) 2015-2018 1984not Security GmbH
+ * Author: Max Bruckner (FSMaxB)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sodium.h>
+
+#include "../lib/state-store.hpp"
+#include "utils.hpp"
+#include "exception.hpp"
+
+using namespace Molch;
+
+static const std::string store_path{"state-store-test.store"};
+
+static std::vector<Buffer> protobuf_export(const UserStore& store) {
+	Arena pool;
+	TRY_WITH_RESULT(exported_users_result, store.exportProtobuf(pool));
+	const auto& exported_users{exported_users_result.value()};
+
+	std::vector<Buffer> export_buffers;
+	export_buffers.reserve(exported_users.size());
+	for (const auto& user : exported_users) {
+		auto packed_size{molch__protobuf__user__get_packed_size(user)};
+		export_buffers.emplace_back(packed_size, 0);
+		TRY_VOID(export_buffers.back().setSize(molch__protobuf__user__pack(user, byte_to_uchar(export_buffers.back().data()))));
+	}
+
+	return export_buffers;
+}
+
+static void add_conversation(User& user) {
+	PrivateKey our_private_identity;
+	PublicKey our_public_identity;
+	TRY_VOID(crypto_box_keypair(our_public_identity, our_private_identity));
+
+	PrivateKey our_private_ephemeral;
+	PublicKey our_public_ephemeral;
+	TRY_VOID(crypto_box_keypair(our_public_ephemeral, our_private_ephemeral));
+
+	PublicKey their_public_identity;
+	randombytes_buf(their_public_identity);
+
+	PublicKey their_public_ephemeral;
+	randombytes_buf(their_public_ephemeral);
+
+	TRY_WITH_RESULT(conversation, Molch::Conversation::create(
+		our_private_identity,
+		our_public_identity,
+		their_public_identity,
+		our_private_ephemeral,
+		our_public_ephemeral,
+		their_public_ephemeral));
+
+	TRY_VOID(user.conversations.add(std::move(conversation.value())));
+}
+
+static PublicSigningKey add_user(UserStore& users) {
+	TRY_WITH_RESULT(user, User::create());
+	const auto id{user.value().id()};
+	users.add(std::move(user.value()));
+
+	return id;
+}
+
+static std::pair<StateStore,UserStore> open_store(const BackupKey& store_key) {
+	TRY_WITH_RESULT(opened_store, StateStore::open(store_path, store_key));
+	return std::move(opened_store.value());
+}
+
+static size_t file_size() {
+	std::ifstream file{store_path, std::ios::binary | std::ios::ate};
+	return static_cast<size_t>(file.tellg());
+}
+
+int main() {
+	try {
+		TRY_VOID(Molch::sodium_init());
+		std::remove(store_path.c_str());
+
+		BackupKey store_key;
+		randombytes_buf(store_key);
+
+		UserStore users;
+		const auto alice{add_user(users)};
+		const auto bob{add_user(users)};
+		add_conversation(*users.find(alice));
+		add_conversation(*users.find(alice));
+		add_conversation(*users.find(bob));
+
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			if (stored_users.size() != 0) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "New state store isn't empty."};
+			}
+
+			TRY_VOID(store.persist(users));
+			TRY_VOID(store.sync());
+			const auto full_size{store.size()};
+			std::cout << "Persisted two users and three conversations in " << full_size << " bytes.\n";
+
+			//nothing changed, nothing is written
+			TRY_VOID(store.persist(users));
+			if (store.size() != full_size) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Unchanged state has been written again."};
+			}
+
+			//only the new conversation is written
+			add_conversation(*users.find(bob));
+			TRY_VOID(store.persist(users));
+			const auto appended_size{store.size() - full_size};
+			std::cout << "Appended " << appended_size << " bytes for one conversation.\n";
+			if ((appended_size == 0) or (appended_size >= (full_size / 2))) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "More than the changed conversation has been written."};
+			}
+			if (users.changedEverything() or not users.changes().empty()) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Changes of the user store haven't been cleared."};
+			}
+
+			//a conversation that has been removed through its user is removed from the store as well
+			auto& alice_conversations{users.find(alice)->conversations};
+			const auto removed_conversation{std::cbegin(alice_conversations)->id()};
+			alice_conversations.remove(removed_conversation);
+			TRY_VOID(store.persist(users));
+			TRY_VOID(store.sync());
+		}
+
+		//restore from the file
+		const auto exported_after_change{protobuf_export(users)};
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			if (protobuf_export(stored_users) != exported_after_change) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Restored state doesn't match."};
+			}
+
+			//the state store can't be opened twice
+			const auto second_store{StateStore::open(store_path, store_key)};
+			if (second_store.has_value()) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Opened the state store twice."};
+			}
+		}
+		std::cout << "Restored the state store.\n";
+
+		//an incomplete record at the end is discarded
+		const auto complete_size{file_size()};
+		{
+			std::ofstream file{store_path, std::ios::binary | std::ios::app};
+			const std::array<char,10> partial_record{0, 0, 1, 0, 'p', 'a', 'r', 't', 'i', 'a'};
+			file.write(partial_record.data(), partial_record.size());
+		}
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			if ((protobuf_export(stored_users) != exported_after_change) or (store.size() != complete_size)) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Failed to recover from an incomplete record."};
+			}
+		}
+		if (file_size() != complete_size) {
+			throw Molch::Exception{status_type::INCORRECT_DATA, "Incomplete record hasn't been truncated."};
+		}
+		std::cout << "Discarded an incomplete record.\n";
+
+		//a different key can't open the store and doesn't change it
+		{
+			BackupKey wrong_key;
+			randombytes_buf(wrong_key);
+			const auto opened{StateStore::open(store_path, wrong_key)};
+			if (opened.has_value() or (opened.error().type != status_type::DECRYPT_ERROR)) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Opened the state store with the wrong key."};
+			}
+			if (file_size() != complete_size) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Opening with the wrong key changed the state store."};
+			}
+		}
+
+		//a corrupted last record isn't mistaken for an incomplete one
+		{
+			std::fstream file{store_path, std::ios::binary | std::ios::in | std::ios::out};
+			file.seekg(-1, std::ios::end);
+			const auto last_byte{static_cast<char>(file.get())};
+			file.seekp(-1, std::ios::end);
+			file.put(static_cast<char>(last_byte ^ 1));
+			file.close();
+
+			const auto opened{StateStore::open(store_path, store_key)};
+			if (opened.has_value() or (opened.error().type != status_type::DECRYPT_ERROR)) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Opened a state store with a corrupted record."};
+			}
+			if (file_size() != complete_size) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Corrupted record has been truncated."};
+			}
+
+			file.open(store_path, std::ios::binary | std::ios::in | std::ios::out);
+			file.seekp(-1, std::ios::end);
+			file.put(last_byte);
+		}
+		std::cout << "Rejected a wrong key and a corrupted record.\n";
+
+		//removed users and their conversations stay removed
+		users.remove(bob);
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			TRY_VOID(store.persist(users));
+		}
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			if ((stored_users.size() != 1) or (protobuf_export(stored_users) != protobuf_export(users))) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Removed user has been restored."};
+			}
+		}
+		std::cout << "Removed a user.\n";
+
+		//deltas can still be imported after a restart
+		{
+			PrivateKey our_private_identity;
+			PublicKey our_public_identity;
+			TRY_VOID(crypto_box_keypair(our_public_identity, our_private_identity));
+			PrivateKey our_private_ephemeral;
+			PublicKey our_public_ephemeral;
+			TRY_VOID(crypto_box_keypair(our_public_ephemeral, our_private_ephemeral));
+			PublicKey their_public_identity;
+			randombytes_buf(their_public_identity);
+			PublicKey their_public_ephemeral;
+			randombytes_buf(their_public_ephemeral);
+			TRY_WITH_RESULT(conversation, Molch::Conversation::create(
+				our_private_identity,
+				our_public_identity,
+				their_public_identity,
+				our_private_ephemeral,
+				our_public_ephemeral,
+				their_public_ephemeral));
+			BackupHash base_hash;
+			randombytes_buf(base_hash);
+			conversation.value().setBackupCheckpoint(base_hash, 1);
+			const auto conversation_id{conversation.value().id()};
+			Arena arena;
+			TRY_WITH_RESULT(delta, conversation.value().exportDeltaProtobuf(arena));
+			TRY_VOID(users.find(alice)->conversations.add(std::move(conversation.value())));
+
+			{
+				auto [store, stored_users]{open_store(store_key)};
+				TRY_VOID(store.persist(users));
+			}
+			auto [store, stored_users]{open_store(store_key)};
+			User *owner{nullptr};
+			TRY_WITH_RESULT(restored_conversation, stored_users.findConversation(owner, conversation_id));
+			if (restored_conversation.value() == nullptr) {
+				throw Molch::Exception{status_type::NOT_FOUND, "Failed to restore the conversation."};
+			}
+			if (restored_conversation.value()->hasBackupCheckpoint(1)) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Restored backup checkpoint can export deltas."};
+			}
+			TRY_VOID(restored_conversation.value()->applyDelta(*delta.value()));
+		}
+		std::cout << "Restored a backup checkpoint.\n";
+
+		//replacing users over and over again leaves mostly outdated records, which are compacted
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			size_t maximum_size{0};
+			for (size_t i{0}; i < 200; i++) {
+				const auto temporary_user{add_user(users)};
+				TRY_VOID(store.persist(users));
+				maximum_size = std::max(maximum_size, store.size());
+				users.remove(temporary_user);
+				TRY_VOID(store.persist(users));
+			}
+			TRY_VOID(store.sync());
+			std::cout << "Compacted from at most " << maximum_size << " to " << store.size() << " bytes.\n";
+			if ((store.size() >= maximum_size) or (store.size() > (2 * state_store_compaction_threshold))) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "State store hasn't been compacted."};
+			}
+		}
+		{
+			auto [store, stored_users]{open_store(store_key)};
+			if (protobuf_export(stored_users) != protobuf_export(users)) {
+				throw Molch::Exception{status_type::INCORRECT_DATA, "Compacted state doesn't match."};
+			}
+		}
+		std::cout << "Restored the compacted state store.\n";
+
+		std::remove(store_path.c_str());
+	} catch (const std::exception& exception) {
+		std::cerr << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}